@@ -8,11 +8,34 @@ Usage:
     img  = PZP.read("image.pzp")         # numpy array, or dict of raw bytes
     meta = PZP.info("image.pzp")         # metadata dict without decoding pixels
 
+    # Planar float32, normalised, decoded in one pass (needs numpy)
+    x = PZP.read_tensor("image.pzp", layout="chw", scale=1/255.0)
+
+    # Bulk decompress with asynchronous read-ahead (completion order)
+    for name, img in PZP.read_many(paths, depth=16):
+        ...
+
+    # Frames decoded once per node, shared by all worker processes
+    cache = PZP.Cache("/pzp-train", budget=8 << 30)
+    img   = cache.read("image.pzp")           # read-only zero-copy view
+
+    # RGB-D: colour and depth of one instant as the layers of one file
+    PZP.write_layers("frame.pzp", [rgb, (depth, {"use_rle": True})])
+    depth = PZP.read("frame.pzp", layer=1)   # reads only the depth layer
+
     # Compress
     PZP.write("out.pzp", img)                            # default: zstd only
     PZP.write("out.pzp", img, use_rle=True)              # + delta pre-filter
     PZP.write("out.pzp", img, use_palette=True)          # + palette indexing
     PZP.write("out.pzp", img, use_rle=True, use_palette=True)  # all filters
+    PZP.write("out.pzp", img, use_rle=True, backend="lz4")     # faster decode
+    PZP.write("out.pzp", img, backend="store")                 # no entropy stage
+
+    # Pixels of a backend="store" file, used where they lie in a mapping
+    img = PZP.view(mmap.mmap(fd, 0, access=mmap.ACCESS_READ))
+
+    # Decoded by a pzpd daemon shared by the processes of the node
+    img = PZP.fetch("image.pzp", "/tmp/pzpd.sock")   # read-only zero-copy view
 
     # Inspect which flags were used when the file was written
     arr, flags = PZP.read("image.pzp", return_flags=True)
@@ -40,10 +63,28 @@ Configuration flags (pass to write() as configuration=):
     USE_RLE         = 2   # delta pre-filter (improves ratio for smooth images)
     USE_PALETTE     = 4   # per-channel palette indexing (best for images with few
                           # unique values per channel, e.g. segmentation maps)
+    USE_RUNS        = 32  # per-row run tokens (flat label maps), replaces USE_RLE
+    USE_PYRAMID     = 64  # also store 1/2, 1/4, … resolution levels (read(level=N))
+    USE_NEAR_LOSSLESS = 128  # 16-bit samples within ±max_error (write(max_error=N))
+    USE_LAYERS      = 512 # one layer of a multi-layer file (write_layers())
+    USE_DELTA16     = 1024 # 16-bit delta filter, used instead of USE_RLE for
+                           # 16-bit images (set by the encoder)
+    USE_RANS        = 2048 # rANS coded pixel data instead of zstd's LZ stage
+                           # (write(..., configuration=USE_COMPRESSION | USE_RANS))
+    USE_LZ4         = 4096 # LZ4 instead of zstd (write(..., backend="lz4"))
+    USE_STORE       = 8192 # no entropy stage (write(..., backend="store"))
+    USE_YCOCG       = 16384 # YCoCg-R colour transform before the delta filter
+                            # (8-bit RGB with USE_RLE, e.g. photos)
+    USE_SPARSE      = 32768 # zero samples as a validity mask, the rest delta coded
+                            # (16-bit depth with USE_RLE and invalid pixels)
 """
 
+import array
 import ctypes
+import mmap
 import os
+import socket
+import struct
 import sys
 
 # ---------------------------------------------------------------------------
@@ -81,6 +122,30 @@ _lib.pzp_decompress_file.argtypes = [
     ctypes.POINTER(ctypes.c_uint),     # configuration
 ]
 
+# pzp_decompress_file_level / pzp_levels_file — resolution pyramid
+_lib.pzp_decompress_file_level.restype  = ctypes.POINTER(ctypes.c_ubyte)
+_lib.pzp_decompress_file_level.argtypes = [ctypes.c_char_p, ctypes.c_uint] + [ctypes.POINTER(ctypes.c_uint)] * 7
+
+_lib.pzp_levels_file.restype  = ctypes.c_uint
+_lib.pzp_levels_file.argtypes = [ctypes.c_char_p]
+
+# pzp_*_layer(s) — multi-layer frames (struct pzp_layer)
+class _Layer(ctypes.Structure):
+    _fields_ = [("pixels", ctypes.POINTER(ctypes.c_ubyte))] + [(field, ctypes.c_uint) for field in
+                ("width", "height", "bitsperpixel", "channels", "configuration", "max_error", "native16")]
+
+
+_MAX_LAYERS = 16  # PZP_MAX_LAYERS
+
+_lib.pzp_compress_file_layers.restype  = ctypes.c_int
+_lib.pzp_compress_file_layers.argtypes = [ctypes.POINTER(_Layer), ctypes.c_uint, ctypes.c_char_p]
+_lib.pzp_layers_file.restype  = ctypes.c_uint
+_lib.pzp_layers_file.argtypes = [ctypes.c_char_p]
+_lib.pzp_decompress_file_layer.restype  = ctypes.c_int
+_lib.pzp_decompress_file_layer.argtypes = [ctypes.c_char_p, ctypes.c_uint, ctypes.POINTER(_Layer)]
+_lib.pzp_decompress_file_layers.restype  = ctypes.c_uint
+_lib.pzp_decompress_file_layers.argtypes = [ctypes.c_char_p, ctypes.POINTER(_Layer), ctypes.c_uint]
+
 _lib.pzp_free.restype  = None
 _lib.pzp_free.argtypes = [ctypes.c_void_p]
 
@@ -96,6 +161,116 @@ _lib.pzp_compress_file.argtypes = [
     ctypes.c_char_p,                   # output_filename
 ]
 
+# pzp_compress_file_native16
+_lib.pzp_compress_file_native16.restype  = ctypes.c_int
+_lib.pzp_compress_file_native16.argtypes = [
+    ctypes.POINTER(ctypes.c_ushort),
+    ctypes.c_uint,
+    ctypes.c_uint,
+    ctypes.c_uint,
+    ctypes.c_uint,
+    ctypes.c_char_p,
+]
+
+# pzp_compress_file_near
+_lib.pzp_compress_file_near.restype  = ctypes.c_int
+_lib.pzp_compress_file_near.argtypes = [
+    ctypes.c_void_p,
+    ctypes.c_int,
+    ctypes.c_uint,
+    ctypes.c_uint,
+    ctypes.c_uint,
+    ctypes.c_uint,
+    ctypes.c_uint,
+    ctypes.c_char_p,
+]
+
+# pzp_max_error_file
+_lib.pzp_max_error_file.restype  = ctypes.c_long
+_lib.pzp_max_error_file.argtypes = [ctypes.c_char_p]
+
+# pzp_info_file
+_lib.pzp_info_file.restype  = ctypes.c_int
+_lib.pzp_info_file.argtypes = [ctypes.c_char_p] + [ctypes.POINTER(ctypes.c_uint)] * 7
+
+# pzp_decompress_file_to_tensor
+_lib.pzp_decompress_file_to_tensor.restype  = ctypes.c_int
+_lib.pzp_decompress_file_to_tensor.argtypes = [
+    ctypes.c_char_p,
+    ctypes.c_void_p,
+    ctypes.c_size_t,
+    ctypes.c_uint,
+    ctypes.c_uint,
+    ctypes.c_uint,
+    ctypes.POINTER(ctypes.c_float),
+    ctypes.POINTER(ctypes.c_float),
+    ctypes.c_uint,
+] + [ctypes.POINTER(ctypes.c_uint)] * 5
+
+# pzp_bulk_* — read-ahead loader for many files
+_lib.pzp_bulk_open.restype  = ctypes.c_void_p
+_lib.pzp_bulk_open.argtypes = [ctypes.POINTER(ctypes.c_char_p), ctypes.c_uint, ctypes.c_uint]
+
+_lib.pzp_bulk_next.restype  = ctypes.c_int
+_lib.pzp_bulk_next.argtypes = [
+    ctypes.c_void_p,
+    ctypes.POINTER(ctypes.c_uint),
+    ctypes.POINTER(ctypes.POINTER(ctypes.c_ubyte)),
+    ctypes.POINTER(ctypes.c_uint),
+    ctypes.POINTER(ctypes.c_uint),
+    ctypes.POINTER(ctypes.c_uint),
+    ctypes.POINTER(ctypes.c_uint),
+    ctypes.POINTER(ctypes.c_uint),
+    ctypes.POINTER(ctypes.c_uint),
+    ctypes.POINTER(ctypes.c_uint),
+]
+
+_lib.pzp_bulk_close.restype  = None
+_lib.pzp_bulk_close.argtypes = [ctypes.c_void_p]
+
+# pzp_shared_cache_* — decoded-frame cache in shared memory
+class _CacheView(ctypes.Structure):
+    _fields_ = [
+        ("pixels",        ctypes.c_void_p),
+        ("size",          ctypes.c_size_t),
+        ("width",         ctypes.c_uint),
+        ("height",        ctypes.c_uint),
+        ("bpp",           ctypes.c_uint),
+        ("channels",      ctypes.c_uint),
+        ("configuration", ctypes.c_uint),
+        ("slot",          ctypes.c_uint),
+        ("owned",         ctypes.c_void_p),
+    ]
+
+
+class _CacheStats(ctypes.Structure):
+    _fields_ = [(name, ctypes.c_uint64) for name in
+                ("hits", "misses", "evictions", "uncached", "budget", "used")] + [("frames", ctypes.c_uint)]
+
+
+_lib.pzp_shared_cache_open.restype  = ctypes.c_void_p
+_lib.pzp_shared_cache_open.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_uint]
+_lib.pzp_shared_cache_get.restype  = ctypes.c_int
+_lib.pzp_shared_cache_get.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(_CacheView)]
+_lib.pzp_shared_cache_release.restype  = None
+_lib.pzp_shared_cache_release.argtypes = [ctypes.c_void_p, ctypes.POINTER(_CacheView)]
+_lib.pzp_shared_cache_stats.restype  = None
+_lib.pzp_shared_cache_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(_CacheStats)]
+_lib.pzp_shared_cache_close.restype  = None
+_lib.pzp_shared_cache_close.argtypes = [ctypes.c_void_p]
+_lib.pzp_shared_cache_unlink.restype  = ctypes.c_int
+_lib.pzp_shared_cache_unlink.argtypes = [ctypes.c_char_p]
+
+# pzp_store_view — offset of the pixels of a stored frame, -1 if it must be decoded
+_lib.pzp_store_view.restype  = ctypes.c_longlong
+_lib.pzp_store_view.argtypes = [
+    ctypes.c_void_p,
+    ctypes.c_size_t,
+    ctypes.POINTER(ctypes.c_uint),
+    ctypes.POINTER(ctypes.c_uint),
+    ctypes.POINTER(ctypes.c_uint),
+]
+
 # ---------------------------------------------------------------------------
 # Configuration flag constants (mirror of PZPFlags in pzp.h)
 # ---------------------------------------------------------------------------
@@ -103,6 +278,22 @@ _lib.pzp_compress_file.argtypes = [
 USE_COMPRESSION = 1
 USE_RLE         = 2
 USE_PALETTE     = 4
+USE_BITPACK     = 16  # set by the encoder: palette indices stored as 1/2/4-bit planes
+USE_RUNS        = 32  # per-row (run, pixel) tokens instead of the delta filter
+USE_PYRAMID     = 64  # half, quarter, … resolution levels stored after the image
+USE_NEAR_LOSSLESS = 128  # 16-bit samples within ±max_error of the original
+USE_RANGE       = 256 # set by the encoder: channels rebased to [min, max] and bit-packed
+USE_LAYERS      = 512 # set by the encoder: one layer of a write_layers() file
+USE_DELTA16     = 1024 # set by the encoder: 16-bit residuals replace USE_RLE on 16-bit images
+USE_RANS        = 2048 # pixel data rANS coded (order-0 per channel) instead of LZ matched
+USE_LZ4         = 4096 # frame coded with LZ4 instead of zstd
+USE_STORE       = 8192 # frame stored without an entropy stage
+USE_YCOCG       = 16384 # reversible YCoCg-R colour transform before USE_RLE (8-bit RGB)
+USE_SPARSE      = 32768 # validity mask + valid samples only, instead of USE_RLE (16-bit depth)
+
+# Compression backends by name, the ID is the configuration's backend field
+_BACKENDS = {"zstd": 0, "lz4": USE_LZ4, "store": USE_STORE}
+_BACKEND_FLAGS = USE_LZ4 | USE_STORE
 
 # ---------------------------------------------------------------------------
 # Optional numpy support
@@ -114,11 +305,23 @@ try:
 except ImportError:
     _NUMPY = False
 
+# ---------------------------------------------------------------------------
+# Native extension module (optional)
+# ---------------------------------------------------------------------------
+
+# pzp._native (pzp_module.c, built by setup.py) runs read / read_tensor / info /
+# write without ctypes call overhead and with the GIL released while coding;
+# without it the same calls go through libpzp.so.
+try:
+    from pzp import _native
+except ImportError:
+    _native = None
+
 # ---------------------------------------------------------------------------
 # Internal helper
 # ---------------------------------------------------------------------------
 
-def _decode(filename: str):
+def _decode(filename: str, level: int = 0):
     """
     Call the C decompressor and return (raw_buf, meta_dict).
 
@@ -142,8 +345,7 @@ def _decode(filename: str):
     ch_int      = ctypes.c_uint(0)
     config      = ctypes.c_uint(0)
 
-    ptr = _lib.pzp_decompress_file(
-        filename_b,
+    args = (
         ctypes.byref(width),
         ctypes.byref(height),
         ctypes.byref(bpp_ext),
@@ -152,10 +354,27 @@ def _decode(filename: str):
         ctypes.byref(ch_int),
         ctypes.byref(config),
     )
+    if level:
+        ptr = _lib.pzp_decompress_file_level(filename_b, level, *args)
+    else:
+        ptr = _lib.pzp_decompress_file(filename_b, *args)
 
     if not ptr:
         raise RuntimeError(f"PZP: failed to decompress '{filename}'")
 
+    return _take(ptr, width, height, bpp_ext, ch_ext, bpp_int, ch_int, config)
+
+
+def _take_layer(layer):
+    """(raw_buf, meta) of a decoded _Layer; frees its pixels."""
+    channels_internal = layer.channels * (layer.bitsperpixel // 8)
+    return _take(layer.pixels, *(ctypes.c_uint(v) for v in (
+        layer.width, layer.height, layer.bitsperpixel, layer.channels,
+        8, channels_internal, layer.configuration)))
+
+
+def _take(ptr, width, height, bpp_ext, ch_ext, bpp_int, ch_int, config):
+    """Copy a decoded C buffer into Python-owned memory, free it, return (raw_buf, meta)."""
     w  = width.value
     h  = height.value
     be = bpp_ext.value
@@ -197,7 +416,7 @@ def _decode(filename: str):
 # Public API
 # ---------------------------------------------------------------------------
 
-def read(filename: str, *, return_flags: bool = False):
+def read(filename: str, *, return_flags: bool = False, level: int = 0, layer: int = 0):
     """
     Decompress a PZP file and return the pixel data.
 
@@ -213,9 +432,55 @@ def read(filename: str, *, return_flags: bool = False):
     return_flags : bool
         When True, return a (array, flags) tuple instead of just the array.
         flags is an int bitfield (USE_COMPRESSION | USE_RLE | USE_PALETTE …).
+    level : int
+        Resolution level of a file written with use_pyramid=True: 0 is the
+        full image, each level halves width and height.  Only that level's
+        bytes are read and decoded.  See levels().
+    layer : int
+        Layer of a file written with write_layers(); only that layer's bytes
+        are read.  Layer 0 is what a plain read() returns.  See layers().
     """
-    raw_buf, meta = _decode(filename)
+    if layer:
+        if level:
+            raise ValueError("PZP.read: level and layer cannot be combined")
+        out = _Layer()
+        if not _lib.pzp_decompress_file_layer(filename.encode(sys.getfilesystemencoding()), layer, ctypes.byref(out)):
+            raise RuntimeError(f"PZP: failed to decompress layer {layer} of '{filename}'")
+        return _shape(*_take_layer(out), return_flags)
 
+    if level:
+        return _shape(*_decode(filename, level), return_flags)
+
+    if _NUMPY:
+        # Decode straight into the numpy array: no intermediate C buffer, and
+        # 16-bit values come out native-endian from the reconstruction pass.
+        if _native is not None:
+            # One read of the file; the array is allocated once its header is parsed.
+            arr, _w, _h, _be, ce, flags = _native.decode(filename, _hwc_array)
+        else:
+            meta = info(filename)
+            be, ce = meta["bpp"], meta["channels"]
+            if be not in (8, 16):
+                raise ValueError(f"PZP: unsupported bit depth {be}")
+
+            arr = np.empty((meta["height"], meta["width"], ce),
+                           dtype=np.uint8 if be == 8 else np.uint16)
+            flags = _decode_into(filename, arr, 0, "hwc", 1.0, 0.0)[4]
+
+        if ce == 1:
+            arr = arr[:, :, 0]
+        return (arr, flags) if return_flags else arr
+
+    return _shape(*_decode(filename), return_flags)
+
+
+def _hwc_array(height, width, channels, bpp):
+    """Decode target for read(): a new (height, width, channels) uint8 / uint16 array."""
+    return np.empty((height, width, channels), dtype=np.uint16 if bpp == 16 else np.uint8)
+
+
+def _shape(raw_buf, meta, return_flags=False):
+    """Turn (raw_buf, meta) into the array / dict that read() returns."""
     w     = meta["width"]
     h     = meta["height"]
     be    = meta["bpp"]          # external bits-per-pixel (per channel)
@@ -258,13 +523,393 @@ def read(filename: str, *, return_flags: bool = False):
     return (result, flags) if return_flags else result
 
 
+def read_many(filenames, *, depth: int = 16, return_flags: bool = False):
+    """
+    Decompress many PZP files, reading up to `depth` files ahead (io_uring,
+    or a pread thread pool where io_uring is unavailable) while the current
+    one is being decoded.
+
+    Yields (filename, image) pairs as reads complete, which is not
+    necessarily the order of `filenames`.  image is what read() returns.
+    Raises RuntimeError for a file that cannot be read or decoded.
+    """
+    names = [str(f) for f in filenames]
+    if not names:
+        return
+
+    encoded = [n.encode(sys.getfilesystemencoding()) for n in names]
+    c_names = (ctypes.c_char_p * len(encoded))(*encoded)
+
+    loader = _lib.pzp_bulk_open(c_names, len(encoded), depth)
+    if not loader:
+        raise RuntimeError("PZP.read_many: could not start the bulk loader")
+
+    index   = ctypes.c_uint(0)
+    ptr     = ctypes.POINTER(ctypes.c_ubyte)()
+    width   = ctypes.c_uint(0)
+    height  = ctypes.c_uint(0)
+    bpp_ext = ctypes.c_uint(0)
+    ch_ext  = ctypes.c_uint(0)
+    bpp_int = ctypes.c_uint(0)
+    ch_int  = ctypes.c_uint(0)
+    config  = ctypes.c_uint(0)
+
+    try:
+        while _lib.pzp_bulk_next(loader, ctypes.byref(index), ctypes.byref(ptr),
+                                 ctypes.byref(width), ctypes.byref(height),
+                                 ctypes.byref(bpp_ext), ctypes.byref(ch_ext),
+                                 ctypes.byref(bpp_int), ctypes.byref(ch_int),
+                                 ctypes.byref(config)):
+            name = names[index.value]
+            if not ptr:
+                raise RuntimeError(f"PZP: failed to decompress '{name}'")
+            raw_buf, meta = _take(ptr, width, height, bpp_ext, ch_ext, bpp_int, ch_int, config)
+            yield name, _shape(raw_buf, meta, return_flags)
+    finally:
+        _lib.pzp_bulk_close(loader)
+
+
+_TENSOR_TYPES   = {"uint8": 0, "uint16": 1, "float32": 2, "float16": 3}
+_TENSOR_LAYOUTS = {"hwc": 0, "chw": 1}
+
+
+def _decode_into(filename, out, index, layout, scale, offset):
+    """Decode into slot `index` of numpy array `out` by pointer; return (w, h, bpp, channels, config)."""
+    scales  = np.atleast_1d(np.asarray(scale,  dtype=np.float32))
+    offsets = np.atleast_1d(np.asarray(offset, dtype=np.float32))
+    count   = max(len(scales), len(offsets))
+    scales  = np.ascontiguousarray(np.broadcast_to(scales,  (count,)))
+    offsets = np.ascontiguousarray(np.broadcast_to(offsets, (count,)))
+
+    if _native is not None:
+        return _native.decode(filename, out, index, _TENSOR_LAYOUTS[layout], _TENSOR_TYPES[out.dtype.name],
+                              scales.tolist(), offsets.tolist())[1:]
+
+    values = [ctypes.c_uint(0) for _ in range(5)]
+    ok = _lib.pzp_decompress_file_to_tensor(
+        filename.encode(sys.getfilesystemencoding()),
+        out.ctypes.data, out.nbytes, index,
+        _TENSOR_LAYOUTS[layout], _TENSOR_TYPES[out.dtype.name],
+        scales.ctypes.data_as(ctypes.POINTER(ctypes.c_float)),
+        offsets.ctypes.data_as(ctypes.POINTER(ctypes.c_float)),
+        count,
+        *[ctypes.byref(v) for v in values],
+    )
+    if not ok:
+        raise RuntimeError(f"PZP: failed to decompress '{filename}'")
+    return tuple(v.value for v in values)
+
+
+def read_tensor(filename: str, *, layout: str = "chw", dtype="float32",
+                scale=1.0, offset=0.0, out=None, index: int = 0):
+    """
+    Decompress straight into a model-ready array.  The layout change and the
+    per-channel  value * scale + offset  conversion happen inside the decoder,
+    on each reconstructed chunk while it is still in cache, instead of as
+    separate numpy passes over the image.
+
+    Parameters
+    ----------
+    layout : "chw" (planar) or "hwc" (interleaved).  The channel axis is kept
+             for single-channel images.
+    dtype  : float32 / float16 apply scale and offset to the raw 0..255 or
+             0..65535 values; uint8 / uint16 copy raw values (the dtype must
+             match the image bit depth).
+    scale, offset : scalar or one value per channel.  Mean/std normalisation
+             of 8-bit data is scale = 1 / (255 * std), offset = -mean / std.
+    out, index : decode into slot `index` of an existing C-contiguous array of
+             that dtype, e.g. an (N, C, H, W) batch, and return a view of the
+             slot.  A new array is allocated when out is None.
+
+    Requires numpy.
+    """
+    if not _NUMPY:
+        raise RuntimeError("PZP.read_tensor requires numpy")
+
+    dtype_name = np.dtype(dtype).name
+    if dtype_name not in _TENSOR_TYPES:
+        raise ValueError(f"PZP.read_tensor: unsupported dtype {dtype_name}")
+    if layout not in _TENSOR_LAYOUTS:
+        raise ValueError(f"PZP.read_tensor: layout must be 'chw' or 'hwc', got {layout!r}")
+
+    if out is None:
+        meta  = info(filename)
+        shape = ((meta["channels"], meta["height"], meta["width"]) if layout == "chw"
+                 else (meta["height"], meta["width"], meta["channels"]))
+        out   = np.empty(shape, dtype=dtype_name)
+        index = 0
+    elif out.dtype.name != dtype_name or not out.flags.c_contiguous or not out.flags.writeable:
+        raise ValueError(f"PZP.read_tensor: out must be a writeable C-contiguous {dtype_name} array")
+
+    w, h, _bpp, ce, _config = _decode_into(filename, out, index, layout, scale, offset)
+    shape = (ce, h, w) if layout == "chw" else (h, w, ce)
+    slot  = ce * h * w
+    return out.reshape(-1)[index * slot:(index + 1) * slot].reshape(shape)
+
+
+
+class _CacheSegment:
+    """This process's mapping of a cache segment; detached when the last user goes."""
+
+    def __init__(self, handle):
+        self.handle = handle
+
+    def __del__(self):
+        if self.handle:
+            _lib.pzp_shared_cache_close(self.handle)
+            self.handle = None
+
+
+class _CachePin:
+    """Keeps a cached frame pinned (never evicted) while an array views it."""
+
+    def __init__(self, segment, view):
+        self.segment = segment
+        self.view    = view
+
+    def __del__(self):
+        _lib.pzp_shared_cache_release(self.segment.handle, ctypes.byref(self.view))
+
+
+class Cache:
+    """
+    Decoded-frame cache in POSIX shared memory, shared by every process that
+    opens the same `name` — e.g. all DataLoader workers of a node, across
+    epochs.  A file is decoded once into the segment; later reads, from any
+    process, are zero-copy views of it.  Frames are keyed by the file's
+    inode, size and mtime and evicted (CLOCK) when `budget` bytes are used.
+
+        cache = PZP.Cache("/pzp-train", budget=8 << 30)   # in each worker
+        img   = cache.read("image.pzp")
+
+    With numpy, read() returns a read-only array shaped like read()'s that
+    keeps its frame pinned until the array is garbage collected.  Without
+    numpy it returns read()'s dict, copied out of the segment.
+    The segment outlives the processes; remove it with PZP.Cache.drop(name).
+    """
+
+    def __init__(self, name: str = "/pzp-cache", budget: int = 1 << 30, entries: int = 0):
+        handle = _lib.pzp_shared_cache_open(name.encode(), budget, entries)
+        if not handle:
+            raise RuntimeError(f"PZP: cannot open shared-memory cache '{name}'")
+        self._segment = _CacheSegment(handle)
+
+    def read(self, filename, *, return_flags: bool = False):
+        filename = str(filename)
+        view = _CacheView()
+        if not _lib.pzp_shared_cache_get(self._segment.handle,
+                                         filename.encode(sys.getfilesystemencoding()),
+                                         ctypes.byref(view)):
+            raise RuntimeError(f"PZP: failed to decompress '{filename}'")
+
+        pin   = _CachePin(self._segment, view)
+        flags = view.configuration
+        c_arr = (ctypes.c_ubyte * view.size).from_address(view.pixels)
+
+        if _NUMPY:
+            c_arr._pin = pin  # released with the last array viewing the frame
+            arr = np.ctypeslib.as_array(c_arr)
+            arr = arr.view(np.uint16 if view.bpp == 16 else np.uint8)
+            arr = arr.reshape(view.height, view.width, view.channels)
+            arr.flags.writeable = False  # other processes see the same memory
+            if view.channels == 1:
+                arr = arr[:, :, 0]
+            return (arr, flags) if return_flags else arr
+
+        meta = {"width": view.width, "height": view.height, "bpp": view.bpp,
+                "channels": view.channels, "configuration": flags}
+        data = bytes(c_arr)
+        del pin
+        if meta["bpp"] == 16 and sys.byteorder == "little":
+            samples = array.array("H", data)
+            samples.byteswap()  # big-endian, like read()
+            data = samples.tobytes()
+        return _shape(data, meta, return_flags)
+
+    def stats(self) -> dict:
+        """Segment-wide counters: hits, misses, evictions, uncached, budget, used, frames."""
+        stats = _CacheStats()
+        _lib.pzp_shared_cache_stats(self._segment.handle, ctypes.byref(stats))
+        return {name: getattr(stats, name) for name, _ in _CacheStats._fields_}
+
+    def close(self):
+        """Stop using the cache; arrays still viewing frames keep the mapping."""
+        self._segment = None
+
+    @staticmethod
+    def drop(name: str = "/pzp-cache") -> bool:
+        """Remove the segment; processes still attached keep their mapping."""
+        return bool(_lib.pzp_shared_cache_unlink(name.encode()))
+
+
+def view(buffer):
+    """
+    Zero-copy read of a file written with backend="store" and no filters
+    (8-bit, plain write() options), held in memory — bytes, or better an
+    mmap of a file on tmpfs.  Returns a read-only (height, width[, channels])
+    uint8 array viewing the pixels inside `buffer`, or None if the file is
+    not stored that way (use read() then).  The checksum is not verified.
+    Needs numpy.
+    """
+    if not _NUMPY:
+        raise ValueError("PZP.view: needs numpy")
+    data = np.frombuffer(buffer, dtype=np.uint8)
+    w, h, c = ctypes.c_uint(0), ctypes.c_uint(0), ctypes.c_uint(0)
+    offset = _lib.pzp_store_view(data.ctypes.data, data.size, ctypes.byref(w), ctypes.byref(h), ctypes.byref(c))
+    if offset < 0:
+        return None
+    arr = data[offset:offset + w.value * h.value * c.value].reshape(h.value, w.value, c.value)
+    arr.flags.writeable = False
+    return arr[:, :, 0] if c.value == 1 else arr
+
+
+# pzpd request / reply, see pzp_daemon.h (native layout, local to the machine)
+_DAEMON_MAGIC   = 0x44505A50
+_DAEMON_VERSION = 1
+_DAEMON_REQUEST = struct.Struct("=7I4096s")
+_DAEMON_REPLY   = struct.Struct("=8IQ")
+
+
+def fetch(filename, socket_path="/tmp/pzpd.sock", *, level: int = 0, roi=None, return_flags: bool = False):
+    """
+    Have the pzpd daemon listening on `socket_path` decode pyramid level
+    `level` of `filename`, cropped to roi = (x, y, width, height) if given.
+    The daemon decodes into shared memory and hands over its descriptor;
+    requests for the same frame made while it decodes share that decode.
+    With numpy, returns a read-only array, shaped like read()'s, that maps
+    the shared buffer.  Without numpy, returns read()'s dict.
+    """
+    path = os.fsencode(str(filename))
+    if len(path) >= 4096:
+        raise ValueError("PZP.fetch: path too long")
+    x, y, width, height = roi if roi is not None else (0, 0, 0, 0)
+
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as connection:
+        connection.connect(socket_path)
+        connection.sendall(_DAEMON_REQUEST.pack(_DAEMON_MAGIC, _DAEMON_VERSION, level, x, y, width, height, path))
+        data, ancillary, _, _ = connection.recvmsg(_DAEMON_REPLY.size, socket.CMSG_SPACE(4))
+
+    fds = array.array("i")
+    for cmsg_level, cmsg_type, payload in ancillary:
+        if cmsg_level == socket.SOL_SOCKET and cmsg_type == socket.SCM_RIGHTS:
+            fds.frombytes(payload[:len(payload) - len(payload) % fds.itemsize])
+    try:
+        if len(data) != _DAEMON_REPLY.size:
+            raise RuntimeError(f"PZP: no reply from the daemon at '{socket_path}'")
+        magic, status, w, h, bpp, channels, flags, _, size = _DAEMON_REPLY.unpack(data)
+        if magic != _DAEMON_MAGIC or status != 0 or len(fds) != 1:
+            raise RuntimeError(f"PZP: the daemon failed to decompress '{filename}': {os.strerror(status)}")
+        buffer = mmap.mmap(fds[0], size, flags=mmap.MAP_SHARED, prot=mmap.PROT_READ)
+    finally:
+        for fd in fds:
+            os.close(fd)
+
+    if _NUMPY:
+        arr = np.frombuffer(buffer, dtype=np.uint16 if bpp == 16 else np.uint8)
+        arr = arr.reshape(h, w, channels)  # read-only, keeps the mapping alive
+        if channels == 1:
+            arr = arr[:, :, 0]
+        return (arr, flags) if return_flags else arr
+
+    meta = {"width": w, "height": h, "bpp": bpp, "channels": channels, "configuration": flags}
+    data = bytes(buffer)
+    buffer.close()
+    if bpp == 16 and sys.byteorder == "little":
+        samples = array.array("H", data)
+        samples.byteswap()  # big-endian, like read()
+        data = samples.tobytes()
+    return _shape(data, meta, return_flags)
+
+
+def levels(filename: str) -> int:
+    """
+    Number of resolution levels read(level=…) accepts: 1 for a plain file,
+    1 + the stored pyramid levels for a file written with use_pyramid=True.
+    """
+    count = _lib.pzp_levels_file(filename.encode(sys.getfilesystemencoding()))
+    if count == 0:
+        raise RuntimeError(f"PZP: failed to open '{filename}'")
+    return count
+
+
+def layers(filename: str) -> int:
+    """
+    Number of layers read(layer=…) accepts: 1 for a plain file, the number of
+    images stored for a file written with write_layers().
+    """
+    count = _lib.pzp_layers_file(filename.encode(sys.getfilesystemencoding()))
+    if count == 0:
+        raise RuntimeError(f"PZP: failed to open '{filename}'")
+    return count
+
+
+def read_layers(filename: str, *, return_flags: bool = False) -> list:
+    """
+    Decode every layer of a file written with write_layers() with a single
+    file read.  Returns a list of what read() returns for each layer.
+    """
+    out = (_Layer * _MAX_LAYERS)()
+    count = _lib.pzp_decompress_file_layers(filename.encode(sys.getfilesystemencoding()), out, _MAX_LAYERS)
+    if count == 0:
+        raise RuntimeError(f"PZP: failed to decompress '{filename}'")
+    return [_shape(*_take_layer(out[i]), return_flags) for i in range(count)]
+
+
+def max_error(filename: str) -> int:
+    """
+    Error bound of a file written with write(..., max_error=N): every decoded
+    sample is within ±N of the original.  0 for lossless files.
+    """
+    bound = _lib.pzp_max_error_file(filename.encode(sys.getfilesystemencoding()))
+    if bound < 0:
+        raise RuntimeError(f"PZP: failed to read header of '{filename}'")
+    return bound
+
+
 def info(filename: str) -> dict:
     """
-    Return metadata for a PZP file without retaining the pixel buffer.
-    Keys: width, height, bpp, channels, bpp_internal, ch_internal, configuration.
+    Return metadata for a PZP file.  Only the header is decoded.
+    Keys: width, height, bpp, channels, bpp_internal, ch_internal, configuration,
+    backend ("zstd", "lz4" or "store").
     """
-    _raw, meta = _decode(filename)
-    return meta
+    if _native is not None:
+        w, h, be, ce, bi, ci, config = _native.info(filename)
+    else:
+        values = [ctypes.c_uint(0) for _ in range(7)]
+        if not _lib.pzp_info_file(filename.encode(sys.getfilesystemencoding()),
+                                  *[ctypes.byref(v) for v in values]):
+            raise RuntimeError(f"PZP: failed to read header of '{filename}'")
+        w, h, be, ce, bi, ci, config = (v.value for v in values)
+    return {
+        "width":         w,
+        "height":        h,
+        "bpp":           be,
+        "channels":      ce,
+        "bpp_internal":  bi,
+        "ch_internal":   ci,
+        "configuration": config,
+        "backend":       next(name for name, flag in _BACKENDS.items()
+                              if flag == config & _BACKEND_FLAGS),
+    }
+
+
+def _flags(use_rle=False, use_palette=False, use_runs=False, use_pyramid=False,
+           max_error=0, configuration=USE_COMPRESSION, backend="zstd") -> int:
+    """Configuration bitfield for write()'s keyword options."""
+    if backend not in _BACKENDS:
+        raise ValueError(f"PZP: unknown backend {backend!r}, use one of {', '.join(_BACKENDS)}")
+    cfg = configuration | USE_COMPRESSION | _BACKENDS[backend]
+    if use_rle:
+        cfg |= USE_RLE
+    if use_palette:
+        cfg |= USE_PALETTE
+    if use_runs:
+        cfg |= USE_RUNS
+    if use_pyramid:
+        cfg |= USE_PYRAMID
+    if max_error:
+        cfg |= USE_NEAR_LOSSLESS
+    return cfg
 
 
 def write(filename: str, data, *,
@@ -272,6 +917,10 @@ def write(filename: str, data, *,
           bpp: int = 0, channels: int = 0,
           use_rle: bool = False,
           use_palette: bool = False,
+          use_runs: bool = False,
+          use_pyramid: bool = False,
+          max_error: int = 0,
+          backend: str = "zstd",
           configuration: int = USE_COMPRESSION) -> None:
     """
     Compress pixel data and write a .pzp file.
@@ -296,6 +945,24 @@ def write(filename: str, data, *,
         Enable per-channel palette indexing.  Best for images with few unique
         values per channel (e.g. segmentation maps, label images).
         Adds USE_PALETTE to the configuration bitfield.
+    use_runs : bool
+        Store per-row (run, pixel) tokens instead of the delta filter.
+        Best for flat label maps with long horizontal runs.
+        Adds USE_RUNS to the configuration bitfield.
+    use_pyramid : bool
+        Also store half, quarter, … resolution copies after the full image so
+        previews can be read with read(level=N) without decoding everything.
+        Adds USE_PYRAMID to the configuration bitfield.
+    max_error : int
+        Near-lossless mode for 16-bit data: every decoded sample is within
+        ±max_error of the original (quantized prediction residuals, JPEG-LS
+        NEAR style).  Drops the noisy low bits of depth frames; 0 = lossless.
+        Adds USE_NEAR_LOSSLESS to the configuration bitfield.
+    backend : str
+        Entropy stage behind the filters: "zstd" (default, best ratio), "lz4"
+        (several times faster decode) or "store" (no entropy stage, for tmpfs
+        staging: unfiltered 8-bit images can then be used in place with view()).
+        Adds USE_LZ4 / USE_STORE to the configuration bitfield; read() handles all three.
     configuration : int
         Full configuration bitfield.  USE_COMPRESSION (1) is always or'd in.
         Prefer the convenience booleans (use_rle, use_palette) for common cases.
@@ -306,11 +973,7 @@ def write(filename: str, data, *,
     RuntimeError if the C encoder returns an error.
     """
     # Always ensure USE_COMPRESSION is set
-    cfg = configuration | USE_COMPRESSION
-    if use_rle:
-        cfg |= USE_RLE
-    if use_palette:
-        cfg |= USE_PALETTE
+    cfg = _flags(use_rle, use_palette, use_runs, use_pyramid, max_error, configuration, backend)
 
     if _NUMPY and isinstance(data, np.ndarray):
         arr = data
@@ -323,28 +986,46 @@ def write(filename: str, data, *,
 
         h, w, c = arr.shape
 
+        fname = filename.encode(sys.getfilesystemencoding())
+
+        # Handed to C by pointer: a native-endian uint16 array goes straight to
+        # the SIMD byte-plane split, with no byte swap or intermediate copies.
+        if arr.dtype == np.uint8 and max_error:
+            raise ValueError("PZP.write: max_error needs uint16 data")
+        if _native is not None and arr.dtype.kind == "u" and arr.dtype.itemsize <= 2:
+            arr = np.ascontiguousarray(arr, dtype=np.uint16 if arr.itemsize == 2 else np.uint8)
+            _native.encode(filename, arr, w, h, 8 * arr.itemsize, c, cfg, max_error, arr.itemsize == 2)
+            return
         if arr.dtype == np.uint8:
-            pixel_bpp = 8
-            raw = arr.tobytes()
-        elif arr.dtype == np.uint16:
-            # PZP/PNM byte order is big-endian; convert if the array is native-endian
-            pixel_bpp = 16
-            raw = arr.astype(">u2").tobytes()
+            arr = np.ascontiguousarray(arr)
+            rc  = _lib.pzp_compress_file(arr.ctypes.data_as(ctypes.POINTER(ctypes.c_ubyte)),
+                                         w, h, 8, c, cfg, fname)
+        elif arr.dtype.kind == "u" and arr.dtype.itemsize == 2 and max_error:
+            arr = np.ascontiguousarray(arr, dtype=np.uint16)
+            rc  = _lib.pzp_compress_file_near(arr.ctypes.data, 1, w, h, c, cfg, max_error, fname)
+        elif arr.dtype.kind == "u" and arr.dtype.itemsize == 2:
+            arr = np.ascontiguousarray(arr, dtype=np.uint16)
+            rc  = _lib.pzp_compress_file_native16(arr.ctypes.data_as(ctypes.POINTER(ctypes.c_ushort)),
+                                                  w, h, c, cfg, fname)
         else:
-            raise ValueError(
-                f"PZP.write: unsupported dtype {arr.dtype}. Use uint8 or uint16.")
+            raise ValueError(f"PZP.write: unsupported dtype {arr.dtype}. Use uint8 or uint16.")
 
-    else:
-        # Raw bytes path — caller must supply all metadata
-        if not (width and height and bpp and channels):
-            raise ValueError(
-                "PZP.write: width, height, bpp, and channels are required "
-                "when data is not a numpy array.")
-        if bpp not in (8, 16):
-            raise ValueError(f"PZP.write: bpp must be 8 or 16, got {bpp}")
+        if rc == 0:
+            raise RuntimeError(f"PZP.write: compression failed for '{filename}'")
+        return
 
-        w, h, pixel_bpp, c = width, height, bpp, channels
-        raw = bytes(data)
+    # Raw bytes path — caller must supply all metadata
+    if not (width and height and bpp and channels):
+        raise ValueError(
+            "PZP.write: width, height, bpp, and channels are required "
+            "when data is not a numpy array.")
+    if bpp not in (8, 16):
+        raise ValueError(f"PZP.write: bpp must be 8 or 16, got {bpp}")
+    if max_error and bpp != 16:
+        raise ValueError(f"PZP.write: max_error needs bpp=16")
+
+    w, h, pixel_bpp, c = width, height, bpp, channels
+    raw = bytes(data)
 
     expected = w * h * c * (pixel_bpp // 8)
     if len(raw) != expected:
@@ -352,9 +1033,68 @@ def write(filename: str, data, *,
             f"PZP.write: pixel buffer is {len(raw)} bytes, "
             f"expected {expected} ({w}×{h}×{c}ch×{pixel_bpp//8}B)")
 
+    if _native is not None:
+        _native.encode(filename, raw, w, h, pixel_bpp, c, cfg, max_error)
+        return
+
     buf   = (ctypes.c_ubyte * len(raw)).from_buffer_copy(raw)
     fname = filename.encode(sys.getfilesystemencoding())
 
-    rc = _lib.pzp_compress_file(buf, w, h, pixel_bpp, c, cfg, fname)
+    if max_error:
+        rc = _lib.pzp_compress_file_near(buf, 0, w, h, c, cfg, max_error, fname)
+    else:
+        rc = _lib.pzp_compress_file(buf, w, h, pixel_bpp, c, cfg, fname)
     if rc == 0:
         raise RuntimeError(f"PZP.write: compression failed for '{filename}'")
+
+
+def write_layers(filename: str, images) -> None:
+    """
+    Store several numpy images of one instant, e.g. uint8 RGB colour and uint16
+    depth, as the layers of one .pzp file.  Each layer keeps its own bit depth,
+    channel count and mode, and the layers are encoded in parallel.
+
+    images : list of ndarray, or of (ndarray, options) pairs where options is a
+             dict of write()'s keyword flags for that layer (use_rle,
+             use_palette, use_runs, use_pyramid, max_error, backend,
+             configuration).
+
+    Read back with read(filename, layer=N) or read_layers(filename); a plain
+    read() returns layer 0.
+    """
+    if not _NUMPY:
+        raise ValueError("PZP.write_layers: needs numpy arrays")
+    images = list(images)
+    if not 1 <= len(images) <= _MAX_LAYERS:
+        raise ValueError(f"PZP.write_layers: 1..{_MAX_LAYERS} layers, got {len(images)}")
+
+    layers = (_Layer * len(images))()
+    keep   = []  # arrays that must outlive the C call
+    for i, image in enumerate(images):
+        arr, options = image if isinstance(image, tuple) else (image, {})
+        if arr.ndim == 2:
+            arr = arr[:, :, np.newaxis]
+        if arr.ndim != 3:
+            raise ValueError(f"PZP.write_layers: layer {i}: expected 2-D or 3-D array, got {arr.shape}")
+        if arr.dtype == np.uint8:
+            if options.get("max_error"):
+                raise ValueError(f"PZP.write_layers: layer {i}: max_error needs uint16 data")
+            arr, bpp = np.ascontiguousarray(arr), 8
+        elif arr.dtype.kind == "u" and arr.dtype.itemsize == 2:
+            arr, bpp = np.ascontiguousarray(arr, dtype=np.uint16), 16
+        else:
+            raise ValueError(f"PZP.write_layers: layer {i}: unsupported dtype {arr.dtype}. Use uint8 or uint16.")
+        keep.append(arr)
+
+        h, w, c = arr.shape
+        layers[i].pixels        = arr.ctypes.data_as(ctypes.POINTER(ctypes.c_ubyte))
+        layers[i].width         = w
+        layers[i].height        = h
+        layers[i].bitsperpixel  = bpp
+        layers[i].channels      = c
+        layers[i].configuration = _flags(**options)
+        layers[i].max_error     = options.get("max_error", 0)
+        layers[i].native16      = 1 if bpp == 16 else 0
+
+    if not _lib.pzp_compress_file_layers(layers, len(images), filename.encode(sys.getfilesystemencoding())):
+        raise RuntimeError(f"PZP.write_layers: compression failed for '{filename}'")
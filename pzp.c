@@ -1,11 +1,30 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <strings.h>
+#include <pthread.h>
 
 #include "pzp.h"
+#include "pzp_loader.h"
+#include "pzp_cache.h"
+#include "pzp_daemon.h"
 //sudo apt install libzstd-dev
 
-#define PPMREADBUFLEN 256
 #define PRINT_COMMENTS 0
+#define PNM_MAX_HEADER 4096 // bytes of header (comments included) read from a stream
+#define PNM_MAX_DEPTH  16   // PAM channels accepted
+
+// The library reports errors through return values, the command line tool ends here
+static void fail(const char * message)
+{
+  fprintf(stderr,RED "PZP Fatal Error: %s\n" NORMAL,message);
+  exit(EXIT_FAILURE);
+}
 
 static unsigned int simplePowPPM(unsigned int base,unsigned int exp)
 {
@@ -19,231 +38,1394 @@ static unsigned int simplePowPPM(unsigned int base,unsigned int exp)
     return retres;
 }
 
-static unsigned char * ReadPNM(unsigned char * buffer,const char * filename,unsigned int *width,unsigned int *height,unsigned long * timestamp, unsigned int * bytesPerPixel, unsigned int * channels)
+// ─── PNM / PAM input ────────────────────────────────────────────────────────
+//See http://en.wikipedia.org/wiki/Portable_anymap#File_format_description for this simple and useful format
+// P5 (grey), P6 (RGB) and P7 (PAM: any DEPTH, e.g. GRAYSCALE_ALPHA or RGB_ALPHA) with a
+// MAXVAL up to 255 (8-bit samples) or up to 65535 (16-bit big-endian samples).
+struct PNMHeader
 {
-    * bytesPerPixel = 0;
-    * channels = 0;
+    unsigned int width, height, channels, bytesPerPixel;
+    unsigned long timestamp; // "# TIMESTAMP <n>" comment, 0 if there is none
+};
 
-    //See http://en.wikipedia.org/wiki/Portable_anymap#File_format_description for this simple and useful format
-    unsigned char * pixels=buffer;
-    FILE *pf=0;
-    pf = fopen(filename,"rb");
+static int PNMIsSpace(unsigned char c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
 
-    if (pf!=0 )
+// Skip whitespace and # comments, noting a TIMESTAMP comment.  Returns 0 if the data ends first.
+static int PNMSkipSpace(const unsigned char *data, size_t size, size_t *pos, unsigned long *timestamp)
+{
+    while (*pos < size)
     {
-        *width=0;
-        *height=0;
-        *timestamp=0;
-
-        char buf[PPMREADBUFLEN]= {0};
-        char *t;
-        unsigned int w=0, h=0, d=0;
-        int r=0, z=0;
-
-        t = fgets(buf, PPMREADBUFLEN, pf);
-        if (t == 0)
+        if (data[*pos] == '#')
         {
-            fclose(pf);
-            return buffer;
-        }
+            size_t end = *pos;
+            while ( (end < size) && (data[end] != '\n') ) { end++; }
+            if (end == size) { return 0; }
 
-        if ( strncmp(buf,"P6\n", 3) == 0 )
-        {
-            *channels=3;
-        }
-        else if ( strncmp(buf,"P5\n", 3) == 0 )
-        {
-            *channels=1;
+            for (size_t i = *pos; i + 9 <= end; i++)
+            {
+                if (memcmp(data + i, "TIMESTAMP", 9) == 0)
+                {
+                    unsigned long value = 0;
+                    for (i += 9; (i < end) && (PNMIsSpace(data[i])); i++) { }
+                    for (; (i < end) && (data[i] >= '0') && (data[i] <= '9'); i++) { value = value * 10 + (data[i] - '0'); }
+                    *timestamp = value;
+                    break;
+                }
+            }
+#if PRINT_COMMENTS
+            fprintf(stderr, "%.*s\n", (int) (end - *pos), (const char *) data + *pos);
+#endif
+            *pos = end + 1;
         }
-        else
+        else if (PNMIsSpace(data[*pos])) { (*pos)++; }
+        else { return 1; }
+    }
+    return 0;
+}
+
+// Read a decimal number.  Returns 1, 0 if there is none (or it is absurd), -1 if the data ends inside it.
+static int PNMNumber(const unsigned char *data, size_t size, size_t *pos, unsigned int *value)
+{
+    size_t start = *pos;
+    unsigned long long number = 0;
+    while ( (*pos < size) && (data[*pos] >= '0') && (data[*pos] <= '9') )
+    {
+        number = number * 10 + (data[*pos] - '0');
+        if (number > 0xFFFFFFFFull) { return 0; }
+        (*pos)++;
+    }
+    if (*pos == size) { return -1; }
+    if (*pos == start) { return 0; }
+    *value = (unsigned int) number;
+    return 1;
+}
+
+// Bytes of the raster behind a valid header, 0 if it does not fit in memory
+static size_t PNMRasterSize(const struct PNMHeader *header)
+{
+    size_t pixelBytes = (size_t) header->channels * header->bytesPerPixel;
+    if ( (size_t) header->height > SIZE_MAX / pixelBytes / header->width ) { return 0; }
+    return (size_t) header->width * header->height * pixelBytes;
+}
+
+// Parse the P5 / P6 / P7 header at the start of data.  Returns its length (where the
+// raster starts), 0 if it is not a header this reads and -1 if more bytes are needed.
+static long ParsePNMHeader(const unsigned char *data, size_t size, struct PNMHeader *header)
+{
+    memset(header, 0, sizeof(*header));
+    if (size < 3) { return -1; }
+    if ( (data[0] != 'P') || (data[1] < '5') || (data[1] > '7') || (!PNMIsSpace(data[2])) ) { return 0; }
+
+    size_t pos = 2;
+    unsigned int maxval = 0;
+    if (data[1] != '7')
+    {
+        // P5 / P6: width, height and maxval, then exactly one whitespace byte before the raster
+        unsigned int *fields[3] = { &header->width, &header->height, &maxval };
+        for (unsigned int f = 0; f < 3; f++)
         {
-            fprintf(stderr,"Could not understand/Not supported file format\n");
-            fclose(pf);
-            return buffer;
+            if (!PNMSkipSpace(data, size, &pos, &header->timestamp)) { return -1; }
+            int r = PNMNumber(data, size, &pos, fields[f]);
+            if (r <= 0) { return r; }
         }
-        do
+        if (!PNMIsSpace(data[pos])) { return 0; }
+        pos++;
+        header->channels = (data[1] == '6') ? 3 : 1;
+    }
+    else
+    {
+        // P7: "KEYWORD value" lines in any order up to ENDHDR
+        for (;;)
         {
-            /* Px formats can have # comments after first line */
-#if PRINT_COMMENTS
-            memset(buf,0,PPMREADBUFLEN);
-#endif
-            t = fgets(buf, PPMREADBUFLEN, pf);
-            if (strstr(buf,"TIMESTAMP")!=0)
+            if (!PNMSkipSpace(data, size, &pos, &header->timestamp)) { return -1; }
+            size_t keyword = pos;
+            while ( (pos < size) && (!PNMIsSpace(data[pos])) ) { pos++; }
+            if (pos == size) { return -1; }
+            size_t length = pos - keyword;
+
+            if ( (length == 6) && (memcmp(data + keyword, "ENDHDR", 6) == 0) )
             {
-                char * timestampPayloadStr = buf + 10;
-                *timestamp = atoi(timestampPayloadStr);
+                while ( (pos < size) && (data[pos] != '\n') ) { pos++; }
+                if (pos == size) { return -1; }
+                pos++;
+                break;
             }
-
-            if ( t == 0 )
+            if ( (length == 8) && (memcmp(data + keyword, "TUPLTYPE", 8) == 0) )
             {
-                fclose(pf);
-                return buffer;
+                // Informative only, the layout follows from DEPTH
+                while ( (pos < size) && (data[pos] != '\n') ) { pos++; }
+                continue;
             }
+
+            unsigned int *field = NULL;
+            if ( (length == 5) && (memcmp(data + keyword, "WIDTH", 5) == 0) )  { field = &header->width; } else
+            if ( (length == 6) && (memcmp(data + keyword, "HEIGHT", 6) == 0) ) { field = &header->height; } else
+            if ( (length == 5) && (memcmp(data + keyword, "DEPTH", 5) == 0) )  { field = &header->channels; } else
+            if ( (length == 6) && (memcmp(data + keyword, "MAXVAL", 6) == 0) ) { field = &maxval; } else
+                { return 0; }
+
+            if (!PNMSkipSpace(data, size, &pos, &header->timestamp)) { return -1; }
+            int r = PNMNumber(data, size, &pos, field);
+            if (r <= 0) { return r; }
         }
-        while ( strncmp(buf, "#", 1) == 0 );
-        z = sscanf(buf, "%u %u", &w, &h);
-        if ( z < 2 )
-        {
-            fclose(pf);
-            fprintf(stderr,"Incoherent dimensions received %ux%u \n",w,h);
-            return buffer;
-        }
-        // The program fails if the first byte of the image is equal to 32. because
-        // the fscanf eats the space and the image is read with some bit less
-        r = fscanf(pf, "%u\n", &d);
-        if (r < 1)
+    }
+
+    if ( (header->width == 0) || (header->height == 0) || (header->channels == 0) ||
+         (header->channels > PNM_MAX_DEPTH) || (maxval == 0) || (maxval > 65535) )
+    {
+        fprintf(stderr, "Incoherent PNM header %ux%ux%u maxval %u\n", header->width, header->height, header->channels, maxval);
+        return 0;
+    }
+    header->bytesPerPixel = (maxval > 255) ? 2 : 1;
+    if (PNMRasterSize(header) == 0) { return 0; }
+    return (long) pos;
+}
+
+// Where PNM / PAM frames come from: a regular file is mapped and its pixels used in
+// place, anything else (stdin, pipes) is read through stdio, so frames may follow
+// each other on a stream.
+struct PNMInput
+{
+    const char *filename;
+    FILE *stream;
+    unsigned char *map;       // mapped file, or NULL
+    size_t mapSize, mapPos;
+    unsigned char *buffer;    // stream frames are read into this
+    size_t bufferSize;
+};
+
+// Returns 1 on success, 0 if the file cannot be opened
+static int OpenPNMInput(struct PNMInput *input, const char *filename)
+{
+    memset(input, 0, sizeof(*input));
+    input->filename = filename;
+    if (strcmp(filename, "-") == 0)
+    {
+        input->stream = stdin;
+        return 1;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) { return 0; }
+    struct stat st;
+    if ( (fstat(fd, &st) == 0) && (S_ISREG(st.st_mode)) && (st.st_size > 0) )
+    {
+        void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (map != MAP_FAILED)
         {
-            fprintf(stderr,"Could not understand how many bytesPerPixel there are on this image\n");
-            fclose(pf);
-            return buffer;
+            madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+            input->map     = (unsigned char *) map;
+            input->mapSize = (size_t) st.st_size;
+            close(fd);
+            return 1;
         }
-        if (d==255)
+    }
+    input->stream = fdopen(fd, "rb");
+    if (input->stream == NULL) { close(fd); }
+    return (input->stream != NULL);
+}
+
+static void ClosePNMInput(struct PNMInput *input)
+{
+    if (input->map != NULL) { munmap(input->map, input->mapSize); }
+    if ( (input->stream != NULL) && (input->stream != stdin) ) { fclose(input->stream); }
+    pzp_dealloc(input->buffer);
+    memset(input, 0, sizeof(*input));
+}
+
+// 1 if no bytes are left
+static int PNMInputAtEnd(struct PNMInput *input)
+{
+    if (input->map != NULL) { return (input->mapPos == input->mapSize); }
+    int next = fgetc(input->stream);
+    if (next == EOF) { return 1; }
+    ungetc(next, input->stream);
+    return 0;
+}
+
+// The next frame's interleaved pixels (16-bit samples big-endian), pointing into the
+// mapping or into input's buffer, valid until the next call.  NULL on a bad or short frame.
+static const unsigned char * NextPNMFrame(struct PNMInput *input, struct PNMHeader *header)
+{
+    if (input->map != NULL)
+    {
+        const unsigned char *data = input->map + input->mapPos;
+        size_t               left = input->mapSize - input->mapPos;
+        long headerLength = ParsePNMHeader(data, left, header);
+        if (headerLength <= 0)
         {
-            *bytesPerPixel=1;
+            fprintf(stderr, "Could not understand/Not supported file format (%s)\n", input->filename);
+            return NULL;
         }
-        else if (d==65535)
+        size_t raster = PNMRasterSize(header);
+        if (raster > left - (size_t) headerLength)
         {
-            *bytesPerPixel=2;
+            fprintf(stderr, "%s is truncated: %ux%ux%u@%ubit needs %zu bytes of pixels, has %zu\n", input->filename,
+                    header->width, header->height, header->channels, header->bytesPerPixel * 8,
+                    raster, left - (size_t) headerLength);
+            return NULL;
         }
-        else
+        input->mapPos += (size_t) headerLength + raster;
+        return data + headerLength;
+    }
+
+    // Streams: the header is read a byte at a time, so nothing behind it is consumed
+    unsigned char headerData[PNM_MAX_HEADER];
+    size_t headerSize = 0;
+    long headerLength = -1;
+    while ( (headerLength < 0) && (headerSize < sizeof(headerData)) )
+    {
+        int c = fgetc(input->stream);
+        if (c == EOF) { break; }
+        headerData[headerSize++] = (unsigned char) c;
+        headerLength = ParsePNMHeader(headerData, headerSize, header);
+    }
+    if (headerLength <= 0)
+    {
+        if (headerSize > 0) { fprintf(stderr, "Could not understand/Not supported file format (%s)\n", input->filename); }
+        return NULL;
+    }
+
+    size_t raster = PNMRasterSize(header);
+    if (raster > input->bufferSize)
+    {
+        pzp_dealloc(input->buffer);
+        input->buffer     = (unsigned char *) pzp_alloc(raster);
+        input->bufferSize = (input->buffer != NULL) ? raster : 0;
+        if (input->buffer == NULL)
         {
-            fprintf(stderr,"Incoherent payload received %u bits per pixel \n",d);
-            fclose(pf);
-            return buffer;
+            fprintf(stderr, "Could not Allocate enough memory for file %s \n", input->filename);
+            return NULL;
         }
+    }
+    size_t rd = fread(input->buffer, 1, raster, input->stream);
+    if (rd < raster)
+    {
+        fprintf(stderr, "%s is truncated: %ux%ux%u@%ubit needs %zu bytes of pixels, has %zu\n", input->filename,
+                header->width, header->height, header->channels, header->bytesPerPixel * 8, raster, rd);
+        return NULL;
+    }
+    return input->buffer;
+}
 
-        //This is a super ninja hackish patch that fixes the case where fscanf eats one character more on the stream
-        //It could be done better  ( no need to fseek ) but this will have to do for now
-        //Scan for border case
-        unsigned long startOfBinaryPart = ftell(pf);
-        if ( fseek (pf, 0, SEEK_END)!=0 )
+// "-" is standard input / output
+static FILE * OpenStream(const char * filename, const char * mode)
+{
+    if (strcmp(filename, "-") == 0)
+    {
+        return (mode[0] == 'r') ? stdin : stdout;
+    }
+    return fopen(filename, mode);
+}
+
+static void CloseStream(FILE * stream)
+{
+    if ( (stream == stdin) || (stream == stdout) )
+    {
+        fflush(stream);
+        return;
+    }
+    fclose(stream);
+}
+
+static int WritePNMHeader(FILE * fd, const char * filename, unsigned int width, unsigned int height, unsigned int bitsperpixel, unsigned int channels)
+{
+    if ((width == 0) || (height == 0) || (channels == 0) || (bitsperpixel == 0))
+    {
+        fprintf(stderr, "saveRawImageToFile(%s) called with zero dimensions ( %ux%u %u channels %u bpp\n", filename, width, height, channels, bitsperpixel);
+        return 0;
+    }
+    if (bitsperpixel / channels > 16)
+    {
+        fprintf(stderr, "PNM does not support more than 2 bytes per pixel..!\n");
+        return 0;
+    }
+
+    unsigned int bitsperchannelpixel = bitsperpixel / channels;
+    unsigned int maxval = simplePowPPM(2,bitsperchannelpixel) - 1;
+    if ( (channels == 3) || (channels == 1) )
+    {
+        fprintf(fd, "%s\n%u %u\n%u\n", (channels == 3) ? "P6" : "P5", width, height, maxval);
+    }
+    else if (channels <= PNM_MAX_DEPTH)
+    {
+        // Anything else is written as PAM, which the compressor reads back
+        const char *tupleType = (channels == 2) ? "GRAYSCALE_ALPHA" : (channels == 4) ? "RGB_ALPHA" : NULL;
+        fprintf(fd, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH %u\nMAXVAL %u\n", width, height, channels, maxval);
+        if (tupleType != NULL) { fprintf(fd, "TUPLTYPE %s\n", tupleType); }
+        fprintf(fd, "ENDHDR\n");
+    }
+    else
+    {
+        fprintf(stderr, "Invalid channels arg (%u) for SaveRawImageToFile\n", channels);
+        return 0;
+    }
+    return 1;
+}
+
+static int WritePNMFrame(FILE * fd, const char * filename, unsigned char * pixels, unsigned int width, unsigned int height, unsigned int bitsperpixel, unsigned int channels)
+{
+    if (pixels == 0)
+    {
+        fprintf(stderr, "saveRawImageToFile(%s) called for an unallocated (empty) frame, will not write any file output\n", filename);
+        return 0;
+    }
+    if (!WritePNMHeader(fd, filename, width, height, bitsperpixel, channels))
+    {
+        return 0;
+    }
+
+    unsigned int bitsperchannelpixel = bitsperpixel / channels;
+    size_t n = (size_t) width * height * channels * (bitsperchannelpixel / 8);
+
+    fwrite(pixels, 1, n, fd);
+    fflush(fd);
+    return 1;
+}
+
+// Streams a decoded frame to a PNM file band by band (struct pzp_bands callback)
+struct PNMBandWriter
+{
+    FILE *fd;
+    const char *filename;
+    int writable; // the frame has a PNM header, else its bands are skipped as WritePNMFrame would
+};
+
+static int WritePNMBand(void *user, const struct pzp_band *band)
+{
+    struct PNMBandWriter *writer = (struct PNMBandWriter *) user;
+    if (band->firstRow == 0)
+    {
+        writer->writable = WritePNMHeader(writer->fd, writer->filename, band->width, band->height, band->bitsperpixel * band->channels, band->channels);
+    }
+    if (!writer->writable)
+    {
+        return 1;
+    }
+    size_t n = (size_t) band->rowCount * band->rowBytes;
+    return (fwrite(band->rows, 1, n, writer->fd) == n);
+}
+
+static int WritePNM(const char * filename, unsigned char * pixels, unsigned int width, unsigned int height, unsigned int bitsperpixel, unsigned int channels)
+{
+    FILE *fd = OpenStream(filename, "wb");
+    if (fd != 0)
+    {
+        int result = WritePNMFrame(fd, filename, pixels, width, height, bitsperpixel, channels);
+        CloseStream(fd);
+        return result;
+    }
+    else
+    {
+        fprintf(stderr, "SaveRawImageToFile could not open output file %s\n", filename);
+        return 0;
+    }
+    return 0;
+}
+
+
+static double pzp_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// Decode many files with read-ahead and report throughput; nothing is written
+static int bulkLoad(const char **filenames, unsigned int count)
+{
+    // PZP_LOADER=pool / io_uring forces a backend, as the loader falls back silently
+    const char      *forced  = getenv("PZP_LOADER");
+    PZPLoaderBackend backend = PZP_LOADER_AUTO;
+    if ( (forced != NULL) && (strcmp(forced, "pool") == 0) )     { backend = PZP_LOADER_THREADPOOL; }
+    if ( (forced != NULL) && (strcmp(forced, "io_uring") == 0) ) { backend = PZP_LOADER_IO_URING_ONLY; }
+
+    double start = pzp_seconds();
+
+    struct pzp_loader *loader = pzp_loader_open(filenames, count, PZP_LOADER_DEFAULT_DEPTH, backend);
+    if (loader == NULL)
+    {
+        fprintf(stderr, "Failed to start bulk loader\n");
+        return EXIT_FAILURE;
+    }
+
+    unsigned int failed = 0;
+    size_t compressedBytes = 0, decodedBytes = 0;
+    struct pzp_loaded_file file;
+    while (pzp_loader_next(loader, &file))
+    {
+        unsigned char *pixels = NULL;
+        unsigned int width = 0, height = 0, bppExternal = 0, channelsExternal = 0, bppInternal = 0, channelsInternal = 0, configuration = 0;
+        if (file.data != NULL)
         {
-            fprintf(stderr,"Could not find file size to cache client..!\nUnable to serve client\n");
-            fclose(pf);
-            return 0;
+            pixels = pzp_decompress_combined_from_memory(file.data, file.size, &width, &height,
+                                                         &bppExternal, &channelsExternal,
+                                                         &bppInternal, &channelsInternal, &configuration);
+            compressedBytes += file.size;
+            free(file.data);
         }
-        unsigned long totalFileSize = ftell (pf); //lSize now holds the size of the file..
 
-        //fprintf(stderr,"totalFileSize-startOfBinaryPart = %u \n",totalFileSize-startOfBinaryPart);
-        //fprintf(stderr,"bytesPerPixel*channels*w*h = %u \n",bytesPerPixel*channels*w*h);
-        if (totalFileSize-startOfBinaryPart < *bytesPerPixel*(*channels)*w*h )
+        if (pixels == NULL)
         {
-            fprintf(stderr," Detected Border Case\n\n\n");
-            startOfBinaryPart-=1;
+            fprintf(stderr, RED "Failed to load %s" NORMAL "\n", filenames[file.index]);
+            failed++;
+            continue;
         }
-        if ( fseek (pf, startOfBinaryPart, SEEK_SET)!=0 )
+        decodedBytes += (size_t) width * height * channelsInternal * (bppInternal / 8);
+        pzp_dealloc(pixels);
+    }
+    backend = loader->backend;
+    pzp_loader_close(loader);
+
+    double elapsed = pzp_seconds() - start;
+    fprintf(stderr, "Loaded %u/%u files (%s) in %.3f sec : %.1f files/sec, %.1f MB/s decoded, %.1f MB/s read\n",
+            count - failed, count, (backend == PZP_LOADER_IO_URING_ONLY) ? "io_uring" : "thread pool",
+            elapsed, count / elapsed, decodedBytes / elapsed / 1e6, compressedBytes / elapsed / 1e6);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Decode files through a shared-memory frame cache and report what came from it.
+// Start several of these on the same segment to see frames decoded only once.
+static int cacheLoad(const char *segmentName, size_t budget, const char **filenames, unsigned int count)
+{
+    struct pzp_cache *cache = pzp_cache_open(segmentName, budget, 0);
+    if (cache == NULL)
+    {
+        fprintf(stderr, "Failed to open cache %s\n", segmentName);
+        return EXIT_FAILURE;
+    }
+
+    double start = pzp_seconds();
+    unsigned int failed = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        struct pzp_cache_view view;
+        if (!pzp_cache_get(cache, filenames[i], &view))
         {
-            fprintf(stderr,"Could not find file size to cache client..!\nUnable to serve client\n");
-            fclose(pf);
-            return 0;
+            fprintf(stderr, RED "Failed to load %s" NORMAL "\n", filenames[i]);
+            failed++;
+            continue;
         }
-        //-----------------------
-        //----------------------
+        pzp_cache_release(cache, &view);
+    }
+
+    double elapsed = pzp_seconds() - start;
+    struct pzp_cache_stats after;
+    pzp_cache_get_stats(cache, &after);
+    fprintf(stderr, "Loaded %u/%u files in %.3f sec through %s : %u frames cached, %.1f/%.1f MB used, "
+                    "segment totals %llu hits, %llu misses, %llu evictions, %llu uncached\n",
+            count - failed, count, elapsed, segmentName, after.frames, after.used / 1e6, after.budget / 1e6,
+            (unsigned long long) after.hits, (unsigned long long) after.misses,
+            (unsigned long long) after.evictions, (unsigned long long) after.uncached);
+    pzp_cache_close(cache);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-        *width=w;
-        *height=h;
-        if (pixels==0)
+// Ask a pzpd daemon for a frame and write what it hands back.
+static int daemonFetch(const char *socketPath, const char *filename, const char *outputFilename,
+                       unsigned int level, const unsigned int *roi)
+{
+    struct pzp_daemon_frame frame;
+    double start = pzp_seconds();
+    if (!pzp_daemon_fetch(socketPath, filename, level, roi, &frame))
+    {
+        fprintf(stderr, "Failed to fetch %s from %s: %s\n", filename, socketPath, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    double seconds = pzp_seconds() - start;
+
+    // The memfd is read-only and holds native 16-bit samples, PNM wants them big-endian
+    unsigned char *pixels = (unsigned char *) malloc(frame.size);
+    if (pixels == NULL)
+    {
+        pzp_daemon_release(&frame);
+        return EXIT_FAILURE;
+    }
+    if (frame.bitsperpixel == 16)
+    {
+        const unsigned short *samples = (const unsigned short *) frame.pixels;
+        for (size_t i = 0; i < frame.size / 2; i++)
         {
-            pixels= (unsigned char*) malloc(w*h*(*bytesPerPixel)*(*channels)*sizeof(char));
+            pixels[2 * i]     = (unsigned char) (samples[i] >> 8);
+            pixels[2 * i + 1] = (unsigned char) (samples[i] & 0xFF);
         }
+    } else
+    {
+        memcpy(pixels, frame.pixels, frame.size);
+    }
 
-        if ( pixels != 0 )
-        {
-            size_t rd = fread(pixels,*bytesPerPixel*(*channels), w*h, pf);
-            if (rd < w*h )
-            {
-                fprintf(stderr,"Note : Incomplete read while reading file %s (%u instead of %u)\n",filename,(unsigned int) rd, w*h);
-                fprintf(stderr,"Dimensions ( %u x %u ) , Depth %u bytes , Channels %u \n",w,h,*bytesPerPixel,*channels);
-            }
+    fprintf(stderr, "Fetched %s: %ux%ux%u@%ubit in %.3f ms, decode shared by %u requests\n", filename,
+            frame.width, frame.height, frame.channels, frame.bitsperpixel, seconds * 1000.0, frame.shared);
+    int result = WritePNM(outputFilename, pixels, frame.width, frame.height, frame.bitsperpixel * frame.channels, frame.channels);
+    free(pixels);
+    pzp_daemon_release(&frame);
+    return (result) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-            fclose(pf);
+// compress, compress-palette, compress-runs, pack or near, each optionally with
+// "-ycocg", "-sparse", "-rans", "-pyramid" and one of the "-lz4" / "-store" backend suffixes.
+// Returns 0 for anything else.
+static int compressionMode(const char *operation, unsigned int *configuration)
+{
+    static const struct { const char *suffix; unsigned int flag; } suffixes[] =
+        { { "-pyramid", USE_PYRAMID }, { "-rans", USE_RANS }, { "-lz4", USE_LZ4 }, { "-store", USE_STORE }, { "-ycocg", USE_YCOCG },
+          { "-sparse", USE_SPARSE } };
+    char baseOperation[64];
+    size_t operationLength = strlen(operation);
+    *configuration = 0;
+    if (operationLength >= sizeof(baseOperation)) { return 0; }
+    memcpy(baseOperation, operation, operationLength + 1);
 
-#if PRINT_COMMENTS
-            if ( (*channels==1) && (*bytesPerPixel==2) && (timestamp!=0) )
-            {
-                printf("DEPTH %lu\n",*timestamp);
-            }
-            else if ( (*channels==3) && (*bytesPerPixel==1) && (timestamp!=0) )
+    unsigned int stripped = 1;
+    while (stripped)
+    {
+        stripped = 0;
+        for (unsigned int i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+        {
+            size_t suffixLength = strlen(suffixes[i].suffix);
+            if ( (operationLength > suffixLength) && (!(*configuration & suffixes[i].flag)) &&
+                 (strcmp(baseOperation + operationLength - suffixLength, suffixes[i].suffix) == 0) )
             {
-                printf("COLOR %lu\n",*timestamp);
+                operationLength -= suffixLength;
+                baseOperation[operationLength] = 0;
+                *configuration |= suffixes[i].flag;
+                stripped = 1;
             }
-#endif
+        }
+    }
+    if ( (*configuration & PZP_BACKEND_FLAGS) == PZP_BACKEND_FLAGS ) { return 0; }
+    operation = baseOperation;
+    if (strcmp(operation, "compress") == 0)         { *configuration |= USE_COMPRESSION | USE_RLE; } else
+    if (strcmp(operation, "compress-palette") == 0) { *configuration |= USE_COMPRESSION | USE_RLE | USE_PALETTE; } else
+    if (strcmp(operation, "compress-runs") == 0)    { *configuration |= USE_COMPRESSION | USE_RUNS; } else
+    if (strcmp(operation, "pack") == 0)             { *configuration |= USE_COMPRESSION; } else
+    if (strcmp(operation, "near") == 0)             { *configuration |= USE_COMPRESSION | USE_NEAR_LOSSLESS; } else
+                                                    { *configuration = 0; return 0; }
+    return 1;
+}
+
+// Store several PNM images (e.g. the colour and depth of one RGB-D capture) as the
+// layers of one file.  arguments are <mode> <input> pairs, near needs <max_error> too.
+static int compressLayers(const char *output_filename, char **arguments, unsigned int argumentCount)
+{
+    struct pzp_layer layers[PZP_MAX_LAYERS];
+    struct PNMInput  inputs[PZP_MAX_LAYERS]; // own the pixels of layers[]
+    unsigned int count = 0;
+    int result = EXIT_FAILURE;
+    memset(layers, 0, sizeof(layers));
 
-            return pixels;
+    unsigned int a = 0;
+    while (a < argumentCount)
+    {
+        struct pzp_layer *layer = &layers[count];
+        if ( (count == PZP_MAX_LAYERS) || (!compressionMode(arguments[a], &layer->configuration)) )
+        {
+            fprintf(stderr, "Expected a compression mode for layer %u, got %s\n", count, arguments[a]);
+            goto cleanup;
         }
-        else
+        if (layer->configuration & USE_NEAR_LOSSLESS)
         {
-            fprintf(stderr,"Could not Allocate enough memory for file %s \n",filename);
+            if (++a == argumentCount) { break; }
+            layer->maxError = (unsigned int) atoi(arguments[a]);
         }
-        fclose(pf);
+        if (++a == argumentCount) { break; }
+
+        // The encoder only reads the pixels, so a mapped file is used where it lies
+        if (!OpenPNMInput(&inputs[count], arguments[a]))
+        {
+            fprintf(stderr, "File %s does not exist \n", arguments[a]);
+            goto cleanup;
+        }
+        struct PNMHeader header;
+        layer->pixels = (unsigned char *) NextPNMFrame(&inputs[count], &header);
+        if (layer->pixels == NULL) { ClosePNMInput(&inputs[count]); goto cleanup; }
+        layer->width        = header.width;
+        layer->height       = header.height;
+        layer->channels     = header.channels;
+        layer->bitsperpixel = header.bytesPerPixel * 8;
+
+        fprintf(stderr, "Layer %u: %s %ux%ux%u@%ubit mode %u\n", count, arguments[a],
+                layer->width, layer->height, layer->channels, layer->bitsperpixel, layer->configuration);
+        count++;
+        a++;
     }
-    else
+    if ( (a != argumentCount) || (count == 0) )
     {
-        fprintf(stderr,"File %s does not exist \n",filename);
+        fprintf(stderr, "Every layer needs a mode and an input file\n");
+        goto cleanup;
     }
-    return buffer;
+
+    if (pzp_compress_layers(layers, count, output_filename)) { result = EXIT_SUCCESS; }
+
+cleanup:
+    for (unsigned int l = 0; l < count; l++) { ClosePNMInput(&inputs[l]); }
+    return result;
 }
 
-static int WritePNM(const char * filename, unsigned char * pixels, unsigned int width, unsigned int height, unsigned int bitsperpixel, unsigned int channels)
+// ─── File lists ──────────────────────────────────────────────────────────────
+// A growing list of file names, owned by the list
+struct FileList
 {
-    if ((width == 0) || (height == 0) || (channels == 0) || (bitsperpixel == 0))
+    char       **names;
+    unsigned int count, capacity;
+};
+
+static int fileListAdd(struct FileList *list, char *name)
+{
+    if (list->count == list->capacity)
     {
-        fprintf(stderr, "saveRawImageToFile(%s) called with zero dimensions ( %ux%u %u channels %u bpp\n", filename, width, height, channels, bitsperpixel);
-        return 0;
+        unsigned int capacity = (list->capacity > 0) ? list->capacity * 2 : 256;
+        char **names = (char **) realloc(list->names, capacity * sizeof(char *));
+        if (names == NULL) { return 0; }
+        list->names    = names;
+        list->capacity = capacity;
     }
-    if (pixels == 0)
+    list->names[list->count++] = name;
+    return 1;
+}
+
+static void fileListFree(struct FileList *list)
+{
+    for (unsigned int f = 0; f < list->count; f++) { free(list->names[f]); }
+    free(list->names);
+    memset(list, 0, sizeof(*list));
+}
+
+// Collect the files below directory (recursively) whose names match into list
+static void collectFiles(const char *directory, int (*matches)(const char *name), struct FileList *list)
+{
+    DIR *dir = opendir(directory);
+    if (dir == NULL) { return; }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
     {
-        fprintf(stderr, "saveRawImageToFile(%s) called for an unallocated (empty) frame, will not write any file output\n", filename);
-        return 0;
+        if (entry->d_name[0] == '.') { continue; }
+        size_t length = strlen(directory) + strlen(entry->d_name) + 2;
+        char *path = (char *) malloc(length);
+        if (path == NULL) { break; }
+        snprintf(path, length, "%s/%s", directory, entry->d_name);
+
+        struct stat st;
+        if (stat(path, &st) != 0) { free(path); continue; }
+        if (S_ISDIR(st.st_mode))
+        {
+            collectFiles(path, matches, list);
+            free(path);
+        }
+        else if ( (!S_ISREG(st.st_mode)) || (!matches(entry->d_name)) || (!fileListAdd(list, path)) ) { free(path); }
     }
-    if (bitsperpixel / channels > 16)
+    closedir(dir);
+}
+
+// ─── analyze: measure every mode / backend / level on a sample of a dataset ──
+#define ANALYZE_DEFAULT_IMAGES 16
+
+// The grid analyze explores: every filter mode crossed with every entropy stage
+static const char * const analyzeModes[] = { "pack", "compress", "compress-ycocg", "compress-sparse", "compress-palette", "compress-runs" };
+static const struct { const char *suffix, *backend; int level; } analyzeBackends[] =
+{
+    { "",       "zstd",  1 }, { "",      "zstd",  3 }, { "",       "zstd",  9 }, { "", "zstd", 19 },
+    { "-lz4",   "lz4",   1 }, { "-lz4",  "lz4",   9 },
+    { "-rans",  "rans",  0 },
+    { "-store", "store", 0 },
+};
+#define ANALYZE_CONFIGS ( sizeof(analyzeModes) / sizeof(analyzeModes[0]) * sizeof(analyzeBackends) / sizeof(analyzeBackends[0]) )
+
+struct AnalyzeImage
+{
+    struct PNMInput      input;  // keeps the pixels mapped
+    struct PNMHeader     header;
+    const unsigned char *pixels; // interleaved, as in the file
+    size_t               size;
+};
+
+struct AnalyzeResult
+{
+    size_t       compressedBytes;
+    double       encodeSeconds, decodeSeconds; // CPU time of the coding thread
+    unsigned int storedConfiguration;          // the flags the encoder kept
+    int          ok;                           // decoded back to the same pixels
+};
+
+struct AnalyzeRun
+{
+    struct AnalyzeImage  *images;
+    unsigned int          imageCount;
+    unsigned int          configurations[ANALYZE_CONFIGS];
+    struct AnalyzeResult *results;       // imageCount x ANALYZE_CONFIGS
+    unsigned int          next;          // next job, taken atomically
+};
+
+static double analyzeThreadSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static int analyzeHasPNMExtension(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    return (dot != NULL) && ( (strcasecmp(dot, ".pnm") == 0) || (strcasecmp(dot, ".ppm") == 0) ||
+                              (strcasecmp(dot, ".pgm") == 0) || (strcasecmp(dot, ".pam") == 0) );
+}
+
+static int analyzeCompareNames(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+// Encode and decode one image with one configuration, timing both
+static void analyzeJob(const struct AnalyzeImage *image, unsigned int configuration, int level, struct AnalyzeResult *result)
+{
+    const struct PNMHeader *header = &image->header;
+    unsigned int bitsperpixel         = header->bytesPerPixel * 8;
+    unsigned int channelsInternal     = header->channels * header->bytesPerPixel; // 16-bit samples are two 8-bit planes
+    size_t       planeSize            = (size_t) header->width * header->height;
+
+    unsigned char  *planes  = (unsigned char *)  pzp_alloc(planeSize * channelsInternal);
+    unsigned char **buffers = (unsigned char **) pzp_alloc(channelsInternal * sizeof(unsigned char *));
+    if ( (planes == NULL) || (buffers == NULL) ) { pzp_dealloc(planes); pzp_dealloc(buffers); return; }
+    for (unsigned int ch = 0; ch < channelsInternal; ch++) { buffers[ch] = planes + ch * planeSize; }
+
+    struct pzp_sink sink;
+    pzp_sink_memory(&sink);
+    double start = analyzeThreadSeconds();
+    pzp_split_channels(image->pixels, buffers, channelsInternal, header->width, header->height);
+    pzp_compress_to_sink_level(buffers, header->width, header->height, bitsperpixel, header->channels,
+                               8, channelsInternal, configuration, 0, level, &sink);
+    double encoded = analyzeThreadSeconds();
+
+    unsigned int width = 0, height = 0, bppExternal = 0, channelsExternal = 0, bppInternal = 0, channelsOut = 0, storedConfiguration = 0;
+    unsigned char *decoded = pzp_decompress_combined_from_memory(sink.data, sink.size, &width, &height,
+                                                                 &bppExternal, &channelsExternal,
+                                                                 &bppInternal, &channelsOut, &storedConfiguration);
+    double decodedAt = analyzeThreadSeconds();
+
+    result->compressedBytes     = sink.size;
+    result->storedConfiguration = storedConfiguration;
+    result->encodeSeconds   = encoded - start;
+    result->decodeSeconds   = decodedAt - encoded;
+    result->ok = (decoded != NULL) && (width == header->width) && (height == header->height) &&
+                 (memcmp(decoded, image->pixels, image->size) == 0);
+
+    pzp_dealloc(decoded);
+    pzp_sink_release(&sink);
+    pzp_dealloc(buffers);
+    pzp_dealloc(planes);
+}
+
+static void * analyzeWorker(void *argument)
+{
+    struct AnalyzeRun *run = (struct AnalyzeRun *) argument;
+    unsigned int total = run->imageCount * (unsigned int) ANALYZE_CONFIGS;
+    unsigned int backends = sizeof(analyzeBackends) / sizeof(analyzeBackends[0]);
+    for (;;)
     {
-        fprintf(stderr, "PNM does not support more than 2 bytes per pixel..!\n");
-        return 0;
+        unsigned int job = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED);
+        if (job >= total) { break; }
+        unsigned int image = job / ANALYZE_CONFIGS, config = job % ANALYZE_CONFIGS;
+        analyzeJob(&run->images[image], run->configurations[config], analyzeBackends[config % backends].level,
+                   &run->results[(size_t) image * ANALYZE_CONFIGS + config]);
     }
+    return NULL;
+}
 
-    FILE *fd = fopen(filename, "wb");
-    if (fd != 0)
+struct AnalyzeScore
+{
+    double ratio, encodeMBs, decodeMBs;
+};
+
+// Sum the results of the images in a class (channels, bits; 0 = any) per configuration,
+// then print the configurations no other one beats on ratio, encode and decode speed
+static void analyzeReport(const struct AnalyzeRun *run, unsigned int channels, unsigned int bits)
+{
+    struct AnalyzeScore score[ANALYZE_CONFIGS];
+    unsigned int images = 0;
+    size_t rawBytes = 0;
+    for (unsigned int i = 0; i < run->imageCount; i++)
     {
-        if (channels == 3)
+        const struct PNMHeader *header = &run->images[i].header;
+        if ( (channels != 0) && ( (header->channels != channels) || (header->bytesPerPixel * 8 != bits) ) ) { continue; }
+        images++;
+        rawBytes += run->images[i].size;
+    }
+    if (images == 0) { return; }
+
+    for (unsigned int c = 0; c < ANALYZE_CONFIGS; c++)
+    {
+        size_t compressed = 0;
+        double encode = 0.0, decode = 0.0;
+        for (unsigned int i = 0; i < run->imageCount; i++)
         {
-            fprintf(fd, "P6\n");
+            const struct PNMHeader *header = &run->images[i].header;
+            if ( (channels != 0) && ( (header->channels != channels) || (header->bytesPerPixel * 8 != bits) ) ) { continue; }
+            const struct AnalyzeResult *result = &run->results[(size_t) i * ANALYZE_CONFIGS + c];
+            compressed += result->compressedBytes;
+            encode     += result->encodeSeconds;
+            decode     += result->decodeSeconds;
         }
-        else if (channels == 1)
+        score[c].ratio     = (compressed > 0)  ? (double) rawBytes / compressed : 0.0;
+        score[c].encodeMBs = (encode > 0.0)    ? rawBytes / encode / 1e6 : 0.0;
+        score[c].decodeMBs = (decode > 0.0)    ? rawBytes / decode / 1e6 : 0.0;
+    }
+
+    if (channels == 0) { printf("\nAll images: %u, %.1f MB\n", images, rawBytes / 1e6); }
+                  else { printf("\n%uch %ubit: %u images, %.1f MB\n", channels, bits, images, rawBytes / 1e6); }
+    printf("  %-18s %-6s %5s %8s %10s %10s\n", "mode", "stage", "level", "ratio", "enc MB/s", "dec MB/s");
+
+    // The encoder drops flags that do not apply (-ycocg on depth, -sparse on colour, ...):
+    // a mode that stored the same frames as an earlier one at the same stage and level
+    // is that mode again and stays out of the front
+    unsigned int backends = sizeof(analyzeBackends) / sizeof(analyzeBackends[0]);
+    int front[ANALYZE_CONFIGS];
+    for (unsigned int c = 0; c < ANALYZE_CONFIGS; c++)
+    {
+        front[c] = 1;
+        for (unsigned int d = c % backends; (d < c) && (front[c]); d += backends)
         {
-            fprintf(fd, "P5\n");
+            unsigned int same = 1;
+            for (unsigned int i = 0; (i < run->imageCount) && (same); i++)
+            {
+                const struct PNMHeader *header = &run->images[i].header;
+                if ( (channels != 0) && ( (header->channels != channels) || (header->bytesPerPixel * 8 != bits) ) ) { continue; }
+                same = (run->results[(size_t) i * ANALYZE_CONFIGS + c].storedConfiguration ==
+                        run->results[(size_t) i * ANALYZE_CONFIGS + d].storedConfiguration);
+            }
+            if (same) { front[c] = 0; }
         }
-        else
+    }
+
+    // Pareto front, listed from the best ratio down
+    for (unsigned int c = 0; c < ANALYZE_CONFIGS; c++)
+    {
+        if (!front[c]) { continue; }
+        for (unsigned int d = 0; (d < ANALYZE_CONFIGS) && (front[c]); d++)
         {
-            fprintf(stderr, "Invalid channels arg (%u) for SaveRawImageToFile\n", channels);
-            fclose(fd);
-            return 1;
+            if ( (front[d]) && (score[d].ratio >= score[c].ratio) && (score[d].encodeMBs >= score[c].encodeMBs) && (score[d].decodeMBs >= score[c].decodeMBs) &&
+                 ( (score[d].ratio > score[c].ratio) || (score[d].encodeMBs > score[c].encodeMBs) || (score[d].decodeMBs > score[c].decodeMBs) ) )
+                { front[c] = 0; }
         }
+    }
+    for (;;)
+    {
+        int best = -1;
+        for (unsigned int c = 0; c < ANALYZE_CONFIGS; c++)
+            if ( (front[c]) && ( (best < 0) || (score[c].ratio > score[best].ratio) ) ) { best = (int) c; }
+        if (best < 0) { break; }
+        front[best] = 0;
 
-        unsigned int bitsperchannelpixel = bitsperpixel / channels;
-        fprintf(fd, "%u %u\n%u\n", width, height, simplePowPPM(2,bitsperchannelpixel) - 1);
+        char level[16] = "-";
+        if (analyzeBackends[best % backends].level > 0) { snprintf(level, sizeof(level), "%d", analyzeBackends[best % backends].level); }
+        printf("  %-18s %-6s %5s %8.3f %10.1f %10.1f\n", analyzeModes[best / backends], analyzeBackends[best % backends].backend,
+               level, score[best].ratio, score[best].encodeMBs, score[best].decodeMBs);
+    }
+}
 
-        unsigned int n = width * height * channels * (bitsperchannelpixel / 8);
+// Encode a sample of the PNM / PAM images below a directory with every mode, entropy
+// stage and level, on threads threads, and print the Pareto-optimal configurations
+// overall and per image class (channels and bit depth)
+static int analyzeDataset(const char *directory, unsigned int maxImages, unsigned int threads)
+{
+    struct FileList list;
+    memset(&list, 0, sizeof(list));
+    collectFiles(directory, analyzeHasPNMExtension, &list);
+    char       **files     = list.names;
+    unsigned int fileCount = list.count;
+    if (fileCount == 0)
+    {
+        fprintf(stderr, "No .pnm / .ppm / .pgm / .pam files below %s\n", directory);
+        fileListFree(&list);
+        return EXIT_FAILURE;
+    }
+    qsort(files, fileCount, sizeof(char *), analyzeCompareNames);
 
-        fwrite(pixels, 1, n, fd);
-        fflush(fd);
-        fclose(fd);
-        return 1;
+    // An evenly spaced sample of the sorted files
+    struct AnalyzeRun run;
+    memset(&run, 0, sizeof(run));
+    unsigned int sampled = (fileCount < maxImages) ? fileCount : maxImages;
+    run.images  = (struct AnalyzeImage *) calloc(sampled, sizeof(struct AnalyzeImage));
+    run.results = (struct AnalyzeResult *) calloc((size_t) sampled * ANALYZE_CONFIGS, sizeof(struct AnalyzeResult));
+    if ( (run.images == NULL) || (run.results == NULL) ) { fail("Memory allocation failed"); }
+    for (unsigned int s = 0; s < sampled; s++)
+    {
+        const char *filename = files[(size_t) s * fileCount / sampled];
+        struct AnalyzeImage *image = &run.images[run.imageCount];
+        if (!OpenPNMInput(&image->input, filename)) { continue; }
+        image->pixels = NextPNMFrame(&image->input, &image->header);
+        if (image->pixels == NULL) { ClosePNMInput(&image->input); continue; }
+        image->size = PNMRasterSize(&image->header);
+        run.imageCount++;
     }
-    else
+
+    int result = EXIT_FAILURE;
+    unsigned int backends = sizeof(analyzeBackends) / sizeof(analyzeBackends[0]);
+    for (unsigned int c = 0; c < ANALYZE_CONFIGS; c++)
     {
-        fprintf(stderr, "SaveRawImageToFile could not open output file %s\n", filename);
-        return 0;
+        char name[64];
+        snprintf(name, sizeof(name), "%s%s", analyzeModes[c / backends], analyzeBackends[c % backends].suffix);
+        compressionMode(name, &run.configurations[c]);
     }
-    return 0;
+
+    if (run.imageCount > 0)
+    {
+        if (threads > run.imageCount * ANALYZE_CONFIGS) { threads = run.imageCount * ANALYZE_CONFIGS; }
+        fprintf(stderr, "Analyzing %u of %u images under %s with %u configurations on %u threads\n",
+                run.imageCount, fileCount, directory, (unsigned int) ANALYZE_CONFIGS, threads);
+
+        // The encoder's report of every choice it makes would drown the table
+        pzp_set_verbose(0);
+
+        double start = pzp_seconds();
+        pthread_t *workers = (pthread_t *) calloc(threads, sizeof(pthread_t));
+        unsigned int started = 0;
+        while ( (workers != NULL) && (started + 1 < threads) &&
+                (pthread_create(&workers[started], NULL, analyzeWorker, &run) == 0) ) { started++; }
+        analyzeWorker(&run);
+        for (unsigned int t = 0; t < started; t++) { pthread_join(workers[t], NULL); }
+        free(workers);
+        double elapsed = pzp_seconds() - start;
+        pzp_set_verbose(1);
+
+        unsigned int failed = 0;
+        for (size_t r = 0; r < (size_t) run.imageCount * ANALYZE_CONFIGS; r++) { failed += (!run.results[r].ok); }
+        if (failed > 0) { fprintf(stderr, RED "%u encodes did not decode back to the original pixels" NORMAL "\n", failed); }
+                   else { result = EXIT_SUCCESS; }
+        fprintf(stderr, "%u encodes and decodes in %.1f sec\n", run.imageCount * (unsigned int) ANALYZE_CONFIGS, elapsed);
+
+        printf("Pareto-optimal configurations (ratio, encode and decode MB/s of thread CPU time)\n");
+        analyzeReport(&run, 0, 0);
+        for (unsigned int i = 0; i < run.imageCount; i++)
+        {
+            // Each class once, at its first image
+            const struct PNMHeader *header = &run.images[i].header;
+            unsigned int seen = 0;
+            for (unsigned int j = 0; j < i; j++)
+                seen |= (run.images[j].header.channels == header->channels) && (run.images[j].header.bytesPerPixel == header->bytesPerPixel);
+            if (!seen) { analyzeReport(&run, header->channels, header->bytesPerPixel * 8); }
+        }
+    }
+
+    for (unsigned int i = 0; i < run.imageCount; i++) { ClosePNMInput(&run.images[i].input); }
+    fileListFree(&list);
+    free(run.images);
+    free(run.results);
+    return result;
 }
 
+// ─── recompress: re-encode .pzp files in place with another mode / level ─────
+// The flags a recompress mode chooses; the rest (delta16, range, bit-packing) the
+// encoder decides from the pixels, and near-lossless is never added after the fact
+#define RECOMPRESS_FLAGS ( USE_COMPRESSION | USE_RLE | USE_PALETTE | USE_RUNS | USE_PYRAMID | USE_RANS | \
+                           USE_LZ4 | USE_STORE | USE_YCOCG | USE_SPARSE )
+
+enum RecompressStatus
+{
+    RECOMPRESS_FAILED = 0,
+    RECOMPRESS_DONE,        // replaced by the new encoding
+    RECOMPRESS_SKIPPED,     // already in the target configuration
+    RECOMPRESS_KEPT,        // same configuration, the new level was not smaller
+    RECOMPRESS_UNSUPPORTED  // layers, several frames or near-lossless, left alone
+};
+
+struct RecompressResult
+{
+    size_t      inputBytes, outputBytes;
+    int         status;
+    const char *reason;     // why a file failed or was left alone
+};
+
+struct RecompressRun
+{
+    char                   **files;
+    unsigned int             fileCount;
+    unsigned int             configuration;
+    int                      level;
+    struct RecompressResult *results;
+    unsigned int             next;    // next file, taken atomically
+};
+
+static int recompressHasPZPExtension(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    return (dot != NULL) && (strcasecmp(dot, ".pzp") == 0);
+}
+
+// A stored configuration in the terms of a requested one: the encoder swaps the delta
+// filter (USE_RLE) for USE_DELTA16 or USE_SPARSE and adds range / bit-packing itself
+static unsigned int recompressStoredMode(unsigned int configuration)
+{
+    if (configuration & (USE_DELTA16 | USE_SPARSE)) { configuration |= USE_RLE; }
+    return configuration & RECOMPRESS_FLAGS;
+}
+
+// The requested configuration after the rules pzp_compress_frame and the pyramid
+// builder apply from the header alone; only USE_SPARSE also depends on the pixels
+static unsigned int recompressTargetMode(unsigned int configuration, const unsigned int header[10])
+{
+    unsigned int bitsperpixel = header[1], channels = header[2], width = header[3], height = header[4];
+    unsigned int channelsInternal = header[6];
+
+    if ( (configuration & USE_PALETTE) && (channelsInternal > 8) ) { configuration &= ~USE_PALETTE; }
+    if (configuration & USE_RUNS) { configuration &= ~USE_RLE; }
+    if ( (configuration & USE_SPARSE) &&
+         ( (!(configuration & USE_RLE)) || (configuration & (USE_PALETTE | USE_RUNS)) ||
+           (bitsperpixel != 16) || (channels != 1) || (channelsInternal != 2) ) )
+        { configuration &= ~USE_SPARSE; }
+    if ( (configuration & USE_YCOCG) &&
+         ( (!(configuration & USE_RLE)) || (configuration & (USE_PALETTE | USE_RUNS)) ||
+           (bitsperpixel != 8) || (channels != 3) || (channelsInternal != 3) ) )
+        { configuration &= ~USE_YCOCG; }
+    if ( (configuration & USE_PYRAMID) &&
+         ( ((width + 1) / 2 < PZP_PYRAMID_MIN_SIDE) || ((height + 1) / 2 < PZP_PYRAMID_MIN_SIDE) ) )
+        { configuration &= ~USE_PYRAMID; }
+    return configuration & RECOMPRESS_FLAGS;
+}
+
+// Replace filename with data through a temporary file in the same directory, so
+// readers see either the old or the new file, never a partial one
+static int recompressReplace(const char *filename, const void *data, size_t size, mode_t mode)
+{
+    size_t length = strlen(filename) + 8;
+    char *temporary = (char *) malloc(length);
+    if (temporary == NULL) { return 0; }
+    snprintf(temporary, length, "%s.XXXXXX", filename);
+
+    int fd = mkstemp(temporary);
+    if (fd < 0) { free(temporary); return 0; }
+
+    const unsigned char *bytes = (const unsigned char *) data;
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t n = write(fd, bytes + written, size - written);
+        if (n > 0) { written += (size_t) n; continue; }
+        if ( (n < 0) && (errno == EINTR) ) { continue; }
+        break;
+    }
+    int ok = (written == size) && (fchmod(fd, mode & 07777) == 0) && (fsync(fd) == 0);
+    ok = (close(fd) == 0) && ok;
+    ok = ok && (rename(temporary, filename) == 0);
+    if (!ok) { unlink(temporary); }
+    free(temporary);
+    return ok;
+}
+
+// Decode frame 0 of one file, encode it with the run's configuration and level, check
+// that it decodes back to the same pixels and swap it in
+static void recompressJob(const struct RecompressRun *run, const char *filename, struct RecompressResult *result)
+{
+    result->status = RECOMPRESS_FAILED;
+    result->reason = "cannot read the file";
+
+    struct stat st;
+    unsigned int header[10];
+    if (lstat(filename, &st) != 0) { return; }
+    result->inputBytes = result->outputBytes = (size_t) st.st_size;
+    if (!S_ISREG(st.st_mode))
+    {
+        result->status = RECOMPRESS_UNSUPPORTED;
+        result->reason = "not a regular file";
+        return;
+    }
+    result->reason = "not a .pzp file";
+    if (!pzp_read_header_words(filename, header)) { return; }
+
+    // PZP0 files are always rewritten, that moves them to the current format revision
+    int isLegacy = (header[0] != convert_header(pzp_header));
+    if (header[8] & (USE_LAYERS | USE_NEAR_LOSSLESS))
+    {
+        result->status = RECOMPRESS_UNSUPPORTED;
+        result->reason = (header[8] & USE_LAYERS) ? "layers" : "near-lossless";
+        return;
+    }
+    if ( (!isLegacy) && (run->level == 0) &&
+         (recompressStoredMode(header[8]) == recompressTargetMode(run->configuration, header)) )
+    {
+        result->status = RECOMPRESS_SKIPPED;
+        return;
+    }
+
+    size_t size = 0;
+    unsigned char *data = (unsigned char *) pzp_read_file_to_memory(filename, &size);
+    if (data == NULL) { result->reason = "cannot read the file"; return; }
+    result->inputBytes = result->outputBytes = size;
+
+    struct pzp_source source;
+    pzp_source_memory(&source, data, size);
+    unsigned int width = 0, height = 0, bitsperpixel = 0, channels = 0, bitsperpixelInternal = 0, channelsInternal = 0, configuration = 0;
+    unsigned char *pixels = pzp_decompress_from_source(&source, &width, &height, &bitsperpixel, &channels,
+                                                       &bitsperpixelInternal, &channelsInternal, &configuration);
+    unsigned char  *planes  = NULL;
+    unsigned char **buffers = NULL;
+    unsigned char  *decoded = NULL;
+    struct pzp_sink sink;
+    pzp_sink_memory(&sink);
+
+    result->reason = "does not decode";
+    if ( (pixels == NULL) || ( (bitsperpixel != 8) && (bitsperpixel != 16) ) ) { goto cleanup; }
+
+    // Whatever follows frame 0 must be its pyramid; streams of frames are left alone
+    if ( (source.input.pos < source.input.size) && (pzp_pyramid_levels_from_memory(data, size) <= 1) )
+    {
+        result->status = RECOMPRESS_UNSUPPORTED;
+        result->reason = "several frames";
+        goto cleanup;
+    }
+
+    channelsInternal = channels * (bitsperpixel / 8); // 16-bit samples are two 8-bit planes
+    size_t planeSize = (size_t) width * height;
+    planes  = (unsigned char *)  pzp_alloc(planeSize * channelsInternal);
+    buffers = (unsigned char **) pzp_alloc(channelsInternal * sizeof(unsigned char *));
+    result->reason = "out of memory";
+    if ( (planes == NULL) || (buffers == NULL) ) { goto cleanup; }
+    for (unsigned int ch = 0; ch < channelsInternal; ch++) { buffers[ch] = planes + ch * planeSize; }
+
+    pzp_split_channels(pixels, buffers, channelsInternal, width, height);
+    result->reason = "could not be encoded";
+    if (!pzp_compress_to_sink_level(buffers, width, height, bitsperpixel, channels,
+                                    8, channelsInternal, run->configuration, 0, run->level, &sink))
+        { goto cleanup; }
+
+    unsigned int newHeader[10];
+    unsigned int checkWidth = 0, checkHeight = 0, checkBits = 0, checkChannels = 0, checkBitsInternal = 0, checkChannelsInternal = 0;
+    decoded = pzp_decompress_combined_from_memory(sink.data, sink.size, &checkWidth, &checkHeight, &checkBits, &checkChannels,
+                                                  &checkBitsInternal, &checkChannelsInternal, &configuration);
+    result->reason = "the new encoding does not decode to the same pixels";
+    if ( (decoded == NULL) || (!pzp_read_header_words_from_memory(sink.data, sink.size, newHeader)) ||
+         (checkWidth != width) || (checkHeight != height) || (checkBits != bitsperpixel) || (checkChannels != channels) ||
+         (memcmp(decoded, pixels, planeSize * channelsInternal) != 0) )
+        { goto cleanup; }
+
+    // The encoder dropped a flag that does not apply (e.g. -sparse without zeros): same file
+    if ( (!isLegacy) && (newHeader[8] == header[8]) && ( (run->level == 0) || (sink.size >= size) ) )
+    {
+        result->status = (run->level == 0) ? RECOMPRESS_SKIPPED : RECOMPRESS_KEPT;
+        goto cleanup;
+    }
+
+    result->reason = "cannot replace the file";
+    if (!recompressReplace(filename, sink.data, sink.size, st.st_mode)) { goto cleanup; }
+    result->status      = RECOMPRESS_DONE;
+    result->outputBytes = sink.size;
+
+cleanup:
+    pzp_sink_release(&sink);
+    pzp_dealloc(decoded);
+    pzp_dealloc(buffers);
+    pzp_dealloc(planes);
+    pzp_dealloc(pixels);
+    pzp_dealloc(data);
+}
+
+static void * recompressWorker(void *argument)
+{
+    struct RecompressRun *run = (struct RecompressRun *) argument;
+    for (;;)
+    {
+        unsigned int job = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED);
+        if (job >= run->fileCount) { break; }
+        recompressJob(run, run->files[job], &run->results[job]);
+    }
+    return NULL;
+}
+
+// Re-encode the .pzp files given (directories are searched recursively) with mode and
+// level (0 = the mode's default) on threads threads, without going through PNM
+static int recompressFiles(const char *mode, int level, unsigned int threads, char **paths, unsigned int pathCount)
+{
+    struct RecompressRun run;
+    memset(&run, 0, sizeof(run));
+    if ( (!compressionMode(mode, &run.configuration)) || (run.configuration & USE_NEAR_LOSSLESS) )
+    {
+        fprintf(stderr, "recompress needs a lossless compression mode, got %s\n", mode);
+        return EXIT_FAILURE;
+    }
+    run.level = level;
+
+    struct FileList list;
+    memset(&list, 0, sizeof(list));
+    for (unsigned int p = 0; p < pathCount; p++)
+    {
+        struct stat st;
+        if ( (stat(paths[p], &st) == 0) && (S_ISDIR(st.st_mode)) ) { collectFiles(paths[p], recompressHasPZPExtension, &list); continue; }
+        char *name = strdup(paths[p]);
+        if ( (name == NULL) || (!fileListAdd(&list, name)) ) { free(name); }
+    }
+    if (list.count == 0)
+    {
+        fprintf(stderr, "No .pzp files to recompress\n");
+        fileListFree(&list);
+        return EXIT_FAILURE;
+    }
+    run.files     = list.names;
+    run.fileCount = list.count;
+    run.results   = (struct RecompressResult *) calloc(run.fileCount, sizeof(struct RecompressResult));
+    if (run.results == NULL) { fail("Memory allocation failed"); }
+
+    if (threads > run.fileCount) { threads = run.fileCount; }
+    fprintf(stderr, "Recompressing %u files to %s (level %d) on %u threads\n", run.fileCount, mode, level, threads);
+
+    // As in analyze, the encoder's reports would drown the summary
+    pzp_set_verbose(0);
+
+    double start = pzp_seconds();
+    pthread_t *workers = (pthread_t *) calloc(threads, sizeof(pthread_t));
+    unsigned int started = 0;
+    while ( (workers != NULL) && (started + 1 < threads) &&
+            (pthread_create(&workers[started], NULL, recompressWorker, &run) == 0) ) { started++; }
+    recompressWorker(&run);
+    for (unsigned int t = 0; t < started; t++) { pthread_join(workers[t], NULL); }
+    free(workers);
+    double elapsed = pzp_seconds() - start;
+    pzp_set_verbose(1);
+
+    unsigned int counts[RECOMPRESS_UNSUPPORTED + 1] = { 0 };
+    size_t inputBytes = 0, outputBytes = 0, readBytes = 0;
+    for (unsigned int f = 0; f < run.fileCount; f++)
+    {
+        const struct RecompressResult *result = &run.results[f];
+        counts[result->status]++;
+        if (result->status == RECOMPRESS_DONE)
+        {
+            inputBytes  += result->inputBytes;
+            outputBytes += result->outputBytes;
+        }
+        if ( (result->status == RECOMPRESS_DONE) || (result->status == RECOMPRESS_KEPT) ) { readBytes += result->inputBytes; }
+        if (result->status == RECOMPRESS_FAILED)      { fprintf(stderr, RED "%s: %s" NORMAL "\n", run.files[f], result->reason); }
+        if (result->status == RECOMPRESS_UNSUPPORTED) { fprintf(stderr, YELLOW "%s: %s, left alone" NORMAL "\n", run.files[f], result->reason); }
+    }
+
+    double saved = (double) inputBytes - (double) outputBytes;
+    printf("Recompressed %u of %u files in %.2f sec (%.1f files/s, %.1f MB/s re-encoded)\n",
+           counts[RECOMPRESS_DONE], run.fileCount, elapsed,
+           (elapsed > 0.0) ? run.fileCount / elapsed : 0.0, (elapsed > 0.0) ? readBytes / elapsed / 1e6 : 0.0);
+    printf("  %u already %s, %u not smaller at level %d, %u unsupported, %u failed\n",
+           counts[RECOMPRESS_SKIPPED], mode, counts[RECOMPRESS_KEPT], level, counts[RECOMPRESS_UNSUPPORTED], counts[RECOMPRESS_FAILED]);
+    printf("  %zu -> %zu bytes, saved %.0f bytes (%.2f %%)\n", inputBytes, outputBytes, saved,
+           (inputBytes > 0) ? 100.0 * saved / inputBytes : 0.0);
+
+    free(run.results);
+    fileListFree(&list);
+    return (counts[RECOMPRESS_FAILED] == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
 int main(int argc, char *argv[])
 {
+    // The command line reports the choices the encoder makes
+    pzp_set_verbose(1);
+
+    if ( (argc >= 3) && (strcmp(argv[1], "load") == 0) )
+    {
+        return bulkLoad((const char **) argv + 2, (unsigned int) (argc - 2));
+    }
+
+    if ( (argc >= 3) && (argc <= 5) && (strcmp(argv[1], "analyze") == 0) )
+    {
+        unsigned int images  = (argc > 3) ? (unsigned int) atoi(argv[3]) : ANALYZE_DEFAULT_IMAGES;
+        long         online  = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned int threads = (argc > 4) ? (unsigned int) atoi(argv[4]) : (online > 0) ? (unsigned int) online : 1;
+        return analyzeDataset(argv[2], (images > 0) ? images : 1, (threads > 0) ? threads : 1);
+    }
+
+    if ( (argc >= 6) && (strcmp(argv[1], "recompress") == 0) )
+    {
+        long         online  = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned int threads = (unsigned int) atoi(argv[4]);
+        if (threads == 0) { threads = (online > 0) ? (unsigned int) online : 1; }
+        return recompressFiles(argv[2], atoi(argv[3]), threads, argv + 5, (unsigned int) (argc - 5));
+    }
+
+    if ( (argc >= 5) && (strcmp(argv[1], "cache") == 0) )
+    {
+        size_t budget = (size_t) strtoull(argv[3], NULL, 10) * 1024 * 1024;
+        return cacheLoad(argv[2], budget, (const char **) argv + 4, (unsigned int) (argc - 4));
+    }
+
+    if ( ( (argc == 5) || (argc == 6) || (argc == 10) ) && (strcmp(argv[1], "fetch") == 0) )
+    {
+        unsigned int level = (argc > 5) ? (unsigned int) atoi(argv[5]) : 0;
+        unsigned int roi[4] = { 0, 0, 0, 0 };
+        for (int i = 0; (argc == 10) && (i < 4); i++) { roi[i] = (unsigned int) atoi(argv[6 + i]); }
+        return daemonFetch(argv[2], argv[3], argv[4], level, (argc == 10) ? roi : NULL);
+    }
+
+    if ( (argc == 3) && (strcmp(argv[1], "cache-drop") == 0) )
+    {
+        return pzp_cache_unlink(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if ( (argc == 5) && (strcmp(argv[1], "level") == 0) )
+    {
+        // Decode one pyramid level (0 = full size) of a file written with a *-pyramid mode
+        unsigned int level = (unsigned int) atoi(argv[2]);
+        unsigned int width = 0, height = 0, bitsperpixelExternal = 0, channelsExternal = 0;
+        unsigned int bitsperpixelInternal = 0, channelsInternal = 0, configuration = 0;
+
+        unsigned char *reconstructed = pzp_decompress_level(argv[3], level, &width, &height,
+                                                            &bitsperpixelExternal, &channelsExternal,
+                                                            &bitsperpixelInternal, &channelsInternal, &configuration);
+        if (reconstructed == NULL) { return EXIT_FAILURE; }
+
+        fprintf(stderr, "Level %u of %s: %ux%ux%u@%ubit\n", level, argv[3], width, height, channelsExternal, bitsperpixelExternal);
+        WritePNM(argv[4], reconstructed, width, height, bitsperpixelExternal * channelsExternal, channelsExternal);
+        pzp_dealloc(reconstructed);
+        return EXIT_SUCCESS;
+    }
+
+    if ( (argc >= 5) && (strcmp(argv[1], "layers") == 0) )
+    {
+        return compressLayers(argv[2], argv + 3, (unsigned int) (argc - 3));
+    }
+
+    if ( (argc == 5) && (strcmp(argv[1], "layer") == 0) )
+    {
+        // Decode one layer of a file written with "layers", reading only its bytes
+        unsigned int index = (unsigned int) atoi(argv[2]);
+        struct pzp_layer layer;
+        if (!pzp_decompress_layer(argv[3], index, &layer)) { return EXIT_FAILURE; }
+
+        fprintf(stderr, "Layer %u/%u of %s: %ux%ux%u@%ubit\n", index, pzp_layers(argv[3]), argv[3],
+                layer.width, layer.height, layer.channels, layer.bitsperpixel);
+        WritePNM(argv[4], layer.pixels, layer.width, layer.height, layer.bitsperpixel * layer.channels, layer.channels);
+        pzp_dealloc(layer.pixels);
+        return EXIT_SUCCESS;
+    }
+
+    // near[-pyramid] <max_error> <input> <output>: drop the bound, the rest is a normal compression mode
+    unsigned int maxError = 0;
+    if ( (argc == 5) && (strncmp(argv[1], "near", 4) == 0) )
+    {
+        maxError = (unsigned int) atoi(argv[2]);
+        argv[2]  = argv[1];
+        argv++;
+        argc--;
+    }
+
     if (argc != 4)
     {
-        fprintf(stderr, "Usage: %s <compress|compress-palette|decompress> <input_file> <output_file>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <compress|compress-palette|compress-runs|pack|decompress> <input_file> <output_file>\n", argv[0]);
+        fprintf(stderr, "       (\"-\" as input / output file is stdin / stdout, stdin may carry several frames)\n");
+        fprintf(stderr, "       %s <compress|compress-palette|compress-runs|pack>-pyramid <input_file> <output_file>\n", argv[0]);
+        fprintf(stderr, "       %s <compress|compress-palette|compress-runs|pack>-rans <input_file> <output_file>   (rANS coded pixel data)\n", argv[0]);
+        fprintf(stderr, "       %s <compress|compress-palette|compress-runs|pack>-<lz4|store> <input_file> <output_file>   (LZ4 or no entropy stage instead of zstd)\n", argv[0]);
+        fprintf(stderr, "       %s compress-ycocg <input_rgb8.ppm> <output_file>   (YCoCg-R colour transform before the delta filter)\n", argv[0]);
+        fprintf(stderr, "       %s compress-sparse <input_depth16.pgm> <output_file>   (zero samples as a validity mask, the rest delta coded)\n", argv[0]);
+        fprintf(stderr, "       %s near <max_error> <input_16bit.pnm> <output_file>   (near-pyramid works too)\n", argv[0]);
+        fprintf(stderr, "       %s level <level> <file.pzp> <output_file>\n", argv[0]);
+        fprintf(stderr, "       %s layers <output_file> <mode> <input_file> [<mode> <input_file> ...]   (near <max_error> <input>)\n", argv[0]);
+        fprintf(stderr, "       %s layer <layer> <file.pzp> <output_file>\n", argv[0]);
+        fprintf(stderr, "       %s load <file.pzp> [file.pzp ...]\n", argv[0]);
+        fprintf(stderr, "       %s analyze <directory> [images] [threads]   (Pareto front of modes / backends / levels)\n", argv[0]);
+        fprintf(stderr, "       %s recompress <mode> <level> <threads> <file.pzp|directory> [...]   (re-encode in place, 0 = default level / all cores)\n", argv[0]);
+        fprintf(stderr, "       %s fetch <socket> <file.pzp> <output_file> [level] [x y width height]   (decoded by a running pzpd)\n", argv[0]);
+        fprintf(stderr, "       %s cache </segment> <budget_MB> <file.pzp> [file.pzp ...]   |   %s cache-drop </segment>\n", argv[0], argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -251,72 +1433,167 @@ int main(int argc, char *argv[])
     const char * input_commandline_parameter  = argv[2];
     const char * output_commandline_parameter = argv[3];
 
+    // Any compression mode followed by "-pyramid" also stores the resolution pyramid,
+    // "-rans" codes the pixel data with rANS in a stored frame instead of zstd,
+    // "-ycocg" decorrelates the colours of 8-bit RGB images before the delta filter,
+    // "-sparse" moves the zero (invalid) samples of 16-bit depth to a validity mask,
+    // "-lz4" / "-store" code the frame with LZ4 or store it instead of using zstd
     unsigned int configuration = 0;
-    int performCompression     = 0;
-    if (strcmp(operation, "compress") == 0)         { performCompression=1; configuration = USE_COMPRESSION | USE_RLE; } else
-    if (strcmp(operation, "compress-palette") == 0) { performCompression=1; configuration = USE_COMPRESSION | USE_RLE | USE_PALETTE; } else
-    if (strcmp(operation, "pack") == 0)             { performCompression=1; configuration = USE_COMPRESSION; }
+    int performCompression     = compressionMode(operation, &configuration);
+
+    // "-" reads from stdin / writes to stdout; stdin may carry several frames back to back
+    int fromStdin = (strcmp(input_commandline_parameter, "-") == 0);
+    int toStdout  = (strcmp(output_commandline_parameter, "-") == 0);
+    if ( (configuration & USE_PYRAMID) && (fromStdin || toStdout) )
+    {
+        fprintf(stderr, "Pyramid levels are indexed from the end of a file, use file names with %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
 
     if (performCompression)
     {
-        fprintf(stderr, "Opening %s:", input_commandline_parameter);
+        // Regular files are mapped and split straight from the mapping, stdin is read frame by frame
+        struct PNMInput input;
+        if (!OpenPNMInput(&input, input_commandline_parameter))
+        {
+            fprintf(stderr,"File %s does not exist \n",input_commandline_parameter);
+            return EXIT_FAILURE;
+        }
+        FILE *output = 0;
+        struct pzp_sink sink;
+        unsigned int frames = 0;
 
-        unsigned char *image = NULL;
-        unsigned int width = 0, height = 0, bytesPerPixel = 0, channels = 0, bitsperpixelInternal = 0, channelsInternal=0;
-        unsigned long timestamp = 0;
+        do
+        {
+            fprintf(stderr, "Opening %s:", input_commandline_parameter);
 
-        image = ReadPNM(0, input_commandline_parameter, &width, &height, &timestamp, &bytesPerPixel, &channels);
-        unsigned int bitsperpixel = bytesPerPixel * 8;
-        fprintf(stderr, "%ux%ux%u@%ubit mode %u \n", width, height, channels, bitsperpixel,configuration);
+            struct PNMHeader header;
+            const unsigned char *image = NextPNMFrame(&input, &header);
+            unsigned int width = header.width, height = header.height, channels = header.channels;
+            unsigned int bitsperpixel = header.bytesPerPixel * 8, bitsperpixelInternal = 0, channelsInternal = 0;
+            fprintf(stderr, "%ux%ux%u@%ubit mode %u \n", width, height, channels, bitsperpixel,configuration);
 
-        bitsperpixelInternal = bitsperpixel;
-        channelsInternal     = channels;
+            bitsperpixelInternal = bitsperpixel;
+            channelsInternal     = channels;
 
-        if (bitsperpixel==16)
-        {
-            //having one channel of 16bit is the same as having 2 channels of 8 bit
-            bitsperpixelInternal = 8;
-            channelsInternal*=2;
-        }
+            if (bitsperpixel==16)
+            {
+                //having one channel of 16bit is the same as having 2 channels of 8 bit
+                bitsperpixelInternal = 8;
+                channelsInternal*=2;
+            }
 
-        if (image!=NULL)
-        {
-         unsigned char **buffers = malloc(channelsInternal * sizeof(unsigned char *));
+            if ( (image!=NULL) && (output==0) )
+            {
+                output = OpenStream(output_commandline_parameter, "wb");
+                if (output == 0) { fail("File error"); }
+                pzp_sink_file(&sink, output);
+            }
 
-         if (buffers!=NULL)
-         {
-           // Fix: check each per-channel allocation; clean up and bail on failure
-           for (unsigned int ch = 0; ch < channelsInternal; ch++)
-           {
-             buffers[ch] = malloc(width * height * sizeof(unsigned char));
-             if (buffers[ch] == NULL)
+            if (image!=NULL)
+            {
+             unsigned char **buffers = pzp_alloc(channelsInternal * sizeof(unsigned char *));
+
+             if (buffers!=NULL)
              {
-                 fprintf(stderr, "Failed to allocate channel buffer %u\n", ch);
-                 for (unsigned int j = 0; j < ch; j++) { free(buffers[j]); }
-                 free(buffers);
-                 free(image);
+               // Fix: check each per-channel allocation; clean up and bail on failure
+               for (unsigned int ch = 0; ch < channelsInternal; ch++)
+               {
+                 buffers[ch] = pzp_alloc((size_t) width * height * sizeof(unsigned char));
+                 if (buffers[ch] == NULL)
+                 {
+                     fprintf(stderr, "Failed to allocate channel buffer %u\n", ch);
+                     for (unsigned int j = 0; j < ch; j++) { pzp_dealloc(buffers[j]); }
+                     pzp_dealloc(buffers);
+                     ClosePNMInput(&input);
+                     return EXIT_FAILURE;
+                 }
+               }
+
+               pzp_split_channels(image, buffers, channelsInternal, width, height);
+
+               // RLE filter and palette encoding are now handled inside pzp_compress_to_sink
+               // in the correct order: palette first, then delta filter.
+               int encoded = pzp_compress_to_sink(buffers, width,height, bitsperpixel,channels, bitsperpixelInternal, channelsInternal, configuration, maxError, &sink);
+               fflush(output); // hand every frame to the next pipeline stage right away
+
+               //Deallocate intermediate buffers..
+               // Fix: use channelsInternal (not channels) — for 16-bit images these differ
+               for (unsigned int ch = 0; ch < channelsInternal; ch++)
+               {
+                 pzp_dealloc(buffers[ch]);
+               }
+               pzp_dealloc(buffers);
+
+               if (!encoded)
+               {
+                 fprintf(stderr, "Could not write %s\n", output_commandline_parameter);
+                 ClosePNMInput(&input);
+                 CloseStream(output);
                  return EXIT_FAILURE;
+               }
              }
-           }
+             frames++;
+            }//If we have an image
+            else
+            {
+              ClosePNMInput(&input);
+              if (output!=0) { CloseStream(output); }
+              return EXIT_FAILURE;
+            }
 
-           pzp_split_channels(image, buffers, channelsInternal, width, height);
+            // Stop at the end of stdin (or after the one frame of a named file)
+            if ( (!fromStdin) || (PNMInputAtEnd(&input)) ) { break; }
+        } while (1);
 
-           // RLE filter and palette encoding are now handled inside pzp_compress_combined
-           // in the correct order: palette first, then delta filter.
-           pzp_compress_combined(buffers, width,height, bitsperpixel,channels, bitsperpixelInternal, channelsInternal, configuration, output_commandline_parameter);
+        if (frames > 1) { fprintf(stderr, "Compressed %u frames\n", frames); }
+        ClosePNMInput(&input);
+        CloseStream(output);
+    }
+    else
+    if ( ( (strcmp(operation, "decompress") == 0) || (strcmp(operation, "uncompress") == 0) ) && (fromStdin) )
+    {
+        // Decode frames while they stream in, writing each band of rows of the PNM
+        // as soon as it is reconstructed
+        struct pzp_source source;
+        pzp_source_fd(&source, 0);
+        FILE *output = OpenStream(output_commandline_parameter, "wb");
+        if (output == 0)
+        {
+            fprintf(stderr, "SaveRawImageToFile could not open output file %s\n", output_commandline_parameter);
+            return EXIT_FAILURE;
+        }
 
-           //Deallocate intermediate buffers..
-           // Fix: use channelsInternal (not channels) — for 16-bit images these differ
-           for (unsigned int ch = 0; ch < channelsInternal; ch++)
-           {
-             free(buffers[ch]);
-           }
-           free(buffers);
-         }
-         // Fix: free image regardless of whether buffers allocation succeeded
-         free(image);
-        }//If we have an image
-        else{ return EXIT_FAILURE; }
+        struct PNMBandWriter writer = { output, output_commandline_parameter, 0 };
+        struct pzp_bands bands = { WritePNMBand, &writer, 0 };
+
+        unsigned int frames = 0;
+        int result = EXIT_SUCCESS;
+        while (!pzp_source_at_end(&source))
+        {
+            unsigned int width = 0, height = 0;
+            unsigned int bitsperpixelExternal = 0, channelsExternal = 3;
+            unsigned int bitsperpixelInternal = 24, channelsInternal = 3;
+            unsigned int configuration = 0;
+
+            unsigned char *reconstructed = pzp_decompress_from_source_bands(&source, &bands, &width, &height,
+                                                                            &bitsperpixelExternal, &channelsExternal,
+                                                                            &bitsperpixelInternal, &channelsInternal, &configuration);
+            if (reconstructed == NULL)
+            {
+                fprintf(stderr, "Failed to decode frame %u from stdin\n", frames);
+                result = EXIT_FAILURE;
+                break;
+            }
+            fflush(output);
+            pzp_dealloc(reconstructed);
+            frames++;
+        }
+
+        if (frames > 1) { fprintf(stderr, "Decompressed %u frames\n", frames); }
+        pzp_source_close(&source);
+        CloseStream(output);
+        return result;
     }
     else
     if ( (strcmp(operation, "decompress") == 0) || (strcmp(operation, "uncompress") == 0) )
@@ -336,7 +1613,7 @@ int main(int argc, char *argv[])
          {
           bitsperpixelExternal *= channelsExternal; //This is needed because of what writePNM expects..
           WritePNM(output_commandline_parameter, reconstructed, width, height, bitsperpixelExternal, channelsExternal);
-          free(reconstructed);
+          pzp_dealloc(reconstructed);
          }
 
     }
@@ -28,10 +28,24 @@ extern "C"
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 #include <zstd.h>
 //sudo apt install libzstd-dev
 
+#ifndef PZP_LZ4
+#define PZP_LZ4 1   // 0 builds without liblz4, USE_LZ4 frames are then rejected
+#endif
+#if PZP_LZ4
+#include <lz4frame.h>
+//sudo apt install liblz4-dev
+#endif
+
 #if INTEL_OPTIMIZATIONS
 #include <immintrin.h>  // AVX intrinsics
 #include <emmintrin.h>  // SSE2
@@ -39,13 +53,70 @@ extern "C"
 //#warning "Intel Optimizations Enabled"
 #endif // INTEL_OPTIMIZATIONS
 
-#define PZP_VERBOSE 0
+#ifndef PZP_VERBOSE
+#define PZP_VERBOSE 0 // 1 also traces every decoded header and stored frame
+#endif
+
+/* The encoder reports the choices it makes (palette, delta, range, rANS, pyramid
+   levels, ...) on stderr only when asked to, see pzp_set_verbose.  Warnings and
+   errors are printed regardless. */
+static int pzp_verbose = PZP_VERBOSE;
+#define PZP_REPORT(...) do { if (pzp_verbose) { fprintf(stderr, __VA_ARGS__); } } while (0)
+
+static void pzp_set_verbose(int verbose)
+{
+    pzp_verbose = verbose;
+}
 
-static const char pzp_version[]="v0.01";
-static const char pzp_header[4]={"PZP0"};
+static const char pzp_version[]="v0.02";
+static const char pzp_header[4]={'P','Z','P','1'};
+static const char pzp_header_v0[4]={'P','Z','P','0'}; // legacy 32-bit size revision, still decoded
 
 static const int headerSize =  sizeof(unsigned int) * 10;
-//header, width, height, bitsperpixel, channels, internalbitsperpixel, internalchannels, checksum, compression_mode, unused
+//header, width, height, bitsperpixel, channels, internalbitsperpixel, internalchannels, checksum (PZP0) / near-lossless max error (PZP1), compression_mode, palette_bytes
+
+// PZP1 files start with a uint32 backend ID (PZP0 readers reject it as an invalid
+// size: a PZP0 size is never below headerSize) followed by the uint64 uncompressed
+// payload size, and carry the checksum as a uint32 trailer after the pixel data
+// instead of in the header.  The ID says which backend coded the payload behind
+// the prefix, 0 (zstd) for every file written before there was a choice.
+static const int prefixSizeV0 = sizeof(unsigned int);
+static const int prefixSizeV1 = sizeof(unsigned int) + sizeof(unsigned long long);
+static const int trailerSize  = sizeof(unsigned int);
+
+// USE_PYRAMID files append one complete PZP1 stream (prefix + zstd frame) per
+// coarser level behind the main frame, then an index at the very end of the file:
+//   uint64 offset, uint64 size   × levels   (level 1 first)
+//   uint32 levels, "PZPL"
+// Readers that ignore the flag never look past the main frame.
+static const char pzp_pyramid_magic[4]={'P','Z','P','L'};
+#define PZP_PYRAMID_MAX_LEVELS 8
+#define PZP_PYRAMID_MIN_SIDE   16  // no level is made smaller than this on either side
+#define PZP_PYRAMID_FOOTER_MAX (PZP_PYRAMID_MAX_LEVELS * 2 * sizeof(unsigned long long) + 2 * sizeof(unsigned int))
+
+// Multi-layer frames (e.g. RGB8 colour + 16-bit depth of one instant) store each
+// layer as a complete PZP1 stream with its own bit depth, channel count, flags
+// and palette, including its pyramid levels and index when it has USE_PYRAMID.
+// The layers follow each other and an index closes the file:
+//   uint64 offset, uint64 size   × layers   (layer 0 first, at offset 0)
+//   uint32 layers, "PZPM"
+// so every layer can be read and decoded on its own, and readers that ignore the
+// index decode layer 0 as a plain file.
+static const char pzp_layers_magic[4]={'P','Z','P','M'};
+#define PZP_MAX_LAYERS        16
+#define PZP_LAYERS_FOOTER_MAX (PZP_MAX_LAYERS * 2 * sizeof(unsigned long long) + 2 * sizeof(unsigned int))
+
+#if defined(__cplusplus)
+  #define PZP_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+  #define PZP_THREAD_LOCAL __declspec(thread)
+#else
+  #define PZP_THREAD_LOCAL __thread
+#endif
+
+// Encoder/decoder staging granularity: pixel data is streamed through zstd in
+// chunks of this many bytes so memory stays bounded for gigapixel images.
+#define PZP_CHUNK_BYTES (1 << 20)
 
 
 #define NORMAL   "\033[0m"
@@ -60,9 +131,32 @@ typedef enum
     USE_COMPRESSION = 1 << 0,  // 0001
     USE_RLE         = 1 << 1,  // 0010 — delta/prefix-sum filter before zstd
     USE_PALETTE     = 1 << 2,  // 0100 — per-channel palette indexing (best for images with few unique colors)
-    TEST_FLAG2      = 1 << 3   // 1000
+    TEST_FLAG2      = 1 << 3,  // 1000
+    USE_BITPACK     = 1 << 4,  // 10000 — palette indices stored as planar 1/2/4-bit planes (set by the encoder)
+    USE_RUNS        = 1 << 5,  // 100000 — per-row (run, pixel) tokens instead of the delta filter (flat label maps)
+    USE_PYRAMID     = 1 << 6,  // 1000000 — half, quarter, … resolution copies appended after the main frame
+    USE_NEAR_LOSSLESS = 1 << 7,// 10000000 — 16-bit samples within ±header[7] of the original, quantized residuals instead of the delta filter
+    USE_RANGE       = 1 << 8,  // 100000000 — channels rebased to their [min,max] range and bit-packed, constant ones not stored (set by the encoder)
+    USE_LAYERS      = 1 << 9,  // 1000000000 — one layer of a multi-layer frame, the layer index closes the file (set by the encoder)
+    USE_DELTA16     = 1 << 10, // 10000000000 — USE_RLE on 16-bit samples: zigzag coded 16-bit residuals instead of per-byte deltas (set by the encoder)
+    USE_RANS        = 1 << 11, // 100000000000 — stored pixel / index data rANS coded per chunk (order-0 model per channel) instead of zstd, stored (implies USE_STORE)
+    USE_LZ4         = 1 << 12, // 1000000000000 — payload coded with LZ4 instead of zstd (backend 1)
+    USE_STORE       = 1 << 13, // 10000000000000 — payload stored uncompressed (backend 2)
+    USE_YCOCG       = 1 << 14, // 100000000000000 — with USE_RLE on 8-bit RGB: reversible YCoCg-R colour transform before the delta filter
+    USE_SPARSE      = 1 << 15  // 1000000000000000 — with USE_RLE on 16-bit depth: validity mask of the non-zero samples, then only those, delta coded
 } PZPFlags;
 
+// The backend ID of a frame is this 2-bit field of its configuration, 0 = zstd
+typedef enum
+{
+    PZP_BACKEND_ZSTD  = 0,
+    PZP_BACKEND_LZ4   = 1,
+    PZP_BACKEND_STORE = 2,
+    PZP_BACKEND_COUNT
+} PZPBackend;
+#define PZP_BACKEND_SHIFT 12
+#define PZP_BACKEND_FLAGS (USE_LZ4 | USE_STORE)
+
 static unsigned int convert_header(const char header[4])
 {
     return ((unsigned int)header[0] << 24) |
@@ -71,17 +165,170 @@ static unsigned int convert_header(const char header[4])
            ((unsigned int)header[3]);
 }
 
-static void fail(const char * message)
+// ─── Memory ─────────────────────────────────────────────────────────────────
+// Every buffer pzp.h allocates (file contents, zstd staging, planes, decoded
+// images) goes through a struct pzp_allocator.  Encoders use the one of the sink
+// they write to (sink->allocator, which also grows memory sinks), decoders the
+// one of their struct pzp_dctx.  Where that is NULL, or no context is involved
+// (file reads, source read-ahead, the plain decoders), the default applies,
+// which pzp_set_allocator() swaps for an arena or pool.
+// The default returns PZP_ALIGNMENT-aligned blocks; from PZP_HUGE_PAGE_SIZE up
+// they are huge-page aligned and advised for transparent huge pages, so a 4K
+// frame costs a handful of page faults instead of thousands.  Default blocks are
+// plain libc memory and free() still works on them; with any other allocator
+// release what the decoders return with pzp_dealloc().
+
+#define PZP_ALIGNMENT       64                // cache line, and two AVX2 vectors
+#define PZP_HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+#ifndef PZP_HUGE_PAGES
+#define PZP_HUGE_PAGES      1                 // 0 keeps large buffers on regular pages
+#endif
+
+struct pzp_allocator
+{
+    void * (*alloc)(void *user, size_t size);
+    void   (*free)(void *user, void *pointer);
+    void   *user;
+};
+
+static void * pzp_default_alloc(void *user, size_t size)
+{
+    (void) user;
+    void *pointer = NULL;
+   #if PZP_HUGE_PAGES && defined(MADV_HUGEPAGE)
+    if (size >= PZP_HUGE_PAGE_SIZE)
+    {
+        size_t rounded = (size + PZP_HUGE_PAGE_SIZE - 1) & ~((size_t) PZP_HUGE_PAGE_SIZE - 1);
+        if (posix_memalign(&pointer, PZP_HUGE_PAGE_SIZE, rounded) != 0) { return NULL; }
+        madvise(pointer, rounded, MADV_HUGEPAGE); // a hint, failure is harmless
+        return pointer;
+    }
+   #endif
+    if (posix_memalign(&pointer, PZP_ALIGNMENT, (size != 0) ? size : 1) != 0) { return NULL; }
+    return pointer;
+}
+
+static void pzp_default_free(void *user, void *pointer)
 {
-  fprintf(stderr,RED "PZP Fatal Error: %s\n" NORMAL,message);
-  exit(EXIT_FAILURE);
+    (void) user;
+    free(pointer);
 }
 
-static unsigned int hash_checksum(const void *data, size_t dataSize)
+/* Optional allocator taking large blocks from the reserved hugetlbfs pool
+   (MAP_HUGETLB, see /proc/sys/vm/nr_hugepages), falling back to the default
+   allocator when the pool is empty.  Its blocks must go to pzp_dealloc(). */
+static void * pzp_hugetlb_alloc(void *user, size_t size)
+{
+    // A PZP_ALIGNMENT prefix records the mapping size (0 = default allocator)
+    size_t total  = size + PZP_ALIGNMENT;
+    size_t mapped = 0;
+    unsigned char *block = NULL;
+   #if defined(MAP_HUGETLB)
+    if (total >= PZP_HUGE_PAGE_SIZE)
+    {
+        mapped = (total + PZP_HUGE_PAGE_SIZE - 1) & ~((size_t) PZP_HUGE_PAGE_SIZE - 1);
+        void *map = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (map == MAP_FAILED) { mapped = 0; } else { block = (unsigned char *) map; }
+    }
+   #endif
+    if (block == NULL)
+    {
+        block = (unsigned char *) pzp_default_alloc(user, total);
+        if (block == NULL) { return NULL; }
+    }
+    memcpy(block, &mapped, sizeof(mapped));
+    return block + PZP_ALIGNMENT;
+}
+
+static void pzp_hugetlb_free(void *user, void *pointer)
+{
+    unsigned char *block = (unsigned char *) pointer - PZP_ALIGNMENT;
+    size_t mapped;
+    memcpy(&mapped, block, sizeof(mapped));
+   #if defined(MAP_HUGETLB)
+    if (mapped != 0) { munmap(block, mapped); return; }
+   #endif
+    pzp_default_free(user, block);
+}
+
+static const struct pzp_allocator pzp_hugetlb_allocator = { pzp_hugetlb_alloc, pzp_hugetlb_free, NULL };
+
+/* The default for contexts without an allocator of their own.  Like everything
+   in this header it is static, so each translation unit including pzp.h has its
+   own; the lock lets any thread swap it while others allocate. */
+static struct pzp_allocator pzp_current_allocator = { pzp_default_alloc, pzp_default_free, NULL };
+static pthread_mutex_t      pzp_current_allocator_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct pzp_allocator pzp_get_allocator(void)
+{
+    pthread_mutex_lock(&pzp_current_allocator_lock);
+    struct pzp_allocator allocator = pzp_current_allocator;
+    pthread_mutex_unlock(&pzp_current_allocator_lock);
+    return allocator;
+}
+
+/* Allocate through `allocator` from now on; NULL restores the default.  Set it
+   before any buffer is allocated, blocks must be released by the allocator that
+   made them. */
+static void pzp_set_allocator(const struct pzp_allocator *allocator)
+{
+    static const struct pzp_allocator standard = { pzp_default_alloc, pzp_default_free, NULL };
+    if ( (allocator == NULL) || (allocator->alloc == NULL) || (allocator->free == NULL) ) { allocator = &standard; }
+    pthread_mutex_lock(&pzp_current_allocator_lock);
+    pzp_current_allocator = *allocator;
+    pthread_mutex_unlock(&pzp_current_allocator_lock);
+}
+
+/* Allocate / release through a context's allocator, the default if it is NULL. */
+static void * pzp_allocator_alloc(const struct pzp_allocator *allocator, size_t size)
+{
+    if (allocator != NULL) { return allocator->alloc(allocator->user, size); }
+    struct pzp_allocator current = pzp_get_allocator();
+    return current.alloc(current.user, size);
+}
+
+static void pzp_allocator_free(const struct pzp_allocator *allocator, void *pointer)
+{
+    if (pointer == NULL) { return; }
+    if (allocator != NULL) { allocator->free(allocator->user, pointer); return; }
+    struct pzp_allocator current = pzp_get_allocator();
+    current.free(current.user, pointer);
+}
+
+static void * pzp_alloc(size_t size)    { return pzp_allocator_alloc(NULL, size); }
+
+static void pzp_dealloc(void *pointer)  { pzp_allocator_free(NULL, pointer); }
+
+// Incremental form of hash_checksum: byte k of the stream always feeds lane k % 4,
+// so the data can be hashed in arbitrary chunks while it is streamed.
+struct pzp_checksum
+{
+    unsigned int h[4];
+    size_t position;
+};
+
+static void pzp_checksum_init(struct pzp_checksum *state)
+{
+    state->h[0] = 0x12345678; state->h[1] = 0x9ABCDEF0;
+    state->h[2] = 0xFEDCBA98; state->h[3] = 0x87654321;
+    state->position = 0;
+}
+
+static void pzp_checksum_update(struct pzp_checksum *state, const void *data, size_t dataSize)
 {
+    static const unsigned int multiplier[4] = { 31, 37, 41, 43 };
     const unsigned char *bytes = (const unsigned char *)data;
-    unsigned int h1 = 0x12345678, h2 = 0x9ABCDEF0, h3 = 0xFEDCBA98, h4 = 0x87654321;
 
+    // Re-align to lane 0
+    while ( (dataSize > 0) && (state->position & 3) )
+    {
+        unsigned int lane = state->position & 3;
+        state->h[lane] = (state->h[lane] ^ *bytes) * multiplier[lane];
+        bytes++; dataSize--; state->position++;
+    }
+
+    unsigned int h1 = state->h[0], h2 = state->h[1], h3 = state->h[2], h4 = state->h[3];
+    size_t consumed = dataSize & ~((size_t) 3);
     while (dataSize >= 4)
     {
         h1 = (h1 ^ bytes[0]) * 31;
@@ -91,14 +338,30 @@ static unsigned int hash_checksum(const void *data, size_t dataSize)
         bytes += 4;
         dataSize -= 4;
     }
+    state->h[0] = h1; state->h[1] = h2; state->h[2] = h3; state->h[3] = h4;
+    state->position += consumed;
 
     // Process remaining bytes
-    if (dataSize > 0) h1 = (h1 ^ bytes[0]) * 31;
-    if (dataSize > 1) h2 = (h2 ^ bytes[1]) * 37;
-    if (dataSize > 2) h3 = (h3 ^ bytes[2]) * 41;
+    for (size_t i = 0; i < dataSize; i++)
+    {
+        unsigned int lane = state->position & 3;
+        state->h[lane] = (state->h[lane] ^ bytes[i]) * multiplier[lane];
+        state->position++;
+    }
+}
 
+static unsigned int pzp_checksum_final(const struct pzp_checksum *state)
+{
     // Final mix to spread entropy
-    return (h1 ^ (h2 >> 3)) + (h3 ^ (h4 << 5));
+    return (state->h[0] ^ (state->h[1] >> 3)) + (state->h[2] ^ (state->h[3] << 5));
+}
+
+static unsigned int hash_checksum(const void *data, size_t dataSize)
+{
+    struct pzp_checksum state;
+    pzp_checksum_init(&state);
+    pzp_checksum_update(&state, data, dataSize);
+    return pzp_checksum_final(&state);
 }
 
 
@@ -111,14 +374,14 @@ static unsigned int hash_checksum(const void *data, size_t dataSize)
    Returns the total serialised byte count for all palettes
    (sum over channels of: 1 byte count-field + counts[ch] bytes values). */
 static unsigned int pzp_palette_build_and_encode(
-        unsigned char **buffers, unsigned int pixels, unsigned int channels,
+        unsigned char **buffers, size_t pixels, unsigned int channels,
         unsigned char palette[8][256], unsigned int counts[8])
 {
     unsigned int total_bytes = 0;
     for (unsigned int ch = 0; ch < channels; ch++)
     {
         unsigned char present[256] = {0};
-        for (unsigned int i = 0; i < pixels; i++) present[buffers[ch][i]] = 1;
+        for (size_t i = 0; i < pixels; i++) present[buffers[ch][i]] = 1;
 
         unsigned char inv[256];
         unsigned int cnt = 0;
@@ -128,7 +391,7 @@ static unsigned int pzp_palette_build_and_encode(
         counts[ch] = cnt;
         total_bytes += 1 + cnt; /* 1 byte (count-1 field) + cnt bytes values */
 
-        for (unsigned int i = 0; i < pixels; i++) buffers[ch][i] = inv[buffers[ch][i]];
+        for (size_t i = 0; i < pixels; i++) buffers[ch][i] = inv[buffers[ch][i]];
     }
     return total_bytes;
 }
@@ -165,14 +428,243 @@ static unsigned int pzp_palette_read(
 
 /* In-place palette lookup on interleaved pixel data: index → original value. */
 static void pzp_palette_apply(
-        unsigned char *data, unsigned int pixels, unsigned int channels,
+        unsigned char *data, size_t pixels, unsigned int channels,
         unsigned char palette[8][256])
 {
-    for (unsigned int i = 0; i < pixels; i++)
+    for (size_t i = 0; i < pixels; i++)
         for (unsigned int ch = 0; ch < channels; ch++)
             data[i * channels + ch] = palette[ch][data[i * channels + ch]];
 }
 
+// ─── Bit-packed palette indices (USE_BITPACK) ───────────────────────────────
+//
+// A channel with at most 2, 4 or 16 palette entries only needs 1, 2 or 4 bits
+// per index.  With USE_BITPACK the index data is stored planar, one plane per
+// channel, each plane packed at its own width (8 = not packed).  Indices are
+// packed LSB-first: element k of a plane sits at bit (k % (8/bits)) * bits of
+// byte k / (8/bits).  Delta-filtered indices are masked to `bits` before
+// packing; the decoder's mod-256 prefix sum masked back to `bits` gives the
+// same index, so the mask is folded into the palette lookup table.
+
+static unsigned int pzp_palette_bits(unsigned int count)
+{
+    if (count <= 2)  return 1;
+    if (count <= 4)  return 2;
+    if (count <= 16) return 4;
+    return 8;
+}
+
+static size_t pzp_bitpacked_size(size_t count, unsigned int bits)
+{
+    return (count * bits + 7) / 8;
+}
+
+/* Stored width of one plane.  USE_RANGE planes with a single value are not stored at all. */
+static unsigned int pzp_plane_bits(unsigned int count, unsigned int configuration)
+{
+    if ( (configuration & USE_RANGE) && (count <= 1) ) return 0;
+    return pzp_palette_bits(count);
+}
+
+/* Size of the planar bit-packed index data for all channels. */
+static size_t pzp_bitpacked_total_size(size_t pixels, unsigned int channels, unsigned int counts[8], unsigned int configuration)
+{
+    size_t total = 0;
+    for (unsigned int ch = 0; ch < channels; ch++)
+        total += pzp_bitpacked_size(pixels, pzp_plane_bits(counts[ch], configuration));
+    return total;
+}
+
+/* Pack `count` byte-sized indices into `bits`-wide fields. Returns bytes written. */
+static size_t pzp_bitpack(const unsigned char *src, unsigned char *dst, size_t count, unsigned int bits)
+{
+    if (bits == 0) { return 0; }
+    if (bits >= 8)
+    {
+        memcpy(dst, src, count);
+        return count;
+    }
+
+    unsigned int  perByte = 8 / bits;
+    unsigned char mask    = (unsigned char) ((1u << bits) - 1);
+    size_t        size    = pzp_bitpacked_size(count, bits);
+    memset(dst, 0, size);
+
+    for (size_t i = 0; i < count; i++)
+        dst[i / perByte] |= (unsigned char) ((src[i] & mask) << ((i % perByte) * bits));
+
+    return size;
+}
+
+static void pzp_bitunpack_Naive(const unsigned char *src, unsigned char *dst, size_t count, unsigned int bits)
+{
+    if (bits == 0)
+    {
+        memset(dst, 0, count);
+        return;
+    }
+    if (bits >= 8)
+    {
+        memcpy(dst, src, count);
+        return;
+    }
+
+    unsigned int  perByte = 8 / bits;
+    unsigned char mask    = (unsigned char) ((1u << bits) - 1);
+    for (size_t i = 0; i < count; i++)
+        dst[i] = (src[i / perByte] >> ((i % perByte) * bits)) & mask;
+}
+
+// ─── Channel range reduction (USE_RANGE) ────────────────────────────────────
+//
+// Without a palette the encoder still measures every internal channel.  16-bit
+// samples are first rebased by the minimum of their channel, then each byte
+// plane is stored as value - min in the USE_BITPACK layout, 1, 2 or 4 bits wide
+// when its [min, max] range allows, and not at all when it is constant.  The
+// range table takes the palette's place after the header:
+//   channelsInternal × (min, max) bytes
+//   channelsExternal × uint16 base, big-endian   (16-bit images only)
+// The decoder treats each plane as the implicit palette min, min+1, … max, so
+// the same unpack + lookup kernel restores it.
+
+/* Measure and, if any plane gets narrower than 8 bits, rebase buffers[] in place.
+   Fills palette/counts with the implicit ranges and base[] with the 16-bit bases.
+   Returns the range table size, or 0 (buffers untouched) if nothing shrinks. */
+static unsigned int pzp_range_build_and_encode(
+        unsigned char **buffers, size_t pixels,
+        unsigned int channelsExternal, unsigned int channelsInternal, unsigned int bitsperpixelExternal,
+        unsigned char palette[8][256], unsigned int counts[8], unsigned int base[8])
+{
+    if ( (channelsInternal > 8) || (pixels == 0) ) { return 0; }
+    int wide = (bitsperpixelExternal == 16) && (channelsInternal == 2 * channelsExternal);
+
+    unsigned char low[8], high[8];
+    if (wide)
+    {
+        for (unsigned int c = 0; c < channelsExternal; c++)
+        {
+            const unsigned char *hi = buffers[2 * c], *lo = buffers[2 * c + 1];
+            unsigned int minimum = 65535;
+            for (size_t i = 0; i < pixels; i++)
+            {
+                unsigned int v = (unsigned int) (hi[i] << 8 | lo[i]);
+                minimum = (v < minimum) ? v : minimum;
+            }
+            base[c] = minimum;
+
+            unsigned int hiLow = 255, hiHigh = 0, loLow = 255, loHigh = 0;
+            for (size_t i = 0; i < pixels; i++)
+            {
+                unsigned int v = (unsigned int) (hi[i] << 8 | lo[i]) - minimum;
+                unsigned int h = v >> 8, l = v & 0xFF;
+                hiLow = (h < hiLow) ? h : hiLow;  hiHigh = (h > hiHigh) ? h : hiHigh;
+                loLow = (l < loLow) ? l : loLow;  loHigh = (l > loHigh) ? l : loHigh;
+            }
+            low[2 * c] = (unsigned char) hiLow;  high[2 * c]     = (unsigned char) hiHigh;
+            low[2 * c + 1] = (unsigned char) loLow; high[2 * c + 1] = (unsigned char) loHigh;
+        }
+    } else
+    {
+        for (unsigned int ch = 0; ch < channelsInternal; ch++)
+        {
+            unsigned char minimum = 255, maximum = 0;
+            for (size_t i = 0; i < pixels; i++)
+            {
+                unsigned char v = buffers[ch][i];
+                minimum = (v < minimum) ? v : minimum;
+                maximum = (v > maximum) ? v : maximum;
+            }
+            low[ch] = minimum; high[ch] = maximum;
+        }
+    }
+
+    int shrinks = 0;
+    for (unsigned int ch = 0; ch < channelsInternal; ch++)
+    {
+        counts[ch] = (unsigned int) (high[ch] - low[ch]) + 1;
+        if (pzp_plane_bits(counts[ch], USE_RANGE) < 8) { shrinks = 1; }
+    }
+    if (!shrinks) { return 0; }
+
+    if (wide)
+    {
+        for (unsigned int c = 0; c < channelsExternal; c++)
+        {
+            unsigned char *hi = buffers[2 * c], *lo = buffers[2 * c + 1];
+            for (size_t i = 0; i < pixels; i++)
+            {
+                unsigned int v = (unsigned int) (hi[i] << 8 | lo[i]) - base[c];
+                hi[i] = (unsigned char) (v >> 8);
+                lo[i] = (unsigned char) (v & 0xFF);
+            }
+        }
+    }
+    for (unsigned int ch = 0; ch < channelsInternal; ch++)
+    {
+        if (low[ch] != 0)
+            for (size_t i = 0; i < pixels; i++) { buffers[ch][i] -= low[ch]; }
+        for (unsigned int k = 0; k < counts[ch]; k++) { palette[ch][k] = (unsigned char) (low[ch] + k); }
+    }
+
+    return 2 * channelsInternal + (wide ? 2 * channelsExternal : 0);
+}
+
+/* Serialize the range table to dst. Returns bytes written. */
+static unsigned int pzp_range_write(
+        unsigned char *dst, unsigned int channelsExternal, unsigned int channelsInternal, int wide,
+        unsigned char palette[8][256], unsigned int counts[8], const unsigned int base[8])
+{
+    unsigned int off = 0;
+    for (unsigned int ch = 0; ch < channelsInternal; ch++)
+    {
+        dst[off++] = palette[ch][0];
+        dst[off++] = (unsigned char) (palette[ch][0] + counts[ch] - 1);
+    }
+    for (unsigned int c = 0; (wide) && (c < channelsExternal); c++)
+    {
+        dst[off++] = (unsigned char) (base[c] >> 8);
+        dst[off++] = (unsigned char) (base[c] & 0xFF);
+    }
+    return off;
+}
+
+/* Parse the range table into implicit palettes. Returns bytes consumed, 0 if malformed. */
+static unsigned int pzp_range_read(
+        const unsigned char *src, unsigned int channelsExternal, unsigned int channelsInternal, int wide,
+        unsigned char palette[8][256], unsigned int counts[8], unsigned int base[8])
+{
+    unsigned int off = 0;
+    for (unsigned int ch = 0; ch < channelsInternal; ch++)
+    {
+        unsigned char minimum = src[off++], maximum = src[off++];
+        if (maximum < minimum) { return 0; }
+        counts[ch] = (unsigned int) (maximum - minimum) + 1;
+        for (unsigned int k = 0; k < counts[ch]; k++) { palette[ch][k] = (unsigned char) (minimum + k); }
+    }
+    for (unsigned int c = 0; (wide) && (c < channelsExternal); c++)
+    {
+        base[c] = (unsigned int) (src[off] << 8 | src[off + 1]);
+        off += 2;
+    }
+    return off;
+}
+
+/* Add the 16-bit channel bases back onto decoded big-endian samples. */
+static void pzp_range_add_base(unsigned char *data, size_t pixels, unsigned int channelsExternal, const unsigned int base[8])
+{
+    for (unsigned int c = 0; c < channelsExternal; c++)
+    {
+        if (base[c] == 0) { continue; }
+        unsigned char *sample = data + 2 * c;
+        for (size_t i = 0; i < pixels; i++, sample += 2 * channelsExternal)
+        {
+            unsigned int v = (unsigned int) (sample[0] << 8 | sample[1]) + base[c];
+            sample[0] = (unsigned char) (v >> 8);
+            sample[1] = (unsigned char) (v & 0xFF);
+        }
+    }
+}
+
 // ────────────────────────────────────────────────────────────────────────────
 
 static void * pzp_read_file_to_memory(const char *filename, size_t *fileSize)
@@ -200,7 +692,7 @@ static void * pzp_read_file_to_memory(const char *filename, size_t *fileSize)
        }
     rewind(fp);
 
-    void *buffer = malloc(file_size);
+    void *buffer = pzp_alloc(file_size);
     if (!buffer)
       {
         fprintf(stderr,"Failed to allocate memory");
@@ -212,7 +704,7 @@ static void * pzp_read_file_to_memory(const char *filename, size_t *fileSize)
     if (read_size != (size_t)file_size)
        {
         fprintf(stderr,"Failed to read file completely");
-        free(buffer);
+        pzp_dealloc(buffer);
         fclose(fp);
         return NULL;
        }
@@ -222,795 +714,4817 @@ static void * pzp_read_file_to_memory(const char *filename, size_t *fileSize)
     return buffer;
 }
 
+// ─── Sources and sinks ──────────────────────────────────────────────────────
+//
+// The encoder writes and the streaming decoder reads through these instead of
+// named files, so frames can go through pipes, sockets or memory.  Each comes
+// with constructors for a FILE*, a file descriptor, memory and a user callback:
+//   read(context, buffer, size)  returns the bytes read, 0 at the end or on error
+//   write(context, data, size)   returns the bytes written, fewer on error
+// A source keeps a read-ahead buffer, so one source can deliver several
+// consecutive frames (see pzp_decompress_from_source); call pzp_source_close()
+// when done.  A memory sink grows a buffer through sink->allocator that the
+// caller hands back with pzp_sink_release().
 
+struct pzp_source
+{
+    size_t (*read)(void *context, void *buffer, size_t size);
+    void  *context;
+    ZSTD_inBuffer  input;    // bytes read ahead, not yet consumed
+    unsigned char *buffer;   // owned read-ahead storage (NULL for memory sources)
+    size_t         capacity;
+    size_t         frameRemaining; // last backend hint, 0 once the current frame is complete
+    unsigned int   backend;        // PZPBackend of the current frame, from its prefix
+    int            fd;
+};
 
-static void pzp_split_channels(const unsigned char *image, unsigned char **buffers, int num_buffers, int WIDTH, int HEIGHT)
+struct pzp_sink
 {
-    int total_size = WIDTH * HEIGHT;
+    size_t (*write)(void *context, const void *data, size_t size);
+    void  *context;
+    unsigned long long written; // bytes written so far
+    unsigned char *data;        // memory sink output
+    size_t         size;
+    size_t         capacity;
+    int            fd;
+    int            failed;      // a write came up short, later writes are dropped
+    const struct pzp_allocator *allocator; // memory sink growth and encoder buffers, NULL = default
+};
 
-    // Split channels
-    for (int i = 0; i < total_size; i++)
-    {
-        for (int ch = 0; ch < num_buffers; ch++)
-        {
-            buffers[ch][i] = image[i * num_buffers + ch];
-        }
-    }
+static size_t pzp_file_read(void *context, void *buffer, size_t size)
+{
+    return fread(buffer, 1, size, (FILE *) context);
 }
 
-static void pzp_RLE_filter(unsigned char **buffers, int num_buffers, int WIDTH, int HEIGHT)
+static size_t pzp_file_write(void *context, const void *data, size_t size)
 {
-    int total_size = WIDTH * HEIGHT;
+    return fwrite(data, 1, size, (FILE *) context);
+}
 
-    // Apply left-pixel delta filtering
-    for (int i = total_size - 1; i > 0; i--)
+static size_t pzp_fd_read(void *context, void *buffer, size_t size)
+{
+    const struct pzp_source *source = (const struct pzp_source *) context;
+    for (;;)
     {
-        for (int ch = 0; ch < num_buffers; ch++)
-        {
-            buffers[ch][i] -= buffers[ch][i - 1];
-        }
+        ssize_t n = read(source->fd, buffer, size);
+        if (n >= 0)           { return (size_t) n; }
+        if (errno != EINTR) { return 0; }
     }
 }
-//-----------------------------------------------------------------------------------------------
-//-----------------------------------------------------------------------------------------------
-static void pzp_compress_combined(unsigned char **buffers,
-                              unsigned int width,unsigned int height,
-                              unsigned int bitsperpixelExternal, unsigned int channelsExternal,
-                              unsigned int bitsperpixelInternal, unsigned int channelsInternal, unsigned int configuration,
-                              const char *output_filename)
-{
-    // ── Step 1: palette encoding (must precede delta filter) ─────────────────
-    // Operates on the original pixel values in the planar buffers[].
-    unsigned char palette[8][256];
-    unsigned int  palette_counts[8];
-    unsigned int  paletteDataBytes = 0;
 
-    if (configuration & USE_PALETTE)
+static size_t pzp_fd_write(void *context, const void *data, size_t size)
+{
+    const struct pzp_sink *sink = (const struct pzp_sink *) context;
+    size_t done = 0;
+    while (done < size)
     {
-        paletteDataBytes = pzp_palette_build_and_encode(
-                buffers, width * height, channelsInternal, palette, palette_counts);
-        fprintf(stderr, "Palette mode: %u channels, palette data %u bytes\n",
-                channelsInternal, paletteDataBytes);
-        for (unsigned int ch = 0; ch < channelsInternal; ch++)
-            fprintf(stderr, "  ch%u: %u unique values\n", ch, palette_counts[ch]);
+        ssize_t n = write(sink->fd, (const unsigned char *) data + done, size - done);
+        if (n > 0)                         { done += (size_t) n; } else
+        if ( (n < 0) && (errno == EINTR) ) { continue; }         else
+                                           { break; }
     }
+    return done;
+}
 
-    // ── Step 2: delta / RLE filter (on palette indices if USE_PALETTE) ───────
-    if (configuration & USE_RLE)
+static size_t pzp_memory_write(void *context, const void *data, size_t size)
+{
+    struct pzp_sink *sink = (struct pzp_sink *) context;
+    if (sink->size + size > sink->capacity)
     {
-        fprintf(stderr, "Using RLE for compression (mode %u)\n", configuration);
-        pzp_RLE_filter(buffers, channelsInternal, width, height);
+        size_t capacity = (sink->capacity < 65536) ? 65536 : sink->capacity;
+        while (capacity < sink->size + size) { capacity *= 2; }
+        unsigned char *grown = (unsigned char *) pzp_allocator_alloc(sink->allocator, capacity);
+        if (grown == NULL) { return 0; }
+        if (sink->size != 0) { memcpy(grown, sink->data, sink->size); }
+        pzp_allocator_free(sink->allocator, sink->data);
+        sink->data     = grown;
+        sink->capacity = capacity;
     }
+    memcpy(sink->data + sink->size, data, size);
+    sink->size += size;
+    return size;
+}
 
-    // ── Step 3: build the combined uncompressed blob ──────────────────────────
-    unsigned int pixel_data_size   = width * height * (bitsperpixelInternal / 8) * channelsInternal;
-    unsigned int combined_buffer_size = headerSize + paletteDataBytes + pixel_data_size;
+static void pzp_source_init(struct pzp_source *source, size_t (*read)(void *, void *, size_t), void *context)
+{
+    memset(source, 0, sizeof(*source));
+    source->read    = read;
+    source->context = context;
+    source->fd      = -1;
+}
 
-    FILE *output = fopen(output_filename, "wb");
-    if (!output) { fail("File error"); }
-
-    unsigned int dataSize = combined_buffer_size;
-    fwrite(&dataSize, sizeof(unsigned int), 1, output);
-
-    size_t max_compressed_size = ZSTD_compressBound(combined_buffer_size);
-    void *compressed_buffer = malloc(max_compressed_size);
-    if (!compressed_buffer) { fail("Memory allocation failed"); }
-
-    unsigned char *combined_buffer_raw = (unsigned char *)malloc(combined_buffer_size);
-    if (!combined_buffer_raw) { fail("Memory allocation failed"); }
-
-    // ── Step 4: write header ──────────────────────────────────────────────────
-    unsigned int *memStartAsUINT             = (unsigned int *)combined_buffer_raw;
-    unsigned int *headerTarget               = memStartAsUINT + 0;
-    unsigned int *bitsperpixelTarget         = memStartAsUINT + 1;
-    unsigned int *channelsTarget             = memStartAsUINT + 2;
-    unsigned int *widthTarget                = memStartAsUINT + 3;
-    unsigned int *heightTarget               = memStartAsUINT + 4;
-    unsigned int *bitsperpixelInternalTarget = memStartAsUINT + 5;
-    unsigned int *channelsInternalTarget     = memStartAsUINT + 6;
-    unsigned int *checksumTarget             = memStartAsUINT + 7;
-    unsigned int *compressionModeTarget      = memStartAsUINT + 8;
-    unsigned int *paletteDataSizeTarget      = memStartAsUINT + 9; /* formerly "unused" */
-
-    *headerTarget               = convert_header(pzp_header);
-    *bitsperpixelTarget         = bitsperpixelExternal;
-    *channelsTarget             = channelsExternal;
-    *widthTarget                = width;
-    *heightTarget               = height;
-    *bitsperpixelInternalTarget = bitsperpixelInternal;
-    *channelsInternalTarget     = channelsInternal;
-    *compressionModeTarget      = configuration;
-    *paletteDataSizeTarget      = paletteDataBytes;
-
-    // ── Step 5: write palette prefix (if any) then interleaved pixel/index data
-    unsigned char *write_ptr = combined_buffer_raw + headerSize;
-    if (paletteDataBytes > 0)
-    {
-        pzp_palette_write(write_ptr, channelsInternal, palette, palette_counts);
-        write_ptr += paletteDataBytes;
-    }
+static void pzp_source_file(struct pzp_source *source, FILE *file) { pzp_source_init(source, pzp_file_read, file); }
 
-    // Interleave planar buffers → pixel/index data
-    for (unsigned int i = 0; i < width * height; i++)
-        for (unsigned int ch = 0; ch < channelsInternal; ch++)
-            write_ptr[i * channelsInternal + ch] = buffers[ch][i];
+static void pzp_source_fd(struct pzp_source *source, int fd)
+{
+    pzp_source_init(source, pzp_fd_read, source);
+    source->fd = fd;
+}
 
-    // Checksum covers only the index/pixel data (not the palette prefix).
-    *checksumTarget = hash_checksum(write_ptr, pixel_data_size);
+/* Memory sources are decoded in place, nothing is copied. */
+static void pzp_source_memory(struct pzp_source *source, const void *data, size_t size)
+{
+    pzp_source_init(source, NULL, NULL);
+    source->input.src  = data;
+    source->input.size = size;
+}
 
-    #if PZP_VERBOSE
-    fprintf(stderr, "Storing %ux%ux%u@%ubit/%u@%ubit | mode %u | palette %u B | CRC:0x%X\n",
-            width, height, channelsExternal, bitsperpixelExternal,
-            channelsInternal, bitsperpixelInternal,
-            configuration, paletteDataBytes, *checksumTarget);
-    #endif
+static void pzp_source_close(struct pzp_source *source)
+{
+    pzp_dealloc(source->buffer);
+    source->buffer = NULL;
+}
 
-    // ── Step 6: ZSTD compress — use higher level when palette mode is active ──
-    int zstd_level = (configuration & USE_PALETTE) ? 19 : 1;
-    size_t compressed_size = ZSTD_compress(
-            compressed_buffer, max_compressed_size,
-            combined_buffer_raw, combined_buffer_size, zstd_level);
-    if (ZSTD_isError(compressed_size))
+/* Replace the consumed read-ahead with the next block of the source.
+   Returns 0 at the end of the source. */
+static int pzp_source_refill(struct pzp_source *source)
+{
+    if (source->read == NULL) { return 0; }
+    if (source->buffer == NULL)
     {
-        fprintf(stderr, "Zstd compression error: %s\n", ZSTD_getErrorName(compressed_size));
-        fail("Zstd compression error");
+        source->capacity = ZSTD_DStreamInSize();
+        source->buffer   = (unsigned char *) pzp_alloc(source->capacity);
+        if (source->buffer == NULL) { return 0; }
     }
+    source->input.src  = source->buffer;
+    source->input.size = source->read(source->context, source->buffer, source->capacity);
+    source->input.pos  = 0;
+    return (source->input.size != 0);
+}
 
-    #if PZP_VERBOSE
-    fprintf(stderr, "Compression Ratio : %0.2f\n", (float)dataSize / compressed_size);
-    #endif
-
-    fwrite(compressed_buffer, 1, compressed_size, output);
-
-    free(compressed_buffer);
-    free(combined_buffer_raw);
-    fclose(output);
+/* 1 if the source has no more bytes (reading ahead if needed). */
+static int pzp_source_at_end(struct pzp_source *source)
+{
+    return (source->input.pos == source->input.size) && (!pzp_source_refill(source));
 }
-//-----------------------------------------------------------------------------------------------
-//-----------------------------------------------------------------------------------------------
-//----------------------------------------------------------------------------------------------
-#if INTEL_OPTIMIZATIONS
-static void pzp_prefix_sum_sse2(unsigned char *src, unsigned char *dst, unsigned int size)
+
+/* Copy exactly `size` raw (not zstd coded) bytes out of the source. */
+static int pzp_source_read_raw(struct pzp_source *source, void *dst, size_t size)
 {
-    __m128i carry = _mm_setzero_si128();
-    unsigned int i = 0;
-    for (; i + 15 < size; i += 16)
+    unsigned char *out = (unsigned char *) dst;
+    while (size > 0)
     {
-        __m128i v = _mm_loadu_si128((__m128i *)(src + i));
-        v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
-        v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
-        v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
-        v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
-        v = _mm_add_epi8(v, carry);
-        _mm_storeu_si128((__m128i *)(dst + i), v);
-        unsigned char last = (unsigned char)_mm_cvtsi128_si32(_mm_srli_si128(v, 15));
-        carry = _mm_set1_epi8((char)last);
+        if ( (source->input.pos == source->input.size) && (!pzp_source_refill(source)) ) { return 0; }
+        size_t n = source->input.size - source->input.pos;
+        if (n > size) { n = size; }
+        memcpy(out, (const unsigned char *) source->input.src + source->input.pos, n);
+        source->input.pos += n;
+        out  += n;
+        size -= n;
     }
-    for (; i < size; i++)
-        dst[i] = src[i] + (i > 0 ? dst[i - 1] : 0);
+    return 1;
 }
 
-static void pzp_extractAndReconstruct_SSE2(unsigned char *decompressed_bytes, unsigned char *reconstructed, unsigned int width, unsigned int height, unsigned int channels, int restoreRLEChannels)
+static void pzp_sink_init(struct pzp_sink *sink, size_t (*write)(void *, const void *, size_t), void *context)
 {
-    unsigned int total_size = width * height;
-    unsigned char *src = decompressed_bytes;
-    unsigned char *r   = reconstructed;
+    memset(sink, 0, sizeof(*sink));
+    sink->write   = write;
+    sink->context = context;
+    sink->fd      = -1;
+}
 
-    if (restoreRLEChannels)
-    {
-        switch (channels)
-        {
-            case 1:
-            {
-                pzp_prefix_sum_sse2(src, r, total_size);
-                break;
-            }
-            case 2:
-            {
-                // Each channel accumulates independently with stride 2.
-                // Kogge-Stone with shifts 2, 4, 8 covers all 8 pixel pairs in 16 bytes.
-                // Carry = last pixel (2 bytes), broadcast to all 8 pixel positions.
-                __m128i carry = _mm_setzero_si128();
-                unsigned int i = 0;
+static void pzp_sink_file(struct pzp_sink *sink, FILE *file) { pzp_sink_init(sink, pzp_file_write, file); }
 
-                for (; i + 7 < total_size; i += 8)
-                {
-                    __m128i v = _mm_loadu_si128((__m128i *)(src + i * 2));
+static void pzp_sink_fd(struct pzp_sink *sink, int fd)
+{
+    pzp_sink_init(sink, pzp_fd_write, sink);
+    sink->fd = fd;
+}
 
-                    // Within-block prefix sum per channel (stride 2)
-                    v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
-                    v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
-                    v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+/* Collects the output in sink->data (sink->size bytes), release it with pzp_sink_release().
+   Set sink->allocator after this call to grow the buffer through another allocator. */
+static void pzp_sink_memory(struct pzp_sink *sink) { pzp_sink_init(sink, pzp_memory_write, sink); }
 
-                    // Add cross-block carry to every element
-                    v = _mm_add_epi8(v, carry);
-                    _mm_storeu_si128((__m128i *)(r + i * 2), v);
+/* Hand a memory sink's buffer back to the allocator that grew it, leaving the sink empty. */
+static void pzp_sink_release(struct pzp_sink *sink)
+{
+    pzp_allocator_free(sink->allocator, sink->data);
+    sink->data     = NULL;
+    sink->size     = 0;
+    sink->capacity = 0;
+}
 
-                    // Carry: last 2 bytes (one pixel) broadcast to all 8 pixel positions.
-                    // _mm_set1_epi16 replicates a 16-bit pattern to all 8 epi16 lanes,
-                    // which is exactly the [ch0_acc, ch1_acc] pair repeated 8 times.
-                    int tmp = _mm_cvtsi128_si32(_mm_srli_si128(v, 14));
-                    carry = _mm_set1_epi16((short)(tmp & 0xFFFF));
-                }
+/* Returns 1 if all `size` bytes were written.  After a short write the sink is
+   marked failed and takes nothing more, so an encoder can stop checking and look
+   at sink->failed once the frame is done. */
+static int pzp_sink_write(struct pzp_sink *sink, const void *data, size_t size)
+{
+    if (sink->failed) { return 0; }
+    size_t n = (size == 0) ? 0 : sink->write(sink->context, data, size);
+    sink->written += n;
+    if (n != size) { sink->failed = 1; }
+    return (n == size);
+}
 
-                // Scalar tail (also handles total_size < 8)
-                for (; i < total_size; i++)
-                {
-                    r[i * 2]     = src[i * 2]     + (i > 0 ? r[(i - 1) * 2]     : 0);
-                    r[i * 2 + 1] = src[i * 2 + 1] + (i > 0 ? r[(i - 1) * 2 + 1] : 0);
-                }
-                break;
-            }
-            case 3:
-            {
-                // Scalar prefix sum for 3-channel interleaved data.
-                r[0] = src[0]; r[1] = src[1]; r[2] = src[2];
-                for (unsigned int i = 1; i < total_size; i++)
-                {
-                    r[i*3]   = src[i*3]   + r[(i-1)*3];
-                    r[i*3+1] = src[i*3+1] + r[(i-1)*3+1];
-                    r[i*3+2] = src[i*3+2] + r[(i-1)*3+2];
-                }
-                break;
-            }
-            default:
-            {
-                for (unsigned int ch = 0; ch < channels; ch++) { r[ch] = src[ch]; }
-                for (unsigned int i = 1; i < total_size; i++)
-                {
-                    for (unsigned int ch = 0; ch < channels; ch++)
-                    {
-                        r[i * channels + ch] = src[i * channels + ch] + r[(i - 1) * channels + ch];
-                    }
-                }
-                break;
-            }
-        }
-    }
-    else // Non-RLE: data is already in final interleaved layout
+
+
+static void pzp_split_channels(const unsigned char *image, unsigned char **buffers, unsigned int num_buffers, unsigned int WIDTH, unsigned int HEIGHT)
+{
+    size_t total_size = (size_t) WIDTH * HEIGHT;
+
+    // Split channels
+    for (size_t i = 0; i < total_size; i++)
     {
-        memcpy(r, src, total_size * channels);
+        for (unsigned int ch = 0; ch < num_buffers; ch++)
+        {
+            buffers[ch][i] = image[i * num_buffers + ch];
+        }
     }
 }
 
-
-static void pzp_memcpy_avx2(unsigned char *dst, unsigned char *src, unsigned int size)
+/* Same as pzp_split_channels for native-endian 16-bit pixels: channel c goes to
+   its hi byte plane buffers[2c] and lo byte plane buffers[2c+1], so callers can
+   hand over uint16 arrays without first converting them to PNM byte order. */
+static void pzp_split_channels_native16(const unsigned short *image, unsigned char **buffers, unsigned int channels, unsigned int WIDTH, unsigned int HEIGHT)
 {
-    unsigned int i = 0;
-    __m256i v;
+    size_t total_size = (size_t) WIDTH * HEIGHT;
+    size_t i = 0;
 
-    // Process 32 bytes at a time
-    for (; i + 31 < size; i += 32)
+   #if INTEL_OPTIMIZATIONS
+    if (channels == 1)
     {
-        v = _mm256_loadu_si256((__m256i *)(src + i));
-        _mm256_storeu_si256((__m256i *)(dst + i), v);
+        // Per lane: lo bytes to the bottom 8, hi bytes to the top 8; then gather the halves across lanes
+        const __m256i split = _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+                                               0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+        const unsigned char one = 1;
+        if (*(const unsigned char *) &one) // little-endian host
+        for (; i + 16 <= total_size; i += 16)
+        {
+            __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(image + i)), split);
+            v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i *)(buffers[1] + i), _mm256_castsi256_si128(v));
+            _mm_storeu_si128((__m128i *)(buffers[0] + i), _mm256_extracti128_si256(v, 1));
+        }
     }
+   #endif // INTEL_OPTIMIZATIONS
 
-    // Process remaining bytes
-    for (; i < size; i++)
+    for (; i < total_size; i++)
     {
-        dst[i] = src[i];
+        for (unsigned int ch = 0; ch < channels; ch++)
+        {
+            unsigned short value = image[i * channels + ch];
+            buffers[2 * ch]    [i] = (unsigned char) (value >> 8);
+            buffers[2 * ch + 1][i] = (unsigned char) (value & 0xFF);
+        }
     }
 }
 
-/**
- * @brief Computes the prefix sum of an array using AVX2 SIMD operations.
- *
- * This function processes an array of unsigned 8-bit integers (bytes) in chunks of 32 bytes at a time,
- * using AVX2 intrinsics to perform vectorized addition. The prefix sum means that each element in the
- * output is the sum of all previous elements including itself, i.e.,
- *
- *      dst[i] = src[i] + dst[i-1]
- *
- * The algorithm leverages SIMD parallelism for faster execution by processing 32 elements in a single iteration.
- *
- * @param src  Pointer to the source array of unsigned 8-bit integers.
- * @param dst  Pointer to the destination array where the computed prefix sum will be stored.
- * @param size Number of elements in the source array. Must be a multiple of 32 for best performance.
- * @note
- * - The function assumes `size` is a multiple of 32 for optimal performance. If not, a scalar fallback is needed.
- * - This implementation is efficient for **short sequences** but not ideal for very long sequences,
- *   as it does not fully exploit SIMD-friendly prefix sum techniques like **Hillis-Steele scan**.
- * - If processing very large arrays, consider a **two-pass approach** to propagate values properly across blocks.
- * - Works best when `src` and `dst` are **aligned** to 32-byte boundaries, though `_mm256_loadu_si256`
- *   handles unaligned memory safely but slightly slower than aligned `_mm256_load_si256`.
- */
-static void pzp_prefix_sum_avx2(unsigned char *src, unsigned char *dst, unsigned int size)
+static void pzp_RLE_filter(unsigned char **buffers, unsigned int num_buffers, unsigned int WIDTH, unsigned int HEIGHT)
 {
-    // 1-channel prefix sum: dst[i] = src[i] + dst[i-1], processing 32 bytes per iteration.
-    //
-    // AVX2 key constraint: _mm256_slli_si256 shifts within each 128-bit lane independently.
-    // It cannot propagate across the lane boundary.  We handle this in two explicit steps:
-    //
-    //   Step 1 – Kogge-Stone within each 16-byte lane (shifts 1, 2, 4, 8).
-    //            Lane 0 (bytes  0-15): correct prefix sums from byte 0.
-    //            Lane 1 (bytes 16-31): correct prefix sums from byte 16 only (missing carry).
-    //
-    //   Step 2 – Cross-lane carry: extract last byte of lane 0, broadcast to all of lane 1,
-    //            add to lane 1 only so bytes 16-31 gain the cumulative sum through byte 15.
-    //
-    //   Step 3 – Cross-block carry: add the carry from the previous 32-byte block to every
-    //            element.  Carry = last byte of the previous block's result, broadcast to 32.
-
-    __m256i carry = _mm256_setzero_si256();
-    unsigned int i = 0;
+    size_t total_size = (size_t) WIDTH * HEIGHT;
 
-    for (; i + 31 < size; i += 32)
+    // Apply left-pixel delta filtering
+    for (size_t i = total_size; i-- > 1; )
     {
-        __m256i v = _mm256_loadu_si256((__m256i *)(src + i));
-
-        // Step 1: Kogge-Stone within each 128-bit lane.
-        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 1));
-        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 2));
-        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 4));
-        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 8));
-
-        // Step 2: propagate last byte of lane 0 to all bytes of lane 1.
+        for (unsigned int ch = 0; ch < num_buffers; ch++)
         {
-            __m128i lane0 = _mm256_castsi256_si128(v);
-            unsigned char last0 = (unsigned char)_mm_cvtsi128_si32(_mm_srli_si128(lane0, 15));
-            // Build a 256-bit vector: zeros in lane 0, broadcast of last0 in lane 1.
-            __m256i lane_carry = _mm256_set_m128i(_mm_set1_epi8((char)last0),
-                                                   _mm_setzero_si128());
-            v = _mm256_add_epi8(v, lane_carry);
+            buffers[ch][i] -= buffers[ch][i - 1];
         }
+    }
+}
 
-        // Step 3: add cross-block carry to all 32 bytes.
-        v = _mm256_add_epi8(v, carry);
-        _mm256_storeu_si256((__m256i *)(dst + i), v);
+/* USE_DELTA16 (16-bit images with USE_RLE): the left-pixel delta is taken on
+   whole samples, continuing across rows, and only then split into hi/lo planes.
+   Per-byte deltas lose the borrow between the bytes, so a smooth depth ramp gives
+   a noisy hi plane and a near random lo plane; here it gives small residuals in
+   both.  Residuals (mod 65536, read as signed) are zigzag coded (0,-1,1,-2,… →
+   0,1,2,3,…) so steps either way leave the hi plane at 0. */
+#define PZP_DELTA16_MAX_CHANNELS 8
 
-        // Update carry: broadcast last byte of the result (byte 31 = last of lane 1).
+static void pzp_delta16_filter(unsigned char **buffers, unsigned int channelsExternal, unsigned int WIDTH, unsigned int HEIGHT)
+{
+    size_t total_size = (size_t) WIDTH * HEIGHT;
+    for (unsigned int c = 0; c < channelsExternal; c++)
+    {
+        unsigned char *hi = buffers[2 * c];
+        unsigned char *lo = buffers[2 * c + 1];
+        unsigned short previous = 0;
+        for (size_t i = 0; i < total_size; i++)
         {
-            __m128i hi = _mm256_extracti128_si256(v, 1);
-            unsigned char last = (unsigned char)_mm_cvtsi128_si32(_mm_srli_si128(hi, 15));
-            carry = _mm256_set1_epi8((char)last);
+            unsigned short value    = (unsigned short) (hi[i] << 8 | lo[i]);
+            short          residual = (short) (unsigned short) (value - previous);
+            unsigned short zigzag   = (unsigned short) (((unsigned int) residual << 1) ^ (unsigned int) (residual >> 15));
+            previous = value;
+            hi[i] = (unsigned char) (zigzag >> 8);
+            lo[i] = (unsigned char) (zigzag & 0xFF);
         }
     }
+}
 
-    // Scalar tail (also covers the case size < 32).
-    for (; i < size; i++)
-        dst[i] = src[i] + (i > 0 ? dst[i - 1] : 0);
+/* Inverse of pzp_delta16_filter on interleaved big-endian hi/lo data, in place.
+   previous[] carries each channel's last sample across calls (start at 0). */
+static void pzp_delta16_reconstruct_Naive(unsigned char *data, size_t pixels, unsigned int channelsExternal, unsigned short *previous)
+{
+    for (unsigned int c = 0; c < channelsExternal; c++)
+    {
+        unsigned char *sample = data + 2 * c;
+        size_t stride = 2 * (size_t) channelsExternal;
+        unsigned short value = previous[c];
+        for (size_t i = 0; i < pixels; i++, sample += stride)
+        {
+            unsigned int zigzag = (unsigned int) (sample[0] << 8 | sample[1]);
+            value = (unsigned short) (value + ((zigzag >> 1) ^ (0u - (zigzag & 1))));
+            sample[0] = (unsigned char) (value >> 8);
+            sample[1] = (unsigned char) (value & 0xFF);
+        }
+        previous[c] = value;
+    }
 }
 
-/**
- * @brief Computes the prefix sum for a 2-channel interleaved array using AVX2 SIMD operations.
- *
- * This function processes an array where two interleaved unsigned 8-bit integer channels are present.
- * It computes the prefix sum separately for each channel while preserving their interleaved layout.
- * The prefix sum ensures that:
- *
- *      dst[2*i]   = src[2*i]   + dst[2*i - 2]
- *      dst[2*i+1] = src[2*i+1] + dst[2*i - 1]
- *
- * The function uses AVX2 to process 32 elements (16 pairs of channels) per iteration, improving performance.
- *
- * @param src  Pointer to the source array of unsigned 8-bit integers (interleaved 2-channel format).
- * @param dst  Pointer to the destination array where the computed prefix sum will be stored.
- * @param size Number of interleaved channel pairs in the source array (not the byte size).
- * @note
- * - The function assumes `size` is a multiple of 16 for optimal performance. If not, a scalar fallback is needed.
- * - This implementation works efficiently for small to medium-sized sequences but does not fully optimize
- *   long sequences where more sophisticated prefix sum algorithms (such as Hillis-Steele scan) may be required.
- * - Works best when `src` and `dst` are **aligned** to 32-byte boundaries, although `_mm256_loadu_si256`
- *   allows for unaligned memory access at a slight performance cost.
- */
-static void pzp_prefix_sum_avx2_2ch(unsigned char *src, unsigned char *dst, unsigned int size)
+/* USE_YCOCG (8-bit RGB with USE_RLE): the lifting steps of YCoCg-R,
+       Co = R - B,  t = B + (Co >> 1),  Cg = G - t,  Y = t + (Cg >> 1),
+   taken modulo 256 with Co and Cg read as signed bytes.  Each step adds a function
+   of a value already stored, so the wrapped transform is exactly invertible and
+   every plane stays 8 bits wide.  The left-pixel delta then runs on Y, Co, Cg,
+   which are far less correlated than R, G, B on photographic content. */
+static inline int pzp_ycocg_half(unsigned char value) { return ((signed char) value) >> 1; }
+
+static void pzp_ycocg_forward(unsigned char **buffers, size_t pixels)
 {
-    // 2-channel interleaved prefix sum: 16 pixel-pairs (32 bytes) per iteration.
-    // size = number of pixels (pairs); total bytes = size * 2.
-    //
-    //   dst[2*i]   = src[2*i]   + dst[2*(i-1)]     (channel 0)
-    //   dst[2*i+1] = src[2*i+1] + dst[2*(i-1)+1]   (channel 1)
-    //
-    // The two channels are independent; their stride in the interleaved layout is 2 bytes.
-    // Kogge-Stone uses shifts of 2, 4, 8 (not 1, 2, 4, 8) to match that stride.
-    // After the intra-lane scan, cross-lane carry propagates the last pixel-pair of lane 0
-    // (bytes 14-15) to all 8 pixel positions in lane 1.
-    // The _mm256_set1_epi16 broadcast replicates the 2-byte [ch0,ch1] pattern to all 16
-    // positions across both lanes, forming the cross-block carry.
+    unsigned char *r = buffers[0], *g = buffers[1], *b = buffers[2];
+    for (size_t i = 0; i < pixels; i++)
+    {
+        unsigned char co = (unsigned char) (r[i] - b[i]);
+        unsigned char t  = (unsigned char) (b[i] + pzp_ycocg_half(co));
+        unsigned char cg = (unsigned char) (g[i] - t);
+        r[i] = (unsigned char) (t + pzp_ycocg_half(cg)); // Y
+        g[i] = co;
+        b[i] = cg;
+    }
+}
 
-    __m256i carry = _mm256_setzero_si256();
-    unsigned int i = 0;
+/* Interleaved Y, Co, Cg back to R, G, B, in place. */
+static void pzp_ycocg_inverse(unsigned char *data, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++, data += 3)
+    {
+        unsigned char t = (unsigned char) (data[0] - pzp_ycocg_half(data[2]));
+        unsigned char g = (unsigned char) (data[2] + t);
+        unsigned char b = (unsigned char) (t - pzp_ycocg_half(data[1]));
+        data[0] = (unsigned char) (b + data[1]);
+        data[1] = g;
+        data[2] = b;
+    }
+}
 
-    for (; i + 15 < size; i += 16)
+/* Prefix sum of interleaved Y, Co, Cg deltas and the inverse transform in one pass,
+   in place.  previous[] carries the last Y, Co, Cg across calls (start at 0). */
+static void pzp_ycocg_reconstruct_Naive(unsigned char *data, size_t pixels, unsigned char previous[3])
+{
+    unsigned char y = previous[0], co = previous[1], cg = previous[2];
+    for (size_t i = 0; i < pixels; i++, data += 3)
     {
-        // Load 16 interleaved pixel-pairs = 32 bytes.
-        __m256i v = _mm256_loadu_si256((__m256i *)(src + i * 2));
+        y  = (unsigned char) (y  + data[0]);
+        co = (unsigned char) (co + data[1]);
+        cg = (unsigned char) (cg + data[2]);
+        unsigned char t = (unsigned char) (y - pzp_ycocg_half(cg));
+        unsigned char b = (unsigned char) (t - pzp_ycocg_half(co));
+        data[0] = (unsigned char) (b + co);
+        data[1] = (unsigned char) (cg + t);
+        data[2] = b;
+    }
+    previous[0] = y; previous[1] = co; previous[2] = cg;
+}
 
-        // Step 1: Kogge-Stone within each 128-bit lane, stride 2 (one pixel-pair per step).
-        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 2));
-        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 4));
-        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 8));
-        // Lane 0 (pixels 0-7): correct prefix sums.
-        // Lane 1 (pixels 8-15): sums relative to pixel 8 only — missing pixel 7 carry.
+/* USE_SPARSE (16-bit single channel depth with USE_RLE): zero samples are the
+   sensor's "no reading" and come in blobs, where the delta filter would pay two
+   large residuals per edge.  The stored data is instead
+     - the validity mask, one bit per pixel (LSB first) in rows of (width + 7) / 8
+       bytes, each row XORed with the row above so blob interiors turn to zeros,
+     - the valid samples only, in scan order, USE_DELTA16 coded (zigzag residual
+       from the previous valid sample) as interleaved hi/lo bytes.
+   The number of valid samples is the mask's population count. */
+static size_t pzp_sparse_mask_bytes(unsigned int width, unsigned int height)
+{
+    return (size_t) ((width + 7) / 8) * height;
+}
 
-        // Step 2: cross-lane carry — last pixel-pair of lane 0 (bytes 14-15) → all of lane 1.
+static int pzp_sparse_has_zeros(unsigned char **buffers, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++)
+        if ( (buffers[0][i] | buffers[1][i]) == 0 ) { return 1; }
+    return 0;
+}
+
+/* Build the mask and move the valid samples of the hi/lo planes to their front,
+   delta coded.  Returns how many there are. */
+static size_t pzp_sparse_filter(unsigned char **buffers, unsigned int width, unsigned int height, unsigned char *mask)
+{
+    unsigned char *hi = buffers[0], *lo = buffers[1];
+    size_t rowBytes = (width + 7) / 8, valid = 0;
+    memset(mask, 0, pzp_sparse_mask_bytes(width, height));
+    for (unsigned int y = 0; y < height; y++)
+    {
+        unsigned char *row = mask + y * rowBytes;
+        for (unsigned int x = 0; x < width; x++)
         {
-            __m128i lane0 = _mm256_castsi256_si128(v);
-            // Shift right by 14: puts bytes 14 and 15 in positions 0 and 1.
-            int last_px = _mm_cvtsi128_si32(_mm_srli_si128(lane0, 14));
-            // _mm_set1_epi16 replicates the 16-bit [ch0,ch1] pair to all 8 positions.
-            __m128i bcast = _mm_set1_epi16((short)(last_px & 0xFFFF));
-            // Add to lane 1 only (zeros in lane 0).
-            __m256i lane_carry = _mm256_set_m128i(bcast, _mm_setzero_si128());
-            v = _mm256_add_epi8(v, lane_carry);
+            size_t i = (size_t) y * width + x;
+            if ( (hi[i] | lo[i]) == 0 ) { continue; }
+            row[x / 8] |= (unsigned char) (1u << (x % 8));
+            hi[valid] = hi[i];
+            lo[valid] = lo[i];
+            valid++;
         }
+    }
+    for (unsigned int y = height - 1; (y > 0) && (y < height); y--)
+        for (size_t b = 0; b < rowBytes; b++)
+            mask[y * rowBytes + b] ^= mask[(y - 1) * rowBytes + b];
 
-        // Step 3: add cross-block carry to all 32 bytes.
-        v = _mm256_add_epi8(v, carry);
-        _mm256_storeu_si256((__m256i *)(dst + i * 2), v);
+    if (valid > 0) { pzp_delta16_filter(buffers, 1, (unsigned int) valid, 1); }
+    return valid;
+}
 
-        // Update carry: last pixel-pair of the result (bytes 30-31 of lane 1).
+/* USE_NEAR_LOSSLESS (16-bit images only), JPEG-LS NEAR style: every sample is
+   predicted from the previous reconstructed sample of its channel (the left pixel,
+   continuing across rows like the delta filter) and the residual is quantized to
+   steps of 2*maxError+1.  The encoder predicts from exactly what the decoder will
+   rebuild, so errors stay within ±maxError instead of piling up along the row.
+   Quantized residuals are zigzag coded (0,-1,1,-2,… → 0,1,2,3,…) into the hi/lo
+   byte planes, which leaves the hi plane nearly constant. */
+#define PZP_NEAR_MAX_CHANNELS 8
+#define PZP_NEAR_MAX_ERROR    32767
+
+static void pzp_near_quantize(unsigned char **buffers, unsigned int channelsExternal, unsigned int WIDTH, unsigned int HEIGHT, unsigned int maxError)
+{
+    size_t total_size = (size_t) WIDTH * HEIGHT;
+    int near = (int) maxError;
+    int step = 2 * near + 1;
+
+    for (unsigned int c = 0; c < channelsExternal; c++)
+    {
+        unsigned char *hi = buffers[2 * c];
+        unsigned char *lo = buffers[2 * c + 1];
+        int previous = 0;
+        for (size_t i = 0; i < total_size; i++)
         {
-            __m128i hi = _mm256_extracti128_si256(v, 1);
-            int last_px = _mm_cvtsi128_si32(_mm_srli_si128(hi, 14));
-            carry = _mm256_set1_epi16((short)(last_px & 0xFFFF));
+            int residual  = (hi[i] << 8 | lo[i]) - previous;
+            int quantized = (residual >= 0) ? (residual + near) / step : -((near - residual) / step);
+
+            previous += quantized * step;
+            if (previous < 0)     { previous = 0; }     else
+            if (previous > 65535) { previous = 65535; }
+
+            unsigned int zigzag = (quantized >= 0) ? (unsigned int) quantized << 1 : ((unsigned int) -quantized << 1) - 1;
+            hi[i] = (unsigned char) (zigzag >> 8);
+            lo[i] = (unsigned char) (zigzag & 0xFF);
         }
     }
+}
 
-    // Scalar tail (also covers size < 16).
-    for (; i < size; i++)
+/* Inverse of pzp_near_quantize on interleaved hi/lo data, in place.  previous[]
+   carries each channel's last reconstructed sample across calls (start at 0). */
+static void pzp_near_reconstruct(unsigned char *data, size_t pixels, unsigned int channelsExternal, unsigned int maxError, int *previous)
+{
+    int step = 2 * (int) maxError + 1;
+    for (unsigned int c = 0; c < channelsExternal; c++)
     {
-        dst[i * 2]     = src[i * 2]     + (i > 0 ? dst[(i - 1) * 2]     : 0);
-        dst[i * 2 + 1] = src[i * 2 + 1] + (i > 0 ? dst[(i - 1) * 2 + 1] : 0);
+        // Only the add and clamp depend on the previous sample; keep that chain short
+        unsigned char *sample = data + 2 * c;
+        size_t stride = 2 * (size_t) channelsExternal;
+        int value = previous[c];
+        for (size_t i = 0; i < pixels; i++, sample += stride)
+        {
+            unsigned int zigzag = (unsigned int) (sample[0] << 8 | sample[1]);
+            int delta = (int) (zigzag >> 1) ^ -(int) (zigzag & 1); // zigzag → signed residual
+            value += delta * step;
+            value  = (value < 0) ? 0 : value;
+            value  = (value > 65535) ? 65535 : value;
+            sample[0] = (unsigned char) (value >> 8);
+            sample[1] = (unsigned char) (value & 0xFF);
+        }
+        previous[c] = value;
     }
 }
 
-
-static void pzp_extractAndReconstruct_AVX2(unsigned char *decompressed_bytes, unsigned char *reconstructed, unsigned int width, unsigned int height, unsigned int channels, int restoreRLEChannels)
+/* USE_RUNS token stream: every row is a sequence of (run, pixel) tokens.
+   run-1 is stored as a LEB128 varint followed by the channels bytes of the
+   repeated pixel. Runs never cross a row boundary, so rows [rowStart, rowEnd)
+   can be encoded independently and concatenated.  A token never takes more
+   than channels + 1 bytes per pixel it covers.  Returns the bytes written to dst. */
+static size_t pzp_runs_encode(unsigned char **buffers, unsigned int num_buffers, unsigned int WIDTH,
+                              unsigned int rowStart, unsigned int rowEnd, unsigned char *dst)
 {
-    unsigned int total_size = width * height;
-    unsigned char *src = decompressed_bytes;
-    unsigned char *r = reconstructed;
-
-    if (restoreRLEChannels)
+    size_t off = 0;
+    for (unsigned int y = rowStart; y < rowEnd; y++)
     {
-        switch (channels)
+        size_t rowOffset = (size_t) y * WIDTH;
+        unsigned int x = 0;
+        while (x < WIDTH)
         {
-            case 1: {
-                pzp_prefix_sum_avx2(src, r, total_size);
-                break;
-            }
-            case 2: {
-                pzp_prefix_sum_avx2_2ch(src,r,total_size);
-                break;
-            }
-            case 3: {
-                // Scalar prefix sum for 3-channel interleaved data.
-                r[0] = src[0]; r[1] = src[1]; r[2] = src[2];
-                for (unsigned int i = 1; i < total_size; ++i)
-                {
-                    r[i*3]   = src[i*3]   + r[(i-1)*3];
-                    r[i*3+1] = src[i*3+1] + r[(i-1)*3+1];
-                    r[i*3+2] = src[i*3+2] + r[(i-1)*3+2];
-                }
-                break;
+            size_t       i   = rowOffset + x;
+            unsigned int run = 1;
+            while (x + run < WIDTH)
+            {
+                unsigned int same = 1;
+                for (unsigned int ch = 0; ch < num_buffers; ch++)
+                    if (buffers[ch][i + run] != buffers[ch][i]) { same = 0; break; }
+                if (!same) { break; }
+                run++;
             }
-            default: {
-                // Generic case (scalar fallback)
-                for (unsigned int ch = 0; ch < channels; ++ch)
-                {
-                    r[ch] = src[ch];
-                }
-                for (unsigned int i = 1; i < total_size; ++i)
-                {
-                    for (unsigned int ch = 0; ch < channels; ++ch)
-                    {
-                        r[i * channels + ch] = src[i * channels + ch] + r[(i - 1) * channels + ch];
-                    }
-                }
-                break;
+
+            unsigned int v = run - 1;
+            do
+            {
+                unsigned char b = (unsigned char) (v & 0x7F);
+                v >>= 7;
+                if (v) { b |= 0x80; }
+                dst[off++] = b;
+            } while (v);
+
+            for (unsigned int ch = 0; ch < num_buffers; ch++)
+            {
+                dst[off++] = buffers[ch][i];
             }
+            x += run;
         }
-    } else
+    }
+    return off;
+}
+//-----------------------------------------------------------------------------------------------
+//-----------------------------------------------------------------------------------------------
+// ─── rANS entropy coding (USE_RANS) ─────────────────────────────────────────
+//
+// An entropy-only alternative to zstd's LZ stage for the stored pixel / index
+// data: after the delta or palette filters it is mostly small residuals with few
+// long matches.  The data is coded in blocks (the encoder's chunks), each with a
+// static order-0 model per context, context = byte position % contexts, so every
+// internal channel of the interleaved layout gets its own frequencies.
+// 32 rANS states are interleaved (byte i belongs to state i % 32) and share one
+// stream of 16-bit words, which lets the AVX2 decoder run all of them in four
+// vectors.  Block layout:
+//   uint32 raw size, uint32 coded size, then the coded bytes:
+//   uint8 contexts (0: the raw bytes follow), uint8 0,
+//   per context a 32-byte symbol bitmap and a uint16 frequency per present symbol
+//   (summing to PZP_RANS_SCALE), the 32 uint32 final states, the word stream.
+// The blocks follow a uint64 raw size and uint64 coded size of the whole section.
+// The encoder hands each block to the store backend as soon as its chunk is coded,
+// so it writes PZP_SIZE_STREAMED for the coded size and for the data size of the
+// PZP1 prefix: the block sizes delimit the frame.  Older files with known sizes
+// inside a zstd frame still decode.
+
+#define PZP_RANS_SCALE_BITS     12
+#define PZP_RANS_SCALE          (1u << PZP_RANS_SCALE_BITS)
+#define PZP_RANS_LOW            (1u << 16)   // states stay in [LOW, LOW << 16)
+#define PZP_RANS_LANES          32
+#define PZP_RANS_MAX_CONTEXTS   16
+#define PZP_RANS_BLOCK_HEADER   (2 * sizeof(unsigned int))
+#define PZP_RANS_SECTION_HEADER (2 * sizeof(unsigned long long))
+#define PZP_SIZE_STREAMED       (~0ULL)      // size not known when the frame was written
+#define PZP_RANS_MODEL_MAX      (PZP_RANS_MAX_CONTEXTS * (32 + 256 * sizeof(unsigned short)))
+
+/* Scale the symbol counts of one context to frequencies summing to PZP_RANS_SCALE,
+   every present symbol keeping at least 1.  An empty context gets no frequencies. */
+static void pzp_rans_normalize(const unsigned int counts[256], size_t total, unsigned int freqs[256])
+{
+    unsigned int sum = 0, largest = 0;
+    for (unsigned int s = 0; s < 256; s++)
     {
-        // Non-RLE path
-        switch (channels)
+        freqs[s] = 0;
+        if (counts[s] == 0) { continue; }
+        unsigned long long f = ((unsigned long long) counts[s] * PZP_RANS_SCALE) / total;
+        freqs[s] = (f == 0) ? 1 : (unsigned int) f;
+        sum += freqs[s];
+        if (freqs[s] > freqs[largest]) { largest = s; }
+    }
+    if (sum == 0) { return; }
+
+    // Rounding down leaves slots over, rounding rare symbols up may take too many
+    if (sum < PZP_RANS_SCALE) { freqs[largest] += PZP_RANS_SCALE - sum; }
+    while (sum > PZP_RANS_SCALE)
+    {
+        for (unsigned int s = 0; s < 256; s++)
+            if (freqs[s] > freqs[largest]) { largest = s; }
+        unsigned int take = (freqs[largest] - 1 < sum - PZP_RANS_SCALE) ? freqs[largest] - 1 : sum - PZP_RANS_SCALE;
+        freqs[largest] -= take;
+        sum            -= take;
+    }
+}
+
+/* Code one block of `size` bytes with `contexts` models and append it (block header
+   included) to the coded sink.  words is scratch room for `size` 16-bit words.
+   Blocks that would not shrink are stored raw.  Returns 0 if the sink failed. */
+static int pzp_rans_encode_block(const unsigned char *src, size_t size, unsigned int contexts,
+                                  unsigned short *words, struct pzp_sink *coded)
+{
+    unsigned int  counts[PZP_RANS_MAX_CONTEXTS][256];
+    unsigned int  freqs[PZP_RANS_MAX_CONTEXTS][256];
+    unsigned int  starts[PZP_RANS_MAX_CONTEXTS][256];
+    unsigned char model[PZP_RANS_MODEL_MAX];
+    size_t        modelBytes = 0;
+
+    // ── Step 1: per-context histograms → normalized frequencies and bitmaps ──
+    memset(counts, 0, sizeof(unsigned int) * 256 * contexts);
+    for (size_t i = 0, c = 0; i < size; i++)
+    {
+        counts[c][src[i]]++;
+        if (++c == contexts) { c = 0; }
+    }
+    for (unsigned int c = 0; c < contexts; c++)
+    {
+        size_t total = size / contexts + ( (c < size % contexts) ? 1 : 0 );
+        pzp_rans_normalize(counts[c], total, freqs[c]);
+
+        unsigned char *bitmap = model + modelBytes;
+        memset(bitmap, 0, 32);
+        modelBytes += 32;
+        unsigned int start = 0;
+        for (unsigned int s = 0; s < 256; s++)
         {
-            case 1:
-                memcpy(r, src, total_size);
-                break;
-            case 2:
-            {
-                // Copy 32 bytes at a time (16 pixels)
-                unsigned int i = 0;
-                for (; i + 15 < total_size; i += 16)
-                {
-                    __m256i data = _mm256_loadu_si256((__m256i*)(src + 2 * i));
-                    _mm256_storeu_si256((__m256i*)(r + 2 * i), data);
-                }
-                // Remaining elements
-                for (; i < total_size; ++i)
-                {
-                    r[2 * i] = src[2 * i];
-                    r[2 * i + 1] = src[2 * i + 1];
-                }
-                break;
-            }
-            case 3:
+            starts[c][s] = start;
+            if (freqs[c][s] == 0) { continue; }
+            unsigned short f = (unsigned short) freqs[c][s];
+            bitmap[s >> 3] |= (unsigned char) (1u << (s & 7));
+            memcpy(model + modelBytes, &f, sizeof(f));
+            modelBytes += sizeof(f);
+            start += f;
+        }
+    }
+
+    // ── Step 2: encode backwards, so the decoder reads the words forwards ────
+    unsigned int state[PZP_RANS_LANES];
+    for (unsigned int l = 0; l < PZP_RANS_LANES; l++) { state[l] = PZP_RANS_LOW; }
+
+    unsigned short *out = words + size;
+    unsigned int    c   = (size > 0) ? (unsigned int) ((size - 1) % contexts) : 0;
+    for (size_t i = size; i-- > 0; )
+    {
+        unsigned int  s = src[i];
+        unsigned int  f = freqs[c][s];
+        unsigned int *x = &state[i & (PZP_RANS_LANES - 1)];
+        if ( (unsigned long long) *x >= ((unsigned long long) (PZP_RANS_LOW >> PZP_RANS_SCALE_BITS) << 16) * f )
+        {
+            *--out = (unsigned short) (*x & 0xFFFF);
+            *x >>= 16;
+        }
+        *x = ((*x / f) << PZP_RANS_SCALE_BITS) + (*x % f) + starts[c][s];
+        c = (c == 0) ? contexts - 1 : c - 1;
+    }
+    size_t wordCount = (size_t) (words + size - out);
+
+    // ── Step 3: write the block, or the raw bytes when coding does not pay ───
+    unsigned char mode[2] = { (unsigned char) contexts, 0 };
+    size_t codedSize = sizeof(mode) + modelBytes + sizeof(state) + wordCount * sizeof(unsigned short);
+    if (codedSize >= sizeof(mode) + size)
+    {
+        mode[0]   = 0;
+        codedSize = sizeof(mode) + size;
+    }
+    unsigned int blockHeader[2] = { (unsigned int) size, (unsigned int) codedSize };
+    int written = pzp_sink_write(coded, blockHeader, sizeof(blockHeader)) && pzp_sink_write(coded, mode, sizeof(mode));
+    if (mode[0] == 0)
+        written = written && pzp_sink_write(coded, src, size);
+    else
+        written = written && pzp_sink_write(coded, model, modelBytes) &&
+                  pzp_sink_write(coded, state, sizeof(state)) &&
+                  pzp_sink_write(coded, out, wordCount * sizeof(unsigned short));
+    return written;
+}
+
+/* Build the slot tables of a block's models: entry = symbol << 24 | (slot - start) << 12 | (freq - 1).
+   Returns the model bytes read, 0 if they are malformed. */
+static size_t pzp_rans_read_models(const unsigned char *src, size_t srcSize, unsigned int contexts, unsigned int *table)
+{
+    size_t pos = 0;
+    for (unsigned int c = 0; c < contexts; c++)
+    {
+        unsigned int *slots = table + (size_t) c * PZP_RANS_SCALE;
+        if (pos + 32 > srcSize) { return 0; }
+        const unsigned char *bitmap = src + pos;
+        pos += 32;
+
+        unsigned int start = 0;
+        for (unsigned int s = 0; s < 256; s++)
+        {
+            if (!(bitmap[s >> 3] & (1u << (s & 7)))) { continue; }
+            unsigned short f;
+            if (pos + sizeof(f) > srcSize) { return 0; }
+            memcpy(&f, src + pos, sizeof(f));
+            pos += sizeof(f);
+            if ( (f == 0) || (start + f > PZP_RANS_SCALE) ) { return 0; }
+
+            unsigned int entry = (s << 24) | (unsigned int) (f - 1);
+            for (unsigned int k = 0; k < f; k++) { slots[start + k] = entry | (k << 12); }
+            start += f;
+        }
+        // An unused context decodes as symbol 0, the block checks below reject it
+        if (start == 0) { memset(slots, 0, PZP_RANS_SCALE * sizeof(unsigned int)); } else
+        if (start != PZP_RANS_SCALE) { return 0; }
+    }
+    return pos;
+}
+
+/* Decode bytes [position, size) of a block with the interleaved states. */
+static int pzp_rans_decode_Naive(const unsigned int *table, unsigned int contexts, unsigned int *state,
+                                 const unsigned short **wordsInput, const unsigned short *end,
+                                 unsigned char *dst, size_t position, size_t size)
+{
+    const unsigned short *words = *wordsInput;
+    unsigned int c = (unsigned int) (position % contexts);
+    for (size_t i = position; i < size; i++)
+    {
+        unsigned int *x = &state[i & (PZP_RANS_LANES - 1)];
+        unsigned int  e = table[(size_t) c * PZP_RANS_SCALE + (*x & (PZP_RANS_SCALE - 1))];
+        unsigned int  y = ((e & 0xFFF) + 1) * (*x >> PZP_RANS_SCALE_BITS) + ((e >> 12) & 0xFFF);
+        dst[i] = (unsigned char) (e >> 24);
+
+        // Branch-free refill: whether a state needs a word is as good as random
+        unsigned int refill = (y < PZP_RANS_LOW);
+        unsigned int next   = (words < end) ? *words : 0;
+        *x     = (refill) ? ((y << 16) | next) : y;
+        words += refill;
+        if (++c == contexts) { c = 0; }
+    }
+    *wordsInput = words;
+    return (words <= end);
+}
+
+#if INTEL_OPTIMIZATIONS
+/* Refill permutations: for a movemask of the states that need a word, lane j takes
+   word (number of refilled lanes before j) of the next eight. */
+static unsigned int pzp_rans_refill[256][8];
+static pthread_once_t pzp_rans_refill_once = PTHREAD_ONCE_INIT;
+
+static void pzp_rans_refill_init(void)
+{
+    for (unsigned int mask = 0; mask < 256; mask++)
+    {
+        unsigned int taken = 0;
+        for (unsigned int j = 0; j < 8; j++)
+        {
+            pzp_rans_refill[mask][j] = taken;
+            if (mask & (1u << j)) { taken++; }
+        }
+    }
+}
+
+/* 32 bytes per iteration, eight states per vector:
+     Step 1 – gather each state's slot entry from its context's table.
+     Step 2 – symbol = entry >> 24, state = freq * (state >> 12) + (slot - start).
+     Step 3 – the states that fell below PZP_RANS_LOW take the next 16-bit words in
+              lane order: their movemask picks a permutation spreading 8 words over them.
+     Step 4 – the 32 symbols are packed to bytes and stored.
+   Stops where fewer than 32 bytes or 32 words are left; the scalar loop finishes. */
+static void pzp_rans_decode_AVX2(const unsigned int *table, unsigned int contexts, unsigned int *state,
+                                 const unsigned short **wordsInput, const unsigned short *end,
+                                 unsigned char *dst, size_t *position, size_t size)
+{
+    pthread_once(&pzp_rans_refill_once, pzp_rans_refill_init);
+
+    const __m256i slotMask = _mm256_set1_epi32(PZP_RANS_SCALE - 1);
+    const __m256i fieldMask = _mm256_set1_epi32(0xFFF);
+    const __m256i one      = _mm256_set1_epi32(1);
+    const __m256i zero     = _mm256_setzero_si256();
+    const __m256i order    = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    // Table offset of each lane's context, advancing by 32 bytes a step
+    const __m256i step     = _mm256_set1_epi32((int) ((PZP_RANS_LANES % contexts) * PZP_RANS_SCALE));
+    const __m256i wrap     = _mm256_set1_epi32((int) (contexts * PZP_RANS_SCALE));
+    const __m256i lastContext = _mm256_set1_epi32((int) ((contexts - 1) * PZP_RANS_SCALE));
+
+    const unsigned short *words = *wordsInput;
+    size_t i = *position;
+    __m256i x[4], context[4];
+    for (unsigned int v = 0; v < 4; v++)
+    {
+        unsigned int offsets[8];
+        for (unsigned int j = 0; j < 8; j++)
+            offsets[j] = (unsigned int) ((i + v * 8 + j) % contexts) * PZP_RANS_SCALE;
+        context[v] = _mm256_loadu_si256((const __m256i *) offsets);
+        x[v]       = _mm256_loadu_si256((const __m256i *) (state + v * 8));
+    }
+
+    for (; (i + PZP_RANS_LANES <= size) && (end - words >= PZP_RANS_LANES); i += PZP_RANS_LANES)
+    {
+        __m256i symbols[4], refill[4];
+        unsigned int mask[4];
+        for (unsigned int v = 0; v < 4; v++)
+        {
+            // Step 1 + 2
+            __m256i e = _mm256_i32gather_epi32((const int *) table, _mm256_add_epi32(context[v], _mm256_and_si256(x[v], slotMask)), 4);
+            symbols[v] = _mm256_srli_epi32(e, 24);
+            __m256i freq = _mm256_add_epi32(_mm256_and_si256(e, fieldMask), one);
+            __m256i bias = _mm256_and_si256(_mm256_srli_epi32(e, 12), fieldMask);
+            x[v] = _mm256_add_epi32(_mm256_mullo_epi32(freq, _mm256_srli_epi32(x[v], PZP_RANS_SCALE_BITS)), bias);
+            refill[v] = _mm256_cmpeq_epi32(_mm256_srli_epi32(x[v], 16), zero);
+            mask[v]   = (unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(refill[v]));
+
+            if (contexts > 1)
             {
-                // Copy 24 bytes at a time (8 pixels)
-                unsigned int i = 0;
-                for (; i + 7 < total_size; i += 8)
-                {
-                    __m256i data = _mm256_loadu_si256((__m256i*)(src + 3 * i));
-                    _mm256_storeu_si256((__m256i*)(r + 3 * i), data);
-                }
-                // Remaining elements
-                for (; i < total_size; ++i)
-                {
-                    r[3 * i]     = src[3 * i];
-                    r[3 * i + 1] = src[3 * i + 1];
-                    r[3 * i + 2] = src[3 * i + 2];
-                }
-                break;
-            }
-            default: {
-                // Generic case (scalar fallback)
-                for (unsigned int i = 0; i < total_size; ++i)
-                {
-                    for (unsigned int ch = 0; ch < channels; ++ch)
-                    {
-                        r[i * channels + ch] = src[i * channels + ch];
-                    }
-                }
-                break;
+                context[v] = _mm256_add_epi32(context[v], step);
+                context[v] = _mm256_sub_epi32(context[v], _mm256_and_si256(_mm256_cmpgt_epi32(context[v], lastContext), wrap));
             }
         }
+
+        // Step 3: word offsets first, so the four loads do not wait on each other
+        const unsigned short *next[4];
+        next[0] = words;
+        for (unsigned int v = 1; v < 4; v++) { next[v] = next[v - 1] + __builtin_popcount(mask[v - 1]); }
+        words = next[3] + __builtin_popcount(mask[3]);
+        for (unsigned int v = 0; v < 4; v++)
+        {
+            __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) next[v]));
+            w    = _mm256_permutevar8x32_epi32(w, _mm256_loadu_si256((const __m256i *) pzp_rans_refill[mask[v]]));
+            x[v] = _mm256_blendv_epi8(x[v], _mm256_or_si256(_mm256_slli_epi32(x[v], 16), w), refill[v]);
+        }
+
+        // Step 4
+        __m256i low  = _mm256_packus_epi32(symbols[0], symbols[1]);
+        __m256i high = _mm256_packus_epi32(symbols[2], symbols[3]);
+        __m256i packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(low, high), order);
+        _mm256_storeu_si256((__m256i *) (dst + i), packed);
     }
+
+    for (unsigned int v = 0; v < 4; v++)
+        _mm256_storeu_si256((__m256i *) (state + v * 8), x[v]);
+    *wordsInput = words;
+    *position   = i;
 }
 #endif // INTEL_OPTIMIZATIONS
-static void pzp_extractAndReconstruct_Naive(unsigned char *decompressed_bytes, unsigned char *reconstructed, unsigned int width, unsigned int height, unsigned int channels, int restoreRLEChannels)
+
+/* Decode one block (the bytes after its 8-byte header, 2-byte aligned) into
+   rawSize bytes of dst.  table has room for PZP_RANS_MAX_CONTEXTS models.
+   Returns 1 on success, 0 if the block is corrupted. */
+static int pzp_rans_decode(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t rawSize, unsigned int *table)
 {
-    unsigned int total_size = width * height;
-    unsigned char *src = decompressed_bytes;
-    unsigned char *r   = reconstructed;
+    if (srcSize < 2) { return 0; }
+    unsigned int contexts = src[0];
+    if (contexts == 0)
+    {
+        if (srcSize != 2 + rawSize) { return 0; }
+        memcpy(dst, src + 2, rawSize);
+        return 1;
+    }
+    if (contexts > PZP_RANS_MAX_CONTEXTS) { return 0; }
 
-    if (restoreRLEChannels)
+    size_t modelBytes = pzp_rans_read_models(src + 2, srcSize - 2, contexts, table);
+    size_t pos = 2 + modelBytes;
+    unsigned int state[PZP_RANS_LANES];
+    if ( (modelBytes == 0) || (pos + sizeof(state) > srcSize) || ((srcSize - pos - sizeof(state)) & 1) ) { return 0; }
+    memcpy(state, src + pos, sizeof(state));
+    pos += sizeof(state);
+
+    const unsigned short *words = (const unsigned short *) (src + pos);
+    const unsigned short *end   = (const unsigned short *) (src + srcSize);
+    size_t position = 0;
+   #if INTEL_OPTIMIZATIONS
+    pzp_rans_decode_AVX2(table, contexts, state, &words, end, dst, &position, rawSize);
+   #endif // INTEL_OPTIMIZATIONS
+    if (!pzp_rans_decode_Naive(table, contexts, state, &words, end, dst, position, rawSize)) { return 0; }
+
+    // The encoder started every state at PZP_RANS_LOW and used up all words
+    if (words != end) { return 0; }
+    for (unsigned int l = 0; l < PZP_RANS_LANES; l++)
+        if (state[l] != PZP_RANS_LOW) { return 0; }
+    return 1;
+}
+//-----------------------------------------------------------------------------------------------
+//-----------------------------------------------------------------------------------------------
+// ─── Compression backends ───────────────────────────────────────────────────
+//
+// The filters, palette and rANS stages produce the uncompressed payload (header,
+// palette, stored data, trailer); a backend is only the entropy stage that codes
+// it into the frame behind the size prefix:
+//   zstd  (0) — default, best ratio
+//   LZ4   (1) — an LZ4 frame of linked 64 KiB blocks, decodes several times faster
+//   store (2) — the payload as is, for tmpfs staging; see pzp_store_view_from_memory
+// The encoder picks one with USE_LZ4 / USE_STORE and writes its ID into the
+// prefix, so the decoder knows the backend before the payload and dispatches every
+// read through the table entry of the frame.
+
+#define PZP_LZ4_CHUNK (64 * 1024)   // encoder input per LZ4F_compressUpdate call
+
+struct pzp_backend;
+
+/* One frame being coded: the backend's context and the output it writes to. */
+struct pzp_cctx
+{
+    const struct pzp_backend *backend;
+    struct pzp_sink *output;
+    void            *outBuffer;
+    size_t           outBufferSize;
+    ZSTD_CCtx       *zstd;
+   #if PZP_LZ4
+    LZ4F_cctx       *lz4;
+   #endif
+};
+
+/* Per-thread decoding contexts, prepared for the backend of the frame being read.
+   The decoded pixels and all scratch buffers come from allocator, NULL is the
+   default (see pzp_set_allocator). */
+struct pzp_dctx
+{
+    const struct pzp_backend *backend;
+    const struct pzp_allocator *allocator;
+    ZSTD_DCtx       *zstd;
+   #if PZP_LZ4
+    LZ4F_dctx       *lz4;
+   #endif
+};
+
+struct pzp_backend
+{
+    const char *name;
+    // Start a frame of dataSize payload bytes, level is the zstd level asked for
+    int  (*compressBegin)(struct pzp_cctx *cctx, int level, unsigned long long dataSize);
+    // Code the next payload bytes, end also closes the frame
+    void (*compress)(struct pzp_cctx *cctx, const void *data, size_t size, int end);
+    void (*compressFree)(struct pzp_cctx *cctx);
+    // Reset the thread's context for a new frame
+    int  (*decompressBegin)(struct pzp_dctx *dctx);
+    // Pull exactly size payload bytes out of the frame, 0 on an error or an early end
+    int  (*decompress)(struct pzp_dctx *dctx, struct pzp_source *source, void *dst, size_t size);
+    // Consume what is left of the frame (end marks, checksums), 0 if it is not only that
+    int  (*finish)(struct pzp_dctx *dctx, struct pzp_source *source);
+};
+
+static int pzp_zstd_compress_begin(struct pzp_cctx *cctx, int level, unsigned long long dataSize)
+{
+    cctx->zstd = ZSTD_createCCtx();
+    cctx->outBufferSize = ZSTD_CStreamOutSize();
+    cctx->outBuffer     = pzp_allocator_alloc(cctx->output->allocator, cctx->outBufferSize);
+    if ( (!cctx->zstd) || (!cctx->outBuffer) ) { return 0; }
+    ZSTD_CCtx_setParameter(cctx->zstd, ZSTD_c_compressionLevel, level);
+    ZSTD_CCtx_setPledgedSrcSize(cctx->zstd, dataSize);
+    return 1;
+}
+
+/* Feed one block of the uncompressed payload to the zstd stream and write whatever
+   compressed output it produces. ZSTD_e_end also flushes the end of the frame. */
+static void pzp_zstd_compress(struct pzp_cctx *cctx, const void *data, size_t size, int end)
+{
+    if (cctx->output->failed) { return; } // nothing more reaches the sink
+    ZSTD_EndDirective mode = (end) ? ZSTD_e_end : ZSTD_e_continue;
+    ZSTD_inBuffer input = { data, size, 0 };
+    int finished = 0;
+    while (!finished)
     {
-        switch (channels)
+        ZSTD_outBuffer out = { cctx->outBuffer, cctx->outBufferSize, 0 };
+        size_t remaining = ZSTD_compressStream2(cctx->zstd, &out, &input, mode);
+        if (ZSTD_isError(remaining))
         {
-            case 1:
-                r[0] = src[0];
-                for (unsigned int i = 1; i < total_size; i++)
-                {
-                    r[i] = src[i] + r[i - 1];
-                }
-                break;
-            case 2:
-                r[0] = src[0];
-                r[1] = src[1];
-                for (unsigned int i = 1; i < total_size; i++)
-                {
-                    r   += 2;
-                    src += 2;
-                    r[0] = src[0] + r[-2];
-                    r[1] = src[1] + r[-1];
-                }
-                break;
-            case 3:
-                r[0] = src[0];
-                r[1] = src[1];
-                r[2] = src[2];
-                for (unsigned int i = 1; i < total_size; i++)
-                {
-                    r   += 3;
-                    src += 3;
-                    r[0] = src[0] + r[-3];
-                    r[1] = src[1] + r[-2];
-                    r[2] = src[2] + r[-1];
-                }
-                break;
-            default:
-                for (unsigned int ch = 0; ch < channels; ch++)
-                {
-                    r[ch] = src[ch];
-                }
-                for (unsigned int i = 1; i < total_size; i++)
-                {
-                    for (unsigned int ch = 0; ch < channels; ch++)
-                    {
-                        r[i * channels + ch] = src[i * channels + ch] + r[(i - 1) * channels + ch];
-                    }
-                }
-                break;
+            fprintf(stderr, "Zstd compression error: %s\n", ZSTD_getErrorName(remaining));
+            cctx->output->failed = 1;
+            return;
+        }
+        if (!pzp_sink_write(cctx->output, cctx->outBuffer, out.pos)) { return; }
+        finished = (mode == ZSTD_e_end) ? (remaining == 0) : (input.pos == input.size);
+    }
+}
+
+static void pzp_zstd_compress_free(struct pzp_cctx *cctx)
+{
+    ZSTD_freeCCtx(cctx->zstd);
+    pzp_allocator_free(cctx->output->allocator, cctx->outBuffer);
+}
+
+/* Streaming decompression allocates a window buffer per context, which costs
+   more than decoding a small image. Each thread keeps one context alive and
+   resets it between frames. */
+static int pzp_zstd_decompress_begin(struct pzp_dctx *dctx)
+{
+    if (dctx->zstd == NULL) { dctx->zstd = ZSTD_createDCtx(); }
+      else                  { ZSTD_DCtx_reset(dctx->zstd, ZSTD_reset_session_only); }
+    return (dctx->zstd != NULL);
+}
+
+static int pzp_zstd_decompress(struct pzp_dctx *dctx, struct pzp_source *source, void *dst, size_t size)
+{
+    ZSTD_outBuffer output = { dst, size, 0 };
+    ZSTD_inBuffer *input  = &source->input;
+    while (output.pos < output.size)
+    {
+        if (input->pos == input->size) { pzp_source_refill(source); }
+
+        size_t inputBefore  = input->pos;
+        size_t outputBefore = output.pos;
+        size_t ret = ZSTD_decompressStream(dctx->zstd, &output, input);
+        if (ZSTD_isError(ret))
+        {
+            fprintf(stderr, "Zstd decompression error: %s\n", ZSTD_getErrorName(ret));
+            return 0;
+        }
+        source->frameRemaining = ret;
+        if ( (input->pos == inputBefore) && (output.pos == outputBefore) )
+        {
+            fprintf(stderr, "Zstd stream ended %lu bytes early\n", (unsigned long) (output.size - output.pos));
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int pzp_zstd_finish(struct pzp_dctx *dctx, struct pzp_source *source)
+{
+    unsigned char spare[64];
+    while (source->frameRemaining != 0)
+    {
+        ZSTD_outBuffer output = { spare, sizeof(spare), 0 };
+        if ( (source->input.pos == source->input.size) && (!pzp_source_refill(source)) )
+        {
+            fprintf(stderr, "PZP stream ended inside the zstd frame\n");
+            return 0;
+        }
+        size_t ret = ZSTD_decompressStream(dctx->zstd, &output, &source->input);
+        if ( (ZSTD_isError(ret)) || (output.pos != 0) )
+        {
+            fprintf(stderr, "PZP frame carries more data than its header describes\n");
+            return 0;
+        }
+        source->frameRemaining = ret;
+    }
+    return 1;
+}
+
+#if PZP_LZ4
+/* Palette frames ask zstd for level 19, LZ4 then switches to its HC coder. */
+static int pzp_lz4_compress_begin(struct pzp_cctx *cctx, int level, unsigned long long dataSize)
+{
+    LZ4F_preferences_t preferences;
+    memset(&preferences, 0, sizeof(preferences));
+    preferences.frameInfo.blockSizeID   = LZ4F_max64KB;
+    preferences.frameInfo.blockMode     = LZ4F_blockLinked;
+    preferences.frameInfo.contentSize   = dataSize;
+    preferences.compressionLevel        = (level > 1) ? 9 : 0;
+
+    if (LZ4F_isError(LZ4F_createCompressionContext(&cctx->lz4, LZ4F_VERSION))) { cctx->lz4 = NULL; return 0; }
+    cctx->outBufferSize = LZ4F_compressBound(PZP_LZ4_CHUNK, &preferences) + LZ4F_HEADER_SIZE_MAX;
+    cctx->outBuffer     = pzp_allocator_alloc(cctx->output->allocator, cctx->outBufferSize);
+    if (!cctx->outBuffer) { return 0; }
+
+    size_t written = LZ4F_compressBegin(cctx->lz4, cctx->outBuffer, cctx->outBufferSize, &preferences);
+    if (LZ4F_isError(written))
+    {
+        fprintf(stderr, "LZ4 compression error: %s\n", LZ4F_getErrorName(written));
+        return 0;
+    }
+    return pzp_sink_write(cctx->output, cctx->outBuffer, written);
+}
+
+static void pzp_lz4_compress(struct pzp_cctx *cctx, const void *data, size_t size, int end)
+{
+    if (cctx->output->failed) { return; } // nothing more reaches the sink
+    const unsigned char *input = (const unsigned char *) data;
+    while ( (size > 0) || (end) )
+    {
+        size_t n = (size < PZP_LZ4_CHUNK) ? size : PZP_LZ4_CHUNK;
+        size_t written = (n > 0) ? LZ4F_compressUpdate(cctx->lz4, cctx->outBuffer, cctx->outBufferSize, input, n, NULL) :
+                                   LZ4F_compressEnd(cctx->lz4, cctx->outBuffer, cctx->outBufferSize, NULL);
+        if (LZ4F_isError(written))
+        {
+            fprintf(stderr, "LZ4 compression error: %s\n", LZ4F_getErrorName(written));
+            cctx->output->failed = 1;
+            return;
+        }
+        if (!pzp_sink_write(cctx->output, cctx->outBuffer, written)) { return; }
+        if (n == 0) { break; }
+        input += n;
+        size  -= n;
+    }
+}
+
+static void pzp_lz4_compress_free(struct pzp_cctx *cctx)
+{
+    LZ4F_freeCompressionContext(cctx->lz4);
+    pzp_allocator_free(cctx->output->allocator, cctx->outBuffer);
+}
+
+static int pzp_lz4_decompress_begin(struct pzp_dctx *dctx)
+{
+    if (dctx->lz4 == NULL)
+    {
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx->lz4, LZ4F_VERSION))) { dctx->lz4 = NULL; return 0; }
+    } else
+    {
+        LZ4F_resetDecompressionContext(dctx->lz4);
+    }
+    return 1;
+}
+
+static int pzp_lz4_decompress(struct pzp_dctx *dctx, struct pzp_source *source, void *dst, size_t size)
+{
+    unsigned char *out = (unsigned char *) dst;
+    ZSTD_inBuffer *input = &source->input;
+    while (size > 0)
+    {
+        if (input->pos == input->size) { pzp_source_refill(source); }
+
+        size_t produced = size;
+        size_t consumed = input->size - input->pos;
+        size_t ret = LZ4F_decompress(dctx->lz4, out, &produced,
+                                     (const unsigned char *) input->src + input->pos, &consumed, NULL);
+        if (LZ4F_isError(ret))
+        {
+            fprintf(stderr, "LZ4 decompression error: %s\n", LZ4F_getErrorName(ret));
+            return 0;
+        }
+        input->pos += consumed;
+        source->frameRemaining = ret;
+        if ( (consumed == 0) && (produced == 0) )
+        {
+            fprintf(stderr, "LZ4 stream ended %lu bytes early\n", (unsigned long) size);
+            return 0;
+        }
+        out  += produced;
+        size -= produced;
+    }
+    return 1;
+}
+
+static int pzp_lz4_finish(struct pzp_dctx *dctx, struct pzp_source *source)
+{
+    unsigned char spare[64];
+    while (source->frameRemaining != 0)
+    {
+        if ( (source->input.pos == source->input.size) && (!pzp_source_refill(source)) )
+        {
+            fprintf(stderr, "PZP stream ended inside the LZ4 frame\n");
+            return 0;
+        }
+        size_t produced = sizeof(spare);
+        size_t consumed = source->input.size - source->input.pos;
+        size_t ret = LZ4F_decompress(dctx->lz4, spare, &produced,
+                                     (const unsigned char *) source->input.src + source->input.pos, &consumed, NULL);
+        if ( (LZ4F_isError(ret)) || (produced != 0) )
+        {
+            fprintf(stderr, "PZP frame carries more data than its header describes\n");
+            return 0;
+        }
+        source->input.pos     += consumed;
+        source->frameRemaining = ret;
+    }
+    return 1;
+}
+#endif // PZP_LZ4
+
+/* The store backend writes the payload as is.  frameRemaining counts the payload
+   bytes not read yet, so reads never run into the next frame. */
+static int pzp_store_compress_begin(struct pzp_cctx *cctx, int level, unsigned long long dataSize)
+{
+    (void) cctx; (void) level; (void) dataSize;
+    return 1;
+}
+
+static void pzp_store_compress(struct pzp_cctx *cctx, const void *data, size_t size, int end)
+{
+    (void) end;
+    pzp_sink_write(cctx->output, data, size); // a short write marks the sink failed
+}
+
+static void pzp_store_compress_free(struct pzp_cctx *cctx) { (void) cctx; }
+
+static int pzp_store_decompress_begin(struct pzp_dctx *dctx) { (void) dctx; return 1; }
+
+static int pzp_store_decompress(struct pzp_dctx *dctx, struct pzp_source *source, void *dst, size_t size)
+{
+    (void) dctx;
+    if ( (size > source->frameRemaining) || (!pzp_source_read_raw(source, dst, size)) )
+    {
+        fprintf(stderr, "PZP stored frame ended early\n");
+        return 0;
+    }
+    if (source->frameRemaining != (size_t) PZP_SIZE_STREAMED) { source->frameRemaining -= size; }
+    return 1;
+}
+
+static int pzp_store_finish(struct pzp_dctx *dctx, struct pzp_source *source)
+{
+    (void) dctx;
+    if ( (source->frameRemaining != 0) && (source->frameRemaining != (size_t) PZP_SIZE_STREAMED) )
+    {
+        fprintf(stderr, "PZP frame carries more data than its header describes\n");
+        return 0;
+    }
+    return 1;
+}
+
+static const struct pzp_backend pzp_backends[PZP_BACKEND_COUNT] =
+{
+    { "zstd",  pzp_zstd_compress_begin,  pzp_zstd_compress,  pzp_zstd_compress_free,
+               pzp_zstd_decompress_begin, pzp_zstd_decompress, pzp_zstd_finish },
+   #if PZP_LZ4
+    { "lz4",   pzp_lz4_compress_begin,   pzp_lz4_compress,   pzp_lz4_compress_free,
+               pzp_lz4_decompress_begin,  pzp_lz4_decompress,  pzp_lz4_finish },
+   #else
+    { "lz4",   NULL, NULL, NULL, NULL, NULL, NULL },
+   #endif
+    { "store", pzp_store_compress_begin, pzp_store_compress, pzp_store_compress_free,
+               pzp_store_decompress_begin, pzp_store_decompress, pzp_store_finish },
+};
+
+/* Backend ID asked for by a configuration, or PZP_BACKEND_COUNT if it is not
+   available in this build. */
+static unsigned int pzp_backend_id(unsigned int configuration)
+{
+    unsigned int id = (configuration & PZP_BACKEND_FLAGS) >> PZP_BACKEND_SHIFT;
+    if ( (id >= PZP_BACKEND_COUNT) || (pzp_backends[id].decompress == NULL) ) { return PZP_BACKEND_COUNT; }
+    return id;
+}
+
+/* Start coding one frame with the backend of the configuration.  Returns 0, with
+   nothing left to free, if the backend is not in this build or cannot start. */
+static int pzp_cctx_begin(struct pzp_cctx *cctx, unsigned int configuration, struct pzp_sink *output,
+                          int level, unsigned long long dataSize)
+{
+    unsigned int id = pzp_backend_id(configuration);
+    if (id == PZP_BACKEND_COUNT)
+    {
+        fprintf(stderr, "Compression backend not available in this build\n");
+        return 0;
+    }
+
+    memset(cctx, 0, sizeof(*cctx));
+    cctx->backend = &pzp_backends[id];
+    cctx->output  = output;
+    if (!cctx->backend->compressBegin(cctx, level, dataSize))
+    {
+        fprintf(stderr, "Compression backend could not start the frame\n");
+        cctx->backend->compressFree(cctx);
+        return 0;
+    }
+    return 1;
+}
+
+/* Code the next bytes of the payload (end: the last ones, closing the frame). */
+static void pzp_cctx_write(struct pzp_cctx *cctx, const void *data, size_t size, int end)
+{
+    cctx->backend->compress(cctx, data, size, end);
+}
+
+static void pzp_cctx_free(struct pzp_cctx *cctx)
+{
+    cctx->backend->compressFree(cctx);
+}
+
+/* Where the stored pixel / index data goes: straight into the backend, or with
+   USE_RANS through one rANS block per chunk, written as soon as it is coded. */
+struct pzp_stored_writer
+{
+    struct pzp_cctx    *cctx;
+    struct pzp_checksum checksum;
+    struct pzp_sink     rans;       // the current coded block (USE_RANS)
+    unsigned short     *words;      // rANS scratch, one word per staged byte
+    unsigned long long  codedSize;  // all coded blocks so far
+};
+
+static void pzp_stored_write(struct pzp_stored_writer *stored, const unsigned char *data, size_t size, unsigned int contexts)
+{
+    // Planes that are not stored (constant USE_RANGE channels) must not leave empty rANS blocks
+    if (size == 0) { return; }
+    pzp_checksum_update(&stored->checksum, data, size);
+    if (stored->words == NULL)
+    {
+        pzp_cctx_write(stored->cctx, data, size, 0);
+        return;
+    }
+    stored->rans.size = 0;
+    if (!pzp_rans_encode_block(data, size, contexts, stored->words, &stored->rans))
+    {
+        fprintf(stderr, "rANS block could not be coded, out of memory\n");
+        stored->cctx->output->failed = 1;
+        return;
+    }
+    stored->codedSize += stored->rans.size;
+    pzp_cctx_write(stored->cctx, stored->rans.data, stored->rans.size, 0);
+}
+
+/* Stage the filtered planar buffers in their stored layout (bit-packed planes, run
+   tokens, sparse mask and samples or interleaved pixels) one chunk at a time and hand
+   each to the writer.  Run tokens come already encoded in runs.  Interleaved chunks
+   start on a pixel, so their rANS contexts are the internal channels. */
+static void pzp_compress_stored(unsigned char **buffers, unsigned int width, unsigned int height,
+                                unsigned int channelsInternal, unsigned int configuration,
+                                const unsigned int palette_counts[8],
+                                const unsigned char *sparseMask, size_t sparseValid,
+                                const struct pzp_sink *runs,
+                                unsigned char *staging, size_t staging_size,
+                                struct pzp_stored_writer *stored)
+{
+    size_t pixels = (size_t) width * height;
+    if (configuration & USE_SPARSE)
+    {
+        size_t maskBytes = pzp_sparse_mask_bytes(width, height);
+        for (size_t start = 0; start < maskBytes; start += staging_size)
+        {
+            size_t count = (maskBytes - start < staging_size) ? maskBytes - start : staging_size;
+            pzp_stored_write(stored, sparseMask + start, count, 1);
+        }
+        size_t chunk_values = staging_size / 2;
+        for (size_t start = 0; start < sparseValid; start += chunk_values)
+        {
+            size_t count = (sparseValid - start < chunk_values) ? sparseValid - start : chunk_values;
+            for (size_t i = 0; i < count; i++)
+            {
+                staging[2 * i]     = buffers[0][start + i];
+                staging[2 * i + 1] = buffers[1][start + i];
+            }
+            pzp_stored_write(stored, staging, 2 * count, 2);
+        }
+    } else
+    if (configuration & USE_BITPACK)
+    {
+        // Planar index data, each channel packed to its own width.
+        // Chunks start on multiples of 8 elements so every chunk is byte aligned.
+        size_t chunkElements = (size_t) PZP_CHUNK_BYTES;
+        for (unsigned int ch = 0; ch < channelsInternal; ch++)
+        {
+            unsigned int bits = pzp_plane_bits(palette_counts[ch], configuration);
+            for (size_t start = 0; start < pixels; start += chunkElements)
+            {
+                size_t count = (pixels - start < chunkElements) ? pixels - start : chunkElements;
+                size_t bytes = pzp_bitpack(buffers[ch] + start, staging, count, bits);
+                pzp_stored_write(stored, staging, bytes, 1);
+            }
+        }
+    } else
+    if (configuration & USE_RUNS)
+    {
+        for (size_t start = 0; start < runs->size; start += staging_size)
+        {
+            size_t count = (runs->size - start < staging_size) ? runs->size - start : staging_size;
+            pzp_stored_write(stored, runs->data + start, count, 1);
+        }
+    } else
+    {
+        // Interleave planar buffers → pixel/index data, one chunk at a time
+        unsigned int contexts = (channelsInternal <= PZP_RANS_MAX_CONTEXTS) ? channelsInternal : 1;
+        size_t chunk_pixels = staging_size / channelsInternal;
+        for (size_t start = 0; start < pixels; start += chunk_pixels)
+        {
+            size_t count = (pixels - start < chunk_pixels) ? pixels - start : chunk_pixels;
+            for (size_t i = 0; i < count; i++)
+                for (unsigned int ch = 0; ch < channelsInternal; ch++)
+                    staging[i * channelsInternal + ch] = buffers[ch][start + i];
+            pzp_stored_write(stored, staging, count * channelsInternal, contexts);
+        }
+    }
+}
+
+/* Write one complete PZP1 stream (size prefix + backend frame) for the planar image
+   to output.  buffers[] are filtered in place.
+   maxError is the USE_NEAR_LOSSLESS bound and is ignored without that flag.
+   level is the zstd level (LZ4 switches to HC above 1), 0 for the mode's default. */
+static int pzp_compress_frame(unsigned char **buffers,
+                              unsigned int width,unsigned int height,
+                              unsigned int bitsperpixelExternal, unsigned int channelsExternal,
+                              unsigned int bitsperpixelInternal, unsigned int channelsInternal, unsigned int configuration,
+                              unsigned int maxError, int level,
+                              struct pzp_sink *output)
+{
+    size_t pixels = (size_t) width * height;
+    if (output->failed) { return 0; }
+    #if PZP_VERBOSE
+    unsigned long long startWritten = output->written;
+    #endif
+
+    // ── Step 0: near-lossless residuals replace the pixels (and the delta filter) ─
+    if (configuration & USE_NEAR_LOSSLESS)
+    {
+        if ( (maxError == 0) || (maxError > PZP_NEAR_MAX_ERROR) || (bitsperpixelExternal != 16) ||
+             (channelsInternal != 2 * channelsExternal) || (channelsExternal > PZP_NEAR_MAX_CHANNELS) )
+        {
+            fprintf(stderr, "Near-lossless mode needs 16-bit samples, up to %u channels and a max error of 1..%u, storing losslessly\n",
+                    PZP_NEAR_MAX_CHANNELS, PZP_NEAR_MAX_ERROR);
+            configuration &= ~USE_NEAR_LOSSLESS;
+        } else
+        {
+            PZP_REPORT("Near-lossless mode: max error %u\n", maxError);
+            configuration &= ~USE_RLE;
+            pzp_near_quantize(buffers, channelsExternal, width, height, maxError);
+        }
+    }
+    if (!(configuration & USE_NEAR_LOSSLESS)) { maxError = 0; }
+
+    // ── Step 1: palette encoding (must precede delta filter) ─────────────────
+    // Operates on the original pixel values in the planar buffers[].
+    unsigned char palette[8][256];
+    unsigned int  palette_counts[8] = { 0 };
+    unsigned int  paletteDataBytes = 0;
+
+    if ( (configuration & USE_PALETTE) && (channelsInternal > 8) )
+    {
+        fprintf(stderr, "Palette mode supports up to 8 internal channels, disabling it\n");
+        configuration &= ~USE_PALETTE;
+    }
+
+    if (configuration & USE_PALETTE)
+    {
+        paletteDataBytes = pzp_palette_build_and_encode(
+                buffers, pixels, channelsInternal, palette, palette_counts);
+        PZP_REPORT("Palette mode: %u channels, palette data %u bytes\n",
+                   channelsInternal, paletteDataBytes);
+        for (unsigned int ch = 0; ch < channelsInternal; ch++)
+            PZP_REPORT("  ch%u: %u unique values\n", ch, palette_counts[ch]);
+    }
+
+    // Run tokens replace both the delta filter and bit-packing
+    if (configuration & USE_RUNS) { configuration &= ~USE_RLE; }
+
+    // Bit-packing is decided here from the palette counts, never by the caller.
+    configuration &= ~USE_BITPACK;
+    if ( (configuration & USE_PALETTE) && (!(configuration & USE_RUNS)) )
+    {
+        for (unsigned int ch = 0; ch < channelsInternal; ch++)
+            if (pzp_palette_bits(palette_counts[ch]) < 8) { configuration |= USE_BITPACK; }
+    }
+
+    // Sparse depth is asked for by the caller and kept only for single channel 16-bit
+    // images with some zero samples, whose delta filter it replaces.
+    unsigned char *sparseMask  = NULL;
+    size_t         sparseValid = 0;
+    if ( (configuration & USE_SPARSE) &&
+         ( (!(configuration & USE_RLE)) || (configuration & (USE_PALETTE | USE_RUNS | USE_NEAR_LOSSLESS)) ||
+           (bitsperpixelExternal != 16) || (channelsExternal != 1) || (channelsInternal != 2) ||
+           (!pzp_sparse_has_zeros(buffers, pixels)) ) )
+        { configuration &= ~USE_SPARSE; }
+    if (configuration & USE_SPARSE)
+    {
+        sparseMask = (unsigned char *) pzp_allocator_alloc(output->allocator, pzp_sparse_mask_bytes(width, height) + 1);
+        if (!sparseMask)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            output->failed = 1;
+            return 0;
+        }
+        sparseValid = pzp_sparse_filter(buffers, width, height, sparseMask);
+        configuration = (configuration & ~USE_RLE) | USE_SPARSE;
+        PZP_REPORT("Sparse depth: %zu of %zu samples valid, mask %zu bytes\n",
+                   sparseValid, pixels, pzp_sparse_mask_bytes(width, height));
+    }
+
+    // 16-bit samples are delta filtered as whole samples (USE_DELTA16, decided here).
+    configuration &= ~USE_DELTA16;
+    if ( (configuration & USE_RLE) && (!(configuration & USE_PALETTE)) && (bitsperpixelExternal == 16) &&
+         (channelsInternal == 2 * channelsExternal) && (channelsExternal <= PZP_DELTA16_MAX_CHANNELS) )
+    {
+        PZP_REPORT("Using 16-bit delta filter (%u channels)\n", channelsExternal);
+        pzp_delta16_filter(buffers, channelsExternal, width, height);
+        configuration = (configuration & ~USE_RLE) | USE_DELTA16;
+    }
+
+    // The colour transform is asked for by the caller and kept only where it applies
+    if ( (configuration & USE_YCOCG) &&
+         ( (!(configuration & USE_RLE)) || (configuration & (USE_PALETTE | USE_RUNS | USE_NEAR_LOSSLESS)) ||
+           (bitsperpixelExternal != 8) || (channelsExternal != 3) || (channelsInternal != 3) ) )
+        { configuration &= ~USE_YCOCG; }
+    if (configuration & USE_YCOCG)
+    {
+        PZP_REPORT("Using YCoCg-R colour transform\n");
+        pzp_ycocg_forward(buffers, pixels);
+    }
+
+    // Without a palette, narrow or constant channels are range reduced (also decided here).
+    configuration &= ~USE_RANGE;
+    unsigned int rangeBase[8] = { 0 };
+    int rangeWide = (bitsperpixelExternal == 16) && (channelsInternal == 2 * channelsExternal);
+    if (!(configuration & (USE_PALETTE | USE_RUNS | USE_SPARSE)))
+    {
+        paletteDataBytes = pzp_range_build_and_encode(buffers, pixels, channelsExternal, channelsInternal,
+                                                      bitsperpixelExternal, palette, palette_counts, rangeBase);
+        if (paletteDataBytes > 0)
+        {
+            configuration |= USE_RANGE | USE_BITPACK;
+            PZP_REPORT("Range mode: %u channels, range table %u bytes\n", channelsInternal, paletteDataBytes);
+            for (unsigned int ch = 0; ch < channelsInternal; ch++)
+                PZP_REPORT("  ch%u: [%u, %u] in %u bits\n", ch, palette[ch][0],
+                           palette[ch][0] + palette_counts[ch] - 1, pzp_plane_bits(palette_counts[ch], configuration));
+        }
+    }
+
+    // ── Step 2: delta / RLE filter (on palette indices if USE_PALETTE) ───────
+    if (configuration & USE_RLE)
+    {
+        PZP_REPORT("Using RLE for compression (mode %u)\n", configuration);
+        pzp_RLE_filter(buffers, channelsInternal, width, height);
+    }
+
+    // A single row of run tokens may exceed the chunk size on very wide images
+    size_t staging_size = PZP_CHUNK_BYTES;
+    if ( (configuration & USE_RUNS) && ((size_t) width * (channelsInternal + 1) > staging_size) )
+        staging_size = (size_t) width * (channelsInternal + 1);
+
+    unsigned char *staging = (unsigned char *)pzp_allocator_alloc(output->allocator, staging_size);
+    if (!staging)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        pzp_allocator_free(output->allocator, sparseMask);
+        output->failed = 1;
+        return 0;
+    }
+
+    // ── Step 3: size of the uncompressed payload ──────────────────────────────
+    size_t pixel_data_size = pixels * (bitsperpixelInternal / 8) * channelsInternal;
+    if (configuration & USE_BITPACK)
+        pixel_data_size = pzp_bitpacked_total_size(pixels, channelsInternal, palette_counts, configuration);
+    if (configuration & USE_SPARSE)
+        pixel_data_size = pzp_sparse_mask_bytes(width, height) + 2 * sparseValid;
+
+    // Run tokens are only sized by encoding them, so they are encoded once, into memory
+    struct pzp_sink runs;
+    pzp_sink_memory(&runs);
+    runs.allocator = output->allocator;
+    if (configuration & USE_RUNS)
+    {
+        size_t rowBytes = (size_t) width * (channelsInternal + 1);
+        unsigned int rowsPerChunk = (unsigned int) (staging_size / rowBytes);
+        for (unsigned int y = 0; (y < height) && (!runs.failed); y += rowsPerChunk)
+        {
+            unsigned int rowEnd = (height - y < rowsPerChunk) ? height : y + rowsPerChunk;
+            size_t bytes = pzp_runs_encode(buffers, channelsInternal, width, y, rowEnd, staging);
+            pzp_sink_write(&runs, staging, bytes);
+        }
+        pixel_data_size = runs.size;
+        if (runs.failed)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            output->failed = 1;
+        }
+    }
+
+    // rANS blocks are framed by the store backend, a second entropy pass gains nothing
+    if ( (configuration & USE_RANS) && ((configuration & PZP_BACKEND_FLAGS) != USE_STORE) )
+    {
+        PZP_REPORT("rANS coded data is stored without a compression backend\n");
+        configuration = (configuration & ~PZP_BACKEND_FLAGS) | USE_STORE;
+    }
+
+    // Use higher level when palette mode is active
+    int zstd_level = (level > 0) ? level : (configuration & USE_PALETTE) ? 19 : 1;
+    unsigned int backend = pzp_backend_id(configuration);
+    struct pzp_cctx cctx;
+
+    struct pzp_stored_writer stored;
+    memset(&stored, 0, sizeof(stored));
+    stored.cctx = &cctx;
+    pzp_checksum_init(&stored.checksum); // covers only the index/pixel data (not the palette prefix)
+
+    // The size of rANS coded data is only known once it is written
+    unsigned long long rawSize  = (unsigned long long) headerSize + paletteDataBytes + pixel_data_size + trailerSize;
+    unsigned long long dataSize = (configuration & USE_RANS) ? PZP_SIZE_STREAMED : rawSize;
+    unsigned long long ransSection[2] = { pixel_data_size, PZP_SIZE_STREAMED };
+    if (configuration & USE_RANS)
+    {
+        pzp_sink_memory(&stored.rans);
+        stored.rans.allocator = output->allocator;
+        stored.words = (unsigned short *) pzp_allocator_alloc(output->allocator, staging_size * sizeof(unsigned short));
+        if (!stored.words) { fprintf(stderr, "Memory allocation failed\n"); output->failed = 1; }
+    }
+
+    // PZP1 prefix, see prefixSizeV1, then the backend starts its frame
+    pzp_sink_write(output, &backend, sizeof(unsigned int));
+    pzp_sink_write(output, &dataSize, sizeof(unsigned long long));
+    if ( (output->failed) || (!pzp_cctx_begin(&cctx, configuration, output, zstd_level, dataSize)) )
+    {
+        output->failed = 1;
+        pzp_sink_release(&runs);
+        pzp_sink_release(&stored.rans);
+        pzp_allocator_free(output->allocator, stored.words);
+        pzp_allocator_free(output->allocator, staging);
+        pzp_allocator_free(output->allocator, sparseMask);
+        return 0;
+    }
+
+    // ── Step 4: header and palette prefix ─────────────────────────────────────
+    unsigned int  header[10];
+    unsigned char paletteData[8 * 257];
+
+    header[0] = convert_header(pzp_header);
+    header[1] = bitsperpixelExternal;
+    header[2] = channelsExternal;
+    header[3] = width;
+    header[4] = height;
+    header[5] = bitsperpixelInternal;
+    header[6] = channelsInternal;
+    header[7] = maxError;          /* PZP1 keeps the checksum in the trailer */
+    header[8] = configuration;
+    header[9] = paletteDataBytes;  /* formerly "unused" */
+
+    if (configuration & USE_RANGE)
+        pzp_range_write(paletteData, channelsExternal, channelsInternal, rangeWide, palette, palette_counts, rangeBase);
+    else if (paletteDataBytes > 0)
+        pzp_palette_write(paletteData, channelsInternal, palette, palette_counts);
+
+    // ── Step 5: stream header, palette and pixel/index data through the backend ─
+    pzp_cctx_write(&cctx, header, headerSize, 0);
+    if (paletteDataBytes > 0)
+        pzp_cctx_write(&cctx, paletteData, paletteDataBytes, 0);
+
+    if (configuration & USE_RANS)
+        pzp_cctx_write(&cctx, ransSection, PZP_RANS_SECTION_HEADER, 0);
+    pzp_compress_stored(buffers, width, height, channelsInternal, configuration, palette_counts,
+                        sparseMask, sparseValid, &runs, staging, staging_size, &stored);
+    pzp_sink_release(&runs);
+    if (configuration & USE_RANS)
+    {
+        PZP_REPORT("rANS: %llu bytes of pixel data coded to %llu\n", ransSection[0], stored.codedSize);
+        pzp_sink_release(&stored.rans);
+        pzp_allocator_free(output->allocator, stored.words);
+    }
+
+    unsigned int checksumTrailer = pzp_checksum_final(&stored.checksum);
+    pzp_cctx_write(&cctx, &checksumTrailer, trailerSize, 1);
+
+    #if PZP_VERBOSE
+    fprintf(stderr, "Storing %ux%ux%u@%ubit/%u@%ubit | mode %u | palette %u B | CRC:0x%X\n",
+            width, height, channelsExternal, bitsperpixelExternal,
+            channelsInternal, bitsperpixelInternal,
+            configuration, paletteDataBytes, checksumTrailer);
+    fprintf(stderr, "Compression Ratio : %0.2f\n", (float)rawSize / (output->written - startWritten));
+    #endif
+
+    pzp_cctx_free(&cctx);
+    pzp_allocator_free(output->allocator, staging);
+    pzp_allocator_free(output->allocator, sparseMask);
+    return !output->failed;
+}
+
+/* Halve a planar image in both directions (odd sizes round up, the last row /
+   column is repeated).  Each group of channelsInternal/channelsExternal buffers
+   holds one big-endian value, so 16-bit samples are averaged as 16-bit.
+   nearest keeps the top-left sample instead of the 2x2 mean: palette and run
+   encoded images are label maps, where a mean would invent new labels. */
+static void pzp_pyramid_downsample(unsigned char **src, unsigned char **dst,
+                                   unsigned int channelsExternal, unsigned int channelsInternal,
+                                   unsigned int width, unsigned int height, int nearest)
+{
+    unsigned int outWidth  = (width  + 1) / 2;
+    unsigned int outHeight = (height + 1) / 2;
+    unsigned int group     = channelsInternal / channelsExternal;
+
+    for (unsigned int y = 0; y < outHeight; y++)
+    {
+        size_t row0 = (size_t) (2 * y) * width;
+        size_t row1 = (2 * y + 1 < height) ? row0 + width : row0;
+        size_t out  = (size_t) y * outWidth;
+
+        for (unsigned int x = 0; x < outWidth; x++)
+        {
+            size_t x0 = 2 * x;
+            size_t x1 = (2 * x + 1 < width) ? x0 + 1 : x0;
+
+            for (unsigned int c = 0; c < channelsInternal; c += group)
+            {
+                if (nearest)
+                {
+                    for (unsigned int g = 0; g < group; g++)
+                        dst[c + g][out + x] = src[c + g][row0 + x0];
+                    continue;
+                }
+
+                unsigned int sum = 0;
+                if (group == 2)
+                {
+                    sum = (src[c][row0 + x0] << 8 | src[c + 1][row0 + x0]) + (src[c][row0 + x1] << 8 | src[c + 1][row0 + x1]) +
+                          (src[c][row1 + x0] << 8 | src[c + 1][row1 + x0]) + (src[c][row1 + x1] << 8 | src[c + 1][row1 + x1]);
+                    sum = (sum + 2) >> 2;
+                    dst[c][out + x]     = (unsigned char) (sum >> 8);
+                    dst[c + 1][out + x] = (unsigned char) (sum & 0xFF);
+                } else
+                {
+                    sum = src[c][row0 + x0] + src[c][row0 + x1] + src[c][row1 + x0] + src[c][row1 + x1];
+                    dst[c][out + x] = (unsigned char) ((sum + 2) >> 2);
+                }
+            }
+        }
+    }
+}
+
+/* pzp_compress_to_sink at an explicit zstd level instead of the mode's default
+   (see pzp_compress_frame); the level is not stored, decoding does not need it. */
+static int pzp_compress_to_sink_level(unsigned char **buffers,
+                              unsigned int width,unsigned int height,
+                              unsigned int bitsperpixelExternal, unsigned int channelsExternal,
+                              unsigned int bitsperpixelInternal, unsigned int channelsInternal, unsigned int configuration,
+                              unsigned int maxError, int level,
+                              struct pzp_sink *output)
+{
+    unsigned long long base = output->written;
+
+    // ── Pyramid levels are derived from the original pixels, so build them all
+    //    before the main frame filters buffers[] in place ─────────────────────
+    unsigned int  levels = 0;
+    unsigned int  levelWidth[PZP_PYRAMID_MAX_LEVELS + 1]  = { width };
+    unsigned int  levelHeight[PZP_PYRAMID_MAX_LEVELS + 1] = { height };
+    unsigned char **levelBuffers[PZP_PYRAMID_MAX_LEVELS + 1] = { buffers };
+
+    if ( (configuration & USE_PYRAMID) && (channelsExternal != 0) && (channelsInternal % channelsExternal == 0) )
+    {
+        int nearest = ( (configuration & (USE_PALETTE | USE_RUNS)) != 0 );
+        while (levels < PZP_PYRAMID_MAX_LEVELS)
+        {
+            unsigned int w = (levelWidth[levels]  + 1) / 2;
+            unsigned int h = (levelHeight[levels] + 1) / 2;
+            if ( (w < PZP_PYRAMID_MIN_SIDE) || (h < PZP_PYRAMID_MIN_SIDE) ) { break; }
+
+            unsigned char **level = (unsigned char **) pzp_allocator_alloc(output->allocator, channelsInternal * sizeof(unsigned char *));
+            unsigned char  *data  = (unsigned char *)  pzp_allocator_alloc(output->allocator, (size_t) w * h * channelsInternal);
+            if ( (!level) || (!data) )
+            {
+                fprintf(stderr, "Memory allocation failed\n");
+                pzp_allocator_free(output->allocator, data);
+                pzp_allocator_free(output->allocator, level);
+                output->failed = 1;
+                break;
+            }
+            for (unsigned int ch = 0; ch < channelsInternal; ch++)
+                level[ch] = data + (size_t) ch * w * h;
+
+            pzp_pyramid_downsample(levelBuffers[levels], level, channelsExternal, channelsInternal,
+                                   levelWidth[levels], levelHeight[levels], nearest);
+            levels++;
+            levelWidth[levels]   = w;
+            levelHeight[levels]  = h;
+            levelBuffers[levels] = level;
+        }
+        PZP_REPORT("Pyramid: %u levels below %ux%u\n", levels, width, height);
+    }
+    if (levels == 0) { configuration &= ~USE_PYRAMID; }
+
+    int ok = pzp_compress_frame(buffers, width, height,
+                                bitsperpixelExternal, channelsExternal,
+                                bitsperpixelInternal, channelsInternal,
+                                configuration, maxError, level, output);
+
+    if (levels > 0)
+    {
+        unsigned long long index[PZP_PYRAMID_MAX_LEVELS * 2];
+        for (unsigned int l = 1; l <= levels; l++)
+        {
+            unsigned long long start = output->written - base;
+            ok = pzp_compress_frame(levelBuffers[l], levelWidth[l], levelHeight[l],
+                                    bitsperpixelExternal, channelsExternal,
+                                    bitsperpixelInternal, channelsInternal,
+                                    configuration & ~USE_PYRAMID, maxError, level, output) && ok;
+            index[2 * (l - 1)]     = start;
+            index[2 * (l - 1) + 1] = output->written - base - start;
+
+            pzp_allocator_free(output->allocator, levelBuffers[l][0]);
+            pzp_allocator_free(output->allocator, levelBuffers[l]);
+        }
+
+        pzp_sink_write(output, index, sizeof(unsigned long long) * 2 * levels);
+        pzp_sink_write(output, &levels, sizeof(unsigned int));
+        pzp_sink_write(output, pzp_pyramid_magic, 4);
+    }
+    return (ok) && (!output->failed);
+}
+
+/* Compress the planar image into a sink (see struct pzp_sink).  maxError is the
+   USE_NEAR_LOSSLESS bound and is ignored without that flag.  Pyramid index
+   offsets count from the first byte this call writes.  Returns 1 on success, 0
+   if the sink failed or the backend is not available. */
+static int pzp_compress_to_sink(unsigned char **buffers,
+                              unsigned int width,unsigned int height,
+                              unsigned int bitsperpixelExternal, unsigned int channelsExternal,
+                              unsigned int bitsperpixelInternal, unsigned int channelsInternal, unsigned int configuration,
+                              unsigned int maxError,
+                              struct pzp_sink *output)
+{
+    return pzp_compress_to_sink_level(buffers, width, height,
+                                      bitsperpixelExternal, channelsExternal,
+                                      bitsperpixelInternal, channelsInternal,
+                                      configuration, maxError, 0, output);
+}
+
+/* pzp_compress_combined with a USE_NEAR_LOSSLESS error bound: every decoded
+   16-bit sample is within ±maxError of the original.  Returns 1 on success, 0 if
+   the file cannot be written. */
+static int pzp_compress_combined_near(unsigned char **buffers,
+                              unsigned int width,unsigned int height,
+                              unsigned int bitsperpixelExternal, unsigned int channelsExternal,
+                              unsigned int bitsperpixelInternal, unsigned int channelsInternal, unsigned int configuration,
+                              unsigned int maxError,
+                              const char *output_filename)
+{
+    FILE *output = fopen(output_filename, "wb");
+    if (!output)
+    {
+        fprintf(stderr, "Could not open %s for writing\n", output_filename);
+        return 0;
+    }
+
+    struct pzp_sink sink;
+    pzp_sink_file(&sink, output);
+    int result = pzp_compress_to_sink(buffers, width, height,
+                                      bitsperpixelExternal, channelsExternal,
+                                      bitsperpixelInternal, channelsInternal,
+                                      configuration, maxError, &sink);
+
+    if ( (fclose(output) != 0) || (!result) )
+    {
+        fprintf(stderr, "Could not write %s\n", output_filename);
+        return 0;
+    }
+    return 1;
+}
+
+static int pzp_compress_combined(unsigned char **buffers,
+                              unsigned int width,unsigned int height,
+                              unsigned int bitsperpixelExternal, unsigned int channelsExternal,
+                              unsigned int bitsperpixelInternal, unsigned int channelsInternal, unsigned int configuration,
+                              const char *output_filename)
+{
+    return pzp_compress_combined_near(buffers, width, height,
+                                      bitsperpixelExternal, channelsExternal,
+                                      bitsperpixelInternal, channelsInternal,
+                                      configuration & ~USE_NEAR_LOSSLESS, 0, output_filename);
+}
+
+/* Encode interleaved (HWC) pixels to a file: 8-bit samples, 16-bit ones either
+   big-endian as in PNM or native-endian unsigned shorts when native16 is set.
+   Returns 1 on success, 0 if the description is invalid, memory runs out or the
+   file cannot be written. */
+static int pzp_compress_interleaved(const void *pixels, int native16,
+                                    unsigned int width, unsigned int height,
+                                    unsigned int bitsperpixel, unsigned int channels,
+                                    unsigned int configuration, unsigned int maxError,
+                                    const char *output_filename)
+{
+    if ( (!pixels) || (!output_filename) || (width == 0) || (height == 0) ||
+         ( (bitsperpixel != 8) && (bitsperpixel != 16) ) || (channels == 0) )
+        { return 0; }
+
+    // 16-bit images are split into two 8-bit internal channels per original channel.
+    unsigned int bitsperpixelInternal = (bitsperpixel == 16) ? 8 : bitsperpixel;
+    unsigned int channelsInternal     = (bitsperpixel == 16) ? channels * 2 : channels;
+    size_t       plane                = (size_t) width * height;
+
+    unsigned char **buffers = (unsigned char **) pzp_alloc(channelsInternal * sizeof(unsigned char *));
+    unsigned char  *planes  = (unsigned char *)  pzp_alloc(plane * channelsInternal);
+    if ( (!buffers) || (!planes) )
+    {
+        pzp_dealloc(planes);
+        pzp_dealloc(buffers);
+        return 0;
+    }
+    for (unsigned int ch = 0; ch < channelsInternal; ch++)
+        buffers[ch] = planes + (size_t) ch * plane;
+
+    if ( (native16) && (bitsperpixel == 16) )
+        pzp_split_channels_native16((const unsigned short *) pixels, buffers, channels, width, height);
+    else
+        pzp_split_channels((const unsigned char *) pixels, buffers, channelsInternal, width, height);
+
+    // RLE filter and palette encoding are handled inside pzp_compress_combined.
+    int result = pzp_compress_combined_near(buffers, width, height,
+                                            bitsperpixel, channels,
+                                            bitsperpixelInternal, channelsInternal,
+                                            configuration, maxError, output_filename);
+
+    pzp_dealloc(planes);
+    pzp_dealloc(buffers);
+    return result;
+}
+
+// ─── Multi-layer frames ─────────────────────────────────────────────────────
+
+/* One layer of a multi-layer frame (see pzp_layers_magic).  The encoder reads
+   pixels, width … maxError; decoders fill them in, with pixels a new buffer to
+   pzp_dealloc() and configuration / maxError as stored. */
+struct pzp_layer
+{
+    unsigned char *pixels;        // interleaved (HWC), 16-bit samples big-endian as in PNM
+    unsigned int   width, height;
+    unsigned int   bitsperpixel;  // per sample, 8 or 16
+    unsigned int   channels;
+    unsigned int   configuration; // USE_* flags of this layer
+    unsigned int   maxError;      // USE_NEAR_LOSSLESS bound
+    unsigned int   native16;      // encoder only: 16-bit samples are native-endian unsigned shorts
+};
+
+struct pzp_layer_job
+{
+    const struct pzp_layer *layer;
+    struct pzp_sink         sink;  // the encoded layer
+    struct pzp_allocator    allocator; // the output's, layers are encoded on other threads
+    pthread_t               thread;
+    int                     started;
+    int                     ok;    // the layer was encoded
+};
+
+/* Encode one layer into job->sink (a memory sink), on a thread of its own. */
+static void * pzp_layer_encode(void *argument)
+{
+    struct pzp_layer_job   *job   = (struct pzp_layer_job *) argument;
+    const struct pzp_layer *layer = job->layer;
+
+    unsigned int bitsperpixelInternal = (layer->bitsperpixel == 16) ? 8 : layer->bitsperpixel;
+    unsigned int channelsInternal     = (layer->bitsperpixel == 16) ? layer->channels * 2 : layer->channels;
+    size_t       plane                = (size_t) layer->width * layer->height;
+
+    unsigned char **buffers = (unsigned char **) pzp_allocator_alloc(&job->allocator, channelsInternal * sizeof(unsigned char *));
+    unsigned char  *planes  = (unsigned char *)  pzp_allocator_alloc(&job->allocator, plane * channelsInternal);
+    pzp_sink_memory(&job->sink);
+    job->sink.allocator = &job->allocator;
+    if ( (!buffers) || (!planes) )
+    {
+        pzp_allocator_free(&job->allocator, planes);
+        pzp_allocator_free(&job->allocator, buffers);
+        return NULL;
+    }
+    for (unsigned int ch = 0; ch < channelsInternal; ch++)
+        buffers[ch] = planes + (size_t) ch * plane;
+
+    if ( (layer->native16) && (layer->bitsperpixel == 16) )
+        pzp_split_channels_native16((const unsigned short *) layer->pixels, buffers, layer->channels, layer->width, layer->height);
+    else
+        pzp_split_channels(layer->pixels, buffers, channelsInternal, layer->width, layer->height);
+
+    job->ok = pzp_compress_to_sink(buffers, layer->width, layer->height,
+                                   layer->bitsperpixel, layer->channels,
+                                   bitsperpixelInternal, channelsInternal,
+                                   layer->configuration | USE_LAYERS, layer->maxError, &job->sink);
+
+    pzp_allocator_free(&job->allocator, planes);
+    pzp_allocator_free(&job->allocator, buffers);
+    return NULL;
+}
+
+/* 1 if every layer can be encoded. */
+static int pzp_layers_check(const struct pzp_layer *layers, unsigned int count)
+{
+    if ( (layers == NULL) || (count == 0) || (count > PZP_MAX_LAYERS) )
+    {
+        fprintf(stderr, "A multi-layer frame holds 1..%u layers, not %u\n", PZP_MAX_LAYERS, count);
+        return 0;
+    }
+    for (unsigned int l = 0; l < count; l++)
+    {
+        if ( (layers[l].pixels == NULL) || (layers[l].width == 0) || (layers[l].height == 0) || (layers[l].channels == 0) ||
+             ( (layers[l].bitsperpixel != 8) && (layers[l].bitsperpixel != 16) ) )
+        {
+            fprintf(stderr, "Layer %u: %ux%ux%u@%ubit cannot be encoded\n", l,
+                    layers[l].width, layers[l].height, layers[l].channels, layers[l].bitsperpixel);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Write `count` layers as one multi-layer frame.  Each layer keeps its own mode
+   (USE_RLE, USE_PALETTE, USE_RUNS, USE_PYRAMID, USE_NEAR_LOSSLESS …); they are
+   encoded in parallel and written in order, followed by the layer index; the
+   output's allocator (or the default) is then called from the encoding threads
+   too.  Returns 1 on success, 0 if a layer description is invalid, a layer could not
+   be encoded or the sink failed. */
+static int pzp_compress_layers_to_sink(const struct pzp_layer *layers, unsigned int count, struct pzp_sink *output)
+{
+    if (!pzp_layers_check(layers, count)) { return 0; }
+
+    // ── Step 1: encode every layer into its own memory sink, in parallel ─────
+    struct pzp_layer_job jobs[PZP_MAX_LAYERS];
+    memset(jobs, 0, sizeof(jobs));
+    for (unsigned int l = 0; l < count; l++)
+    {
+        jobs[l].layer     = &layers[l];
+        jobs[l].allocator = (output->allocator != NULL) ? *output->allocator : pzp_get_allocator();
+    }
+    for (unsigned int l = 1; l < count; l++)
+        jobs[l].started = (pthread_create(&jobs[l].thread, NULL, pzp_layer_encode, &jobs[l]) == 0);
+
+    pzp_layer_encode(&jobs[0]);
+    for (unsigned int l = 1; l < count; l++)
+    {
+        if (jobs[l].started) { pthread_join(jobs[l].thread, NULL); }
+                        else { pzp_layer_encode(&jobs[l]); }
+    }
+
+    // ── Step 2: the layers back to back, then the index ──────────────────────
+    int ok = 1;
+    unsigned long long base = output->written;
+    unsigned long long index[PZP_MAX_LAYERS * 2];
+    for (unsigned int l = 0; l < count; l++)
+    {
+        if (!jobs[l].ok) { fprintf(stderr, "Layer %u could not be encoded\n", l); ok = 0; }
+        index[2 * l]     = output->written - base;
+        index[2 * l + 1] = jobs[l].sink.size;
+        if (ok) { pzp_sink_write(output, jobs[l].sink.data, jobs[l].sink.size); }
+        pzp_sink_release(&jobs[l].sink);
+    }
+    if (!ok) { return 0; }
+
+    pzp_sink_write(output, index, sizeof(unsigned long long) * 2 * count);
+    pzp_sink_write(output, &count, sizeof(unsigned int));
+    pzp_sink_write(output, pzp_layers_magic, 4);
+
+    PZP_REPORT("Layers: %u in %llu bytes\n", count, output->written - base);
+    return !output->failed;
+}
+
+static int pzp_compress_layers(const struct pzp_layer *layers, unsigned int count, const char *output_filename)
+{
+    if (!pzp_layers_check(layers, count)) { return 0; }
+
+    FILE *output = fopen(output_filename, "wb");
+    if (!output)
+    {
+        fprintf(stderr, "Could not open %s for writing\n", output_filename);
+        return 0;
+    }
+
+    struct pzp_sink sink;
+    pzp_sink_file(&sink, output);
+    int result = pzp_compress_layers_to_sink(layers, count, &sink);
+
+    if (fclose(output) != 0)
+    {
+        fprintf(stderr, "Could not write %s\n", output_filename);
+        return 0;
+    }
+    return result;
+}
+
+//-----------------------------------------------------------------------------------------------
+//-----------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------
+#if INTEL_OPTIMIZATIONS
+static void pzp_prefix_sum_sse2(unsigned char *src, unsigned char *dst, size_t size)
+{
+    __m128i carry = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 15 < size; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((__m128i *)(src + i));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi8(v, carry);
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+        unsigned char last = (unsigned char)_mm_cvtsi128_si32(_mm_srli_si128(v, 15));
+        carry = _mm_set1_epi8((char)last);
+    }
+    for (; i < size; i++)
+        dst[i] = src[i] + (i > 0 ? dst[i - 1] : 0);
+}
+
+static void pzp_extractAndReconstruct_SSE2(unsigned char *decompressed_bytes, unsigned char *reconstructed, unsigned int width, unsigned int height, unsigned int channels, int restoreRLEChannels)
+{
+    size_t total_size = (size_t) width * height;
+    unsigned char *src = decompressed_bytes;
+    unsigned char *r   = reconstructed;
+
+    if (restoreRLEChannels)
+    {
+        switch (channels)
+        {
+            case 1:
+            {
+                pzp_prefix_sum_sse2(src, r, total_size);
+                break;
+            }
+            case 2:
+            {
+                // Each channel accumulates independently with stride 2.
+                // Kogge-Stone with shifts 2, 4, 8 covers all 8 pixel pairs in 16 bytes.
+                // Carry = last pixel (2 bytes), broadcast to all 8 pixel positions.
+                __m128i carry = _mm_setzero_si128();
+                size_t i = 0;
+
+                for (; i + 7 < total_size; i += 8)
+                {
+                    __m128i v = _mm_loadu_si128((__m128i *)(src + i * 2));
+
+                    // Within-block prefix sum per channel (stride 2)
+                    v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+                    v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+                    v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+
+                    // Add cross-block carry to every element
+                    v = _mm_add_epi8(v, carry);
+                    _mm_storeu_si128((__m128i *)(r + i * 2), v);
+
+                    // Carry: last 2 bytes (one pixel) broadcast to all 8 pixel positions.
+                    // _mm_set1_epi16 replicates a 16-bit pattern to all 8 epi16 lanes,
+                    // which is exactly the [ch0_acc, ch1_acc] pair repeated 8 times.
+                    int tmp = _mm_cvtsi128_si32(_mm_srli_si128(v, 14));
+                    carry = _mm_set1_epi16((short)(tmp & 0xFFFF));
+                }
+
+                // Scalar tail (also handles total_size < 8)
+                for (; i < total_size; i++)
+                {
+                    r[i * 2]     = src[i * 2]     + (i > 0 ? r[(i - 1) * 2]     : 0);
+                    r[i * 2 + 1] = src[i * 2 + 1] + (i > 0 ? r[(i - 1) * 2 + 1] : 0);
+                }
+                break;
+            }
+            case 3:
+            {
+                // Scalar prefix sum for 3-channel interleaved data.
+                r[0] = src[0]; r[1] = src[1]; r[2] = src[2];
+                for (size_t i = 1; i < total_size; i++)
+                {
+                    r[i*3]   = src[i*3]   + r[(i-1)*3];
+                    r[i*3+1] = src[i*3+1] + r[(i-1)*3+1];
+                    r[i*3+2] = src[i*3+2] + r[(i-1)*3+2];
+                }
+                break;
+            }
+            default:
+            {
+                for (unsigned int ch = 0; ch < channels; ch++) { r[ch] = src[ch]; }
+                for (size_t i = 1; i < total_size; i++)
+                {
+                    for (unsigned int ch = 0; ch < channels; ch++)
+                    {
+                        r[i * channels + ch] = src[i * channels + ch] + r[(i - 1) * channels + ch];
+                    }
+                }
+                break;
+            }
+        }
+    }
+    else // Non-RLE: data is already in final interleaved layout
+    {
+        memcpy(r, src, total_size * channels);
+    }
+}
+
+
+static void pzp_memcpy_avx2(unsigned char *dst, unsigned char *src, size_t size)
+{
+    size_t i = 0;
+    __m256i v;
+
+    // Process 32 bytes at a time
+    for (; i + 31 < size; i += 32)
+    {
+        v = _mm256_loadu_si256((__m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), v);
+    }
+
+    // Process remaining bytes
+    for (; i < size; i++)
+    {
+        dst[i] = src[i];
+    }
+}
+
+/**
+ * @brief Computes the prefix sum of an array using AVX2 SIMD operations.
+ *
+ * This function processes an array of unsigned 8-bit integers (bytes) in chunks of 32 bytes at a time,
+ * using AVX2 intrinsics to perform vectorized addition. The prefix sum means that each element in the
+ * output is the sum of all previous elements including itself, i.e.,
+ *
+ *      dst[i] = src[i] + dst[i-1]
+ *
+ * The algorithm leverages SIMD parallelism for faster execution by processing 32 elements in a single iteration.
+ *
+ * @param src  Pointer to the source array of unsigned 8-bit integers.
+ * @param dst  Pointer to the destination array where the computed prefix sum will be stored.
+ * @param size Number of elements in the source array. Must be a multiple of 32 for best performance.
+ * @note
+ * - The function assumes `size` is a multiple of 32 for optimal performance. If not, a scalar fallback is needed.
+ * - This implementation is efficient for **short sequences** but not ideal for very long sequences,
+ *   as it does not fully exploit SIMD-friendly prefix sum techniques like **Hillis-Steele scan**.
+ * - If processing very large arrays, consider a **two-pass approach** to propagate values properly across blocks.
+ * - Works best when `src` and `dst` are **aligned** to 32-byte boundaries, though `_mm256_loadu_si256`
+ *   handles unaligned memory safely but slightly slower than aligned `_mm256_load_si256`.
+ */
+static void pzp_prefix_sum_avx2(unsigned char *src, unsigned char *dst, size_t size)
+{
+    // 1-channel prefix sum: dst[i] = src[i] + dst[i-1], processing 32 bytes per iteration.
+    //
+    // AVX2 key constraint: _mm256_slli_si256 shifts within each 128-bit lane independently.
+    // It cannot propagate across the lane boundary.  We handle this in two explicit steps:
+    //
+    //   Step 1 – Kogge-Stone within each 16-byte lane (shifts 1, 2, 4, 8).
+    //            Lane 0 (bytes  0-15): correct prefix sums from byte 0.
+    //            Lane 1 (bytes 16-31): correct prefix sums from byte 16 only (missing carry).
+    //
+    //   Step 2 – Cross-lane carry: extract last byte of lane 0, broadcast to all of lane 1,
+    //            add to lane 1 only so bytes 16-31 gain the cumulative sum through byte 15.
+    //
+    //   Step 3 – Cross-block carry: add the carry from the previous 32-byte block to every
+    //            element.  Carry = last byte of the previous block's result, broadcast to 32.
+
+    __m256i carry = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 31 < size; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((__m256i *)(src + i));
+
+        // Step 1: Kogge-Stone within each 128-bit lane.
+        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 1));
+        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 2));
+        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 4));
+        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 8));
+
+        // Step 2: propagate last byte of lane 0 to all bytes of lane 1.
+        {
+            __m128i lane0 = _mm256_castsi256_si128(v);
+            unsigned char last0 = (unsigned char)_mm_cvtsi128_si32(_mm_srli_si128(lane0, 15));
+            // Build a 256-bit vector: zeros in lane 0, broadcast of last0 in lane 1.
+            __m256i lane_carry = _mm256_set_m128i(_mm_set1_epi8((char)last0),
+                                                   _mm_setzero_si128());
+            v = _mm256_add_epi8(v, lane_carry);
+        }
+
+        // Step 3: add cross-block carry to all 32 bytes.
+        v = _mm256_add_epi8(v, carry);
+        _mm256_storeu_si256((__m256i *)(dst + i), v);
+
+        // Update carry: broadcast last byte of the result (byte 31 = last of lane 1).
+        {
+            __m128i hi = _mm256_extracti128_si256(v, 1);
+            unsigned char last = (unsigned char)_mm_cvtsi128_si32(_mm_srli_si128(hi, 15));
+            carry = _mm256_set1_epi8((char)last);
+        }
+    }
+
+    // Scalar tail (also covers the case size < 32).
+    for (; i < size; i++)
+        dst[i] = src[i] + (i > 0 ? dst[i - 1] : 0);
+}
+
+/**
+ * @brief Computes the prefix sum for a 2-channel interleaved array using AVX2 SIMD operations.
+ *
+ * This function processes an array where two interleaved unsigned 8-bit integer channels are present.
+ * It computes the prefix sum separately for each channel while preserving their interleaved layout.
+ * The prefix sum ensures that:
+ *
+ *      dst[2*i]   = src[2*i]   + dst[2*i - 2]
+ *      dst[2*i+1] = src[2*i+1] + dst[2*i - 1]
+ *
+ * The function uses AVX2 to process 32 elements (16 pairs of channels) per iteration, improving performance.
+ *
+ * @param src  Pointer to the source array of unsigned 8-bit integers (interleaved 2-channel format).
+ * @param dst  Pointer to the destination array where the computed prefix sum will be stored.
+ * @param size Number of interleaved channel pairs in the source array (not the byte size).
+ * @note
+ * - The function assumes `size` is a multiple of 16 for optimal performance. If not, a scalar fallback is needed.
+ * - This implementation works efficiently for small to medium-sized sequences but does not fully optimize
+ *   long sequences where more sophisticated prefix sum algorithms (such as Hillis-Steele scan) may be required.
+ * - Works best when `src` and `dst` are **aligned** to 32-byte boundaries, although `_mm256_loadu_si256`
+ *   allows for unaligned memory access at a slight performance cost.
+ */
+static void pzp_prefix_sum_avx2_2ch(unsigned char *src, unsigned char *dst, size_t size)
+{
+    // 2-channel interleaved prefix sum: 16 pixel-pairs (32 bytes) per iteration.
+    // size = number of pixels (pairs); total bytes = size * 2.
+    //
+    //   dst[2*i]   = src[2*i]   + dst[2*(i-1)]     (channel 0)
+    //   dst[2*i+1] = src[2*i+1] + dst[2*(i-1)+1]   (channel 1)
+    //
+    // The two channels are independent; their stride in the interleaved layout is 2 bytes.
+    // Kogge-Stone uses shifts of 2, 4, 8 (not 1, 2, 4, 8) to match that stride.
+    // After the intra-lane scan, cross-lane carry propagates the last pixel-pair of lane 0
+    // (bytes 14-15) to all 8 pixel positions in lane 1.
+    // The _mm256_set1_epi16 broadcast replicates the 2-byte [ch0,ch1] pattern to all 16
+    // positions across both lanes, forming the cross-block carry.
+
+    __m256i carry = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 15 < size; i += 16)
+    {
+        // Load 16 interleaved pixel-pairs = 32 bytes.
+        __m256i v = _mm256_loadu_si256((__m256i *)(src + i * 2));
+
+        // Step 1: Kogge-Stone within each 128-bit lane, stride 2 (one pixel-pair per step).
+        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 2));
+        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 4));
+        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 8));
+        // Lane 0 (pixels 0-7): correct prefix sums.
+        // Lane 1 (pixels 8-15): sums relative to pixel 8 only — missing pixel 7 carry.
+
+        // Step 2: cross-lane carry — last pixel-pair of lane 0 (bytes 14-15) → all of lane 1.
+        {
+            __m128i lane0 = _mm256_castsi256_si128(v);
+            // Shift right by 14: puts bytes 14 and 15 in positions 0 and 1.
+            int last_px = _mm_cvtsi128_si32(_mm_srli_si128(lane0, 14));
+            // _mm_set1_epi16 replicates the 16-bit [ch0,ch1] pair to all 8 positions.
+            __m128i bcast = _mm_set1_epi16((short)(last_px & 0xFFFF));
+            // Add to lane 1 only (zeros in lane 0).
+            __m256i lane_carry = _mm256_set_m128i(bcast, _mm_setzero_si128());
+            v = _mm256_add_epi8(v, lane_carry);
+        }
+
+        // Step 3: add cross-block carry to all 32 bytes.
+        v = _mm256_add_epi8(v, carry);
+        _mm256_storeu_si256((__m256i *)(dst + i * 2), v);
+
+        // Update carry: last pixel-pair of the result (bytes 30-31 of lane 1).
+        {
+            __m128i hi = _mm256_extracti128_si256(v, 1);
+            int last_px = _mm_cvtsi128_si32(_mm_srli_si128(hi, 14));
+            carry = _mm256_set1_epi16((short)(last_px & 0xFFFF));
+        }
+    }
+
+    // Scalar tail (also covers size < 16).
+    for (; i < size; i++)
+    {
+        dst[i * 2]     = src[i * 2]     + (i > 0 ? dst[(i - 1) * 2]     : 0);
+        dst[i * 2 + 1] = src[i * 2 + 1] + (i > 0 ? dst[(i - 1) * 2 + 1] : 0);
+    }
+}
+
+/**
+ * @brief USE_DELTA16 reconstruction: zigzag decode and per-channel 16-bit prefix sum
+ *        of interleaved big-endian samples, in place.
+ *
+ * The 16-bit counterpart of pzp_prefix_sum_avx2_2ch: a pixel holds `channels`
+ * (1, 2 or 4) samples and 16 samples are processed per iteration, so the carry
+ * between the low and high byte of a sample is kept by the epi16 adds.
+ *
+ * @param data     Interleaved big-endian samples (the hi/lo internal channels).
+ * @param pixels   Number of pixels.
+ * @param channels Samples per pixel: 1, 2 or 4 (they divide the 8 samples of a lane).
+ * @param previous Last sample of each channel before `data`, updated on return.
+ */
+static void pzp_delta16_reconstruct_AVX2(unsigned char *data, size_t pixels, unsigned int channels, unsigned short *previous)
+{
+    //   Step 1 – byte swap to native samples and zigzag decode: (z >> 1) ^ -(z & 1).
+    //   Step 2 – Kogge-Stone within each 128-bit lane using epi16 adds, shifting by
+    //            1, 2, 4 pixels (2·channels bytes, …) so a channel only sums with itself.
+    //   Step 3 – cross-lane carry: the last sample of each channel in lane 0 is
+    //            picked by pshufb and moved into lane 1 with a permute.
+    //   Step 4 – cross-block carry: add the running totals of the previous vector,
+    //            swap back to big-endian and store.
+    const __m256i swap = _mm256_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+                                          1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+    const __m256i one  = _mm256_set1_epi16(1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    // Every byte picks the same byte of the last sample of its channel within its own lane
+    unsigned char  tailIndex[32];
+    unsigned short running[16];
+    for (unsigned int j = 0; j < 32; j++)
+        tailIndex[j] = (unsigned char) (2 * (8 - channels + ((j % 16) / 2) % channels) + (j & 1));
+    for (unsigned int w = 0; w < 16; w++)
+        running[w] = previous[w % channels];
+    const __m256i tail  = _mm256_loadu_si256((const __m256i *) tailIndex);
+    __m256i       total = _mm256_loadu_si256((const __m256i *) running);
+
+    size_t values = pixels * channels;
+    size_t i = 0;
+    for (; i + 16 <= values; i += 16)
+    {
+        // Step 1: native samples, zigzag decoded.
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (data + 2 * i)), swap);
+        v = _mm256_xor_si256(_mm256_srli_epi16(v, 1), _mm256_sub_epi16(zero, _mm256_and_si256(v, one)));
+
+        // Step 2: Kogge-Stone within each lane, one pixel = 2 * channels bytes.
+        if (channels == 1) { v = _mm256_add_epi16(v, _mm256_slli_si256(v, 2)); }
+        if (channels <= 2) { v = _mm256_add_epi16(v, _mm256_slli_si256(v, 4)); }
+        v = _mm256_add_epi16(v, _mm256_slli_si256(v, 8));
+
+        // Step 3: lane 0 totals into lane 1.
+        __m256i t = _mm256_shuffle_epi8(v, tail);
+        v = _mm256_add_epi16(v, _mm256_permute2x128_si256(t, t, 0x08));
+
+        // Step 4: previous totals, then lane 1 totals become the next carry.
+        v = _mm256_add_epi16(v, total);
+        t = _mm256_shuffle_epi8(v, tail);
+        total = _mm256_permute2x128_si256(t, t, 0x11);
+        _mm256_storeu_si256((__m256i *) (data + 2 * i), _mm256_shuffle_epi8(v, swap));
+    }
+
+    _mm256_storeu_si256((__m256i *) running, total);
+    for (unsigned int c = 0; c < channels; c++) { previous[c] = running[c]; }
+
+    // Scalar tail (also covers fewer than 16 samples).
+    pzp_delta16_reconstruct_Naive(data + 2 * i, (values - i) / channels, channels, previous);
+}
+
+static void pzp_extractAndReconstruct_AVX2(unsigned char *decompressed_bytes, unsigned char *reconstructed, unsigned int width, unsigned int height, unsigned int channels, int restoreRLEChannels)
+{
+    size_t total_size = (size_t) width * height;
+    unsigned char *src = decompressed_bytes;
+    unsigned char *r = reconstructed;
+
+    if (restoreRLEChannels)
+    {
+        switch (channels)
+        {
+            case 1: {
+                pzp_prefix_sum_avx2(src, r, total_size);
+                break;
+            }
+            case 2: {
+                pzp_prefix_sum_avx2_2ch(src,r,total_size);
+                break;
+            }
+            case 3: {
+                // Scalar prefix sum for 3-channel interleaved data.
+                r[0] = src[0]; r[1] = src[1]; r[2] = src[2];
+                for (size_t i = 1; i < total_size; ++i)
+                {
+                    r[i*3]   = src[i*3]   + r[(i-1)*3];
+                    r[i*3+1] = src[i*3+1] + r[(i-1)*3+1];
+                    r[i*3+2] = src[i*3+2] + r[(i-1)*3+2];
+                }
+                break;
+            }
+            default: {
+                // Generic case (scalar fallback)
+                for (unsigned int ch = 0; ch < channels; ++ch)
+                {
+                    r[ch] = src[ch];
+                }
+                for (size_t i = 1; i < total_size; ++i)
+                {
+                    for (unsigned int ch = 0; ch < channels; ++ch)
+                    {
+                        r[i * channels + ch] = src[i * channels + ch] + r[(i - 1) * channels + ch];
+                    }
+                }
+                break;
+            }
+        }
+    } else
+    {
+        // Non-RLE path
+        switch (channels)
+        {
+            case 1:
+                memcpy(r, src, total_size);
+                break;
+            case 2:
+            {
+                // Copy 32 bytes at a time (16 pixels)
+                size_t i = 0;
+                for (; i + 15 < total_size; i += 16)
+                {
+                    __m256i data = _mm256_loadu_si256((__m256i*)(src + 2 * i));
+                    _mm256_storeu_si256((__m256i*)(r + 2 * i), data);
+                }
+                // Remaining elements
+                for (; i < total_size; ++i)
+                {
+                    r[2 * i] = src[2 * i];
+                    r[2 * i + 1] = src[2 * i + 1];
+                }
+                break;
+            }
+            case 3:
+            {
+                // Copy 24 bytes at a time (8 pixels)
+                size_t i = 0;
+                for (; i + 7 < total_size; i += 8)
+                {
+                    __m256i data = _mm256_loadu_si256((__m256i*)(src + 3 * i));
+                    _mm256_storeu_si256((__m256i*)(r + 3 * i), data);
+                }
+                // Remaining elements
+                for (; i < total_size; ++i)
+                {
+                    r[3 * i]     = src[3 * i];
+                    r[3 * i + 1] = src[3 * i + 1];
+                    r[3 * i + 2] = src[3 * i + 2];
+                }
+                break;
+            }
+            default: {
+                // Generic case (scalar fallback)
+                for (size_t i = 0; i < total_size; ++i)
+                {
+                    for (unsigned int ch = 0; ch < channels; ++ch)
+                    {
+                        r[i * channels + ch] = src[i * channels + ch];
+                    }
+                }
+                break;
+            }
+        }
+    }
+}
+#endif // INTEL_OPTIMIZATIONS
+static void pzp_extractAndReconstruct_Naive(unsigned char *decompressed_bytes, unsigned char *reconstructed, unsigned int width, unsigned int height, unsigned int channels, int restoreRLEChannels)
+{
+    size_t total_size = (size_t) width * height;
+    unsigned char *src = decompressed_bytes;
+    unsigned char *r   = reconstructed;
+
+    if (restoreRLEChannels)
+    {
+        switch (channels)
+        {
+            case 1:
+                r[0] = src[0];
+                for (size_t i = 1; i < total_size; i++)
+                {
+                    r[i] = src[i] + r[i - 1];
+                }
+                break;
+            case 2:
+                r[0] = src[0];
+                r[1] = src[1];
+                for (size_t i = 1; i < total_size; i++)
+                {
+                    r   += 2;
+                    src += 2;
+                    r[0] = src[0] + r[-2];
+                    r[1] = src[1] + r[-1];
+                }
+                break;
+            case 3:
+                r[0] = src[0];
+                r[1] = src[1];
+                r[2] = src[2];
+                for (size_t i = 1; i < total_size; i++)
+                {
+                    r   += 3;
+                    src += 3;
+                    r[0] = src[0] + r[-3];
+                    r[1] = src[1] + r[-2];
+                    r[2] = src[2] + r[-1];
+                }
+                break;
+            default:
+                for (unsigned int ch = 0; ch < channels; ch++)
+                {
+                    r[ch] = src[ch];
+                }
+                for (size_t i = 1; i < total_size; i++)
+                {
+                    for (unsigned int ch = 0; ch < channels; ch++)
+                    {
+                        r[i * channels + ch] = src[i * channels + ch] + r[(i - 1) * channels + ch];
+                    }
+                }
+                break;
+        }
+    }
+    else // Non-RLE path: data is already in final interleaved layout
+    {
+        memcpy(reconstructed, src, total_size * channels);
+    }
+}
+//-----------------------------------------------------------------------------------------------
+static void pzp_extractAndReconstruct(unsigned char *decompressed_bytes, unsigned char *reconstructed, unsigned int width, unsigned int height, unsigned int channels, int restoreRLEChannels)
+{
+   #if INTEL_OPTIMIZATIONS
+     pzp_extractAndReconstruct_AVX2(decompressed_bytes,reconstructed,width,height,channels,restoreRLEChannels);
+   #else
+     pzp_extractAndReconstruct_Naive(decompressed_bytes,reconstructed,width,height,channels,restoreRLEChannels);
+   #endif // INTEL_OPTIMIZATIONS
+}
+
+static void pzp_delta16_reconstruct(unsigned char *data, size_t pixels, unsigned int channelsExternal, unsigned short *previous)
+{
+   #if INTEL_OPTIMIZATIONS
+    if ( (channelsExternal == 1) || (channelsExternal == 2) || (channelsExternal == 4) )
+    {
+        pzp_delta16_reconstruct_AVX2(data, pixels, channelsExternal, previous);
+        return;
+    }
+   #endif // INTEL_OPTIMIZATIONS
+    pzp_delta16_reconstruct_Naive(data, pixels, channelsExternal, previous);
+}
+
+#if INTEL_OPTIMIZATIONS
+/* Signed bytes >> 1: logical shift in 16-bit lanes, drop the neighbour's bit, sign extend bit 6 */
+static inline __m128i pzp_ycocg_half_sse(__m128i v)
+{
+    const __m128i low7 = _mm_set1_epi8(0x7F), sign = _mm_set1_epi8(0x40);
+    return _mm_sub_epi8(_mm_xor_si128(_mm_and_si128(_mm_srli_epi16(v, 1), low7), sign), sign);
+}
+
+/* Byte prefix sum of a vector plus the running total of the previous one */
+static inline __m128i pzp_ycocg_scan_sse(__m128i v, __m128i *running)
+{
+    v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+    v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+    v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi8(v, *running);
+    *running = _mm_shuffle_epi8(v, _mm_set1_epi8(15));
+    return v;
+}
+
+/**
+ * @brief USE_YCOCG reconstruction: prefix sum of interleaved Y, Co, Cg deltas and
+ *        the inverse transform to R, G, B, 16 pixels (48 bytes) per iteration, in place.
+ *
+ * The three loaded vectors are split into Y, Co and Cg planes with pshufb, each
+ * plane is prefix summed in log steps (the last sum broadcast into the next
+ * iteration), the lifting steps are undone on 16 pixels at once and pshufb
+ * interleaves R, G, B again for the store.  Shuffle masks are built once per call:
+ * byte j of plane c is byte 3j + c of the 48, found in vector (3j + c) / 16.
+ * pzp_ycocg_reconstruct_Naive finishes the last pixels.
+ *
+ * @param data     Interleaved Y, Co, Cg deltas, R, G, B on return.
+ * @param pixels   Number of pixels.
+ * @param previous Last Y, Co, Cg before `data`, updated on return.
+ */
+static void pzp_ycocg_reconstruct_SSSE3(unsigned char *data, size_t pixels, unsigned char previous[3])
+{
+    unsigned char split[3][3][16], merge[3][3][16]; // [plane][vector][byte], [vector][plane][byte]
+    for (unsigned int c = 0; c < 3; c++)
+        for (unsigned int v = 0; v < 3; v++)
+            for (unsigned int j = 0; j < 16; j++)
+            {
+                unsigned int in = 3 * j + c, out = 16 * v + j;
+                split[c][v][j] = (in / 16 == v)  ? (unsigned char) (in % 16) : 0x80;
+                merge[v][c][j] = (out % 3 == c)  ? (unsigned char) (out / 3) : 0x80;
+            }
+    __m128i splitMask[3][3], mergeMask[3][3];
+    for (unsigned int a = 0; a < 3; a++)
+        for (unsigned int b = 0; b < 3; b++)
+        {
+            splitMask[a][b] = _mm_loadu_si128((const __m128i *) split[a][b]);
+            mergeMask[a][b] = _mm_loadu_si128((const __m128i *) merge[a][b]);
+        }
+
+    __m128i runY = _mm_set1_epi8((char) previous[0]), runCo = _mm_set1_epi8((char) previous[1]), runCg = _mm_set1_epi8((char) previous[2]);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16)
+    {
+        unsigned char *p = data + 3 * i;
+        __m128i v0 = _mm_loadu_si128((const __m128i *) p);
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (p + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *) (p + 32));
+
+        __m128i plane[3];
+        for (unsigned int c = 0; c < 3; c++)
+            plane[c] = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, splitMask[c][0]), _mm_shuffle_epi8(v1, splitMask[c][1])),
+                                    _mm_shuffle_epi8(v2, splitMask[c][2]));
+
+        __m128i y  = pzp_ycocg_scan_sse(plane[0], &runY);
+        __m128i co = pzp_ycocg_scan_sse(plane[1], &runCo);
+        __m128i cg = pzp_ycocg_scan_sse(plane[2], &runCg);
+
+        __m128i t = _mm_sub_epi8(y, pzp_ycocg_half_sse(cg));
+        plane[2]  = _mm_sub_epi8(t, pzp_ycocg_half_sse(co)); // B
+        plane[1]  = _mm_add_epi8(cg, t);                     // G
+        plane[0]  = _mm_add_epi8(plane[2], co);              // R
+
+        for (unsigned int v = 0; v < 3; v++)
+            _mm_storeu_si128((__m128i *) (p + 16 * v),
+                             _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(plane[0], mergeMask[v][0]), _mm_shuffle_epi8(plane[1], mergeMask[v][1])),
+                                          _mm_shuffle_epi8(plane[2], mergeMask[v][2])));
+    }
+    previous[0] = (unsigned char) _mm_cvtsi128_si32(runY);
+    previous[1] = (unsigned char) _mm_cvtsi128_si32(runCo);
+    previous[2] = (unsigned char) _mm_cvtsi128_si32(runCg);
+
+    pzp_ycocg_reconstruct_Naive(data + 3 * i, pixels - i, previous);
+}
+#endif // INTEL_OPTIMIZATIONS
+
+static void pzp_ycocg_reconstruct(unsigned char *data, size_t pixels, unsigned char previous[3])
+{
+   #if INTEL_OPTIMIZATIONS
+    pzp_ycocg_reconstruct_SSSE3(data, pixels, previous);
+   #else
+    pzp_ycocg_reconstruct_Naive(data, pixels, previous);
+   #endif // INTEL_OPTIMIZATIONS
+}
+
+/* Scatter the valid samples of one mask row to their pixels, zeros elsewhere.
+   Returns the samples consumed. */
+static size_t pzp_sparse_expand_row_Naive(const unsigned char *mask, const unsigned char *values,
+                                          unsigned char *out, unsigned int x, unsigned int width)
+{
+    size_t used = 0;
+    for (; x < width; x++)
+    {
+        if (mask[x / 8] & (1u << (x % 8)))
+        {
+            out[2 * x]     = values[2 * used];
+            out[2 * x + 1] = values[2 * used + 1];
+            used++;
+        }
+        else { out[2 * x] = 0; out[2 * x + 1] = 0; }
+    }
+    return used;
+}
+
+#if INTEL_OPTIMIZATIONS
+/**
+ * @brief Expand packed valid samples under a validity mask, 8 pixels per step.
+ *
+ * A mask byte selects one of 256 pshufb controls that move the next popcount(m)
+ * samples (2 bytes each) to the set pixels and zero the others (0x80 lanes), so
+ * every 16-byte store writes 8 finished pixels: a masked store without a blend.
+ * Reads run up to 16 bytes ahead of the valid samples; the caller pads them.
+ */
+static size_t pzp_sparse_expand_SSSE3(const unsigned char *mask, const unsigned char *values,
+                                      unsigned char *out, unsigned int width, unsigned int height)
+{
+    unsigned char controls[256][16];
+    for (unsigned int m = 0; m < 256; m++)
+    {
+        unsigned int rank = 0;
+        for (unsigned int k = 0; k < 8; k++)
+        {
+            int set = (m >> k) & 1;
+            controls[m][2 * k]     = (set) ? (unsigned char) (2 * rank)     : 0x80;
+            controls[m][2 * k + 1] = (set) ? (unsigned char) (2 * rank + 1) : 0x80;
+            rank += (unsigned int) set;
+        }
+    }
+
+    size_t rowBytes = (width + 7) / 8, used = 0;
+    for (unsigned int y = 0; y < height; y++, mask += rowBytes, out += 2 * (size_t) width)
+    {
+        unsigned int x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            unsigned int m = mask[x / 8];
+            __m128i packed = _mm_loadu_si128((const __m128i *) (values + 2 * used));
+            _mm_storeu_si128((__m128i *) (out + 2 * x), _mm_shuffle_epi8(packed, _mm_loadu_si128((const __m128i *) controls[m])));
+            used += (size_t) __builtin_popcount(m);
+        }
+        used += pzp_sparse_expand_row_Naive(mask, values + 2 * used, out, x, width);
+    }
+    return used;
+}
+#endif // INTEL_OPTIMIZATIONS
+
+/* Inverse of pzp_sparse_filter: stored holds the mask and the delta coded valid
+   samples (and 16 readable bytes of padding behind them).  Returns 0 if the mask
+   and the stored size disagree. */
+static int pzp_sparse_decode(unsigned char *stored, size_t storedSize, unsigned char *reconstructed,
+                             unsigned int width, unsigned int height)
+{
+    size_t rowBytes = (width + 7) / 8, maskBytes = pzp_sparse_mask_bytes(width, height), valid = 0;
+    unsigned char tailBits = (unsigned char) ((width % 8) ? (0xFF << (width % 8)) : 0);
+    for (unsigned int y = 0; y < height; y++)
+    {
+        unsigned char *row = stored + y * rowBytes;
+        if (y > 0)
+            for (size_t b = 0; b < rowBytes; b++) { row[b] ^= row[b - rowBytes]; }
+        if ( (rowBytes > 0) && (row[rowBytes - 1] & tailBits) ) { return 0; }
+        for (size_t b = 0; b < rowBytes; b++) { valid += (size_t) __builtin_popcount(row[b]); }
+    }
+    if (maskBytes + 2 * valid != storedSize) { return 0; }
+
+    unsigned char *values = stored + maskBytes;
+    unsigned short previous = 0;
+    pzp_delta16_reconstruct(values, valid, 1, &previous);
+
+   #if INTEL_OPTIMIZATIONS
+    pzp_sparse_expand_SSSE3(stored, values, reconstructed, width, height);
+   #else
+    size_t used = 0;
+    for (unsigned int y = 0; y < height; y++)
+        used += pzp_sparse_expand_row_Naive(stored + y * rowBytes, values + 2 * used, reconstructed + 2 * (size_t) y * width, 0, width);
+   #endif // INTEL_OPTIMIZATIONS
+    return 1;
+}
+//-----------------------------------------------------------------------------------------------
+#if INTEL_OPTIMIZATIONS
+/* 4-bit planes unpack with a nibble split, 1/2-bit planes need BMI2 pdep. */
+static int pzp_bitunpack_AVX2_supported(unsigned int bits)
+{
+   #ifdef __BMI2__
+    return (bits == 1) || (bits == 2) || (bits == 4);
+   #else
+    return (bits == 4);
+   #endif // __BMI2__
+}
+
+/* Expand the 32 packed indices starting at element i (a multiple of 32) into one register. */
+static __m256i pzp_bitunpack32_AVX2(const unsigned char *src, size_t i, unsigned int bits)
+{
+   #ifdef __BMI2__
+    if (bits == 1)
+    {
+        // 4 bytes → 32 indices, pdep spreads each bit into its own byte
+        uint32_t p; memcpy(&p, src + i / 8, sizeof(p));
+        const uint64_t m = 0x0101010101010101ULL;
+        return _mm256_set_epi64x((long long) _pdep_u64(p >> 24, m), (long long) _pdep_u64(p >> 16, m),
+                                 (long long) _pdep_u64(p >> 8,  m), (long long) _pdep_u64(p, m));
+    }
+    if (bits == 2)
+    {
+        // 8 bytes → 32 indices, pdep spreads each 2-bit pair into its own byte
+        uint64_t p; memcpy(&p, src + i / 4, sizeof(p));
+        const uint64_t m = 0x0303030303030303ULL;
+        return _mm256_set_epi64x((long long) _pdep_u64(p >> 48, m), (long long) _pdep_u64(p >> 32, m),
+                                 (long long) _pdep_u64(p >> 16, m), (long long) _pdep_u64(p, m));
+    }
+   #else
+    (void) bits; // only 4-bit planes get here without BMI2
+   #endif // __BMI2__
+    // 16 bytes → 32 indices, low nibble first
+    __m128i p    = _mm_loadu_si128((const __m128i *)(src + i / 2));
+    __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i lo   = _mm_and_si128(p, mask);
+    __m128i hi   = _mm_and_si128(_mm_srli_epi16(p, 4), mask);
+    return _mm256_set_m128i(_mm_unpackhi_epi8(lo, hi), _mm_unpacklo_epi8(lo, hi));
+}
+
+/* Unpack a bit-packed plane, optionally translating indices through a ≤16 entry
+   table with pshufb in the same pass (lut16 == NULL → plain unpack). */
+static void pzp_bitunpack_AVX2(const unsigned char *src, unsigned char *dst, size_t count,
+                               unsigned int bits, const unsigned char *lut16)
+{
+    size_t i = 0;
+    __m256i table = _mm256_setzero_si256();
+    if (lut16) { table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) lut16)); }
+
+    for (; i + 31 < count; i += 32)
+    {
+        __m256i v = pzp_bitunpack32_AVX2(src, i, bits);
+        if (lut16) { v = _mm256_shuffle_epi8(table, v); }
+        _mm256_storeu_si256((__m256i *)(dst + i), v);
+    }
+
+    // Scalar tail
+    unsigned int  perByte = 8 / bits;
+    unsigned char mask    = (unsigned char) ((1u << bits) - 1);
+    for (; i < count; i++)
+    {
+        unsigned char v = (src[i / perByte] >> ((i % perByte) * bits)) & mask;
+        dst[i] = (lut16) ? lut16[v] : v;
+    }
+}
+
+/* In-place lookup of ≤16 entry palette indices stored one per byte (only the low bits are significant). */
+static void pzp_palette_lookup16_AVX2(unsigned char *data, size_t count, unsigned char mask, const unsigned char *lut16)
+{
+    __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) lut16));
+    __m256i m     = _mm256_set1_epi8((char) mask);
+    size_t i = 0;
+    for (; i + 31 < count; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((__m256i *)(data + i));
+        v = _mm256_shuffle_epi8(table, _mm256_and_si256(v, m));
+        _mm256_storeu_si256((__m256i *)(data + i), v);
+    }
+    for (; i < count; i++)
+        data[i] = lut16[data[i] & mask];
+}
+#endif // INTEL_OPTIMIZATIONS
+
+/* Interleave two decoded planes into 2-byte pixels: the first plane becomes the
+   high byte.  `add` is a 16-bit base (USE_RANGE) added to every big-endian sample;
+   it is 0 for 8-bit two-channel images so the pass is a plain interleave. */
+static void pzp_merge_planes(const unsigned char *first, const unsigned char *second,
+                             unsigned char *output, size_t pixels, unsigned int add)
+{
+    size_t i = 0;
+   #if INTEL_OPTIMIZATIONS
+    const __m256i base = _mm256_set1_epi16((short) add);
+    const __m256i swap = _mm256_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+                                          1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+    for (; i + 32 <= pixels; i += 32)
+    {
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(first  + i));
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(second + i));
+        // Little-endian words for pixels 0-7|16-23 and 8-15|24-31
+        __m256i w0 = _mm256_add_epi16(_mm256_unpacklo_epi8(lo, hi), base);
+        __m256i w1 = _mm256_add_epi16(_mm256_unpackhi_epi8(lo, hi), base);
+        w0 = _mm256_shuffle_epi8(w0, swap);
+        w1 = _mm256_shuffle_epi8(w1, swap);
+        _mm256_storeu_si256((__m256i *)(output + 2 * i),      _mm256_permute2x128_si256(w0, w1, 0x20));
+        _mm256_storeu_si256((__m256i *)(output + 2 * i + 32), _mm256_permute2x128_si256(w0, w1, 0x31));
+    }
+   #endif // INTEL_OPTIMIZATIONS
+    for (; i < pixels; i++)
+    {
+        unsigned int v = ((unsigned int) first[i] << 8 | second[i]) + add;
+        output[2 * i]     = (unsigned char) ((v >> 8) & 0xFF);
+        output[2 * i + 1] = (unsigned char) (v & 0xFF);
+    }
+}
+
+/* Pixels per USE_BITPACK decode block: two planes of this size stay in L1, and a
+   multiple of 32 keeps every block start byte aligned for 1, 2 and 4-bit planes. */
+#define PZP_UNPACK_BLOCK 8192
+
+/* Per-channel tables and running state of a USE_BITPACK decode. */
+struct pzp_unpack_state
+{
+    unsigned char lut[8][256];
+    unsigned int  bits[8];
+    unsigned char mask[8];
+    int           identity[8];
+    unsigned char carry[8];            // USE_RLE prefix sum at the end of the previous block
+    const unsigned char *src[8];       // start of each packed plane
+    unsigned int  channels;
+    int           restoreRLEChannels;
+    const unsigned int *base;          // USE_RANGE 16-bit channel bases, or NULL
+};
+
+/* Prepare the lookup tables for the planes packed back to back at `index_data`.
+   Returns 1 on success, 0 for an unsupported channel count. */
+static int pzp_unpack_init(struct pzp_unpack_state *state, const unsigned char *index_data,
+                           size_t pixels, unsigned int channels,
+                           unsigned char palette[8][256], unsigned int counts[8],
+                           unsigned int configuration, const unsigned int *base)
+{
+    if ( (channels == 0) || (channels > 8) ) { return 0; }
+    state->channels           = channels;
+    state->restoreRLEChannels = ( (configuration & USE_RLE) != 0 );
+    state->base               = base;
+
+    const unsigned char *next = index_data;
+    for (unsigned int ch = 0; ch < channels; ch++)
+    {
+        unsigned int bits = pzp_plane_bits(counts[ch], configuration);
+        unsigned char mask = (unsigned char) ((bits >= 8) ? 0xFF : ((1u << bits) - 1));
+
+        // Full 256-entry table with the index mask folded in (mod-256 prefix sums carry junk high bits)
+        int identity = 1; // a 0..255 range plane needs no lookup
+        for (unsigned int v = 0; v < 256; v++)
+        {
+            state->lut[ch][v] = ((v & mask) < counts[ch]) ? palette[ch][v & mask] : 0;
+            identity &= (state->lut[ch][v] == v);
+        }
+
+        state->bits[ch]     = bits;
+        state->mask[ch]     = mask;
+        state->identity[ch] = identity;
+        state->carry[ch]    = 0;
+        state->src[ch]      = next;
+        next += pzp_bitpacked_size(pixels, bits);
+    }
+    return 1;
+}
+
+/* Decode pixels [start, start + count) into interleaved values at `output`.
+   Every plane is unpacked, prefix-summed (USE_RLE) and looked up through the palette;
+   1-channel images are decoded in place, 2-channel images side by side and merged in
+   one pass.  `lastPlane` holds this block of the last plane when the caller streams
+   it, NULL reads it from the packed planes like the others.  Blocks must come in
+   order and start on multiples of PZP_UNPACK_BLOCK. */
+static void pzp_unpack_block(struct pzp_unpack_state *state, const unsigned char *lastPlane,
+                             unsigned char *output, size_t start, size_t count)
+{
+    unsigned int channels = state->channels;
+    unsigned char planes[2][PZP_UNPACK_BLOCK];
+
+    for (unsigned int ch = 0; ch < channels; ch++)
+    {
+        unsigned int   bits  = state->bits[ch];
+        unsigned char *lut   = state->lut[ch];
+        unsigned char *plane = (channels == 1) ? output + start : planes[ch & 1];
+        const unsigned char *packed = ( (lastPlane != NULL) && (ch == channels - 1) ) ?
+                                      lastPlane : state->src[ch] + start * bits / 8;
+
+        int lookupDone = state->identity[ch];
+       #if INTEL_OPTIMIZATIONS
+        if ((bits > 0) && (bits < 8) && pzp_bitunpack_AVX2_supported(bits))
+        {
+            if (!state->restoreRLEChannels)
+            {
+                pzp_bitunpack_AVX2(packed, plane, count, bits, lut); // unpack + pshufb palette in one pass
+            } else
+            {
+                pzp_bitunpack_AVX2(packed, plane, count, bits, NULL);
+                plane[0] += state->carry[ch];
+                pzp_prefix_sum_avx2(plane, plane, count);
+                state->carry[ch] = plane[count - 1];
+                pzp_palette_lookup16_AVX2(plane, count, state->mask[ch], lut);
+            }
+            lookupDone = 1;
+        } else
+       #endif // INTEL_OPTIMIZATIONS
+        {
+            pzp_bitunpack_Naive(packed, plane, count, bits);
+            if (state->restoreRLEChannels)
+            {
+                plane[0] += state->carry[ch];
+               #if INTEL_OPTIMIZATIONS
+                pzp_prefix_sum_avx2(plane, plane, count);
+               #else
+                for (size_t i = 1; i < count; i++) { plane[i] += plane[i - 1]; }
+               #endif // INTEL_OPTIMIZATIONS
+                state->carry[ch] = plane[count - 1];
+            }
+        }
+
+        if (channels <= 2)
+        {
+            if (!lookupDone)
+                for (size_t i = 0; i < count; i++) { plane[i] = lut[plane[i]]; }
+        } else
+        {
+            unsigned char *dst = output + start * channels + ch;
+            if (lookupDone)
+                for (size_t i = 0; i < count; i++) { dst[i * channels] = plane[i]; }
+            else
+                for (size_t i = 0; i < count; i++) { dst[i * channels] = lut[plane[i]]; }
+        }
+    }
+
+    if (channels == 2)
+        pzp_merge_planes(planes[0], planes[1], output + 2 * start, count, (state->base != NULL) ? state->base[0] : 0);
+    else if ( (state->base != NULL) && (channels > 2) )
+        pzp_range_add_base(output + start * channels, count, channels / 2, state->base);
+}
+//-----------------------------------------------------------------------------------------------
+/* Write `run` copies of a `channels`-byte pixel to dst. */
+static void pzp_run_fill(unsigned char *dst, const unsigned char *pixel, unsigned int channels, unsigned int run)
+{
+    size_t bytes = (size_t) run * channels;
+    if (channels == 1)
+    {
+        memset(dst, pixel[0], bytes);
+        return;
+    }
+
+    // Doubling copy: every memcpy replicates everything written so far
+    size_t head = bytes;
+   #if INTEL_OPTIMIZATIONS
+    // 32*channels bytes hold a whole number of both pixels and registers, so
+    // beyond that the run is a 32-byte load/store loop with that period.
+    size_t period = (size_t) 32 * channels;
+    if (head > period) { head = period; }
+   #endif // INTEL_OPTIMIZATIONS
+
+    memcpy(dst, pixel, channels);
+    size_t filled = channels;
+    while (filled < head)
+    {
+        size_t n = (filled < head - filled) ? filled : head - filled;
+        memcpy(dst + filled, dst, n);
+        filled += n;
+    }
+
+   #if INTEL_OPTIMIZATIONS
+    for (; filled + 32 <= bytes; filled += 32)
+        _mm256_storeu_si256((__m256i *)(dst + filled), _mm256_loadu_si256((const __m256i *)(dst + filled - period)));
+    if (filled < bytes)
+        memcpy(dst + filled, dst + filled - period, bytes - filled);
+   #endif // INTEL_OPTIMIZATIONS
+}
+
+/* Expand a USE_RUNS token stream (see pzp_runs_encode) into interleaved pixels.
+   Returns 1 on success, 0 if the stream does not describe exactly width x height pixels. */
+static int pzp_runs_decode(const unsigned char *src, size_t srcSize, unsigned char *dst,
+                           unsigned int width, unsigned int height, unsigned int channels)
+{
+    size_t off = 0;
+    unsigned char *out = dst;
+
+    for (unsigned int y = 0; y < height; y++)
+    {
+        unsigned int x = 0;
+        while (x < width)
+        {
+            unsigned long v = 0;
+            unsigned int  shift = 0;
+            unsigned char b;
+            do
+            {
+                if ( (off >= srcSize) || (shift > 28) ) { return 0; }
+                b = src[off++];
+                v |= (unsigned long) (b & 0x7F) << shift;
+                shift += 7;
+            } while (b & 0x80);
+
+            if (v >= width - x) { return 0; } // run would cross the row boundary
+            if (off + channels > srcSize) { return 0; }
+
+            unsigned int run = (unsigned int) v + 1;
+            pzp_run_fill(out, src + off, channels, run);
+            off += channels;
+            out += (size_t) run * channels;
+            x   += run;
+        }
+    }
+    return (off == srcSize);
+}
+//-----------------------------------------------------------------------------------------------
+//                       Tensor output (planar / float decode targets)
+//-----------------------------------------------------------------------------------------------
+typedef enum
+{
+    PZP_TENSOR_UINT8 = 0,  // 8-bit images only, raw values
+    PZP_TENSOR_UINT16,     // 16-bit images only, raw values in native byte order
+    PZP_TENSOR_FLOAT32,    // value * scale[c] + offset[c]
+    PZP_TENSOR_FLOAT16     // same, stored as IEEE half
+} PZPTensorType;
+
+typedef enum
+{
+    PZP_LAYOUT_HWC = 0,    // interleaved, like the regular decoder output
+    PZP_LAYOUT_CHW         // one plane per channel
+} PZPTensorLayout;
+
+#define PZP_TENSOR_MAX_CHANNELS 16
+#define PZP_TENSOR_BLOCK        512 // floats staged on the stack before FLOAT16 conversion
+
+/* Where and how a decoded image is written instead of a malloc'ed HWC buffer.
+   The image lands in slot `batchIndex` of `data`, each slot holding one
+   channels*height*width image, so a contiguous NCHW batch can be filled one
+   file at a time.  Set it up with pzp_tensor_init(). */
+struct pzp_tensor
+{
+    void        *data;
+    size_t       capacity;                        // bytes available at data
+    unsigned int batchIndex;
+    unsigned int layout;                          // PZPTensorLayout
+    unsigned int type;                            // PZPTensorType
+    unsigned int width, height, channels;         // expected shape, 0 = whatever the file holds
+    float        scale[PZP_TENSOR_MAX_CHANNELS];  // float types only
+    float        offset[PZP_TENSOR_MAX_CHANNELS];
+};
+
+static void pzp_tensor_init(struct pzp_tensor *tensor, void *data, size_t capacity, PZPTensorType type, PZPTensorLayout layout)
+{
+    memset(tensor, 0, sizeof(struct pzp_tensor));
+    tensor->data     = data;
+    tensor->capacity = capacity;
+    tensor->type     = type;
+    tensor->layout   = layout;
+    for (unsigned int c = 0; c < PZP_TENSOR_MAX_CHANNELS; c++) { tensor->scale[c] = 1.0f; }
+}
+
+static size_t pzp_tensor_element_size(unsigned int type)
+{
+    switch (type)
+    {
+        case PZP_TENSOR_UINT8:   return 1;
+        case PZP_TENSOR_UINT16:  return 2;
+        case PZP_TENSOR_FLOAT32: return 4;
+        case PZP_TENSOR_FLOAT16: return 2;
+    }
+    return 0;
+}
+
+/* Check the tensor can hold a width x height x channels image of bitsperpixel bits
+   and return where its slot starts, or NULL. */
+static unsigned char * pzp_tensor_slot(const struct pzp_tensor *tensor,
+                                       unsigned int width, unsigned int height,
+                                       unsigned int bitsperpixel, unsigned int channels, unsigned int channelsIn)
+{
+    size_t element = pzp_tensor_element_size(tensor->type);
+    if ( (tensor->data == NULL) || (element == 0) || (tensor->layout > PZP_LAYOUT_CHW) )
+    {
+        fprintf(stderr, "PZP tensor output is not set up\n");
+        return NULL;
+    }
+    if ( ( (bitsperpixel != 8) && (bitsperpixel != 16) ) || (channels == 0) ||
+         (channels > PZP_TENSOR_MAX_CHANNELS) || (channelsIn != channels * (bitsperpixel / 8)) )
+    {
+        fprintf(stderr, "PZP tensor output does not support %u channels @ %u bit\n", channels, bitsperpixel);
+        return NULL;
+    }
+    if ( ( (tensor->type == PZP_TENSOR_UINT8)  && (bitsperpixel != 8) ) ||
+         ( (tensor->type == PZP_TENSOR_UINT16) && (bitsperpixel != 16) ) )
+    {
+        fprintf(stderr, "PZP tensor integer type does not match a %u bit image\n", bitsperpixel);
+        return NULL;
+    }
+    if ( ( (tensor->width)    && (tensor->width    != width) )  ||
+         ( (tensor->height)   && (tensor->height   != height) ) ||
+         ( (tensor->channels) && (tensor->channels != channels) ) )
+    {
+        fprintf(stderr, "PZP image %ux%ux%u does not match the tensor shape\n", width, height, channels);
+        return NULL;
+    }
+
+    size_t slotBytes = (size_t) width * height * channels * element;
+    if ( (width && height && (slotBytes / ((size_t) width * height) != channels * element)) ||
+         (slotBytes && (tensor->batchIndex >= tensor->capacity / slotBytes)) )
+    {
+        fprintf(stderr, "PZP tensor slot %u does not fit in %zu bytes\n", tensor->batchIndex, tensor->capacity);
+        return NULL;
+    }
+    return (unsigned char *) tensor->data + (size_t) tensor->batchIndex * slotBytes;
+}
+
+static unsigned short pzp_float_to_half(float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    unsigned int sign     = (bits >> 16) & 0x8000;
+    unsigned int exponent = (bits >> 23) & 0xFF;
+    unsigned int mantissa = bits & 0x7FFFFF;
+
+    if (exponent == 0xFF) { return (unsigned short) (sign | 0x7C00 | (mantissa ? 0x200 : 0)); } // inf / nan
+
+    int e = (int) exponent - 127 + 15;
+    if (e >= 31) { return (unsigned short) (sign | 0x7C00); }                                  // overflow → inf
+    if (e <= 0)
+    {
+        if (e < -10) { return (unsigned short) sign; }                                          // underflow → 0
+        mantissa |= 0x800000;
+        unsigned int shift = (unsigned int) (14 - e);
+        unsigned int half  = mantissa >> shift;
+        unsigned int rest  = mantissa & ((1u << shift) - 1);
+        unsigned int mid   = 1u << (shift - 1);
+        if ( (rest > mid) || ( (rest == mid) && (half & 1) ) ) { half++; }
+        return (unsigned short) (sign | half);
+    }
+
+    unsigned int half = sign | ((unsigned int) e << 10) | (mantissa >> 13);
+    unsigned int rest = mantissa & 0x1FFF;
+    if ( (rest > 0x1000) || ( (rest == 0x1000) && (half & 1) ) ) { half++; } // round to nearest even, may carry into inf
+    return (unsigned short) half;
+}
+
+static void pzp_tensor_emit_half(unsigned short *dst, const float *src, size_t count)
+{
+    size_t i = 0;
+   #if INTEL_OPTIMIZATIONS && defined(__F16C__)
+    for (; i + 8 <= count; i += 8)
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+   #endif // INTEL_OPTIMIZATIONS
+    for (; i < count; i++) { dst[i] = pzp_float_to_half(src[i]); }
+}
+
+// 16-bit values are stored as a hi byte followed by a lo byte
+#define PZP_TENSOR_VALUE(src, bytesPerValue) ( (bytesPerValue == 2) ? (unsigned int) ((src)[0] << 8 | (src)[1]) : (unsigned int) (src)[0] )
+
+/* Merge hi/lo byte pairs into native uint16 values. */
+static void pzp_tensor_u16_merge(unsigned short *dst, const unsigned char *src, size_t values)
+{
+    size_t i = 0;
+   #if INTEL_OPTIMIZATIONS
+    const unsigned short one = 1;
+    if (*(const unsigned char *) &one) // little-endian host: merging is a byte swap
+    {
+        const __m256i swap16 = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                                1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+        for (; i + 16 <= values; i += 16)
+            _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(src + 2 * i)), swap16));
+    }
+   #endif // INTEL_OPTIMIZATIONS
+    for (; i < values; i++)
+        dst[i] = (unsigned short) PZP_TENSOR_VALUE(src + 2 * i, 2);
+}
+
+/* count values, one every `stride` bytes, to contiguous floats.  Written so that
+   once inlined with a constant stride the compiler vectorizes the strided loads. */
+static inline void pzp_tensor_f32_strided(float *dst, const unsigned char *src, size_t count,
+                                          unsigned int stride, unsigned int bytesPerValue, float scale, float offset)
+{
+    size_t i = 0;
+   #if INTEL_OPTIMIZATIONS
+    if ( (stride == 1) && (bytesPerValue == 1) )
+    {
+        __m256 s = _mm256_set1_ps(scale), o = _mm256_set1_ps(offset);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+            _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(v), s), o));
+        }
+    }
+   #endif // INTEL_OPTIMIZATIONS
+    for (; i < count; i++)
+        dst[i] = (float) PZP_TENSOR_VALUE(src + i * stride, bytesPerValue) * scale + offset;
+}
+
+/* Interleaved pixels to interleaved floats, each channel with its own scale/offset. */
+static void pzp_tensor_f32_interleaved(float *dst, const unsigned char *src, size_t pixels, unsigned int channels,
+                                       unsigned int bytesPerValue, const float *scale, const float *offset)
+{
+    size_t values = pixels * channels;
+    size_t i = 0;
+   #if INTEL_OPTIMIZATIONS
+    // 8*channels floats hold a whole number of both pixels and registers, so the
+    // per-lane scale/offset pattern repeats every `channels` registers.
+    float scalePattern[8 * PZP_TENSOR_MAX_CHANNELS], offsetPattern[8 * PZP_TENSOR_MAX_CHANNELS];
+    for (unsigned int k = 0; k < 8 * channels; k++)
+    {
+        scalePattern[k]  = scale[k % channels];
+        offsetPattern[k] = offset[k % channels];
+    }
+
+    const __m128i swap16 = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    unsigned int phase = 0;
+    for (; i + 8 <= values; i += 8)
+    {
+        __m256i v;
+        if (bytesPerValue == 1) { v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i))); }
+          else                  { v = _mm256_cvtepu16_epi32(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 2 * i)), swap16)); }
+
+        __m256 s = _mm256_loadu_ps(scalePattern + 8 * phase);
+        __m256 o = _mm256_loadu_ps(offsetPattern + 8 * phase);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(v), s), o));
+        if (++phase == channels) { phase = 0; }
+    }
+   #endif // INTEL_OPTIMIZATIONS
+    for (; i < values; i++)
+    {
+        unsigned int c = (unsigned int) (i % channels);
+        dst[i] = (float) PZP_TENSOR_VALUE(src + i * bytesPerValue, bytesPerValue) * scale[c] + offset[c];
+    }
+}
+
+static void pzp_tensor_f32_plane(float *dst, const unsigned char *src, size_t count, unsigned int channels,
+                                 unsigned int bytesPerValue, float scale, float offset)
+{
+    // Spell out the common strides so each call site gets a constant-stride loop
+    unsigned int stride = channels * bytesPerValue;
+    switch (stride)
+    {
+        case 1:  pzp_tensor_f32_strided(dst, src, count, 1, 1, scale, offset); break;
+        case 2:  if (bytesPerValue == 2) { pzp_tensor_f32_strided(dst, src, count, 2, 2, scale, offset); }
+                   else                  { pzp_tensor_f32_strided(dst, src, count, 2, 1, scale, offset); }
+                 break;
+        case 3:  pzp_tensor_f32_strided(dst, src, count, 3, 1, scale, offset); break;
+        case 4:  if (bytesPerValue == 2) { pzp_tensor_f32_strided(dst, src, count, 4, 2, scale, offset); }
+                   else                  { pzp_tensor_f32_strided(dst, src, count, 4, 1, scale, offset); }
+                 break;
+        case 6:  pzp_tensor_f32_strided(dst, src, count, 6, 2, scale, offset); break;
+        case 8:  pzp_tensor_f32_strided(dst, src, count, 8, 2, scale, offset); break;
+        default: pzp_tensor_f32_strided(dst, src, count, stride, bytesPerValue, scale, offset); break;
+    }
+}
+
+/* Write `count` reconstructed pixels (interleaved, internal byte layout) that start at
+   pixel `start` of the image into the tensor slot.  Called on each chunk while it is
+   still in cache, so the conversion costs no extra pass over memory. */
+static void pzp_tensor_store(const struct pzp_tensor *tensor, unsigned char *slot,
+                             const unsigned char *src, size_t start, size_t count,
+                             size_t pixels, unsigned int channels, unsigned int bytesPerValue)
+{
+    size_t element = pzp_tensor_element_size(tensor->type);
+    float  block[PZP_TENSOR_BLOCK];
+
+    if (tensor->layout == PZP_LAYOUT_HWC)
+    {
+        size_t values = count * channels;
+        unsigned char *dst = slot + start * channels * element;
+        switch (tensor->type)
+        {
+            case PZP_TENSOR_UINT8:
+                memcpy(dst, src, values);
+                break;
+            case PZP_TENSOR_UINT16:
+                pzp_tensor_u16_merge((unsigned short *) dst, src, values);
+                break;
+            case PZP_TENSOR_FLOAT32:
+                pzp_tensor_f32_interleaved((float *) dst, src, count, channels, bytesPerValue, tensor->scale, tensor->offset);
+                break;
+            case PZP_TENSOR_FLOAT16:
+            {
+                // Whole pixels per block keep the channel phase at 0
+                size_t blockPixels = PZP_TENSOR_BLOCK / channels;
+                for (size_t p = 0; p < count; p += blockPixels)
+                {
+                    size_t n = (count - p < blockPixels) ? count - p : blockPixels;
+                    pzp_tensor_f32_interleaved(block, src + p * channels * bytesPerValue, n, channels, bytesPerValue, tensor->scale, tensor->offset);
+                    pzp_tensor_emit_half((unsigned short *) dst + p * channels, block, n * channels);
+                }
+                break;
+            }
+        }
+        return;
+    }
+
+    // ── Planar: one strided sweep per channel over the cached chunk ──
+    unsigned int stride = channels * bytesPerValue;
+    for (unsigned int c = 0; c < channels; c++)
+    {
+        const unsigned char *in  = src + c * bytesPerValue;
+        unsigned char       *dst = slot + ((size_t) c * pixels + start) * element;
+        switch (tensor->type)
+        {
+            case PZP_TENSOR_UINT8:
+                for (size_t i = 0; i < count; i++) { dst[i] = in[i * stride]; }
+                break;
+            case PZP_TENSOR_UINT16:
+                for (size_t i = 0; i < count; i++)
+                    ((unsigned short *) dst)[i] = (unsigned short) PZP_TENSOR_VALUE(in + i * stride, 2);
+                break;
+            case PZP_TENSOR_FLOAT32:
+                pzp_tensor_f32_plane((float *) dst, in, count, channels, bytesPerValue, tensor->scale[c], tensor->offset[c]);
+                break;
+            case PZP_TENSOR_FLOAT16:
+                for (size_t p = 0; p < count; p += PZP_TENSOR_BLOCK)
+                {
+                    size_t n = (count - p < PZP_TENSOR_BLOCK) ? count - p : PZP_TENSOR_BLOCK;
+                    pzp_tensor_f32_plane(block, in + p * stride, n, channels, bytesPerValue, tensor->scale[c], tensor->offset[c]);
+                    pzp_tensor_emit_half((unsigned short *) dst + p, block, n);
+                }
+                break;
+        }
+    }
+}
+//-----------------------------------------------------------------------------------------------
+//                       Band output (rows handed over while decoding)
+//-----------------------------------------------------------------------------------------------
+#define PZP_BAND_ROWS 16
+
+/* One band of finished rows, handed to a struct pzp_bands callback.  rows points
+   into the decoder's output buffer: rowCount rows of rowBytes bytes, interleaved
+   exactly as the decoded image (16-bit samples big-endian). */
+struct pzp_band
+{
+    const unsigned char *rows;
+    unsigned int firstRow, rowCount;
+    unsigned int width, height;       // of the whole image
+    unsigned int bitsperpixel;        // per sample, 8 or 16
+    unsigned int channels;
+    size_t       rowBytes;
+};
+
+/* Rows delivered while the rest of the frame is still being decompressed, so
+   uploads, resizes or tiling can overlap with decoding.  Bands arrive in order,
+   `rows` rows each (0 = PZP_BAND_ROWS, the last band may be shorter), and stay
+   valid until the image is freed.  The callback returns 0 to stop decoding.
+   The frame checksum is only known after the last band: a consumer must still
+   check that the decode call succeeded before trusting what it was handed.
+   Bitpacked and run token frames are reconstructed whole, then handed out in
+   bands; tensor decodes do not deliver bands. */
+struct pzp_bands
+{
+    int        (*callback)(void *user, const struct pzp_band *band);
+    void        *user;
+    unsigned int rows;
+};
+
+/* Hand the finished rows below rowsDone to bands in full bands, and a short last
+   one when flush is set.  band keeps the position.  Returns 0 if told to stop. */
+static int pzp_bands_emit(const struct pzp_bands *bands, struct pzp_band *band,
+                          const unsigned char *image, unsigned int rowsDone, int flush)
+{
+    if (bands == NULL) { return 1; }
+
+    unsigned int step = (bands->rows != 0) ? bands->rows : PZP_BAND_ROWS;
+    unsigned int next = band->firstRow + band->rowCount;
+    while ( (next < rowsDone) && ( (rowsDone - next >= step) || (flush) ) )
+    {
+        band->firstRow = next;
+        band->rowCount = (rowsDone - next < step) ? rowsDone - next : step;
+        band->rows     = image + (size_t) next * band->rowBytes;
+        if (!bands->callback(bands->user, band)) { return 0; }
+        next += band->rowCount;
+    }
+    return 1;
+}
+//-----------------------------------------------------------------------------------------------
+/* Pull exactly `size` uncompressed bytes out of the frame into dst, reading more
+   coded bytes from the source whenever its read-ahead runs dry.  Every payload read
+   goes through here to the backend of the frame.
+   Returns 1 on success, 0 on a backend error or if the frame ends early. */
+static int pzp_decompress_stream_read(struct pzp_dctx *dctx, struct pzp_source *source, void *dst, size_t size)
+{
+    return dctx->backend->decompress(dctx, source, dst, size);
+}
+
+/* The stored pixel / index data of a USE_RANS frame, decoded one block at a time
+   as the body asks for it. */
+struct pzp_rans_reader
+{
+    unsigned long long rawRemaining;   // stored bytes not yet decoded
+    unsigned long long codedRemaining; // section bytes (block headers included) not yet read, PZP_SIZE_STREAMED if unknown
+    unsigned char *coded;              // current coded block
+    size_t         codedCapacity;
+    unsigned char *block;              // decoded bytes not yet handed out
+    size_t         blockCapacity;
+    size_t         blockSize;
+    size_t         blockPos;
+    unsigned int  *table;              // slot tables, PZP_RANS_MAX_CONTEXTS × PZP_RANS_SCALE entries
+    const struct pzp_allocator *allocator; // the decoding context's
+};
+
+static int pzp_rans_reserve(const struct pzp_allocator *allocator, unsigned char **buffer, size_t *capacity, size_t size)
+{
+    if (size <= *capacity) { return 1; }
+    pzp_allocator_free(allocator, *buffer);
+    *buffer   = (unsigned char *) pzp_allocator_alloc(allocator, size);
+    *capacity = (*buffer != NULL) ? size : 0;
+    return (*buffer != NULL);
+}
+
+static void pzp_rans_reader_free(struct pzp_rans_reader *reader)
+{
+    pzp_allocator_free(reader->allocator, reader->coded);
+    pzp_allocator_free(reader->allocator, reader->block);
+    pzp_allocator_free(reader->allocator, reader->table);
+    memset(reader, 0, sizeof(*reader));
+}
+
+/* Read the next `size` bytes of stored data: from zstd directly, or through the
+   rANS blocks when reader is not NULL.  Blocks that fit are decoded straight into dst. */
+static int pzp_stored_read(struct pzp_dctx *dctx, struct pzp_source *source, struct pzp_rans_reader *reader, void *dst, size_t size)
+{
+    if (reader == NULL) { return pzp_decompress_stream_read(dctx, source, dst, size); }
+
+    unsigned char *out = (unsigned char *) dst;
+    while (size > 0)
+    {
+        if (reader->blockPos == reader->blockSize)
+        {
+            unsigned int blockHeader[2];
+            if ( (reader->codedRemaining < PZP_RANS_BLOCK_HEADER) ||
+                 (!pzp_decompress_stream_read(dctx, source, blockHeader, PZP_RANS_BLOCK_HEADER)) )
+                { fprintf(stderr, "PZP rANS data is truncated\n"); return 0; }
+            if (reader->codedRemaining != PZP_SIZE_STREAMED) { reader->codedRemaining -= PZP_RANS_BLOCK_HEADER; }
+
+            size_t rawSize = blockHeader[0], codedSize = blockHeader[1];
+            if ( (rawSize == 0) || (rawSize > reader->rawRemaining) || (codedSize > reader->codedRemaining) ||
+                 (codedSize > rawSize + 2) )
+                { fprintf(stderr, "PZP rANS block header is corrupted\n"); return 0; }
+            if (reader->codedRemaining != PZP_SIZE_STREAMED) { reader->codedRemaining -= codedSize; }
+            reader->rawRemaining   -= rawSize;
+
+            unsigned char *target = out;
+            if (rawSize > size)
+            {
+                if (!pzp_rans_reserve(reader->allocator, &reader->block, &reader->blockCapacity, rawSize)) { return 0; }
+                target = reader->block;
+            }
+            if (reader->table == NULL)
+            {
+                reader->table = (unsigned int *) pzp_allocator_alloc(reader->allocator, sizeof(unsigned int) * PZP_RANS_MAX_CONTEXTS * PZP_RANS_SCALE);
+                if (reader->table == NULL) { return 0; }
+            }
+            if ( (!pzp_rans_reserve(reader->allocator, &reader->coded, &reader->codedCapacity, codedSize)) ||
+                 (!pzp_decompress_stream_read(dctx, source, reader->coded, codedSize)) )
+                return 0;
+            if (!pzp_rans_decode(reader->coded, codedSize, target, rawSize, reader->table))
+                { fprintf(stderr, "PZP rANS block is corrupted\n"); return 0; }
+
+            if (target == out)
+            {
+                out  += rawSize;
+                size -= rawSize;
+                continue;
+            }
+            reader->blockSize = rawSize;
+            reader->blockPos  = 0;
+        }
+
+        size_t n = reader->blockSize - reader->blockPos;
+        if (n > size) { n = size; }
+        memcpy(out, reader->block + reader->blockPos, n);
+        reader->blockPos += n;
+        out  += n;
+        size -= n;
+    }
+    return 1;
+}
+
+/* Decode the uncompressed payload (header, palette, pixel/index data, PZP1 checksum
+   trailer) while it streams out of zstd. The usual interleaved layout is decompressed
+   straight into the output buffer and reconstructed in place one chunk at a time, so
+   apart from the output itself memory use does not grow with the image size.
+   With a tensor, each reconstructed chunk is converted into the tensor slot instead
+   and the slot pointer is returned; nothing is left for the caller to free.
+   Otherwise finished rows go to bands (if not NULL) as chunks complete them.
+   The 40-byte header has already been read from the input by the caller.
+   rans is an empty reader on dctx's allocator, used when the frame is USE_RANS coded. */
+static unsigned char* pzp_decompress_stream_data(
+                                struct pzp_dctx *dctx, struct pzp_source *input,
+                                unsigned long long dataSize, int isLegacy,
+                                const unsigned int header[10],
+                                unsigned int *widthOutput, unsigned int *heightOutput,
+                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
+                                unsigned int *configuration,
+                                const struct pzp_tensor *tensor,
+                                const struct pzp_bands *bands,
+                                struct pzp_rans_reader *rans)
+{
+    unsigned int bitsperpixelExt  = header[1];
+    unsigned int channelsExt      = header[2];
+    unsigned int width            = header[3];
+    unsigned int height           = header[4];
+    unsigned int bitsperpixelIn   = header[5];
+    unsigned int channelsIn       = header[6];
+    unsigned int storedChecksum   = header[7]; /* PZP0 only, PZP1 keeps it in the trailer */
+    unsigned int compressionCfg   = header[8];
+    unsigned int paletteDataBytes = header[9];
+
+#if PZP_VERBOSE
+    fprintf(stderr, "Detected %ux%ux%u@%ubit/", width, height, channelsExt, bitsperpixelExt);
+    fprintf(stderr, "%u@%ubit", channelsIn, bitsperpixelIn);
+    fprintf(stderr, " | mode %u | CRC:0x%X\n", compressionCfg, storedChecksum);
+#endif
+
+    unsigned int runtimeVersion = convert_header(isLegacy ? pzp_header_v0 : pzp_header);
+    if (runtimeVersion != header[0])
+    {
+        //fail("PZP version mismatch stopping to ensure consistency..");
+        return NULL;
+    }
+
+    if ( (bitsperpixelIn != 8) || (channelsIn == 0) )
+    {
+        fprintf(stderr, "PZP unsupported internal layout %u@%ubit\n", channelsIn, bitsperpixelIn);
+        return NULL;
+    }
+
+    if ( ((compressionCfg & PZP_BACKEND_FLAGS) >> PZP_BACKEND_SHIFT) != input->backend )
+    {
+        fprintf(stderr, "PZP header and prefix disagree on the backend\n");
+        return NULL;
+    }
+
+    // Only stored rANS frames are written before their size is known
+    int streamed = (dataSize == PZP_SIZE_STREAMED);
+    if ( (streamed) && ( (!(compressionCfg & USE_RANS)) || ((compressionCfg & PZP_BACKEND_FLAGS) != USE_STORE) ) )
+    {
+        fprintf(stderr, "PZP frame without a size is not a stored rANS frame\n");
+        return NULL;
+    }
+
+    unsigned int maxError = 0;
+    if (compressionCfg & USE_NEAR_LOSSLESS)
+    {
+        maxError = (isLegacy) ? 0 : header[7];
+        if ( (maxError == 0) || (maxError > PZP_NEAR_MAX_ERROR) || (bitsperpixelExt != 16) ||
+             (channelsIn != 2 * channelsExt) || (channelsExt > PZP_NEAR_MAX_CHANNELS) || (compressionCfg & USE_RLE) )
+        {
+            fprintf(stderr, "PZP near-lossless header is invalid\n");
+            return NULL;
+        }
+    }
+    int nearPrevious[PZP_NEAR_MAX_CHANNELS] = { 0 };
+
+    if ( (compressionCfg & USE_DELTA16) &&
+         ( (bitsperpixelExt != 16) || (channelsIn != 2 * channelsExt) || (channelsExt > PZP_DELTA16_MAX_CHANNELS) ||
+           (compressionCfg & (USE_RLE | USE_PALETTE | USE_RUNS | USE_NEAR_LOSSLESS)) ) )
+    {
+        fprintf(stderr, "PZP 16-bit delta header is invalid\n");
+        return NULL;
+    }
+    unsigned short deltaPrevious[PZP_DELTA16_MAX_CHANNELS] = { 0 };
+
+    if ( (compressionCfg & USE_YCOCG) &&
+         ( (!(compressionCfg & USE_RLE)) || (bitsperpixelExt != 8) || (channelsExt != 3) || (channelsIn != 3) ||
+           (compressionCfg & (USE_PALETTE | USE_RUNS | USE_NEAR_LOSSLESS | USE_DELTA16)) ) )
+    {
+        fprintf(stderr, "PZP YCoCg header is invalid\n");
+        return NULL;
+    }
+    unsigned char ycocgPrevious[3] = { 0 };
+
+    if ( (compressionCfg & USE_SPARSE) &&
+         ( (bitsperpixelExt != 16) || (channelsExt != 1) || (channelsIn != 2) ||
+           (compressionCfg & (USE_RLE | USE_PALETTE | USE_RUNS | USE_NEAR_LOSSLESS | USE_DELTA16 |
+                              USE_RANGE | USE_BITPACK | USE_YCOCG)) ) )
+    {
+        fprintf(stderr, "PZP sparse depth header is invalid\n");
+        return NULL;
+    }
+
+    // After the 40-byte header comes optional palette data, then the pixel/index data.
+    unsigned char palette[8][256];
+    unsigned int  palette_counts[8];
+    unsigned int  rangeBase[8] = { 0 };
+    int rangeWide = (bitsperpixelExt == 16) && (channelsIn == 2 * channelsExt);
+    if (compressionCfg & USE_PALETTE)
+    {
+        unsigned char paletteData[8 * 257];
+        if ( (channelsIn > 8) || (paletteDataBytes > sizeof(paletteData)) ||
+             (!pzp_decompress_stream_read(dctx, input, paletteData, paletteDataBytes)) ||
+             (pzp_palette_read(paletteData, channelsIn, palette, palette_counts) != paletteDataBytes) )
+        {
+            fprintf(stderr, "PZP palette is corrupted\n");
+            return NULL;
+        }
+    } else
+    if (compressionCfg & USE_RANGE)
+    {
+        unsigned char rangeData[4 * 8];
+        if ( (channelsIn > 8) || (paletteDataBytes > sizeof(rangeData)) || (!(compressionCfg & USE_BITPACK)) ||
+             (compressionCfg & USE_RUNS) ||
+             (!pzp_decompress_stream_read(dctx, input, rangeData, paletteDataBytes)) ||
+             (pzp_range_read(rangeData, channelsExt, channelsIn, rangeWide, palette, palette_counts, rangeBase) != paletteDataBytes) )
+        {
+            fprintf(stderr, "PZP range table is corrupted\n");
+            return NULL;
+        }
+    } else
+    if (paletteDataBytes != 0)
+    {
+        fprintf(stderr, "PZP palette data without USE_PALETTE\n");
+        return NULL;
+    }
+
+    // Move from our local variables to function output
+    *bitsperpixelExternalOutput = bitsperpixelExt;
+    *channelsExternalOutput     = channelsExt;
+    *widthOutput                = width;
+    *heightOutput               = height;
+    *bitsperpixelInternalOutput = bitsperpixelIn;
+    *channelsInternalOutput     = channelsIn;
+    *configuration              = compressionCfg;
+
+    size_t pixels      = (size_t)width * height;
+    size_t pixel_size  = pixels * channelsIn;
+    size_t trailer     = (isLegacy) ? 0 : trailerSize;
+    size_t prefix      = (size_t) headerSize + paletteDataBytes;
+    if ( (pixels != 0) && (pixel_size / pixels != channelsIn) )
+    {
+        fprintf(stderr, "PZP image dimensions overflow\n");
+        return NULL;
+    }
+
+    // With USE_RANS the stored data is coded in blocks behind its raw and coded size
+    unsigned long long ransSection[2] = { 0, 0 };
+    struct pzp_rans_reader *storedInput = NULL;
+    if (compressionCfg & USE_RANS)
+    {
+        if (!pzp_decompress_stream_read(dctx, input, ransSection, PZP_RANS_SECTION_HEADER)) { return NULL; }
+        if ( (streamed) ? (ransSection[1] != PZP_SIZE_STREAMED) :
+             ( (ransSection[1] > dataSize) || (prefix + PZP_RANS_SECTION_HEADER + ransSection[1] + trailer != dataSize) ) )
+        {
+            fprintf(stderr, "PZP rANS section size %llu does not match the payload\n", ransSection[1]);
+            return NULL;
+        }
+        rans->rawRemaining   = ransSection[0];
+        rans->codedRemaining = ransSection[1];
+        storedInput = rans;
+    }
+
+    // Size of the stored (filtered / packed / tokenized) index data
+    size_t stored_size = pixel_size;
+    if (compressionCfg & USE_BITPACK)
+    {
+        if ( (!(compressionCfg & (USE_PALETTE | USE_RANGE))) || (compressionCfg & USE_RUNS) )
+        {
+            fprintf(stderr, "PZP bit-packed data without a palette\n");
+            return NULL;
+        }
+        stored_size = pzp_bitpacked_total_size(pixels, channelsIn, palette_counts, compressionCfg);
+    }
+    if (compressionCfg & USE_RUNS)
+    {
+        if ( (prefix + trailer > dataSize) || (ransSection[0] > pixel_size + pixels) ) // a token per pixel at most
+        {
+            fprintf(stderr, "PZP run token stream has an invalid layout\n");
+            return NULL;
+        }
+        stored_size = (storedInput != NULL) ? (size_t) ransSection[0] : (size_t) (dataSize - prefix - trailer);
+    }
+    if (compressionCfg & USE_SPARSE)
+    {
+        // The mask, then two bytes per valid sample, the mask tells how many
+        size_t maskBytes = pzp_sparse_mask_bytes(width, height);
+        if (prefix + trailer > dataSize) { stored_size = 0; }
+        else { stored_size = (storedInput != NULL) ? (size_t) ransSection[0] : (size_t) (dataSize - prefix - trailer); }
+        if ( (stored_size < maskBytes) || (stored_size - maskBytes > pixel_size) )
+        {
+            fprintf(stderr, "PZP sparse depth stream has an invalid layout\n");
+            return NULL;
+        }
+    }
+    if ( (storedInput != NULL) ? (ransSection[0] != stored_size) : (prefix + stored_size + trailer != dataSize) )
+    {
+        fprintf(stderr, "PZP payload size %llu does not match a %ux%ux%u image\n", dataSize, width, height, channelsIn);
+        return NULL;
+    }
+
+    unsigned char *slot = NULL;
+    if (tensor != NULL)
+    {
+        slot = pzp_tensor_slot(tensor, width, height, bitsperpixelExt, channelsExt, channelsIn);
+        if (slot == NULL) { return NULL; }
+    }
+    unsigned int bytesPerValue = bitsperpixelExt / 8;
+
+    struct pzp_band band;
+    memset(&band, 0, sizeof(band));
+    band.width        = width;
+    band.height       = height;
+    band.bitsperpixel = bitsperpixelExt;
+    band.channels     = channelsExt;
+    band.rowBytes     = (size_t) width * channelsIn;
+    if (slot != NULL) { bands = NULL; }
+
+    unsigned int restoreRLEChannels = compressionCfg & USE_RLE;
+
+    // Checksum covers the index/pixel data only (not the palette prefix).
+    struct pzp_checksum checksum;
+    pzp_checksum_init(&checksum);
+
+    if (compressionCfg & (USE_BITPACK | USE_RUNS | USE_SPARSE))
+    {
+        // ── Bit-packed palette / run token / sparse paths: whole-image decode into a scratch buffer ─
+        unsigned char *reconstructed = (unsigned char *) pzp_allocator_alloc(dctx->allocator, pixel_size);
+        if (reconstructed == NULL) { return NULL; }
+
+        int success = 0;
+        unsigned char *stored = NULL;
+        if (compressionCfg & USE_BITPACK)
+        {
+            // Leading planes are read whole; the last one, usually the widest, streams
+            // through one block at a time and is merged into the pixels as it arrives.
+            struct pzp_unpack_state unpack;
+            unsigned char lastPlane[PZP_UNPACK_BLOCK];
+            int addBase = ( (compressionCfg & USE_RANGE) && (rangeWide) );
+            unsigned int lastBits = pzp_plane_bits(palette_counts[channelsIn - 1], compressionCfg);
+            size_t headSize = stored_size - pzp_bitpacked_size(pixels, lastBits);
+
+            stored  = (headSize != 0) ? (unsigned char *) pzp_allocator_alloc(dctx->allocator, headSize) : NULL;
+            success = ( (headSize == 0) || (stored != NULL) ) &&
+                      pzp_stored_read(dctx, input, storedInput, stored, headSize) &&
+                      pzp_unpack_init(&unpack, stored, pixels, channelsIn, palette, palette_counts,
+                                      compressionCfg, (addBase) ? rangeBase : NULL);
+            if (success) { pzp_checksum_update(&checksum, stored, headSize); }
+
+            for (size_t start = 0; (success) && (start < pixels); start += PZP_UNPACK_BLOCK)
+            {
+                size_t count = (pixels - start < PZP_UNPACK_BLOCK) ? pixels - start : PZP_UNPACK_BLOCK;
+                size_t bytes = pzp_bitpacked_size(count, lastBits);
+                success = pzp_stored_read(dctx, input, storedInput, lastPlane, bytes);
+                if (success)
+                {
+                    pzp_checksum_update(&checksum, lastPlane, bytes);
+                    pzp_unpack_block(&unpack, lastPlane, reconstructed, start, count);
+                    // The unpack prefix summed Y, Co, Cg, turn the block back into R, G, B while it is in cache
+                    if (compressionCfg & USE_YCOCG)
+                        pzp_ycocg_inverse(reconstructed + start * channelsIn, count);
+                }
+            }
+        } else
+        {
+            // The sparse expand loads 16 bytes at a time past the last valid sample
+            stored  = (unsigned char *) pzp_allocator_alloc(dctx->allocator, stored_size + ((compressionCfg & USE_SPARSE) ? 16 : 0));
+            success = (stored != NULL) && pzp_stored_read(dctx, input, storedInput, stored, stored_size);
+            if (success) { pzp_checksum_update(&checksum, stored, stored_size); }
+        }
+
+        if ( (success) && (!isLegacy) )
+            success = pzp_decompress_stream_read(dctx, input, &storedChecksum, trailerSize);
+
+        if (success)
+        {
+            unsigned int computedChecksum = pzp_checksum_final(&checksum);
+            if (computedChecksum != storedChecksum)
+            {
+                fprintf(stderr, "PZP checksum mismatch (stored 0x%X, computed 0x%X): file may be corrupted\n",
+                        storedChecksum, computedChecksum);
+                success = 0;
+            }
+        }
+
+        if ( (success) && (compressionCfg & USE_RUNS) )
+        {
+            success = pzp_runs_decode(stored, stored_size, reconstructed, width, height, channelsIn);
+            if (!success) { fprintf(stderr, "PZP run token stream is corrupted\n"); }
+            if ( (success) && (compressionCfg & USE_PALETTE) )
+                pzp_palette_apply(reconstructed, pixels, channelsIn, palette);
+        }
+
+        if ( (success) && (compressionCfg & USE_SPARSE) )
+        {
+            success = pzp_sparse_decode(stored, stored_size, reconstructed, width, height);
+            if (!success) { fprintf(stderr, "PZP sparse depth mask does not match its samples\n"); }
+        }
+        pzp_allocator_free(dctx->allocator, stored);
+
+        if ( (success) && (maxError != 0) )
+            pzp_near_reconstruct(reconstructed, pixels, channelsExt, maxError, nearPrevious);
+
+        if ( (success) && (compressionCfg & USE_DELTA16) )
+            pzp_delta16_reconstruct(reconstructed, pixels, channelsExt, deltaPrevious);
+
+        if ( (success) && (!pzp_bands_emit(bands, &band, reconstructed, height, 1)) )
+            success = 0;
+
+        if (!success)
+        {
+            pzp_allocator_free(dctx->allocator, reconstructed);
+            return NULL;
+        }
+        if (slot != NULL)
+        {
+            pzp_tensor_store(tensor, slot, reconstructed, 0, pixels, pixels, channelsExt, bytesPerValue);
+            pzp_allocator_free(dctx->allocator, reconstructed);
+            return slot;
+        }
+        return reconstructed;
+    }
+
+    // ── Interleaved path: decompress, checksum and reconstruct chunk by chunk ─
+    size_t chunk_pixels = PZP_CHUNK_BYTES / channelsIn;
+    if (chunk_pixels == 0) { chunk_pixels = 1; }
+    if ( (bands != NULL) && (width != 0) )
+    {
+        // Chunks of one band each, so every band is handed over as soon as it is decoded
+        size_t bandPixels = (size_t) ((bands->rows != 0) ? bands->rows : PZP_BAND_ROWS) * width;
+        if (bandPixels < chunk_pixels) { chunk_pixels = bandPixels; }
+    }
+    unsigned char carry[8]; // last reconstructed palette indices of the previous chunk
+
+    // Tensor output reuses one chunk buffer, preceded by the previous chunk's last
+    // (pre-palette) pixel so the delta fold below reads it from chunk[-channelsIn].
+    unsigned char *reconstructed = (unsigned char *) ((slot != NULL) ? pzp_allocator_alloc(dctx->allocator, channelsIn + chunk_pixels * channelsIn) : pzp_allocator_alloc(dctx->allocator, pixel_size));
+    if (reconstructed == NULL) { return NULL; }
+
+    for (size_t start = 0; start < pixels; start += chunk_pixels)
+    {
+        size_t count = (pixels - start < chunk_pixels) ? pixels - start : chunk_pixels;
+        unsigned char *chunk = (slot != NULL) ? reconstructed + channelsIn : reconstructed + start * channelsIn;
+
+        if (!pzp_stored_read(dctx, input, storedInput, chunk, count * channelsIn))
+        {
+            pzp_allocator_free(dctx->allocator, reconstructed);
+            return NULL;
+        }
+        pzp_checksum_update(&checksum, chunk, count * channelsIn);
+
+        if (compressionCfg & USE_YCOCG)
+        {
+            // Running sums stay in Y, Co, Cg, the chunk comes out as R, G, B
+            pzp_ycocg_reconstruct(chunk, count, ycocgPrevious);
+        }
+        else if (restoreRLEChannels)
+        {
+            // Fold the previous chunk's last pixel into the first delta, then scan in place
+            if (start > 0)
+                for (unsigned int ch = 0; ch < channelsIn; ch++)
+                    chunk[ch] += ( (compressionCfg & USE_PALETTE) && (slot == NULL) ) ? carry[ch] : chunk[(int) ch - (int) channelsIn];
+
+            pzp_extractAndReconstruct(chunk, chunk, (unsigned int) count, 1, channelsIn, restoreRLEChannels);
+
+            if (slot != NULL)
+                memcpy(reconstructed, chunk + (count - 1) * channelsIn, channelsIn);
+            else if (compressionCfg & USE_PALETTE)
+                memcpy(carry, chunk + (count - 1) * channelsIn, channelsIn);
+        }
+
+        if (compressionCfg & USE_PALETTE)
+            pzp_palette_apply(chunk, count, channelsIn, palette);
+
+        if (maxError != 0)
+            pzp_near_reconstruct(chunk, count, channelsExt, maxError, nearPrevious);
+
+        if (compressionCfg & USE_DELTA16)
+            pzp_delta16_reconstruct(chunk, count, channelsExt, deltaPrevious);
+
+        if (slot != NULL)
+            pzp_tensor_store(tensor, slot, chunk, start, count, pixels, channelsExt, bytesPerValue);
+        else if (!pzp_bands_emit(bands, &band, reconstructed, (unsigned int) ((start + count) / width), 0))
+        {
+            pzp_allocator_free(dctx->allocator, reconstructed);
+            return NULL;
+        }
+    }
+
+    if (!pzp_bands_emit(bands, &band, reconstructed, height, 1))
+    {
+        pzp_allocator_free(dctx->allocator, reconstructed);
+        return NULL;
+    }
+
+    if ( (!isLegacy) && (!pzp_decompress_stream_read(dctx, input, &storedChecksum, trailerSize)) )
+    {
+        pzp_allocator_free(dctx->allocator, reconstructed);
+        return NULL;
+    }
+
+    unsigned int computedChecksum = pzp_checksum_final(&checksum);
+    if (computedChecksum != storedChecksum)
+    {
+        fprintf(stderr, "PZP checksum mismatch (stored 0x%X, computed 0x%X): file may be corrupted\n",
+                storedChecksum, computedChecksum);
+        pzp_allocator_free(dctx->allocator, reconstructed);
+        return NULL;
+    }
+
+    if (slot != NULL)
+    {
+        pzp_allocator_free(dctx->allocator, reconstructed);
+        return slot;
+    }
+    return reconstructed;
+}
+
+static unsigned char* pzp_decompress_stream_body(
+                                struct pzp_dctx *dctx, struct pzp_source *input,
+                                unsigned long long dataSize, int isLegacy,
+                                const unsigned int header[10],
+                                unsigned int *widthOutput, unsigned int *heightOutput,
+                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
+                                unsigned int *configuration,
+                                const struct pzp_tensor *tensor,
+                                const struct pzp_bands *bands)
+{
+    struct pzp_rans_reader rans;
+    memset(&rans, 0, sizeof(rans));
+    rans.allocator = dctx->allocator;
+    unsigned char *result = pzp_decompress_stream_data(dctx, input, dataSize, isLegacy, header,
+                                                       widthOutput, heightOutput,
+                                                       bitsperpixelExternalOutput, channelsExternalOutput,
+                                                       bitsperpixelInternalOutput, channelsInternalOutput,
+                                                       configuration, tensor, bands, &rans);
+    pzp_rans_reader_free(&rans);
+    return result;
+}
+
+/* Same, reading the header first. */
+static unsigned char* pzp_decompress_stream_payload(
+                                struct pzp_dctx *dctx, struct pzp_source *input,
+                                unsigned long long dataSize, int isLegacy,
+                                unsigned int *widthOutput, unsigned int *heightOutput,
+                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
+                                unsigned int *configuration,
+                                const struct pzp_tensor *tensor,
+                                const struct pzp_bands *bands)
+{
+    unsigned int header[10];
+    if (!pzp_decompress_stream_read(dctx, input, header, headerSize)) { return NULL; }
+
+    return pzp_decompress_stream_body(dctx, input, dataSize, isLegacy, header,
+                                      widthOutput, heightOutput,
+                                      bitsperpixelExternalOutput, channelsExternalOutput,
+                                      bitsperpixelInternalOutput, channelsInternalOutput,
+                                      configuration, tensor, bands);
+}
+
+/* Reset dctx for the frame whose prefix was just read from source.  Each backend's
+   context is created on first use and kept alive for the next frames.  A caller
+   owned dctx starts zeroed (with its allocator set) and ends with pzp_dctx_free(). */
+static int pzp_dctx_begin(struct pzp_dctx *dctx, const struct pzp_source *source)
+{
+    if (source->backend >= PZP_BACKEND_COUNT) { return 0; }
+    dctx->backend = &pzp_backends[source->backend];
+    return dctx->backend->decompressBegin(dctx);
+}
+
+static void pzp_dctx_free(struct pzp_dctx *dctx)
+{
+    ZSTD_freeDCtx(dctx->zstd);
+    dctx->zstd = NULL;
+   #if PZP_LZ4
+    if (dctx->lz4 != NULL) { LZ4F_freeDecompressionContext(dctx->lz4); }
+    dctx->lz4 = NULL;
+   #endif
+}
+
+/* The calling thread's decoding contexts, reset for the frame whose prefix was
+   just read from source. */
+static struct pzp_dctx * pzp_thread_dctx(const struct pzp_source *source)
+{
+    static PZP_THREAD_LOCAL struct pzp_dctx dctx;
+    return (pzp_dctx_begin(&dctx, source)) ? &dctx : NULL;
+}
+
+/* The backend ID of a PZP1 prefix, 1 if this build can decode it. */
+static int pzp_prefix_backend_check(unsigned int backend)
+{
+    if ( (backend < PZP_BACKEND_COUNT) && (pzp_backends[backend].decompress != NULL) ) { return 1; }
+    if (backend < PZP_BACKEND_COUNT) { fprintf(stderr, "PZP was built without the %s backend\n", pzp_backends[backend].name); }
+      else                           { fprintf(stderr, "PZP frame has an unknown backend (%u)\n", backend); }
+    return 0;
+}
+
+/* Parse the size prefix and point a memory source at the frame behind it.
+   Returns 1 and fills source / dataSize / isLegacy, or 0 if the prefix is malformed. */
+static int pzp_open_frame(const void *file_data, size_t file_size,
+                          struct pzp_source *source, unsigned long long *dataSizeOutput, int *isLegacyOutput)
+{
+    if (!file_data || file_size <= sizeof(unsigned int))
+    {
+        fprintf(stderr, "Invalid file data or size\n");
+        return 0;
+    }
+
+    const unsigned char *input_ptr = (const unsigned char *)file_data;
+
+    // Read stored size: uint32 for PZP0, a backend ID followed by a uint64 for PZP1
+    unsigned int legacySize;
+    memcpy(&legacySize, input_ptr, sizeof(unsigned int));
+
+    int isLegacy = (legacySize >= (unsigned int) headerSize);
+    unsigned int backend = (isLegacy) ? (unsigned int) PZP_BACKEND_ZSTD : legacySize;
+    unsigned long long dataSize = legacySize;
+    size_t prefixSize = prefixSizeV0;
+    if (!isLegacy)
+    {
+        if (!pzp_prefix_backend_check(backend)) { return 0; }
+        if (file_size <= (size_t) prefixSizeV1)
+        {
+            fprintf(stderr, "Invalid file data or size\n");
+            return 0;
+        }
+        memcpy(&dataSize, input_ptr + sizeof(unsigned int), sizeof(unsigned long long));
+        prefixSize = prefixSizeV1;
+    }
+
+    size_t compressed_size = file_size - prefixSize;
+    const void *compressed_buffer = input_ptr + prefixSize;
+
+    // Sanity check: the zstd frame records its content size too, a stored one is it
+    int sizeMismatch = 0;
+    if (backend == PZP_BACKEND_ZSTD)
+    {
+        unsigned long long frameSize = ZSTD_getFrameContentSize(compressed_buffer, compressed_size);
+        sizeMismatch = (frameSize == ZSTD_CONTENTSIZE_ERROR) ||
+                       ( (frameSize != ZSTD_CONTENTSIZE_UNKNOWN) && (frameSize != dataSize) );
+    } else
+    if (backend == PZP_BACKEND_STORE)
+    {
+        sizeMismatch = (dataSize != PZP_SIZE_STREAMED) && (dataSize > compressed_size);
+    }
+    if ( (dataSize < (unsigned long long) headerSize) || (sizeMismatch) )
+    {
+        fprintf(stderr, "Error: Invalid size read from memory (%llu)\n", dataSize);
+        return 0;
+    }
+
+    pzp_source_memory(source, compressed_buffer, compressed_size);
+    source->backend        = backend;
+    source->frameRemaining = (backend == PZP_BACKEND_STORE) ? dataSize : 1;
+    *dataSizeOutput = dataSize;
+    *isLegacyOutput = isLegacy;
+    return 1;
+}
+
+/* pzp_decompress_combined_from_memory, handing the rows to bands (see struct
+   pzp_bands) while the rest of the image is decoded. */
+static unsigned char* pzp_decompress_bands_from_memory(
+                                const void *file_data, size_t file_size,
+                                const struct pzp_bands *bands,
+                                unsigned int *widthOutput, unsigned int *heightOutput,
+                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
+                                unsigned int *configuration)
+{
+    struct pzp_source input;
+    unsigned long long dataSize = 0;
+    int isLegacy = 0;
+    if (!pzp_open_frame(file_data, file_size, &input, &dataSize, &isLegacy)) { return NULL; }
+
+    struct pzp_dctx *dctx = pzp_thread_dctx(&input);
+    if (!dctx) { return NULL; }
+
+    unsigned char *result = pzp_decompress_stream_payload(dctx, &input, dataSize, isLegacy,
+                                                          widthOutput, heightOutput,
+                                                          bitsperpixelExternalOutput, channelsExternalOutput,
+                                                          bitsperpixelInternalOutput, channelsInternalOutput,
+                                                          configuration, NULL, bands);
+    return result;
+}
+
+static unsigned char* pzp_decompress_combined_from_memory(
+                                const void *file_data, size_t file_size,
+                                unsigned int *widthOutput, unsigned int *heightOutput,
+                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
+                                unsigned int *configuration)
+{
+    return pzp_decompress_bands_from_memory(file_data, file_size, NULL,
+                                            widthOutput, heightOutput,
+                                            bitsperpixelExternalOutput, channelsExternalOutput,
+                                            bitsperpixelInternalOutput, channelsInternalOutput,
+                                            configuration);
+}
+
+/* Decode into a caller-provided tensor slot (see struct pzp_tensor) instead of a new
+   HWC buffer.  Returns 1 on success, 0 on failure (the slot may be partly written). */
+static int pzp_decompress_to_tensor_from_memory(
+                                const void *file_data, size_t file_size,
+                                const struct pzp_tensor *tensor,
+                                unsigned int *widthOutput, unsigned int *heightOutput,
+                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                unsigned int *configuration)
+{
+    if (tensor == NULL) { return 0; }
+
+    struct pzp_source input;
+    unsigned long long dataSize = 0;
+    int isLegacy = 0;
+    if (!pzp_open_frame(file_data, file_size, &input, &dataSize, &isLegacy)) { return 0; }
+
+    struct pzp_dctx *dctx = pzp_thread_dctx(&input);
+    if (!dctx) { return 0; }
+
+    unsigned int bitsperpixelInternal = 0, channelsInternal = 0;
+    return (pzp_decompress_stream_payload(dctx, &input, dataSize, isLegacy,
+                                          widthOutput, heightOutput,
+                                          bitsperpixelExternalOutput, channelsExternalOutput,
+                                          &bitsperpixelInternal, &channelsInternal,
+                                          configuration, tensor, NULL) != NULL);
+}
+
+/* Read the size prefix in front of the next frame of a source: a uint32 for PZP0,
+   a backend ID followed by a uint64 for PZP1, and note the frame's backend in the
+   source.  Returns 1 on success. */
+static int pzp_source_read_prefix(struct pzp_source *source, unsigned long long *dataSizeOutput, int *isLegacyOutput)
+{
+    unsigned int legacySize = 0;
+    unsigned long long dataSize = 0;
+    if (pzp_source_read_raw(source, &legacySize, sizeof(unsigned int)))
+    {
+        int isLegacy = (legacySize >= (unsigned int) headerSize);
+        if ( (!isLegacy) && (!pzp_prefix_backend_check(legacySize)) ) { return 0; }
+
+        dataSize = legacySize;
+        if ( (isLegacy) || (pzp_source_read_raw(source, &dataSize, sizeof(unsigned long long))) )
+        {
+            if (dataSize < (unsigned long long) headerSize)
+            {
+                fprintf(stderr, "Error: Invalid size read from stream (%llu)\n", dataSize);
+                return 0;
+            }
+            source->backend        = (isLegacy) ? (unsigned int) PZP_BACKEND_ZSTD : legacySize;
+            source->frameRemaining = (source->backend == PZP_BACKEND_STORE) ? dataSize : 1;
+            *dataSizeOutput = dataSize;
+            *isLegacyOutput = isLegacy;
+            return 1;
         }
     }
-    else // Non-RLE path: data is already in final interleaved layout
+    fprintf(stderr, "PZP stream ended before the frame\n");
+    return 0;
+}
+
+/* Consume the end of the frame (zstd checksum, last block header, LZ4 end mark) so
+   the source points at the next frame.  Returns 0 if the frame is truncated or
+   longer than its header says. */
+static int pzp_source_finish_frame(struct pzp_dctx *dctx, struct pzp_source *source)
+{
+    return dctx->backend->finish(dctx, source);
+}
+
+/* Same as pzp_decompress_from_source_bands through a caller owned dctx (see
+   pzp_dctx_begin), whose allocator also makes the returned pixels; NULL takes
+   the calling thread's contexts and the default allocator. */
+static unsigned char* pzp_decompress_from_source_dctx(
+                                struct pzp_dctx *ownDctx,
+                                struct pzp_source *source,
+                                const struct pzp_bands *bands,
+                                unsigned int *widthOutput, unsigned int *heightOutput,
+                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
+                                unsigned int *configuration)
+{
+    unsigned long long dataSize = 0;
+    int isLegacy = 0;
+    if (!pzp_source_read_prefix(source, &dataSize, &isLegacy)) { return NULL; }
+
+    struct pzp_dctx *dctx = (ownDctx != NULL) ? ownDctx : pzp_thread_dctx(source);
+    if ( (!dctx) || ( (ownDctx != NULL) && (!pzp_dctx_begin(dctx, source)) ) ) { return NULL; }
+
+    unsigned char *result = pzp_decompress_stream_payload(dctx, source, dataSize, isLegacy,
+                                                          widthOutput, heightOutput,
+                                                          bitsperpixelExternalOutput, channelsExternalOutput,
+                                                          bitsperpixelInternalOutput, channelsInternalOutput,
+                                                          configuration, NULL, bands);
+    if (result == NULL) { return NULL; }
+
+    if (!pzp_source_finish_frame(dctx, source))
     {
-        memcpy(reconstructed, src, total_size * channels);
+        pzp_allocator_free(dctx->allocator, result);
+        return NULL;
     }
+    return result;
 }
-//-----------------------------------------------------------------------------------------------
-static void pzp_extractAndReconstruct(unsigned char *decompressed_bytes, unsigned char *reconstructed, unsigned int width, unsigned int height, unsigned int channels, int restoreRLEChannels)
+
+/* Decode the next frame of a source (pipe, socket, FILE*, …) while it is being read.
+   The source is left just behind the frame, so a stream of frames is decoded by
+   calling this until pzp_source_at_end().  USE_PYRAMID levels are not skipped, so
+   such streams should not carry them.  Returns the pixels (pzp_dealloc() them) or NULL.
+   With bands (see struct pzp_bands) the rows are handed over as they are decoded,
+   i.e. while later parts of the frame are still arriving. */
+static unsigned char* pzp_decompress_from_source_bands(
+                                struct pzp_source *source,
+                                const struct pzp_bands *bands,
+                                unsigned int *widthOutput, unsigned int *heightOutput,
+                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
+                                unsigned int *configuration)
 {
-   #if INTEL_OPTIMIZATIONS
-     pzp_extractAndReconstruct_AVX2(decompressed_bytes,reconstructed,width,height,channels,restoreRLEChannels);
-   #else
-     pzp_extractAndReconstruct_Naive(decompressed_bytes,reconstructed,width,height,channels,restoreRLEChannels);
-   #endif // INTEL_OPTIMIZATIONS
+    return pzp_decompress_from_source_dctx(NULL, source, bands,
+                                           widthOutput, heightOutput,
+                                           bitsperpixelExternalOutput, channelsExternalOutput,
+                                           bitsperpixelInternalOutput, channelsInternalOutput,
+                                           configuration);
 }
-//-----------------------------------------------------------------------------------------------
-static unsigned char* pzp_decompress_combined_from_memory(
+
+static unsigned char* pzp_decompress_from_source(
+                                struct pzp_source *source,
+                                unsigned int *widthOutput, unsigned int *heightOutput,
+                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
+                                unsigned int *configuration)
+{
+    return pzp_decompress_from_source_bands(source, NULL,
+                                            widthOutput, heightOutput,
+                                            bitsperpixelExternalOutput, channelsExternalOutput,
+                                            bitsperpixelInternalOutput, channelsInternalOutput,
+                                            configuration);
+}
+
+/* Decompress just the 40-byte header.  The PZP0 checksum field is cleared, so
+   header[7] is always the near-lossless bound (or 0).  Returns 1 on success. */
+static int pzp_read_header_words_from_memory(const void *file_data, size_t file_size, unsigned int header[10])
+{
+    struct pzp_source input;
+    unsigned long long dataSize = 0;
+    int isLegacy = 0;
+    if (!pzp_open_frame(file_data, file_size, &input, &dataSize, &isLegacy)) { return 0; }
+
+    struct pzp_dctx *dctx = pzp_thread_dctx(&input);
+    if (!dctx) { return 0; }
+
+    if (!pzp_decompress_stream_read(dctx, &input, header, headerSize)) { return 0; }
+    if (header[0] != convert_header(isLegacy ? pzp_header_v0 : pzp_header)) { return 0; }
+    if (isLegacy) { header[7] = 0; }
+    return 1;
+}
+
+/* Read only the image header, e.g. to size a tensor before decoding.
+   Returns 1 on success, 0 on failure. */
+static int pzp_read_header_from_memory(
                                 const void *file_data, size_t file_size,
                                 unsigned int *widthOutput, unsigned int *heightOutput,
                                 unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
                                 unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
                                 unsigned int *configuration)
 {
-    if (!file_data || file_size <= sizeof(unsigned int))
-    {
-        fprintf(stderr, "Invalid file data or size\n");
+    unsigned int header[10];
+    if (!pzp_read_header_words_from_memory(file_data, file_size, header)) { return 0; }
+
+    *bitsperpixelExternalOutput = header[1];
+    *channelsExternalOutput     = header[2];
+    *widthOutput                = header[3];
+    *heightOutput               = header[4];
+    *bitsperpixelInternalOutput = header[5];
+    *channelsInternalOutput     = header[6];
+    *configuration              = header[8];
+    return 1;
+}
+
+
+/* A USE_STORE frame of an 8-bit image without filters holds its pixels exactly as
+   the decoder returns them (interleaved, no palette / delta / runs / range / rANS),
+   so they can be used where they lie, e.g. in a file mapped from tmpfs.  Returns a
+   pointer into file_data, or NULL if the frame is not stored that way (decode it
+   then).  The checksum trailer is not verified. */
+static const unsigned char * pzp_store_view_from_memory(const void *file_data, size_t file_size,
+                                                        unsigned int *widthOutput, unsigned int *heightOutput,
+                                                        unsigned int *channelsOutput)
+{
+    struct pzp_source input;
+    unsigned long long dataSize = 0;
+    int isLegacy = 0;
+    if ( (file_data == NULL) || (file_size < (size_t) prefixSizeV1 + headerSize) ) { return NULL; }
+    unsigned int backend;
+    memcpy(&backend, file_data, sizeof(unsigned int));
+    if (backend != PZP_BACKEND_STORE) { return NULL; }
+    if (!pzp_open_frame(file_data, file_size, &input, &dataSize, &isLegacy)) { return NULL; }
+
+    const unsigned char *payload = (const unsigned char *) input.input.src;
+    unsigned int header[10];
+    memcpy(header, payload, headerSize);
+
+    unsigned int plainFlags = USE_COMPRESSION | USE_PYRAMID | USE_LAYERS | USE_STORE;
+    size_t pixels = (size_t) header[3] * header[4];
+    size_t bytes  = pixels * header[2];
+    if ( (header[0] != convert_header(pzp_header)) || (header[1] != 8) || (header[5] != 8) ||
+         (header[2] == 0) || (header[6] != header[2]) || (header[8] & ~plainFlags) || (header[9] != 0) ||
+         ( (header[3] != 0) && (pixels / header[3] != header[4]) ) || ( (pixels != 0) && (bytes / pixels != header[2]) ) ||
+         (dataSize != (unsigned long long) headerSize + bytes + trailerSize) )
         return NULL;
+
+    *widthOutput    = header[3];
+    *heightOutput   = header[4];
+    *channelsOutput = header[2];
+    return payload + headerSize;
+}
+
+/* Read only as much of a file as the header needs: the size prefix, the frame
+   header and its first block (at most 128 KiB for zstd, 64 KiB for LZ4). */
+#define PZP_HEADER_PEEK_BYTES ((size_t) ZSTD_BLOCKSIZE_MAX + 64)
+
+static int pzp_read_header_words(const char *input_filename, unsigned int header[10])
+{
+    FILE *fp = fopen(input_filename, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to read file: %s\n", input_filename);
+        return 0;
     }
 
-    const unsigned char *input_ptr = (const unsigned char *)file_data;
+    unsigned char *head = (unsigned char *) pzp_alloc(PZP_HEADER_PEEK_BYTES);
+    if (!head) { fclose(fp); return 0; }
 
-    // Read stored size
-    unsigned int dataSize;
-    memcpy(&dataSize, input_ptr, sizeof(unsigned int));
+    size_t headSize = fread(head, 1, PZP_HEADER_PEEK_BYTES, fp);
+    fclose(fp);
 
-    if (dataSize == 0 || dataSize > 100000000)
-    { // sanity check
-        fprintf(stderr, "Error: Invalid size read from memory (%u)\n", dataSize);
-        return NULL;
+    int result = pzp_read_header_words_from_memory(head, headSize, header);
+    pzp_dealloc(head);
+    return result;
+}
+
+static int pzp_read_header(const char *input_filename,
+                           unsigned int *widthOutput, unsigned int *heightOutput,
+                           unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                           unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
+                           unsigned int *configuration)
+{
+    unsigned int header[10];
+    if (!pzp_read_header_words(input_filename, header)) { return 0; }
+
+    *bitsperpixelExternalOutput = header[1];
+    *channelsExternalOutput     = header[2];
+    *widthOutput                = header[3];
+    *heightOutput               = header[4];
+    *bitsperpixelInternalOutput = header[5];
+    *channelsInternalOutput     = header[6];
+    *configuration              = header[8];
+    return 1;
+}
+
+/* USE_NEAR_LOSSLESS bound of a file: decoded samples are within ±this value of
+   the original, 0 for lossless files.  Returns -1 if the header is unreadable. */
+static long pzp_read_max_error(const char *input_filename)
+{
+    unsigned int header[10];
+    if (!pzp_read_header_words(input_filename, header)) { return -1; }
+    return (header[8] & USE_NEAR_LOSSLESS) ? (long) header[7] : 0;
+}
+
+static unsigned char* pzp_decompress_combined(const char *input_filename,
+                                unsigned int *widthOutput, unsigned int *heightOutput,
+                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
+                                unsigned int *configuration)
+{
+    size_t file_size = 0;
+    void *file_data = pzp_read_file_to_memory(input_filename, &file_size);
+    if (file_data!=NULL)
+    {
+      unsigned char *result = pzp_decompress_combined_from_memory(
+                                                                    file_data, file_size,
+                                                                    widthOutput, heightOutput,
+                                                                    bitsperpixelExternalOutput, channelsExternalOutput,
+                                                                    bitsperpixelInternalOutput, channelsInternalOutput,
+                                                                    configuration
+                                                                  );
+
+      pzp_dealloc(file_data);
+      return result;
     }
 
-    size_t compressed_size = file_size - sizeof(unsigned int);
-    const void *compressed_buffer = input_ptr + sizeof(unsigned int);
+    fprintf(stderr, "Failed to read file: %s\n", input_filename);
+    return NULL;
+}
 
-    size_t decompressed_size = (size_t)dataSize;
-    void *decompressed_buffer = malloc(decompressed_size);
-    if (!decompressed_buffer)
+static int pzp_decompress_to_tensor(const char *input_filename,
+                                    const struct pzp_tensor *tensor,
+                                    unsigned int *widthOutput, unsigned int *heightOutput,
+                                    unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                    unsigned int *configuration)
+{
+    size_t file_size = 0;
+    void *file_data = pzp_read_file_to_memory(input_filename, &file_size);
+    if (file_data == NULL)
     {
-        //free(compressed_buffer);
-        //fail("Memory allocation #2 failed");
+        fprintf(stderr, "Failed to read file: %s\n", input_filename);
         return 0;
     }
 
+    int result = pzp_decompress_to_tensor_from_memory(file_data, file_size, tensor,
+                                                      widthOutput, heightOutput,
+                                                      bitsperpixelExternalOutput, channelsExternalOutput,
+                                                      configuration);
+    pzp_dealloc(file_data);
+    return result;
+}
+
+//-----------------------------------------------------------------------------------------------
+//-----------------------------------------------------------------------------------------------
+/* Look up entry `entry` (0 = first) of an index that closes a file:
+     uint64 offset, uint64 size   × count,   uint32 count, magic
+   tail holds the last tailSize bytes of the fileSize byte file.  Returns count (0
+   if the file does not end in that index) and, if entry is below it, fills in
+   where that entry's bytes live. */
+static unsigned int pzp_footer_find(const unsigned char *tail, size_t tailSize, unsigned long long fileSize,
+                                    const char magic[4], unsigned int maxCount, const char *what,
+                                    unsigned int entry, unsigned long long *offset, unsigned long long *size)
+{
+    const size_t fixedBytes = sizeof(unsigned int) + 4;
+    if ( (tailSize < fixedBytes) || (tailSize > fileSize) ) { return 0; }
+    if (memcmp(tail + tailSize - 4, magic, 4) != 0) { return 0; }
 
+    unsigned int count = 0;
+    memcpy(&count, tail + tailSize - fixedBytes, sizeof(unsigned int));
+    size_t indexBytes = (size_t) count * 2 * sizeof(unsigned long long);
+    if ( (count == 0) || (count > maxCount) || (tailSize < fixedBytes + indexBytes) ) { return 0; }
 
-    size_t actual_decompressed_size = ZSTD_decompress(decompressed_buffer, decompressed_size, compressed_buffer, compressed_size);
-    if (ZSTD_isError(actual_decompressed_size))
+    if (entry < count)
     {
-        //free(compressed_buffer);
-        free(decompressed_buffer);
-        fprintf(stderr, "Zstd decompression error: %s\n", ZSTD_getErrorName(actual_decompressed_size));
-        //fail("Decompression Error");
-        return 0;
+        const unsigned char *record = tail + tailSize - fixedBytes - indexBytes + (size_t) entry * 2 * sizeof(unsigned long long);
+        unsigned long long indexStart = fileSize - fixedBytes - indexBytes;
+        memcpy(offset, record, sizeof(unsigned long long));
+        memcpy(size,   record + sizeof(unsigned long long), sizeof(unsigned long long));
+        if ( (*offset > indexStart) || (*size > indexStart - *offset) )
+        {
+            fprintf(stderr, "PZP %s index is corrupted\n", what);
+            return 0;
+        }
     }
+    return count;
+}
+
+/* Read the last bytes of an open file (up to capacity) into tail.
+   Returns the number of bytes read, 0 on error. */
+static size_t pzp_read_tail(FILE *fp, unsigned char *tail, size_t capacity, unsigned long long *fileSizeOutput)
+{
+    if (fseeko(fp, 0, SEEK_END) != 0) { return 0; }
+    long long fileSize = ftello(fp);
+    if (fileSize <= 0) { return 0; }
+
+    size_t tailSize = ( (unsigned long long) fileSize < capacity ) ? (size_t) fileSize : capacity;
+    if ( (fseeko(fp, fileSize - (long long) tailSize, SEEK_SET) != 0) || (fread(tail, 1, tailSize, fp) != tailSize) ) { return 0; }
 
-    //free(compressed_buffer);
+    *fileSizeOutput = (unsigned long long) fileSize;
+    return tailSize;
+}
+
+/* Look up pyramid level `level` (1 = half size, 2 = quarter, …) in the index at the
+   end of a USE_PYRAMID file.  Returns the number of stored levels below full
+   resolution (0 without an index) and, if level is one of them, fills in where its
+   PZP1 stream lives. */
+static unsigned int pzp_pyramid_find(const unsigned char *tail, size_t tailSize, unsigned long long fileSize,
+                                     unsigned int level, unsigned long long *offset, unsigned long long *size)
+{
+    // level 0 wraps around to an entry past the index: only the count is returned
+    return pzp_footer_find(tail, tailSize, fileSize, pzp_pyramid_magic, PZP_PYRAMID_MAX_LEVELS, "pyramid",
+                           level - 1, offset, size);
+}
 
-    if (actual_decompressed_size != decompressed_size)
+/* Number of resolutions that can be decoded: 1 + the stored pyramid levels. */
+static unsigned int pzp_pyramid_levels_from_memory(const void *file_data, size_t file_size)
+{
+    if (!file_data) { return 0; }
+    size_t tailSize = (file_size < PZP_PYRAMID_FOOTER_MAX) ? file_size : PZP_PYRAMID_FOOTER_MAX;
+    unsigned long long offset, size;
+    return 1 + pzp_pyramid_find((const unsigned char *) file_data + file_size - tailSize, tailSize,
+                                 file_size, 0, &offset, &size);
+}
+
+/* Decode pyramid level `level` (0 = full resolution, each level halves width and
+   height) to an interleaved HWC buffer, touching only that level's bytes. */
+static unsigned char* pzp_decompress_level_from_memory(
+                                const void *file_data, size_t file_size, unsigned int level,
+                                unsigned int *widthOutput, unsigned int *heightOutput,
+                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
+                                unsigned int *configuration)
+{
+    if ( (level > 0) && (file_data != NULL) )
     {
-        free(decompressed_buffer);
-        fprintf(stderr, "Actual Decompressed size %lu mismatch with Decompressed size %lu \n", actual_decompressed_size, decompressed_size);
-        //fail("Decompression Error");
-        return 0;
+        size_t tailSize = (file_size < PZP_PYRAMID_FOOTER_MAX) ? file_size : PZP_PYRAMID_FOOTER_MAX;
+        unsigned long long offset = 0, size = 0;
+        unsigned int levels = pzp_pyramid_find((const unsigned char *) file_data + file_size - tailSize, tailSize,
+                                               file_size, level, &offset, &size);
+        if (level > levels)
+        {
+            fprintf(stderr, "PZP file has no pyramid level %u (%u stored)\n", level, levels);
+            return NULL;
+        }
+        file_data = (const unsigned char *) file_data + offset;
+        file_size = (size_t) size;
     }
 
-    // Read header information
-    unsigned int *memStartAsUINT = (unsigned int *)decompressed_buffer;
-
-    unsigned int *headerSource            = memStartAsUINT + 0;
-    unsigned int *bitsperpixelExtSource   = memStartAsUINT + 1;
-    unsigned int *channelsExtSource       = memStartAsUINT + 2;
-    unsigned int *widthSource             = memStartAsUINT + 3;
-    unsigned int *heightSource            = memStartAsUINT + 4;
-    unsigned int *bitsperpixelInSource    = memStartAsUINT + 5;
-    unsigned int *channelsInSource        = memStartAsUINT + 6;
-    unsigned int *checksumSource          = memStartAsUINT + 7;
-    unsigned int *compressionConfigSource = memStartAsUINT + 8;
-    unsigned int *paletteDataSizeSource   = memStartAsUINT + 9;
-
-    // Move from mapped header memory to our local variables
-    unsigned int bitsperpixelExt  = *bitsperpixelExtSource;
-    unsigned int channelsExt      = *channelsExtSource;
-    unsigned int width            = *widthSource;
-    unsigned int height           = *heightSource;
-    unsigned int bitsperpixelIn   = *bitsperpixelInSource;
-    unsigned int channelsIn       = *channelsInSource;
-    unsigned int compressionCfg   = *compressionConfigSource;
-    unsigned int paletteDataBytes = *paletteDataSizeSource;
+    return pzp_decompress_combined_from_memory(file_data, file_size,
+                                               widthOutput, heightOutput,
+                                               bitsperpixelExternalOutput, channelsExternalOutput,
+                                               bitsperpixelInternalOutput, channelsInternalOutput,
+                                               configuration);
+}
+
+/* Read the pyramid index from the end of an open file.
+   Returns the stored level count like pzp_pyramid_find(). */
+static unsigned int pzp_pyramid_read_index(FILE *fp, unsigned int level,
+                                           unsigned long long *offset, unsigned long long *size)
+{
+    unsigned char tail[PZP_PYRAMID_FOOTER_MAX];
+    unsigned long long fileSize = 0;
+    size_t tailSize = pzp_read_tail(fp, tail, sizeof(tail), &fileSize);
+    if (tailSize == 0) { return 0; }
 
-#if PZP_VERBOSE
-    fprintf(stderr, "Detected %ux%ux%u@%ubit/", width, height, channelsExt, bitsperpixelExt);
-    fprintf(stderr, "%u@%ubit", channelsIn, bitsperpixelIn);
-    fprintf(stderr, " | mode %u | CRC:0x%X\n", compressionCfg, *checksumSource);
-#endif
+    return pzp_pyramid_find(tail, tailSize, fileSize, level, offset, size);
+}
 
-    unsigned int runtimeVersion = convert_header(pzp_header);
-    if (runtimeVersion != *headerSource)
+static unsigned int pzp_pyramid_levels(const char *input_filename)
+{
+    FILE *fp = fopen(input_filename, "rb");
+    if (!fp)
     {
-        free(decompressed_buffer);
-        //fail("PZP version mismatch stopping to ensure consistency..");
+        fprintf(stderr, "Failed to read file: %s\n", input_filename);
         return 0;
     }
+    unsigned long long offset, size;
+    unsigned int levels = pzp_pyramid_read_index(fp, 0, &offset, &size);
+    fclose(fp);
+    return 1 + levels;
+}
 
-    // Move from our local variables to function output
-    *bitsperpixelExternalOutput = bitsperpixelExt;
-    *channelsExternalOutput     = channelsExt;
-    *widthOutput                = width;
-    *heightOutput               = height;
-    *bitsperpixelInternalOutput = bitsperpixelIn;
-    *channelsInternalOutput     = channelsIn;
-    *configuration              = compressionCfg;
+static unsigned char* pzp_decompress_level(const char *input_filename, unsigned int level,
+                                unsigned int *widthOutput, unsigned int *heightOutput,
+                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
+                                unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
+                                unsigned int *configuration)
+{
+    if (level == 0)
+    {
+        return pzp_decompress_combined(input_filename,
+                                       widthOutput, heightOutput,
+                                       bitsperpixelExternalOutput, channelsExternalOutput,
+                                       bitsperpixelInternalOutput, channelsInternalOutput,
+                                       configuration);
+    }
 
-    // After the 40-byte header comes optional palette data, then the pixel/index data.
-    unsigned char *after_header = (unsigned char *)decompressed_buffer + headerSize;
-    unsigned char *index_data   = after_header + paletteDataBytes;
+    FILE *fp = fopen(input_filename, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to read file: %s\n", input_filename);
+        return NULL;
+    }
 
-    // Parse palette (if present) before checksum so we can validate index data.
-    unsigned char palette[8][256];
-    unsigned int  palette_counts[8];
-    if (compressionCfg & USE_PALETTE)
-        pzp_palette_read(after_header, channelsIn, palette, palette_counts);
+    unsigned long long offset = 0, size = 0;
+    unsigned int levels = pzp_pyramid_read_index(fp, level, &offset, &size);
+    if (level > levels)
+    {
+        fprintf(stderr, "PZP file has no pyramid level %u (%u stored)\n", level, levels);
+        fclose(fp);
+        return NULL;
+    }
 
-    // Checksum covers the index/pixel data only (not the palette prefix).
-    size_t pixel_size = (size_t)width * height * (bitsperpixelIn / 8) * channelsIn;
-    unsigned int computedChecksum = hash_checksum(index_data, pixel_size);
-    if (computedChecksum != *checksumSource)
+    // Only the bytes of the requested level are read
+    unsigned char *level_data = (unsigned char *) pzp_alloc((size_t) size);
+    if ( (!level_data) || (fseeko(fp, (long long) offset, SEEK_SET) != 0) ||
+         (fread(level_data, 1, (size_t) size, fp) != (size_t) size) )
     {
-        free(decompressed_buffer);
-        fprintf(stderr, "PZP checksum mismatch (stored 0x%X, computed 0x%X): file may be corrupted\n",
-                *checksumSource, computedChecksum);
+        fprintf(stderr, "Failed to read pyramid level %u of %s\n", level, input_filename);
+        pzp_dealloc(level_data);
+        fclose(fp);
         return NULL;
     }
+    fclose(fp);
 
-    unsigned int restoreRLEChannels = compressionCfg & USE_RLE;
+    unsigned char *result = pzp_decompress_combined_from_memory(level_data, (size_t) size,
+                                                                widthOutput, heightOutput,
+                                                                bitsperpixelExternalOutput, channelsExternalOutput,
+                                                                bitsperpixelInternalOutput, channelsInternalOutput,
+                                                                configuration);
+    pzp_dealloc(level_data);
+    return result;
+}
 
-    // ── Non-RLE path ──────────────────────────────────────────────────────────
-    if (!restoreRLEChannels)
+//-----------------------------------------------------------------------------------------------
+//-----------------------------------------------------------------------------------------------
+/* Where layer `layer` of a multi-layer frame lives, from the index at the end of
+   the file (tail as in pzp_footer_find).  A file without a layer index is one
+   layer spanning the whole file.  Returns the layer count. */
+static unsigned int pzp_layers_find(const unsigned char *tail, size_t tailSize, unsigned long long fileSize,
+                                    unsigned int layer, unsigned long long *offset, unsigned long long *size)
+{
+    unsigned int layers = pzp_footer_find(tail, tailSize, fileSize, pzp_layers_magic, PZP_MAX_LAYERS, "layer",
+                                          layer, offset, size);
+    if (layers == 0)
     {
-        memmove(decompressed_buffer, index_data, pixel_size);
-        if (compressionCfg & USE_PALETTE)
-            pzp_palette_apply((unsigned char *)decompressed_buffer,
-                              width * height, channelsIn, palette);
-        return (unsigned char *)decompressed_buffer;
+        *offset = 0;
+        *size   = fileSize;
+        return 1;
+    }
+    return layers;
+}
+
+static unsigned int pzp_layers_find_in_memory(const void *file_data, size_t file_size, unsigned int layer,
+                                              unsigned long long *offset, unsigned long long *size)
+{
+    size_t tailSize = (file_size < PZP_LAYERS_FOOTER_MAX) ? file_size : PZP_LAYERS_FOOTER_MAX;
+    return pzp_layers_find((const unsigned char *) file_data + file_size - tailSize, tailSize, file_size, layer, offset, size);
+}
+
+/* Number of layers in a file (1 for a plain file). */
+static unsigned int pzp_layers_from_memory(const void *file_data, size_t file_size)
+{
+    if (!file_data) { return 0; }
+    unsigned long long offset, size;
+    return pzp_layers_find_in_memory(file_data, file_size, PZP_MAX_LAYERS, &offset, &size);
+}
+
+/* Decode the PZP1 stream of one layer into *output. */
+static int pzp_layer_decode(const void *layer_data, size_t layer_size, struct pzp_layer *output)
+{
+    unsigned int bitsperpixelInternal = 0, channelsInternal = 0;
+    memset(output, 0, sizeof(*output));
+
+    output->pixels = pzp_decompress_combined_from_memory(layer_data, layer_size,
+                                                         &output->width, &output->height,
+                                                         &output->bitsperpixel, &output->channels,
+                                                         &bitsperpixelInternal, &channelsInternal,
+                                                         &output->configuration);
+    if (output->pixels == NULL) { return 0; }
+
+    unsigned int header[10];
+    if ( (output->configuration & USE_NEAR_LOSSLESS) && (pzp_read_header_words_from_memory(layer_data, layer_size, header)) )
+        { output->maxError = header[7]; }
+    return 1;
+}
+
+/* Decode layer `layer` of a multi-layer frame, touching only that layer's bytes.
+   Returns 1 on success, 0 on failure or if the file has no such layer. */
+static int pzp_decompress_layer_from_memory(const void *file_data, size_t file_size, unsigned int layer,
+                                            struct pzp_layer *output)
+{
+    if ( (!file_data) || (!output) ) { return 0; }
+
+    unsigned long long offset = 0, size = 0;
+    unsigned int layers = pzp_layers_find_in_memory(file_data, file_size, layer, &offset, &size);
+    if (layer >= layers)
+    {
+        fprintf(stderr, "PZP file has no layer %u (%u stored)\n", layer, layers);
+        return 0;
     }
+    return pzp_layer_decode((const unsigned char *) file_data + offset, (size_t) size, output);
+}
 
-    // ── RLE path ──────────────────────────────────────────────────────────────
-    unsigned char *reconstructed = malloc(pixel_size);
-    if (reconstructed == NULL)
+/* Decode every layer (up to maxLayers) into outputs[].  Returns the number of
+   layers decoded, 0 on failure (nothing is left allocated then). */
+static unsigned int pzp_decompress_layers_from_memory(const void *file_data, size_t file_size,
+                                                      struct pzp_layer *outputs, unsigned int maxLayers)
+{
+    unsigned int layers = pzp_layers_from_memory(file_data, file_size);
+    if ( (layers == 0) || (!outputs) ) { return 0; }
+    if (layers > maxLayers) { layers = maxLayers; }
+
+    for (unsigned int l = 0; l < layers; l++)
     {
-        free(decompressed_buffer);
-        return NULL;
+        if (!pzp_decompress_layer_from_memory(file_data, file_size, l, &outputs[l]))
+        {
+            for (unsigned int j = 0; j < l; j++) { pzp_dealloc(outputs[j].pixels); outputs[j].pixels = NULL; }
+            return 0;
+        }
     }
-    pzp_extractAndReconstruct(index_data, reconstructed, width, height, channelsIn, restoreRLEChannels);
-    free(decompressed_buffer);
+    return layers;
+}
 
-    if (compressionCfg & USE_PALETTE)
-        pzp_palette_apply(reconstructed, width * height, channelsIn, palette);
+/* Read the layer index from the end of an open file, like pzp_layers_find(). */
+static unsigned int pzp_layers_read_index(FILE *fp, unsigned int layer,
+                                          unsigned long long *offset, unsigned long long *size)
+{
+    unsigned char tail[PZP_LAYERS_FOOTER_MAX];
+    unsigned long long fileSize = 0;
+    size_t tailSize = pzp_read_tail(fp, tail, sizeof(tail), &fileSize);
+    if (tailSize == 0) { return 0; }
 
-    return reconstructed;
+    return pzp_layers_find(tail, tailSize, fileSize, layer, offset, size);
 }
 
+/* Number of layers in a file (1 for a plain file, 0 if it cannot be read). */
+static unsigned int pzp_layers(const char *input_filename)
+{
+    FILE *fp = fopen(input_filename, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to read file: %s\n", input_filename);
+        return 0;
+    }
+    unsigned long long offset, size;
+    unsigned int layers = pzp_layers_read_index(fp, PZP_MAX_LAYERS, &offset, &size);
+    fclose(fp);
+    return layers;
+}
 
-static unsigned char* pzp_decompress_combined(const char *input_filename,
-                                unsigned int *widthOutput, unsigned int *heightOutput,
-                                unsigned int *bitsperpixelExternalOutput, unsigned int *channelsExternalOutput,
-                                unsigned int *bitsperpixelInternalOutput, unsigned int *channelsInternalOutput,
-                                unsigned int *configuration)
+/* Decode one layer of a file; only the index and that layer's bytes are read. */
+static int pzp_decompress_layer(const char *input_filename, unsigned int layer, struct pzp_layer *output)
+{
+    FILE *fp = fopen(input_filename, "rb");
+    if ( (!fp) || (!output) )
+    {
+        fprintf(stderr, "Failed to read file: %s\n", input_filename);
+        if (fp) { fclose(fp); }
+        return 0;
+    }
+
+    unsigned long long offset = 0, size = 0;
+    unsigned int layers = pzp_layers_read_index(fp, layer, &offset, &size);
+    if (layer >= layers)
+    {
+        fprintf(stderr, "PZP file has no layer %u (%u stored)\n", layer, layers);
+        fclose(fp);
+        return 0;
+    }
+
+    unsigned char *layer_data = (unsigned char *) pzp_alloc((size_t) size);
+    if ( (!layer_data) || (fseeko(fp, (long long) offset, SEEK_SET) != 0) ||
+         (fread(layer_data, 1, (size_t) size, fp) != (size_t) size) )
+    {
+        fprintf(stderr, "Failed to read layer %u of %s\n", layer, input_filename);
+        pzp_dealloc(layer_data);
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+
+    int result = pzp_layer_decode(layer_data, (size_t) size, output);
+    pzp_dealloc(layer_data);
+    return result;
+}
+
+/* Decode every layer of a file with a single read.  Returns the layer count, 0 on failure. */
+static unsigned int pzp_decompress_layers(const char *input_filename, struct pzp_layer *outputs, unsigned int maxLayers)
 {
     size_t file_size = 0;
     void *file_data = pzp_read_file_to_memory(input_filename, &file_size);
-    if (file_data!=NULL)
+    if (file_data == NULL)
     {
-      unsigned char *result = pzp_decompress_combined_from_memory(
-                                                                    file_data, file_size,
-                                                                    widthOutput, heightOutput,
-                                                                    bitsperpixelExternalOutput, channelsExternalOutput,
-                                                                    bitsperpixelInternalOutput, channelsInternalOutput,
-                                                                    configuration
-                                                                  );
-
-      free(file_data);
-      return result;
+        fprintf(stderr, "Failed to read file: %s\n", input_filename);
+        return 0;
     }
 
-    fprintf(stderr, "Failed to read file: %s\n", input_filename);
-    return NULL;
+    unsigned int layers = pzp_decompress_layers_from_memory(file_data, file_size, outputs, maxLayers);
+    pzp_dealloc(file_data);
+    return layers;
 }
 
 #ifdef __cplusplus
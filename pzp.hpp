@@ -0,0 +1,535 @@
+/*
+PZP Portable Zipped PNM - C++ interface
+Copyright (C) 2025 Ammar Qammaz
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PZP_HPP_INCLUDED
+#define PZP_HPP_INCLUDED
+
+// C++20 layer over pzp.h:
+//   pzp::Encoder / pzp::Decoder  RAII owners of a pzp_sink / pzp_source
+//   pzp::Kernel<Channels, Bits, Flags>
+//                                decode kernels specialised at compile time: the
+//                                channel loop is unrolled, if constexpr picks the
+//                                AVX2 scan, so no per-pixel branch is left
+//   pzp::decode<Channels, Bits, Flags>(file, out)
+//                                decode a file in memory straight into a std::span
+// Frames stored with another layout (the encoder picks palette / run / range coding
+// when they pay off) still decode into the span, through the generic decoder.
+// Errors, including a sink that cannot be written, are reported with pzp::Error
+// exceptions.
+
+#include "pzp.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace pzp
+{
+
+using Flags = unsigned int; // PZPFlags bitfield
+
+struct Error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+struct FrameInfo
+{
+    unsigned int width         = 0;
+    unsigned int height        = 0;
+    unsigned int bitsPerPixel  = 0; // per channel, 8 or 16
+    unsigned int channels      = 0;
+    unsigned int configuration = 0;
+};
+
+struct Free
+{
+    void operator()(void *pointer) const { pzp_dealloc(pointer); }
+};
+
+/* A frame decoded without a compile-time layout: interleaved HWC bytes,
+   16-bit samples big-endian like in PNM files. */
+struct Image
+{
+    FrameInfo info;
+    unsigned int bitsPerPixelInternal = 0;
+    unsigned int channelsInternal     = 0;
+    std::unique_ptr<std::uint8_t[], Free> pixels;
+
+    std::size_t size() const { return (std::size_t) info.width * info.height * channelsInternal; }
+    std::span<const std::uint8_t> bytes() const { return { pixels.get(), size() }; }
+};
+
+namespace detail
+{
+
+template<int Bits>
+using Sample = std::conditional_t<Bits == 16, std::uint16_t, std::uint8_t>;
+
+// Bytes a kernel decodes per step: small enough to stay in L2 next to the output
+inline constexpr std::size_t chunkBytes = 64 * 1024;
+
+// Flags that change the stored layout (USE_COMPRESSION / USE_PYRAMID / USE_LAYERS and
+// the backend flags USE_LZ4 / USE_STORE do not)
+inline constexpr Flags layoutFlags = ~(Flags) (USE_COMPRESSION | USE_PYRAMID | USE_LAYERS | PZP_BACKEND_FLAGS);
+
+/* body(std::integral_constant<std::size_t, I>{}) for I = 0 … N-1, expanded at compile time. */
+template<std::size_t N, class Body>
+inline void unroll(Body &&body)
+{
+    [&]<std::size_t... I>(std::index_sequence<I...>)
+    {
+        (body(std::integral_constant<std::size_t, I>{}), ...);
+    }(std::make_index_sequence<N>{});
+}
+
+/* Scalar per-channel running sum over `pixels` interleaved K-byte pixels, in place. */
+template<std::size_t K>
+inline void prefix_sum(std::uint8_t *data, std::size_t pixels, std::array<std::uint8_t, K> &carry)
+{
+    std::array<std::uint8_t, K> sum = carry;
+    for (std::size_t i = 0; i < pixels; i++, data += K)
+        unroll<K>([&](auto c) { sum[c] = data[c] = (std::uint8_t) (sum[c] + data[c]); });
+    carry = sum;
+}
+
+/* Big-endian byte pairs to native 16-bit samples. */
+inline void to_native16(const std::uint8_t *src, std::uint16_t *dst, std::size_t count)
+{
+    std::size_t i = 0;
+   #if INTEL_OPTIMIZATIONS
+    const __m256i swap = _mm256_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+                                          1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (src + 2 * i));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_shuffle_epi8(v, swap));
+    }
+   #endif // INTEL_OPTIMIZATIONS
+    for (; i < count; i++)
+        dst[i] = (std::uint16_t) (src[2 * i] << 8 | src[2 * i + 1]);
+}
+
+/* Scalar USE_DELTA16 reconstruction: zigzag decode, then per-channel running sum
+   of `pixels` pixels of K native 16-bit samples, in place. */
+template<std::size_t K>
+inline void delta16_sum(std::uint16_t *data, std::size_t pixels, std::array<std::uint16_t, K> &carry)
+{
+    std::array<std::uint16_t, K> sum = carry;
+    for (std::size_t i = 0; i < pixels; i++, data += K)
+        unroll<K>([&](auto c)
+        {
+            unsigned int z = data[c];
+            sum[c] = data[c] = (std::uint16_t) (sum[c] + ((z >> 1) ^ (0u - (z & 1))));
+        });
+    carry = sum;
+}
+
+#if INTEL_OPTIMIZATIONS
+/* AVX2 per-channel running sum for K = 1, 2, 4 or 8 interleaved bytes per pixel.
+   K divides the 16-byte lane, so a Kogge-Stone scan with shifts of K, 2K, … stays
+   within each channel; the lane-0 totals are then broadcast into lane 1 and the
+   running totals of the previous vector into both. */
+template<std::size_t K>
+inline void prefix_sum_avx2(std::uint8_t *data, std::size_t bytes, std::array<std::uint8_t, K> &carry)
+{
+    static_assert( (K == 1) || (K == 2) || (K == 4) || (K == 8), "K must divide a 16-byte lane");
+
+    // Every byte picks the last byte of its channel within its own lane
+    alignas(32) std::uint8_t tailIndex[32];
+    alignas(32) std::uint8_t running[32];
+    for (std::size_t j = 0; j < 32; j++)
+    {
+        tailIndex[j] = (std::uint8_t) (16 - K + j % K);
+        running[j]   = carry[j % K];
+    }
+    const __m256i tail  = _mm256_load_si256((const __m256i *) tailIndex);
+    __m256i       total = _mm256_load_si256((const __m256i *) running);
+
+    std::size_t i = 0;
+    for (; i + 32 <= bytes; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (data + i));
+        if constexpr (K <= 1) { v = _mm256_add_epi8(v, _mm256_slli_si256(v, 1)); }
+        if constexpr (K <= 2) { v = _mm256_add_epi8(v, _mm256_slli_si256(v, 2)); }
+        if constexpr (K <= 4) { v = _mm256_add_epi8(v, _mm256_slli_si256(v, 4)); }
+        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 8));
+
+        __m256i t = _mm256_shuffle_epi8(v, tail);
+        v = _mm256_add_epi8(v, _mm256_permute2x128_si256(t, t, 0x08)); // lane 0 totals into lane 1
+        v = _mm256_add_epi8(v, total);
+        _mm256_storeu_si256((__m256i *) (data + i), v);
+
+        t     = _mm256_shuffle_epi8(v, tail);
+        total = _mm256_permute2x128_si256(t, t, 0x11);                   // lane 1 totals everywhere
+    }
+
+    _mm256_store_si256((__m256i *) running, total);
+    for (std::size_t c = 0; c < K; c++) { carry[c] = running[c]; }
+    prefix_sum<K>(data + i, (bytes - i) / K, carry);
+}
+
+/* USE_DELTA16: zigzag decode and per-channel running sum of K interleaved native
+   16-bit samples per pixel, in place.  K = 1, 2 or 4 divides the 8 samples of a lane,
+   so the same scan as prefix_sum_avx2 runs with epi16 adds, keeping the carry
+   between the two bytes of a sample. */
+template<std::size_t K>
+inline void delta16_sum_avx2(std::uint16_t *data, std::size_t pixels, std::array<std::uint16_t, K> &carry)
+{
+    static_assert( (K == 1) || (K == 2) || (K == 4), "K must divide the 8 samples of a lane");
+
+    const __m256i one  = _mm256_set1_epi16(1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    // Every byte picks the same byte of the last sample of its channel within its own lane
+    alignas(32) std::uint8_t  tailIndex[32];
+    alignas(32) std::uint16_t running[16];
+    for (std::size_t j = 0; j < 32; j++)
+        tailIndex[j] = (std::uint8_t) (2 * (8 - K + ((j % 16) / 2) % K) + (j & 1));
+    for (std::size_t w = 0; w < 16; w++)
+        running[w] = carry[w % K];
+    const __m256i tail  = _mm256_load_si256((const __m256i *) tailIndex);
+    __m256i       total = _mm256_load_si256((const __m256i *) running);
+
+    std::size_t values = pixels * K;
+    std::size_t i = 0;
+    for (; i + 16 <= values; i += 16)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (data + i));
+        v = _mm256_xor_si256(_mm256_srli_epi16(v, 1), _mm256_sub_epi16(zero, _mm256_and_si256(v, one)));
+        if constexpr (K <= 1) { v = _mm256_add_epi16(v, _mm256_slli_si256(v, 2)); }
+        if constexpr (K <= 2) { v = _mm256_add_epi16(v, _mm256_slli_si256(v, 4)); }
+        v = _mm256_add_epi16(v, _mm256_slli_si256(v, 8));
+
+        __m256i t = _mm256_shuffle_epi8(v, tail);
+        v = _mm256_add_epi16(v, _mm256_permute2x128_si256(t, t, 0x08)); // lane 0 totals into lane 1
+        v = _mm256_add_epi16(v, total);
+        _mm256_storeu_si256((__m256i *) (data + i), v);
+
+        t     = _mm256_shuffle_epi8(v, tail);
+        total = _mm256_permute2x128_si256(t, t, 0x11);                   // lane 1 totals everywhere
+    }
+
+    _mm256_store_si256((__m256i *) running, total);
+    for (std::size_t c = 0; c < K; c++) { carry[c] = running[c]; }
+    delta16_sum<K>(data + i, (values - i) / K, carry);
+}
+#endif // INTEL_OPTIMIZATIONS
+
+/* Planar internal channels (what pzp_compress_to_sink takes) from HWC samples. */
+template<int Channels, int Bits>
+inline void split(const Sample<Bits> *hwc, std::size_t pixels, unsigned char *const *planes)
+{
+    for (std::size_t i = 0; i < pixels; i++, hwc += Channels)
+        unroll<Channels>([&](auto c)
+        {
+            if constexpr (Bits == 16)
+            {
+                planes[2 * c][i]     = (unsigned char) (hwc[c] >> 8);
+                planes[2 * c + 1][i] = (unsigned char) (hwc[c] & 0xFF);
+            } else
+            {
+                planes[c][i] = hwc[c];
+            }
+        });
+}
+
+} // namespace detail
+
+// ─── Compile-time decode kernels ────────────────────────────────────────────
+//
+// Kernel<Channels, Bits, F> reconstructs the interleaved layout written without
+// palette / bitpack / run / near-lossless / range / rANS / YCoCg / sparse coding: F is USE_COMPRESSION,
+// optionally with USE_RLE (and USE_PYRAMID, which does not change the frame, or a
+// backend flag: the kernel reads through whichever backend coded the frame).
+// With USE_RLE the per-channel running sum runs 32 bytes at a time on AVX2 when
+// a pixel is 1, 2, 4 or 8 bytes and as an unrolled scalar loop otherwise; 16-bit
+// samples come out in native byte order.  16-bit frames asked for USE_RLE are
+// written with USE_DELTA16, so for Bits == 16 the kernel matches that layout and
+// sums zigzag coded 16-bit residuals instead (older 16-bit USE_RLE files take the
+// generic decoder).
+template<int Channels, int Bits, Flags F = USE_COMPRESSION | USE_RLE>
+struct Kernel
+{
+    static_assert( (Channels >= 1) && (Channels <= 4), "1 to 4 channels");
+    static_assert( (Bits == 8) || (Bits == 16), "8 or 16 bits per channel");
+    static_assert( (F & detail::layoutFlags & ~(Flags) USE_RLE) == 0,
+                   "kernels cover the plain and USE_RLE layouts");
+
+    using Sample = detail::Sample<Bits>;
+    static constexpr std::size_t Internal    = (std::size_t) Channels * Bits / 8; // stored bytes per pixel
+    static constexpr std::size_t ChunkPixels = detail::chunkBytes / Internal;
+    static constexpr bool        Delta16     = (Bits == 16) && ( (F & USE_RLE) != 0 );
+    static constexpr Flags       Stored      = Delta16 ? ( (F & ~(Flags) USE_RLE) | USE_DELTA16 ) : F; // layout the encoder writes
+
+    // Running state between calls: the last pixel, stored bytes or (Delta16) native samples
+    using Carry = std::conditional_t<Delta16, std::array<std::uint16_t, Channels>, std::array<std::uint8_t, Internal>>;
+
+    /* Does a header (pzp_read_header_words_from_memory) describe this layout? */
+    static bool matches(const unsigned int header[10])
+    {
+        return (header[1] == (unsigned int) Bits) && (header[2] == (unsigned int) Channels) &&
+               (header[5] == 8) && (header[6] == Internal) &&
+               ( (header[8] & detail::layoutFlags) == (Stored & detail::layoutFlags) ) && (header[9] == 0);
+    }
+
+    /* Reconstruct whole pixels of stored data (scanned in place) into `out`.
+       `carry` holds the last reconstructed pixel of the previous call. */
+    static void reconstruct(std::span<std::uint8_t> stored, std::span<Sample> out, Carry &carry)
+    {
+        std::uint8_t *data   = stored.data();
+        std::size_t   pixels = stored.size() / Internal;
+
+        if constexpr (Delta16)
+        {
+            detail::to_native16(data, out.data(), pixels * Channels);
+           #if INTEL_OPTIMIZATIONS
+            if constexpr (Channels != 3)
+                detail::delta16_sum_avx2<Channels>(out.data(), pixels, carry);
+            else
+           #endif // INTEL_OPTIMIZATIONS
+                detail::delta16_sum<Channels>(out.data(), pixels, carry);
+            return;
+        }
+        else if constexpr ( (F & USE_RLE) != 0 )
+        {
+           #if INTEL_OPTIMIZATIONS
+            if constexpr ( (Internal & (Internal - 1)) == 0 )
+                detail::prefix_sum_avx2<Internal>(data, pixels * Internal, carry);
+            else
+           #endif // INTEL_OPTIMIZATIONS
+                detail::prefix_sum<Internal>(data, pixels, carry);
+        }
+
+        if constexpr (Bits == 16)
+            detail::to_native16(data, out.data(), pixels * Channels);
+        else if (out.data() != data)
+            std::memcpy(out.data(), data, pixels * Internal);
+    }
+};
+
+namespace detail
+{
+
+/* Decode the next frame of a source into `out`: through Kernel<Channels, Bits, F>
+   when the header matches it, through the generic decoder writing a tensor otherwise. */
+template<int Channels, int Bits, Flags F>
+FrameInfo decode_frame(pzp_source &source, std::span<Sample<Bits>> out)
+{
+    using K = Kernel<Channels, Bits, F>;
+
+    unsigned long long dataSize = 0;
+    int isLegacy = 0;
+    if (!pzp_source_read_prefix(&source, &dataSize, &isLegacy)) { throw Error("PZP stream ended before the frame"); }
+
+    struct pzp_dctx *dctx = pzp_thread_dctx(&source);
+    unsigned int header[10];
+    if ( (dctx == NULL) || (!pzp_decompress_stream_read(dctx, &source, header, headerSize)) )
+        throw Error("PZP header could not be decompressed");
+    if (header[0] != convert_header(isLegacy ? pzp_header_v0 : pzp_header))
+        throw Error("Not a PZP frame");
+    if ( ((header[8] & PZP_BACKEND_FLAGS) >> PZP_BACKEND_SHIFT) != source.backend )
+        throw Error("PZP header and prefix disagree on the backend");
+
+    if (!K::matches(header))
+    {
+        struct pzp_tensor tensor;
+        pzp_tensor_init(&tensor, out.data(), out.size_bytes(), (Bits == 16) ? PZP_TENSOR_UINT16 : PZP_TENSOR_UINT8, PZP_LAYOUT_HWC);
+        tensor.channels = Channels;
+
+        FrameInfo info;
+        unsigned int bitsPerPixelInternal = 0, channelsInternal = 0;
+        if ( (!pzp_decompress_stream_body(dctx, &source, dataSize, isLegacy, header, &info.width, &info.height,
+                                          &info.bitsPerPixel, &info.channels, &bitsPerPixelInternal, &channelsInternal,
+                                          &info.configuration, &tensor, NULL)) ||
+             (!pzp_source_finish_frame(dctx, &source)) )
+            throw Error("PZP frame could not be decoded into the output span");
+        return info;
+    }
+
+    std::size_t pixels = (std::size_t) header[3] * header[4];
+    if (dataSize != (unsigned long long) headerSize + pixels * K::Internal + (isLegacy ? 0 : trailerSize))
+        throw Error("PZP payload size does not match the image");
+    if (out.size() < pixels * Channels)
+        throw Error("PZP output span is too small");
+
+    struct pzp_checksum checksum;
+    pzp_checksum_init(&checksum);
+
+    typename K::Carry carry {};
+    std::vector<std::uint8_t> staging((Bits == 16) ? K::ChunkPixels * K::Internal : 0);
+    for (std::size_t start = 0; start < pixels; start += K::ChunkPixels)
+    {
+        std::size_t count = (pixels - start < K::ChunkPixels) ? pixels - start : K::ChunkPixels;
+        std::size_t bytes = count * K::Internal;
+
+        // 8-bit frames are decompressed straight into the output and scanned there
+        std::uint8_t *stored = (Bits == 16) ? staging.data() : (std::uint8_t *) (out.data() + start * Channels);
+        if (!pzp_decompress_stream_read(dctx, &source, stored, bytes)) { throw Error("PZP pixel data is truncated"); }
+        pzp_checksum_update(&checksum, stored, bytes);
+
+        K::reconstruct({ stored, bytes }, out.subspan(start * Channels, count * Channels), carry);
+    }
+
+    unsigned int storedChecksum = header[7];
+    if ( (!isLegacy) && (!pzp_decompress_stream_read(dctx, &source, &storedChecksum, trailerSize)) )
+        throw Error("PZP checksum trailer is missing");
+    if (pzp_checksum_final(&checksum) != storedChecksum)
+        throw Error("PZP checksum mismatch: file may be corrupted");
+    if (!pzp_source_finish_frame(dctx, &source))
+        throw Error("PZP frame is malformed");
+
+    return FrameInfo { header[3], header[4], (unsigned int) Bits, (unsigned int) Channels, header[8] };
+}
+
+} // namespace detail
+
+// ─── Decoder ────────────────────────────────────────────────────────────────
+
+/* Reads frames from a FILE*, a file descriptor, memory or a callback
+   (read(buffer) returns the bytes read, 0 at the end or on error). */
+class Decoder
+{
+public:
+    explicit Decoder(FILE *file)                          { pzp_source_file(&source_, file); }
+    explicit Decoder(int fd)                              { pzp_source_fd(&source_, fd); }
+    explicit Decoder(std::span<const std::uint8_t> data)  { pzp_source_memory(&source_, data.data(), data.size()); }
+    explicit Decoder(std::function<std::size_t(std::span<std::uint8_t>)> read) : read_(std::move(read))
+    {
+        pzp_source_init(&source_, &Decoder::callback, this);
+    }
+    ~Decoder() { pzp_source_close(&source_); }
+
+    Decoder(const Decoder &)            = delete; // the source may point at itself
+    Decoder &operator=(const Decoder &) = delete;
+
+    bool at_end() { return pzp_source_at_end(&source_); }
+
+    /* Next frame, any layout. */
+    Image next()
+    {
+        Image image;
+        unsigned char *pixels = pzp_decompress_from_source(&source_, &image.info.width, &image.info.height,
+                                                           &image.info.bitsPerPixel, &image.info.channels,
+                                                           &image.bitsPerPixelInternal, &image.channelsInternal,
+                                                           &image.info.configuration);
+        if (pixels == NULL) { throw Error("PZP frame could not be decoded"); }
+        image.pixels.reset(pixels);
+        return image;
+    }
+
+    /* Next frame into `out` (HWC, native samples), through Kernel<Channels, Bits, F>
+       when the frame was stored that way.  Throws pzp::Error if the frame does not
+       have Channels channels of Bits bits or `out` is too small. */
+    template<int Channels, int Bits, Flags F = USE_COMPRESSION | USE_RLE>
+    FrameInfo next(std::span<detail::Sample<Bits>> out)
+    {
+        return detail::decode_frame<Channels, Bits, F>(source_, out);
+    }
+
+private:
+    static std::size_t callback(void *context, void *buffer, std::size_t size)
+    {
+        return static_cast<Decoder *>(context)->read_({ static_cast<std::uint8_t *>(buffer), size });
+    }
+
+    pzp_source source_;
+    std::function<std::size_t(std::span<std::uint8_t>)> read_;
+};
+
+/* Decode one file held in memory into `out` (HWC, native samples). */
+template<int Channels, int Bits, Flags F = USE_COMPRESSION | USE_RLE>
+FrameInfo decode(std::span<const std::uint8_t> file, std::span<detail::Sample<Bits>> out)
+{
+    pzp_source source;
+    pzp_source_memory(&source, file.data(), file.size());
+    return detail::decode_frame<Channels, Bits, F>(source, out);
+}
+
+// ─── Encoder ────────────────────────────────────────────────────────────────
+
+/* Writes frames to a FILE*, a file descriptor, memory (default) or a callback
+   (write(data) returns the bytes written, fewer on error).  A memory encoder
+   given an allocator grows its output and all scratch buffers through it. */
+class Encoder
+{
+public:
+    Encoder()                      { pzp_sink_memory(&sink_); }
+    explicit Encoder(const pzp_allocator &allocator) : allocator_(allocator)
+    {
+        pzp_sink_memory(&sink_);
+        sink_.allocator = &allocator_;
+    }
+    explicit Encoder(FILE *file)   { pzp_sink_file(&sink_, file); }
+    explicit Encoder(int fd)       { pzp_sink_fd(&sink_, fd); }
+    explicit Encoder(std::function<std::size_t(std::span<const std::uint8_t>)> write) : write_(std::move(write))
+    {
+        pzp_sink_init(&sink_, &Encoder::callback, this);
+    }
+    ~Encoder() { pzp_sink_release(&sink_); }
+
+    Encoder(const Encoder &)            = delete; // the sink may point at itself
+    Encoder &operator=(const Encoder &) = delete;
+
+    /* Compress one HWC frame of native samples.  maxError is used with USE_NEAR_LOSSLESS. */
+    template<int Channels, int Bits, Flags F = USE_COMPRESSION | USE_RLE>
+    void write(std::span<const detail::Sample<Bits>> hwc, unsigned int width, unsigned int height, unsigned int maxError = 0)
+    {
+        static_assert( (Channels >= 1) && (Channels <= 4) && ( (Bits == 8) || (Bits == 16) ), "1 to 4 channels of 8 or 16 bits");
+        constexpr unsigned int channelsInternal = Channels * Bits / 8;
+
+        std::size_t pixels = (std::size_t) width * height;
+        if (hwc.size() < pixels * Channels) { throw Error("PZP input span is too small"); }
+
+        std::vector<unsigned char> planar(pixels * channelsInternal);
+        std::array<unsigned char *, channelsInternal> planes;
+        for (unsigned int c = 0; c < channelsInternal; c++) { planes[c] = planar.data() + c * pixels; }
+
+        detail::split<Channels, Bits>(hwc.data(), pixels, planes.data());
+        if (!pzp_compress_to_sink(planes.data(), width, height, Bits, Channels, 8, channelsInternal,
+                                  F | USE_COMPRESSION, maxError, &sink_))
+            throw Error("PZP frame could not be written");
+    }
+
+    /* Bytes written so far; the output itself for the memory encoder. */
+    unsigned long long written() const { return sink_.written; }
+    std::span<const std::uint8_t> data() const { return { sink_.data, sink_.size }; }
+
+private:
+    static std::size_t callback(void *context, const void *data, std::size_t size)
+    {
+        return static_cast<Encoder *>(context)->write_({ static_cast<const std::uint8_t *>(data), size });
+    }
+
+    pzp_sink sink_;
+    pzp_allocator allocator_ = {};
+    std::function<std::size_t(std::span<const std::uint8_t>)> write_;
+};
+
+} // namespace pzp
+
+#endif // PZP_HPP_INCLUDED
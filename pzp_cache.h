@@ -0,0 +1,645 @@
+/*
+PZP Portable Zipped PNM
+Copyright (C) 2025 Ammar Qammaz
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Cache of decoded frames shared by every process of a node.
+ *
+ * pzp_cache_open() creates or attaches a POSIX shared-memory segment
+ * (shm_open) holding a hash index and a data region of `budget` bytes.
+ * pzp_cache_get() returns a view of the decoded frame of a file: straight
+ * out of the segment when some process already decoded it, otherwise it
+ * decodes the file into the segment once for everyone.  Several DataLoader
+ * workers, over several epochs, then decode each file once per node.
+ *
+ * Frames are keyed by the file's device, inode, size and mtime, so a
+ * rewritten file is decoded again and its old frame ages out.  Pixels are
+ * stored HWC with 16-bit samples in native byte order (like the uint16
+ * tensor output), and a view stays valid until pzp_cache_release().
+ *
+ * Lookups take no lock: a reader pins a slot by incrementing its pin count
+ * and only then checks that the slot is READY and holds its key, while an
+ * evictor first moves the slot to EVICTING and only then checks that the pin
+ * count is zero, so one of the two always sees the other.  Inserting and
+ * evicting hold a process-shared robust mutex.  The data region is cut into
+ * PZP_CACHE_BLOCK blocks; a frame takes a contiguous run of them, and when
+ * no run is free a CLOCK hand sweeps the slots, clearing reference bits and
+ * evicting unpinned frames until one is.
+ *
+ * A frame larger than the budget, or one that finds everything pinned, is
+ * decoded into private memory instead; the view looks the same.  Slots left
+ * FILLING by a process that died are reclaimed (its pid is gone); frames it
+ * held views of stay pinned until the segment is unlinked and recreated.
+ */
+
+#ifndef PZP_CACHE_H_INCLUDED
+#define PZP_CACHE_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pzp.h"
+
+#define PZP_CACHE_BLOCK             (64 * 1024) // allocation granularity of the data region
+#define PZP_CACHE_MAX_PROBE         32          // slots a lookup looks at before giving up
+#define PZP_CACHE_DEFAULT_ENTRIES   4096
+#define PZP_CACHE_VERSION           1
+
+typedef enum
+{
+    PZP_CACHE_EMPTY = 0,   // never used, ends a probe sequence
+    PZP_CACHE_FILLING,     // reserved by a process decoding into it
+    PZP_CACHE_READY,
+    PZP_CACHE_EVICTING,
+    PZP_CACHE_DEAD         // evicted, reusable
+} PZPCacheState;
+
+// One hash slot.  state / pins / referenced are only touched atomically.
+struct pzp_cache_entry
+{
+    unsigned int  state;
+    unsigned int  pins;        // views handed out and not released yet
+    unsigned int  referenced;  // CLOCK bit, set on every hit
+    int           filler;      // pid decoding into a FILLING slot
+    uint64_t      device, inode, size, mtime; // key
+    uint64_t      offset;      // of the pixels in the data region
+    unsigned int  blocks;
+    unsigned int  width, height, bitsperpixel, channels, configuration;
+};
+
+struct pzp_cache_segment
+{
+    char          magic[8];    // "PZPCACHE"
+    unsigned int  version;
+    unsigned int  initialized; // set last by the creating process
+    uint64_t      segmentSize;
+    uint64_t      budget;      // bytes in the data region
+    unsigned int  slots;       // power of two
+    unsigned int  blocks;
+    unsigned int  hand;        // CLOCK hand, under lock
+    unsigned int  freeBlocks;  // under lock
+    uint64_t      hits, misses, evictions, uncached;
+    pthread_mutex_t lock;      // writers only
+    // followed by struct pzp_cache_entry[slots], unsigned int owner[blocks],
+    // then the data region at the next PZP_CACHE_BLOCK boundary
+};
+
+struct pzp_cache
+{
+    struct pzp_cache_segment *segment;
+    size_t                    mappedSize;
+    struct pzp_cache_entry   *entries;
+    unsigned int             *owners;  // slot + 1 owning each block, 0 when free
+    unsigned char            *data;
+};
+
+struct pzp_cache_view
+{
+    const unsigned char *pixels;  // HWC, 16-bit samples native-endian
+    size_t               size;
+    unsigned int         width, height, bitsperpixel, channels, configuration;
+    unsigned int         slot;    // slot + 1 while pinned, 0 for a private frame
+    unsigned char       *owned;   // private frame, freed by pzp_cache_release
+};
+
+struct pzp_cache_stats
+{
+    uint64_t     hits, misses, evictions, uncached;
+    uint64_t     budget, used;
+    unsigned int frames;
+};
+
+// ────────────────────────────────────────────────────────────────────────────
+
+static uint64_t pzp_cache_hash(const struct pzp_cache_entry *key)
+{
+    // splitmix64 finaliser over the key words
+    uint64_t words[4] = { key->device, key->inode, key->size, key->mtime };
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        h ^= words[i];
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        h ^= h >> 31;
+    }
+    return h;
+}
+
+static int pzp_cache_same_key(const struct pzp_cache_entry *a, const struct pzp_cache_entry *b)
+{
+    return (a->device == b->device) && (a->inode == b->inode) && (a->size == b->size) && (a->mtime == b->mtime);
+}
+
+static void pzp_cache_lock(struct pzp_cache *cache)
+{
+    // A process that died holding the lock leaves it EOWNERDEAD; every critical
+    // section only flips a few fields, so carry on with what it left.
+    if (pthread_mutex_lock(&cache->segment->lock) == EOWNERDEAD)
+        { pthread_mutex_consistent(&cache->segment->lock); }
+}
+
+static void pzp_cache_unlock(struct pzp_cache *cache)
+{
+    pthread_mutex_unlock(&cache->segment->lock);
+}
+
+static int pzp_cache_process_gone(int pid)
+{
+    return (pid > 0) && (kill(pid, 0) != 0) && (errno == ESRCH);
+}
+
+//----------------------------------------------------------------------------------------
+//                                   Lock-free lookup
+//----------------------------------------------------------------------------------------
+
+/*
+ * Look `key` up.  Returns the pinned slot index + 1 on a hit, 0 on a miss.
+ * *filling is set when another live process is decoding that key right now.
+ */
+static unsigned int pzp_cache_lookup(struct pzp_cache *cache, const struct pzp_cache_entry *key, int *filling)
+{
+    unsigned int mask = cache->segment->slots - 1;
+    unsigned int slot = (unsigned int) pzp_cache_hash(key) & mask;
+    *filling = 0;
+
+    for (unsigned int probe = 0; probe < PZP_CACHE_MAX_PROBE; probe++, slot = (slot + 1) & mask)
+    {
+        struct pzp_cache_entry *e = &cache->entries[slot];
+        unsigned int state = __atomic_load_n(&e->state, __ATOMIC_ACQUIRE);
+        if (state == PZP_CACHE_EMPTY) { return 0; }
+
+        if ( (state == PZP_CACHE_FILLING) && (pzp_cache_same_key(e, key)) && (!pzp_cache_process_gone(e->filler)) )
+        {
+            *filling = 1;
+            return 0;
+        }
+        if (state != PZP_CACHE_READY) { continue; }
+
+        // Pin first, then check: the key read before the pin may have been torn
+        __atomic_add_fetch(&e->pins, 1, __ATOMIC_SEQ_CST);
+        if ( (__atomic_load_n(&e->state, __ATOMIC_SEQ_CST) == PZP_CACHE_READY) && (pzp_cache_same_key(e, key)) )
+        {
+            __atomic_store_n(&e->referenced, 1, __ATOMIC_RELAXED);
+            return slot + 1;
+        }
+        __atomic_sub_fetch(&e->pins, 1, __ATOMIC_SEQ_CST);
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------
+//                             Eviction and block allocation
+//----------------------------------------------------------------------------------------
+
+static void pzp_cache_free_blocks(struct pzp_cache *cache, struct pzp_cache_entry *e)
+{
+    unsigned int first = (unsigned int) (e->offset / PZP_CACHE_BLOCK);
+    for (unsigned int b = 0; b < e->blocks; b++) { cache->owners[first + b] = 0; }
+    cache->segment->freeBlocks += e->blocks;
+    e->blocks = 0;
+}
+
+/* Under lock: evict a READY slot nobody has pinned, or reclaim a FILLING one
+   whose process died.  Returns 1 if the slot was freed. */
+static int pzp_cache_try_evict(struct pzp_cache *cache, struct pzp_cache_entry *e)
+{
+    unsigned int state = __atomic_load_n(&e->state, __ATOMIC_SEQ_CST);
+
+    if ( (state == PZP_CACHE_FILLING) && (pzp_cache_process_gone(e->filler)) )
+    {
+        pzp_cache_free_blocks(cache, e);
+        __atomic_store_n(&e->state, PZP_CACHE_DEAD, __ATOMIC_RELEASE);
+        return 1;
+    }
+
+    unsigned int expected = PZP_CACHE_READY;
+    if (!__atomic_compare_exchange_n(&e->state, &expected, PZP_CACHE_EVICTING, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        { return 0; }
+
+    if (__atomic_load_n(&e->pins, __ATOMIC_SEQ_CST) != 0)
+    {
+        __atomic_store_n(&e->state, PZP_CACHE_READY, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+
+    pzp_cache_free_blocks(cache, e);
+    __atomic_store_n(&e->state, PZP_CACHE_DEAD, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&cache->segment->evictions, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/* Under lock: a free run of `count` blocks that contains block `around`,
+   or the first one anywhere when `around` is past the end.  Returns the first
+   block of the run, or the block count when there is none. */
+static unsigned int pzp_cache_find_run(struct pzp_cache *cache, unsigned int count, unsigned int around)
+{
+    unsigned int blocks = cache->segment->blocks;
+    if (around < blocks)
+    {
+        unsigned int start = around, end = around;
+        while ( (start > 0) && (cache->owners[start - 1] == 0) ) { start--; }
+        while ( (end < blocks) && (cache->owners[end] == 0) )    { end++; }
+        return (end - start >= count) ? start : blocks;
+    }
+
+    unsigned int run = 0;
+    for (unsigned int b = 0; b < blocks; b++)
+    {
+        run = (cache->owners[b] == 0) ? run + 1 : 0;
+        if (run == count) { return b + 1 - count; }
+    }
+    return blocks;
+}
+
+/* Under lock: reserve `count` contiguous blocks, sweeping the CLOCK hand over
+   the slots to evict frames until a run frees up.  Returns the first block,
+   or the block count on failure. */
+static unsigned int pzp_cache_allocate(struct pzp_cache *cache, unsigned int count)
+{
+    struct pzp_cache_segment *segment = cache->segment;
+    if ( (count == 0) || (count > segment->blocks) ) { return segment->blocks; }
+
+    unsigned int first = segment->blocks;
+    if (segment->freeBlocks >= count) { first = pzp_cache_find_run(cache, count, segment->blocks); }
+
+    // Two sweeps: the first may only clear reference bits
+    for (unsigned int step = 0; (first == segment->blocks) && (step < 2 * segment->slots); step++)
+    {
+        struct pzp_cache_entry *e = &cache->entries[segment->hand];
+        segment->hand = (segment->hand + 1) & (segment->slots - 1);
+
+        unsigned int state = __atomic_load_n(&e->state, __ATOMIC_ACQUIRE);
+        if ( (state != PZP_CACHE_READY) && (state != PZP_CACHE_FILLING) ) { continue; }
+        if ( (state == PZP_CACHE_READY) && (__atomic_exchange_n(&e->referenced, 0, __ATOMIC_RELAXED)) ) { continue; }
+
+        unsigned int freed = (unsigned int) (e->offset / PZP_CACHE_BLOCK);
+        if (pzp_cache_try_evict(cache, e)) { first = pzp_cache_find_run(cache, count, freed); }
+    }
+
+    if (first == segment->blocks) { return first; }
+    segment->freeBlocks -= count;
+    return first;
+}
+
+/* Under lock: a slot of the probe sequence of `key` to insert into, evicting
+   an unpinned frame of the sequence when none is free.  Returns slot + 1 or 0. */
+static unsigned int pzp_cache_claim_slot(struct pzp_cache *cache, const struct pzp_cache_entry *key)
+{
+    unsigned int mask  = cache->segment->slots - 1;
+    unsigned int start = (unsigned int) pzp_cache_hash(key) & mask;
+
+    for (unsigned int probe = 0, slot = start; probe < PZP_CACHE_MAX_PROBE; probe++, slot = (slot + 1) & mask)
+    {
+        unsigned int state = __atomic_load_n(&cache->entries[slot].state, __ATOMIC_ACQUIRE);
+        if ( (state == PZP_CACHE_EMPTY) || (state == PZP_CACHE_DEAD) ) { return slot + 1; }
+    }
+    for (unsigned int probe = 0, slot = start; probe < PZP_CACHE_MAX_PROBE; probe++, slot = (slot + 1) & mask)
+    {
+        if (pzp_cache_try_evict(cache, &cache->entries[slot])) { return slot + 1; }
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------
+//                                      Public API
+//----------------------------------------------------------------------------------------
+
+/*
+ * Create the segment `name` (e.g. "/pzp-train") with a data region of `budget`
+ * bytes and room for `entries` frames (0 = PZP_CACHE_DEFAULT_ENTRIES), or attach
+ * to it when another process already did; the creator's sizes then apply.
+ * Returns NULL on failure.
+ */
+static struct pzp_cache * pzp_cache_open(const char *name, size_t budget, unsigned int entries)
+{
+    if ( (name == NULL) || (budget < PZP_CACHE_BLOCK) ) { return NULL; }
+    if (entries == 0) { entries = PZP_CACHE_DEFAULT_ENTRIES; }
+
+    // ── Step 1: sizes; twice as many slots as frames keeps probe sequences short ──
+    unsigned int slots = 64;
+    while ( (slots < 2 * entries) && (slots < (1u << 30)) ) { slots <<= 1; }
+    uint64_t blocks = budget / PZP_CACHE_BLOCK;
+    if (blocks > 0xFFFFFFFFu - 1) { blocks = 0xFFFFFFFFu - 1; }
+
+    uint64_t indexSize = sizeof(struct pzp_cache_segment) + (uint64_t) slots * sizeof(struct pzp_cache_entry) + blocks * sizeof(unsigned int);
+    uint64_t dataStart = (indexSize + PZP_CACHE_BLOCK - 1) / PZP_CACHE_BLOCK * PZP_CACHE_BLOCK;
+    uint64_t size      = dataStart + blocks * PZP_CACHE_BLOCK;
+
+    // ── Step 2: create, or attach to the segment somebody else created ──
+    int created = 1;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if ( (fd < 0) && (errno == EEXIST) )
+    {
+        created = 0;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0)
+    {
+        fprintf(stderr, "pzp_cache: cannot open shared memory %s (%s)\n", name, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (created)
+    {
+        if (ftruncate(fd, (off_t) size) != 0)
+        {
+            fprintf(stderr, "pzp_cache: cannot size %s to %llu bytes (%s)\n", name, (unsigned long long) size, strerror(errno));
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+    } else
+    {
+        // The creator may not have sized it yet
+        for (unsigned int wait = 0; ; wait++)
+        {
+            if (fstat(fd, &st) != 0) { close(fd); return NULL; }
+            if (st.st_size >= (off_t) sizeof(struct pzp_cache_segment)) { break; }
+            if (wait == 5000) { fprintf(stderr, "pzp_cache: %s was never initialised\n", name); close(fd); return NULL; }
+            usleep(1000);
+        }
+        size = (uint64_t) st.st_size;
+    }
+
+    void *mapped = mmap(NULL, (size_t) size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        fprintf(stderr, "pzp_cache: cannot map %s (%s)\n", name, strerror(errno));
+        if (created) { shm_unlink(name); }
+        return NULL;
+    }
+
+    struct pzp_cache *cache = (struct pzp_cache *) calloc(1, sizeof(struct pzp_cache));
+    if (cache == NULL) { munmap(mapped, (size_t) size); return NULL; }
+    cache->segment    = (struct pzp_cache_segment *) mapped;
+    cache->mappedSize = (size_t) size;
+
+    struct pzp_cache_segment *segment = cache->segment;
+    if (created)
+    {
+        // ── Step 3: the fresh segment is all zeros: EMPTY slots, free blocks ──
+        memcpy(segment->magic, "PZPCACHE", 8);
+        segment->version     = PZP_CACHE_VERSION;
+        segment->segmentSize = size;
+        segment->budget      = blocks * PZP_CACHE_BLOCK;
+        segment->slots       = slots;
+        segment->blocks      = (unsigned int) blocks;
+        segment->freeBlocks  = (unsigned int) blocks;
+
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&segment->lock, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+
+        __atomic_store_n(&segment->initialized, 1, __ATOMIC_RELEASE);
+    } else
+    {
+        for (unsigned int wait = 0; !__atomic_load_n(&segment->initialized, __ATOMIC_ACQUIRE); wait++)
+        {
+            if (wait == 5000) { fprintf(stderr, "pzp_cache: %s was never initialised\n", name); break; }
+            usleep(1000);
+        }
+        if ( (!__atomic_load_n(&segment->initialized, __ATOMIC_ACQUIRE)) || (memcmp(segment->magic, "PZPCACHE", 8) != 0) ||
+             (segment->version != PZP_CACHE_VERSION) || (segment->segmentSize != size) )
+        {
+            fprintf(stderr, "pzp_cache: %s is not a compatible PZP cache\n", name);
+            munmap(mapped, (size_t) size);
+            free(cache);
+            return NULL;
+        }
+    }
+
+    cache->entries = (struct pzp_cache_entry *) (segment + 1);
+    cache->owners  = (unsigned int *) (cache->entries + segment->slots);
+    cache->data    = (unsigned char *) mapped + (segment->segmentSize - (uint64_t) segment->blocks * PZP_CACHE_BLOCK);
+    return cache;
+}
+
+// Detach; the segment and its frames stay for the other processes.
+static void pzp_cache_close(struct pzp_cache *cache)
+{
+    if (cache == NULL) { return; }
+    munmap(cache->segment, cache->mappedSize);
+    free(cache);
+}
+
+// Remove the segment; processes still attached keep their mapping.
+static int pzp_cache_unlink(const char *name)
+{
+    return (shm_unlink(name) == 0);
+}
+
+static void pzp_cache_fill_view(struct pzp_cache *cache, unsigned int slot, struct pzp_cache_view *view)
+{
+    struct pzp_cache_entry *e = &cache->entries[slot - 1];
+    view->pixels        = cache->data + e->offset;
+    view->size          = (size_t) e->width * e->height * e->channels * (e->bitsperpixel / 8);
+    view->width         = e->width;
+    view->height        = e->height;
+    view->bitsperpixel  = e->bitsperpixel;
+    view->channels      = e->channels;
+    view->configuration = e->configuration;
+    view->slot          = slot;
+    view->owned         = NULL;
+}
+
+static int pzp_cache_decode_into(const void *file, size_t fileSize, void *pixels, size_t size,
+                                 const unsigned int header[10], struct pzp_cache_view *view)
+{
+    struct pzp_tensor tensor;
+    pzp_tensor_init(&tensor, pixels, size, (header[1] == 16) ? PZP_TENSOR_UINT16 : PZP_TENSOR_UINT8, PZP_LAYOUT_HWC);
+
+    return pzp_decompress_to_tensor_from_memory(file, fileSize, &tensor, &view->width, &view->height,
+                                                &view->bitsperpixel, &view->channels, &view->configuration);
+}
+
+/*
+ * View of the decoded frame of `filename`, decoding it into the cache on a
+ * miss.  Returns 1 and fills `view` (release it with pzp_cache_release), or 0
+ * if the file cannot be read or decoded.
+ */
+static int pzp_cache_get(struct pzp_cache *cache, const char *filename, struct pzp_cache_view *view)
+{
+    if ( (cache == NULL) || (filename == NULL) || (view == NULL) ) { return 0; }
+    memset(view, 0, sizeof(struct pzp_cache_view));
+
+    struct stat st;
+    if (stat(filename, &st) != 0) { return 0; }
+
+    struct pzp_cache_entry key;
+    memset(&key, 0, sizeof(key));
+    key.device = (uint64_t) st.st_dev;
+    key.inode  = (uint64_t) st.st_ino;
+    key.size   = (uint64_t) st.st_size;
+    key.mtime  = (uint64_t) st.st_mtim.tv_sec * 1000000000ULL + (uint64_t) st.st_mtim.tv_nsec;
+
+    // ── Step 1: lock-free hit, or wait for the process already decoding it ──
+    unsigned int slot = 0;
+    for (;;)
+    {
+        int filling = 0;
+        slot = pzp_cache_lookup(cache, &key, &filling);
+        if (slot)
+        {
+            __atomic_add_fetch(&cache->segment->hits, 1, __ATOMIC_RELAXED);
+            pzp_cache_fill_view(cache, slot, view);
+            return 1;
+        }
+        if (!filling) { break; }
+        usleep(200);
+    }
+
+    // ── Step 2: read the file and size the frame ──
+    size_t fileSize = 0;
+    void *file = pzp_read_file_to_memory(filename, &fileSize);
+    unsigned int header[10];
+    if ( (file == NULL) || (!pzp_read_header_words_from_memory(file, fileSize, header)) ||
+         ( (header[1] != 8) && (header[1] != 16) ) )
+    {
+        pzp_dealloc(file);
+        return 0;
+    }
+    size_t size = (size_t) header[3] * header[4] * header[2] * (header[1] / 8);
+    unsigned int count = (unsigned int) ((size + PZP_CACHE_BLOCK - 1) / PZP_CACHE_BLOCK);
+
+    // ── Step 3: recheck under the lock, then reserve a slot and blocks ──
+    pzp_cache_lock(cache);
+    int filling = 0;
+    slot = pzp_cache_lookup(cache, &key, &filling);
+    if ( (slot) || (filling) )
+    {
+        // Somebody got there first
+        pzp_cache_unlock(cache);
+        pzp_dealloc(file);
+        if (!slot) { return pzp_cache_get(cache, filename, view); }
+        __atomic_add_fetch(&cache->segment->hits, 1, __ATOMIC_RELAXED);
+        pzp_cache_fill_view(cache, slot, view);
+        return 1;
+    }
+    __atomic_add_fetch(&cache->segment->misses, 1, __ATOMIC_RELAXED);
+
+    slot = ((uint64_t) count <= cache->segment->blocks) ? pzp_cache_claim_slot(cache, &key) : 0;
+    unsigned int first = cache->segment->blocks;
+    if (slot) { first = pzp_cache_allocate(cache, count); }
+
+    if (first == cache->segment->blocks)
+    {
+        // ── Too big, or everything pinned: decode privately ──
+        pzp_cache_unlock(cache);
+        __atomic_add_fetch(&cache->segment->uncached, 1, __ATOMIC_RELAXED);
+
+        view->owned = (unsigned char *) pzp_alloc(size);
+        int success = (view->owned != NULL) && (pzp_cache_decode_into(file, fileSize, view->owned, size, header, view));
+        pzp_dealloc(file);
+        if (!success) { pzp_dealloc(view->owned); view->owned = NULL; return 0; }
+        view->pixels = view->owned;
+        view->size   = size;
+        return 1;
+    }
+
+    struct pzp_cache_entry *e = &cache->entries[slot - 1];
+    for (unsigned int b = 0; b < count; b++) { cache->owners[first + b] = slot; }
+    e->device = key.device;
+    e->inode  = key.inode;
+    e->size   = key.size;
+    e->mtime  = key.mtime;
+    e->offset = (uint64_t) first * PZP_CACHE_BLOCK;
+    e->blocks = count;
+    e->filler = (int) getpid();
+    __atomic_store_n(&e->referenced, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->state, PZP_CACHE_FILLING, __ATOMIC_RELEASE);
+    pzp_cache_unlock(cache);
+
+    // ── Step 4: decode into the segment without holding the lock, then publish ──
+    int success = pzp_cache_decode_into(file, fileSize, cache->data + e->offset, size, header, view);
+    pzp_dealloc(file);
+
+    if (!success)
+    {
+        pzp_cache_lock(cache);
+        pzp_cache_free_blocks(cache, e);
+        __atomic_store_n(&e->state, PZP_CACHE_DEAD, __ATOMIC_RELEASE);
+        pzp_cache_unlock(cache);
+        memset(view, 0, sizeof(struct pzp_cache_view));
+        return 0;
+    }
+
+    e->width         = view->width;
+    e->height        = view->height;
+    e->bitsperpixel  = view->bitsperpixel;
+    e->channels      = view->channels;
+    e->configuration = view->configuration;
+    __atomic_add_fetch(&e->pins, 1, __ATOMIC_SEQ_CST); // our own view; a failed reader may be unpinning
+    __atomic_store_n(&e->state, PZP_CACHE_READY, __ATOMIC_SEQ_CST);
+
+    pzp_cache_fill_view(cache, slot, view);
+    return 1;
+}
+
+// Unpin (or free) a view returned by pzp_cache_get.
+static void pzp_cache_release(struct pzp_cache *cache, struct pzp_cache_view *view)
+{
+    if (view == NULL) { return; }
+    if (view->owned != NULL) { pzp_dealloc(view->owned); }
+    else if ( (cache != NULL) && (view->slot != 0) )
+        { __atomic_sub_fetch(&cache->entries[view->slot - 1].pins, 1, __ATOMIC_SEQ_CST); }
+    memset(view, 0, sizeof(struct pzp_cache_view));
+}
+
+static void pzp_cache_get_stats(struct pzp_cache *cache, struct pzp_cache_stats *stats)
+{
+    memset(stats, 0, sizeof(struct pzp_cache_stats));
+    if (cache == NULL) { return; }
+
+    struct pzp_cache_segment *segment = cache->segment;
+    stats->hits      = __atomic_load_n(&segment->hits,      __ATOMIC_RELAXED);
+    stats->misses    = __atomic_load_n(&segment->misses,    __ATOMIC_RELAXED);
+    stats->evictions = __atomic_load_n(&segment->evictions, __ATOMIC_RELAXED);
+    stats->uncached  = __atomic_load_n(&segment->uncached,  __ATOMIC_RELAXED);
+    stats->budget    = segment->budget;
+
+    pzp_cache_lock(cache);
+    stats->used = (uint64_t) (segment->blocks - segment->freeBlocks) * PZP_CACHE_BLOCK;
+    for (unsigned int s = 0; s < segment->slots; s++)
+        { stats->frames += (__atomic_load_n(&cache->entries[s].state, __ATOMIC_ACQUIRE) == PZP_CACHE_READY); }
+    pzp_cache_unlock(cache);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
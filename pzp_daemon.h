@@ -0,0 +1,774 @@
+/*
+PZP Portable Zipped PNM
+Copyright (C) 2025 Ammar Qammaz
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Decode service of a node: one pzpd process decodes for every other one.
+ *
+ * pzp_daemon_serve() listens on a Unix domain socket.  A client connects,
+ * sends one struct pzp_daemon_request (file, pyramid level, optional region
+ * of interest) and gets back one struct pzp_daemon_reply.  With the reply
+ * comes, as SCM_RIGHTS ancillary data, a memfd holding the decoded pixels.
+ * The client maps it read-only: the pixels are never copied through the
+ * socket, and the buffer is freed when the last process closes or unmaps it.
+ * The memfd is sealed (no write, grow or shrink) before it is handed out.
+ * A client can therefore map it without trusting the other clients it
+ * shares the buffer with.
+ *
+ * Pixels are HWC, with 16-bit samples in native byte order, like the uint16
+ * tensor output and the frame cache (pzp_cache.h).
+ *
+ * A worker pool serves the requests.  The key of a request is its path,
+ * level and region.  While a decode for a key runs, any further request for
+ * the same key is attached to that decode instead of starting its own.  When
+ * the decode is done, the same memfd goes to every waiting client.
+ *
+ * Each connection carries a single request.  The protocol is local to one
+ * machine: structs are sent in native layout and byte order, and a version
+ * mismatch is refused.
+ *
+ * The socket is created with mode 0600, or 0660 for a configured group, so
+ * other users cannot connect.  The daemon reads files with its own rights,
+ * so it checks every request on behalf of the client.  The path must resolve
+ * to a regular file below the configured root.  The client's uid and primary
+ * gid, taken from SO_PEERCRED, must be able to read that file by its mode
+ * bits.
+ */
+
+#ifndef PZP_DAEMON_H_INCLUDED
+#define PZP_DAEMON_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "pzp.h"
+
+#define PZP_DAEMON_MAGIC        0x44505A50u // "PZPD"
+#define PZP_DAEMON_VERSION      1
+#define PZP_DAEMON_MAX_PATH     4096
+#define PZP_DAEMON_MAX_THREADS  64
+#define PZP_DAEMON_TIMEOUT      5           // seconds a client may take to send or receive
+
+struct pzp_daemon_request
+{
+    unsigned int magic, version;
+    unsigned int level;            // pyramid level, 0 = full resolution
+    unsigned int roi[4];           // x, y, width, height in that level; width or height 0 = whole frame
+    char         path[PZP_DAEMON_MAX_PATH];
+};
+
+struct pzp_daemon_reply
+{
+    unsigned int       magic;
+    unsigned int       status;     // 0, or an errno value (no memfd is attached then)
+    unsigned int       width, height, bitsperpixel, channels, configuration;
+    unsigned int       shared;     // requests the decode was handed to, this one included
+    unsigned long long size;       // bytes of pixels in the memfd
+};
+
+// A decoded frame received from the daemon, mapped read-only.
+struct pzp_daemon_frame
+{
+    const unsigned char *pixels;
+    size_t               size;
+    unsigned int         width, height, bitsperpixel, channels, configuration;
+    unsigned int         shared;
+    int                  fd;
+};
+
+// ─── Client ─────────────────────────────────────────────────────────────────
+
+static int pzp_daemon_connect(const char *socketPath)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) { errno = ENAMETOOLONG; return -1; }
+    strcpy(address.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { return -1; }
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+/* Receive one reply and the memfd that may come with it.  Returns 1 when the whole
+   reply arrived; *fd is -1 if no descriptor was attached. */
+static int pzp_daemon_receive(int connection, struct pzp_daemon_reply *reply, int *fd)
+{
+    union { char buffer[CMSG_SPACE(sizeof(int))]; struct cmsghdr align; } control;
+    struct iovec  iov = { reply, sizeof(struct pzp_daemon_reply) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov        = &iov;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    *fd = -1;
+    ssize_t received = recvmsg(connection, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&message); c != NULL; c = CMSG_NXTHDR(&message, c))
+        if ( (c->cmsg_level == SOL_SOCKET) && (c->cmsg_type == SCM_RIGHTS) && (c->cmsg_len == CMSG_LEN(sizeof(int))) )
+            memcpy(fd, CMSG_DATA(c), sizeof(int));
+
+    if ( (received != (ssize_t) sizeof(struct pzp_daemon_reply)) || (message.msg_flags & MSG_CTRUNC) )
+    {
+        if (*fd >= 0) { close(*fd); *fd = -1; }
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Ask the daemon at socketPath for pyramid level `level` of `filename`, cropped
+ * to roi (x, y, width, height; NULL for the whole frame).  Returns 1 and fills
+ * frame (release it with pzp_daemon_release), or 0 with errno set: the daemon's
+ * status when it refused the request, else the local error.
+ */
+static int pzp_daemon_fetch(const char *socketPath, const char *filename, unsigned int level,
+                            const unsigned int roi[4], struct pzp_daemon_frame *frame)
+{
+    memset(frame, 0, sizeof(struct pzp_daemon_frame));
+    frame->fd = -1;
+
+    struct pzp_daemon_request request;
+    memset(&request, 0, sizeof(request));
+    request.magic   = PZP_DAEMON_MAGIC;
+    request.version = PZP_DAEMON_VERSION;
+    request.level   = level;
+    if (roi != NULL) { memcpy(request.roi, roi, sizeof(request.roi)); }
+    if (strlen(filename) >= sizeof(request.path)) { errno = ENAMETOOLONG; return 0; }
+    strcpy(request.path, filename);
+
+    int connection = pzp_daemon_connect(socketPath);
+    if (connection < 0) { return 0; }
+
+    struct pzp_daemon_reply reply;
+    int fd = -1;
+    int ok = (send(connection, &request, sizeof(request), MSG_NOSIGNAL) == (ssize_t) sizeof(request)) &&
+             pzp_daemon_receive(connection, &reply, &fd);
+    int error = errno;
+    close(connection);
+
+    if (!ok)                           { errno = (error != 0) ? error : EPROTO; return 0; }
+    if (reply.magic != PZP_DAEMON_MAGIC) { if (fd >= 0) { close(fd); } errno = EPROTO; return 0; }
+    if ( (reply.status != 0) || (fd < 0) || (reply.size == 0) )
+    {
+        if (fd >= 0) { close(fd); }
+        errno = (reply.status != 0) ? (int) reply.status : EPROTO;
+        return 0;
+    }
+
+    void *pixels = mmap(NULL, (size_t) reply.size, PROT_READ, MAP_SHARED, fd, 0);
+    if (pixels == MAP_FAILED)
+    {
+        error = errno;
+        close(fd);
+        errno = error;
+        return 0;
+    }
+
+    frame->pixels        = (const unsigned char *) pixels;
+    frame->size          = (size_t) reply.size;
+    frame->width         = reply.width;
+    frame->height        = reply.height;
+    frame->bitsperpixel  = reply.bitsperpixel;
+    frame->channels      = reply.channels;
+    frame->configuration = reply.configuration;
+    frame->shared        = reply.shared;
+    frame->fd            = fd;
+    return 1;
+}
+
+static void pzp_daemon_release(struct pzp_daemon_frame *frame)
+{
+    if (frame->pixels != NULL) { munmap((void *) frame->pixels, frame->size); }
+    if (frame->fd >= 0)        { close(frame->fd); }
+    memset(frame, 0, sizeof(struct pzp_daemon_frame));
+    frame->fd = -1;
+}
+
+// ─── Server ─────────────────────────────────────────────────────────────────
+
+// Who may connect and which files are served (NULL options: owner only, any path)
+struct pzp_daemon_options
+{
+    const char *root;   // only files below this directory are served, NULL = anywhere
+    int         group;  // gid that may connect as well (socket mode 0660), -1 = owner only (0600)
+};
+
+// A decode in flight and the connections waiting for it.
+struct pzp_daemon_job
+{
+    struct pzp_daemon_request request;  // the key, with the resolved path
+    dev_t                     device;   // the file every waiter was allowed to read
+    ino_t                     inode;
+    int                      *waiters;
+    unsigned int              waiterCount, waiterCapacity;
+    struct pzp_daemon_job    *next;
+};
+
+struct pzp_daemon
+{
+    int                    listener;
+    pthread_mutex_t        lock;
+    pthread_cond_t         wake;
+    int                   *queue;      // accepted connections, ring buffer
+    unsigned int           queueHead, queueCount, queueCapacity;
+    struct pzp_daemon_job *inflight;
+    char                   root[PATH_MAX]; // resolved, without a trailing '/'; "" = anywhere
+    size_t                 rootLength;
+    int                    stopping;
+    unsigned long long     requests, decodes, coalesced, failed;
+};
+
+// Rows of a region of interest, copied out of the bands as they are decoded.
+struct pzp_daemon_crop
+{
+    unsigned char *pixels;
+    unsigned int   x, y, width, height;
+    int            done;   // the decode was stopped below the region
+};
+
+static int pzp_daemon_crop_band(void *user, const struct pzp_band *band)
+{
+    struct pzp_daemon_crop *crop = (struct pzp_daemon_crop *) user;
+    size_t sampleBytes = band->bitsperpixel / 8;
+    size_t pixelBytes  = sampleBytes * band->channels;
+    size_t outRowBytes = pixelBytes * crop->width;
+
+    for (unsigned int r = 0; r < band->rowCount; r++)
+    {
+        unsigned int y = band->firstRow + r;
+        if ( (y < crop->y) || (y >= crop->y + crop->height) ) { continue; }
+
+        const unsigned char *in  = band->rows + (size_t) r * band->rowBytes + (size_t) crop->x * pixelBytes;
+        unsigned char       *out = crop->pixels + (size_t) (y - crop->y) * outRowBytes;
+        if (sampleBytes == 1)
+        {
+            memcpy(out, in, outRowBytes);
+            continue;
+        }
+        // Decoded rows hold big-endian samples, the memfd native ones
+        unsigned short *samples = (unsigned short *) out;
+        for (size_t i = 0; i < outRowBytes / 2; i++)
+            samples[i] = (unsigned short) (in[2 * i] << 8 | in[2 * i + 1]);
+    }
+
+    // Rows below the region are not needed: stop the decode there
+    unsigned int next = band->firstRow + band->rowCount;
+    if ( (next >= crop->y + crop->height) && (next < band->height) )
+    {
+        crop->done = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/* Read the file a request was authorized for.  It is opened again, so it must
+   still be the same inode.  Returns it (pzp_dealloc) or NULL with *status set. */
+static unsigned char * pzp_daemon_read_file(const char *path, dev_t device, ino_t inode, size_t *size, unsigned int *status)
+{
+    struct stat info;
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if ( (fd < 0) || (fstat(fd, &info) != 0) || (info.st_dev != device) || (info.st_ino != inode) )
+    {
+        *status = (fd < 0) ? (unsigned int) errno : EAGAIN;
+        if (fd >= 0) { close(fd); }
+        return NULL;
+    }
+
+    *size = (size_t) info.st_size;
+    unsigned char *file = (unsigned char *) pzp_alloc(*size + 1);
+    size_t done = 0;
+    while ( (file != NULL) && (done < *size) )
+    {
+        ssize_t n = pread(fd, file + done, *size - done, (off_t) done);
+        if (n <= 0) { pzp_dealloc(file); file = NULL; break; }
+        done += (size_t) n;
+    }
+    close(fd);
+    if (file == NULL) { *status = EIO; }
+    return file;
+}
+
+/* Decode a job's request into a new sealed memfd.  Returns the memfd and fills
+   reply, or -1 with reply->status set. */
+static int pzp_daemon_decode(const struct pzp_daemon_job *job, struct pzp_daemon_reply *reply)
+{
+    const struct pzp_daemon_request *request = &job->request;
+    size_t fileSize = 0;
+    unsigned char *file = pzp_daemon_read_file(request->path, job->device, job->inode, &fileSize, &reply->status);
+    if (file == NULL) { return -1; }
+
+    // Narrow the file down to the stream of the requested level
+    const unsigned char *stream = file;
+    size_t streamSize = fileSize;
+    if (request->level > 0)
+    {
+        size_t tailSize = (fileSize < PZP_PYRAMID_FOOTER_MAX) ? fileSize : PZP_PYRAMID_FOOTER_MAX;
+        unsigned long long offset = 0, size = 0;
+        if (pzp_pyramid_find(file + fileSize - tailSize, tailSize, fileSize, request->level, &offset, &size) < request->level)
+        {
+            pzp_dealloc(file);
+            reply->status = EINVAL;
+            return -1;
+        }
+        stream     = file + offset;
+        streamSize = (size_t) size;
+    }
+
+    unsigned int width = 0, height = 0, bitsperpixel = 0, channels = 0, bitsperpixelInternal = 0, channelsInternal = 0, configuration = 0;
+    if (!pzp_read_header_from_memory(stream, streamSize, &width, &height, &bitsperpixel, &channels,
+                                     &bitsperpixelInternal, &channelsInternal, &configuration))
+    {
+        pzp_dealloc(file);
+        reply->status = EIO;
+        return -1;
+    }
+
+    struct pzp_daemon_crop crop = { NULL, 0, 0, width, height, 0 };
+    int cropped = (request->roi[2] != 0) && (request->roi[3] != 0);
+    if (cropped)
+    {
+        crop.x      = request->roi[0];
+        crop.y      = request->roi[1];
+        crop.width  = request->roi[2];
+        crop.height = request->roi[3];
+    }
+    size_t size = (size_t) crop.width * crop.height * channels * (bitsperpixel / 8);
+    if ( (crop.x > width) || (crop.width > width - crop.x) || (crop.y > height) || (crop.height > height - crop.y) ||
+         ( (bitsperpixel != 8) && (bitsperpixel != 16) ) || (size == 0) )
+    {
+        pzp_dealloc(file);
+        reply->status = EINVAL;
+        return -1;
+    }
+
+    int fd = memfd_create("pzp-frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    unsigned char *pixels = MAP_FAILED;
+    if ( (fd >= 0) && (ftruncate(fd, (off_t) size) == 0) )
+        pixels = (unsigned char *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (pixels == MAP_FAILED)
+    {
+        if (fd >= 0) { close(fd); }
+        pzp_dealloc(file);
+        reply->status = ENOMEM;
+        return -1;
+    }
+
+    int ok = 0;
+    if (cropped)
+    {
+        // The stream is sequential: rows above the region are decoded, the ones below are not.
+        // A region that ends above the last row is handed out without the frame checksum.
+        crop.pixels = pixels;
+        struct pzp_bands bands = { pzp_daemon_crop_band, &crop, 0 };
+        unsigned char *decoded = pzp_decompress_bands_from_memory(stream, streamSize, &bands, &width, &height,
+                                                                  &bitsperpixel, &channels, &bitsperpixelInternal,
+                                                                  &channelsInternal, &configuration);
+        ok = (decoded != NULL) || (crop.done);
+        pzp_dealloc(decoded);
+    } else
+    {
+        struct pzp_tensor tensor;
+        pzp_tensor_init(&tensor, pixels, size, (bitsperpixel == 16) ? PZP_TENSOR_UINT16 : PZP_TENSOR_UINT8, PZP_LAYOUT_HWC);
+        ok = pzp_decompress_to_tensor_from_memory(stream, streamSize, &tensor, &width, &height,
+                                                  &bitsperpixel, &channels, &configuration);
+    }
+    munmap(pixels, size);
+    pzp_dealloc(file);
+
+    // No writable mapping is left, so the buffer can be sealed read-only for good
+    if ( (!ok) || (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) )
+    {
+        close(fd);
+        reply->status = (ok) ? errno : EIO;
+        return -1;
+    }
+
+    reply->width         = crop.width;
+    reply->height        = crop.height;
+    reply->bitsperpixel  = bitsperpixel;
+    reply->channels      = channels;
+    reply->configuration = configuration;
+    reply->size          = size;
+    return fd;
+}
+
+static void pzp_daemon_send(int connection, const struct pzp_daemon_reply *reply, int fd)
+{
+    union { char buffer[CMSG_SPACE(sizeof(int))]; struct cmsghdr align; } control;
+    struct iovec  iov = { (void *) reply, sizeof(struct pzp_daemon_reply) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov    = &iov;
+    message.msg_iovlen = 1;
+    if (fd >= 0)
+    {
+        memset(&control, 0, sizeof(control));
+        message.msg_control    = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&message);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type  = SCM_RIGHTS;
+        c->cmsg_len   = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+    // A client that went away only loses its own reply
+    sendmsg(connection, &message, MSG_NOSIGNAL);
+}
+
+static int pzp_daemon_same_key(const struct pzp_daemon_job *job, const struct pzp_daemon_request *request, const struct stat *file)
+{
+    return (job->device == file->st_dev) && (job->inode == file->st_ino) && (job->request.level == request->level) &&
+           (memcmp(job->request.roi, request->roi, sizeof(request->roi)) == 0) && (strcmp(job->request.path, request->path) == 0);
+}
+
+/* Check a request on behalf of the client behind the connection.  The path is
+   resolved (request->path becomes the result) and must be a regular file below
+   the daemon's root.  The client's uid / primary gid must be able to read it by
+   its owner, group and other bits.  Supplementary groups and ACLs are not
+   consulted, so a file readable only through them is refused.  Returns 0 and
+   fills file, or an errno value for the reply. */
+static unsigned int pzp_daemon_authorize(const struct pzp_daemon *daemon, int connection,
+                                         struct pzp_daemon_request *request, struct stat *file)
+{
+    struct ucred peer;
+    socklen_t    peerLength = sizeof(peer);
+    if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) != 0) { return EACCES; }
+
+    char resolved[PATH_MAX];
+    if (realpath(request->path, resolved) == NULL) { return (unsigned int) errno; }
+    if ( (daemon->rootLength > 0) &&
+         ( (strncmp(resolved, daemon->root, daemon->rootLength) != 0) || (resolved[daemon->rootLength] != '/') ) )
+        return EACCES;
+    if (stat(resolved, file) != 0) { return (unsigned int) errno; }
+    if (!S_ISREG(file->st_mode))   { return EINVAL; }
+
+    int readable = (peer.uid == 0) || (peer.uid == geteuid());
+    if (!readable)
+    {
+        if (file->st_uid == peer.uid)      { readable = (file->st_mode & S_IRUSR) != 0; }
+        else if (file->st_gid == peer.gid) { readable = (file->st_mode & S_IRGRP) != 0; }
+        else                               { readable = (file->st_mode & S_IROTH) != 0; }
+    }
+    if (!readable) { return EACCES; }
+
+    if (strlen(resolved) >= sizeof(request->path)) { return ENAMETOOLONG; }
+    strcpy(request->path, resolved);
+    return 0;
+}
+
+static void pzp_daemon_refuse(int connection, unsigned int status)
+{
+    struct pzp_daemon_reply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.magic  = PZP_DAEMON_MAGIC;
+    reply.status = status;
+    pzp_daemon_send(connection, &reply, -1);
+    close(connection);
+}
+
+// Read and check one request; answers and closes the connection itself when it is malformed.
+static int pzp_daemon_read_request(int connection, struct pzp_daemon_request *request)
+{
+    ssize_t received = recv(connection, request, sizeof(struct pzp_daemon_request), MSG_WAITALL);
+    if ( (received == (ssize_t) sizeof(struct pzp_daemon_request)) && (request->magic == PZP_DAEMON_MAGIC) &&
+         (request->version == PZP_DAEMON_VERSION) && (memchr(request->path, 0, sizeof(request->path)) != NULL) )
+        return 1;
+
+    if (received > 0) { pzp_daemon_refuse(connection, EPROTO); }
+                 else { close(connection); }
+    return 0;
+}
+
+// Serve one connection: either attach it to the decode of its key or run that decode.
+static void pzp_daemon_handle(struct pzp_daemon *daemon, int connection)
+{
+    struct pzp_daemon_request request;
+    if (!pzp_daemon_read_request(connection, &request))
+    {
+        pthread_mutex_lock(&daemon->lock);
+        daemon->failed++;
+        pthread_mutex_unlock(&daemon->lock);
+        return;
+    }
+
+    // Only requests the client is allowed to make are decoded or shared
+    struct stat  file;
+    unsigned int refused = pzp_daemon_authorize(daemon, connection, &request, &file);
+    if (refused != 0)
+    {
+        pzp_daemon_refuse(connection, refused);
+        pthread_mutex_lock(&daemon->lock);
+        daemon->requests++;
+        daemon->failed++;
+        pthread_mutex_unlock(&daemon->lock);
+        return;
+    }
+
+    pthread_mutex_lock(&daemon->lock);
+    daemon->requests++;
+    for (struct pzp_daemon_job *job = daemon->inflight; job != NULL; job = job->next)
+    {
+        if (!pzp_daemon_same_key(job, &request, &file)) { continue; }
+        if (job->waiterCount == job->waiterCapacity)
+        {
+            unsigned int capacity = job->waiterCapacity * 2;
+            int *waiters = (int *) realloc(job->waiters, capacity * sizeof(int));
+            if (waiters == NULL) { break; } // decoded on its own instead
+            job->waiters        = waiters;
+            job->waiterCapacity = capacity;
+        }
+        job->waiters[job->waiterCount++] = connection;
+        daemon->coalesced++;
+        pthread_mutex_unlock(&daemon->lock);
+        return;
+    }
+
+    struct pzp_daemon_job *job = (struct pzp_daemon_job *) calloc(1, sizeof(struct pzp_daemon_job));
+    int *waiters = (int *) malloc(4 * sizeof(int));
+    if ( (job == NULL) || (waiters == NULL) )
+    {
+        daemon->failed++;
+        pthread_mutex_unlock(&daemon->lock);
+        free(job);
+        free(waiters);
+        close(connection);
+        return;
+    }
+    job->request        = request;
+    job->device         = file.st_dev;
+    job->inode          = file.st_ino;
+    job->waiters        = waiters;
+    job->waiters[0]     = connection;
+    job->waiterCount    = 1;
+    job->waiterCapacity = 4;
+    job->next           = daemon->inflight;
+    daemon->inflight    = job;
+    daemon->decodes++;
+    pthread_mutex_unlock(&daemon->lock);
+
+    struct pzp_daemon_reply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.magic = PZP_DAEMON_MAGIC;
+    int fd = pzp_daemon_decode(job, &reply);
+
+    // Later requests for the key start a new decode: the file may have changed by then
+    pthread_mutex_lock(&daemon->lock);
+    for (struct pzp_daemon_job **link = &daemon->inflight; *link != NULL; link = &(*link)->next)
+        if (*link == job) { *link = job->next; break; }
+    if (fd < 0) { daemon->failed += job->waiterCount; }
+    pthread_mutex_unlock(&daemon->lock);
+
+    reply.shared = job->waiterCount;
+    for (unsigned int i = 0; i < job->waiterCount; i++)
+    {
+        pzp_daemon_send(job->waiters[i], &reply, fd);
+        close(job->waiters[i]);
+    }
+    if (fd >= 0) { close(fd); }
+    free(job->waiters);
+    free(job);
+}
+
+static void * pzp_daemon_worker(void *argument)
+{
+    struct pzp_daemon *daemon = (struct pzp_daemon *) argument;
+    for (;;)
+    {
+        pthread_mutex_lock(&daemon->lock);
+        while ( (daemon->queueCount == 0) && (!daemon->stopping) )
+            pthread_cond_wait(&daemon->wake, &daemon->lock);
+        if (daemon->queueCount == 0)
+        {
+            pthread_mutex_unlock(&daemon->lock);
+            return NULL;
+        }
+        int connection = daemon->queue[daemon->queueHead];
+        daemon->queueHead = (daemon->queueHead + 1) % daemon->queueCapacity;
+        daemon->queueCount--;
+        pthread_mutex_unlock(&daemon->lock);
+
+        pzp_daemon_handle(daemon, connection);
+    }
+}
+
+// Append an accepted connection to the queue, growing it when full.
+static int pzp_daemon_enqueue(struct pzp_daemon *daemon, int connection)
+{
+    pthread_mutex_lock(&daemon->lock);
+    if (daemon->queueCount == daemon->queueCapacity)
+    {
+        unsigned int capacity = (daemon->queueCapacity > 0) ? daemon->queueCapacity * 2 : 64;
+        int *queue = (int *) malloc(capacity * sizeof(int));
+        if (queue == NULL)
+        {
+            pthread_mutex_unlock(&daemon->lock);
+            return 0;
+        }
+        for (unsigned int i = 0; i < daemon->queueCount; i++)
+            queue[i] = daemon->queue[(daemon->queueHead + i) % daemon->queueCapacity];
+        free(daemon->queue);
+        daemon->queue         = queue;
+        daemon->queueHead     = 0;
+        daemon->queueCapacity = capacity;
+    }
+    daemon->queue[(daemon->queueHead + daemon->queueCount) % daemon->queueCapacity] = connection;
+    daemon->queueCount++;
+    pthread_cond_signal(&daemon->wake);
+    pthread_mutex_unlock(&daemon->lock);
+    return 1;
+}
+
+/* Bind socketPath, taking it over only when no daemon answers there any more.
+   The socket is bound, restricted to the owner (and group) and listening under
+   a temporary name first and then renamed, so clients never find it before it
+   accepts or while others may still connect.  Returns it or -1. */
+static int pzp_daemon_listen(const char *socketPath, int group)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (snprintf(address.sun_path, sizeof(address.sun_path), "%s.%d", socketPath, (int) getpid()) >= (int) sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path %s is too long\n", socketPath);
+        return -1;
+    }
+
+    int probe = pzp_daemon_connect(socketPath);
+    if (probe >= 0)
+    {
+        close(probe);
+        fprintf(stderr, "A daemon already serves %s\n", socketPath);
+        return -1;
+    }
+
+    unlink(address.sun_path);
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ( (listener < 0) || (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0) ||
+         ( (group >= 0) && (chown(address.sun_path, (uid_t) -1, (gid_t) group) != 0) ) ||
+         (chmod(address.sun_path, (group >= 0) ? 0660 : 0600) != 0) ||
+         (listen(listener, SOMAXCONN) != 0) || (rename(address.sun_path, socketPath) != 0) )
+    {
+        fprintf(stderr, "Failed to listen on %s: %s\n", socketPath, strerror(errno));
+        if (listener >= 0) { close(listener); }
+        unlink(address.sun_path);
+        return -1;
+    }
+    return listener;
+}
+
+/*
+ * Serve decode requests on socketPath with `threads` workers until *stop is set
+ * (from a signal handler, say).  options may be NULL (see pzp_daemon_options).
+ * Removes the socket on the way out.  Returns 1 on a clean shutdown, 0 if the
+ * socket could not be set up or the root does not exist.
+ */
+static int pzp_daemon_serve(const char *socketPath, unsigned int threads, const struct pzp_daemon_options *options,
+                            volatile sig_atomic_t *stop)
+{
+    struct pzp_daemon daemon;
+    memset(&daemon, 0, sizeof(daemon));
+    if ( (options != NULL) && (options->root != NULL) )
+    {
+        if (realpath(options->root, daemon.root) == NULL)
+        {
+            fprintf(stderr, "Root %s: %s\n", options->root, strerror(errno));
+            return 0;
+        }
+        daemon.rootLength = strlen(daemon.root);
+        if (daemon.root[daemon.rootLength - 1] == '/') { daemon.root[--daemon.rootLength] = 0; } // "/": anywhere
+    }
+    daemon.listener = pzp_daemon_listen(socketPath, (options != NULL) ? options->group : -1);
+    if (daemon.listener < 0) { return 0; }
+
+    pthread_mutex_init(&daemon.lock, NULL);
+    pthread_cond_init(&daemon.wake, NULL);
+
+    if (threads == 0)                      { threads = 1; }
+    if (threads > PZP_DAEMON_MAX_THREADS)  { threads = PZP_DAEMON_MAX_THREADS; }
+    pthread_t    workers[PZP_DAEMON_MAX_THREADS];
+    unsigned int started = 0;
+    while ( (started < threads) && (pthread_create(&workers[started], NULL, pzp_daemon_worker, &daemon) == 0) )
+        started++;
+    fprintf(stderr, "Serving %s with %u workers, files below %s\n", socketPath, started, (daemon.rootLength > 0) ? daemon.root : "/");
+
+    struct timeval timeout = { PZP_DAEMON_TIMEOUT, 0 };
+    while ( (started > 0) && (!*stop) )
+    {
+        // Wake up now and then to notice *stop
+        struct pollfd pending = { daemon.listener, POLLIN, 0 };
+        if (poll(&pending, 1, 200) <= 0) { continue; }
+
+        int connection = accept4(daemon.listener, NULL, NULL, SOCK_CLOEXEC);
+        if (connection < 0) { continue; }
+        // A stalled client holds up a worker for the timeout at most
+        setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (!pzp_daemon_enqueue(&daemon, connection)) { close(connection); }
+    }
+
+    close(daemon.listener);
+    unlink(socketPath);
+
+    // Workers finish what was already accepted
+    pthread_mutex_lock(&daemon.lock);
+    daemon.stopping = 1;
+    pthread_cond_broadcast(&daemon.wake);
+    pthread_mutex_unlock(&daemon.lock);
+    for (unsigned int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    fprintf(stderr, "Served %llu requests with %llu decodes (%llu coalesced), %llu failed\n",
+            daemon.requests, daemon.decodes, daemon.coalesced, daemon.failed);
+    free(daemon.queue);
+    pthread_mutex_destroy(&daemon.lock);
+    pthread_cond_destroy(&daemon.wake);
+    return (started > 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PZP_DAEMON_H_INCLUDED
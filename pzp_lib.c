@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include "pzp.h"
+#include "pzp_loader.h"
+#include "pzp_cache.h"
 
 /*
  * Exported C API for ctypes / FFI consumers.
@@ -23,9 +25,154 @@ unsigned char *pzp_decompress_file(
                                    configuration);
 }
 
+/*
+ * pzp_decompress_file_level — decode one level of a USE_PYRAMID file.
+ * level 0 is the full image, each further level halves width and height.
+ * Only the requested level is read from disk.  Returns NULL if the file
+ * stores no such level.
+ */
+unsigned char *pzp_decompress_file_level(
+        const char   *filename,
+        unsigned int  level,
+        unsigned int *width,
+        unsigned int *height,
+        unsigned int *bpp_ext,
+        unsigned int *channels_ext,
+        unsigned int *bpp_int,
+        unsigned int *channels_int,
+        unsigned int *configuration)
+{
+    return pzp_decompress_level(filename, level,
+                                width, height,
+                                bpp_ext, channels_ext,
+                                bpp_int, channels_int,
+                                configuration);
+}
+
+/*
+ * pzp_levels_file — number of decodable levels (1 without a pyramid, 0 on error).
+ */
+unsigned int pzp_levels_file(const char *filename)
+{
+    return pzp_pyramid_levels(filename);
+}
+
 void pzp_free(void *ptr)
 {
-    free(ptr);
+    pzp_dealloc(ptr);
+}
+
+/*
+ * pzp_set_allocator_hooks — allocate every buffer of the library, decoded
+ * images included, through alloc(user, size) / release(user, pointer), e.g. an
+ * arena or pool of the host application.  NULL hooks restore the default:
+ * 64-byte aligned, huge-page advised from 2 MB up.  Set it before decoding
+ * anything; decoded images are still released with pzp_free().
+ */
+void pzp_set_allocator_hooks(void *(*alloc)(void *user, size_t size),
+                             void  (*release)(void *user, void *pointer),
+                             void   *user)
+{
+    struct pzp_allocator allocator = { alloc, release, user };
+    pzp_set_allocator(&allocator);
+}
+
+/*
+ * pzp_use_hugetlb — 1 takes large buffers from the reserved MAP_HUGETLB pool
+ * (falling back to regular memory when it is empty), 0 restores the default.
+ */
+void pzp_use_hugetlb(int enable)
+{
+    pzp_set_allocator(enable ? &pzp_hugetlb_allocator : NULL);
+}
+
+/*
+ * pzp_info_file — read only the header of a .pzp file.
+ * Returns 1 on success, 0 on failure.
+ */
+int pzp_info_file(
+        const char   *filename,
+        unsigned int *width,
+        unsigned int *height,
+        unsigned int *bpp_ext,
+        unsigned int *channels_ext,
+        unsigned int *bpp_int,
+        unsigned int *channels_int,
+        unsigned int *configuration)
+{
+    return pzp_read_header(filename,
+                           width, height,
+                           bpp_ext, channels_ext,
+                           bpp_int, channels_int,
+                           configuration);
+}
+
+/*
+ * pzp_store_view — pixels of a file held in memory (e.g. mapped from tmpfs)
+ * that was written with USE_STORE and no filters, used in place: returns the
+ * byte offset of the interleaved 8-bit pixels inside data, or -1 if the frame
+ * is not stored that way and has to be decoded.  The checksum is not verified.
+ */
+long long pzp_store_view(
+        const void   *data,
+        size_t        size,
+        unsigned int *width,
+        unsigned int *height,
+        unsigned int *channels)
+{
+    const unsigned char *pixels = pzp_store_view_from_memory(data, size, width, height, channels);
+    return (pixels != NULL) ? (long long) (pixels - (const unsigned char *) data) : -1;
+}
+
+/*
+ * pzp_decompress_file_to_tensor — decode a .pzp file into a caller-owned tensor.
+ *
+ * data/capacity: destination buffer and its size in bytes.
+ * batch_index  : the image is written to slot batch_index, each slot holding
+ *                one channels*height*width image (fills an NCHW / NHWC batch).
+ * layout       : 0 = HWC, 1 = CHW.
+ * type         : 0 = uint8, 1 = uint16 (native order), 2 = float32, 3 = float16.
+ * scale/offset : float types only, out = value * scale[c] + offset[c].
+ *                scale_count values each; 1 broadcasts to every channel,
+ *                0 (or NULL) means scale 1 and offset 0.
+ *
+ * Returns 1 on success, 0 on failure.
+ */
+int pzp_decompress_file_to_tensor(
+        const char   *filename,
+        void         *data,
+        size_t        capacity,
+        unsigned int  batch_index,
+        unsigned int  layout,
+        unsigned int  type,
+        const float  *scale,
+        const float  *offset,
+        unsigned int  scale_count,
+        unsigned int *width,
+        unsigned int *height,
+        unsigned int *bpp_ext,
+        unsigned int *channels_ext,
+        unsigned int *configuration)
+{
+    if (scale_count > PZP_TENSOR_MAX_CHANNELS)
+        return 0;
+
+    struct pzp_tensor tensor;
+    pzp_tensor_init(&tensor, data, capacity, (PZPTensorType) type, (PZPTensorLayout) layout);
+    tensor.batchIndex = batch_index;
+
+    for (unsigned int c = 0; c < PZP_TENSOR_MAX_CHANNELS && scale_count > 0; c++)
+    {
+        unsigned int source = (scale_count == 1) ? 0 : c;
+        if (source >= scale_count) break;
+        if (scale)  tensor.scale[c]  = scale[source];
+        if (offset) tensor.offset[c] = offset[source];
+    }
+
+    return pzp_decompress_to_tensor(filename, &tensor,
+                                    width, height,
+                                    bpp_ext, channels_ext,
+                                    configuration);
 }
 
 /*
@@ -52,38 +199,198 @@ int pzp_compress_file(
         unsigned int configuration,
         const char   *output_filename)
 {
-    if (!pixels || !output_filename || width == 0 || height == 0
-            || (bpp != 8 && bpp != 16) || channels == 0)
+    return pzp_compress_interleaved(pixels, 0, width, height, bpp, channels, configuration & ~USE_NEAR_LOSSLESS, 0, output_filename);
+}
+
+/*
+ * pzp_compress_file_native16 — like pzp_compress_file for 16-bit images held
+ * as native-endian uint16 values ([ch0, ch1, …] per pixel), e.g. a numpy
+ * uint16 array passed by pointer.  No byte-order conversion is needed first.
+ *
+ * Returns 1 on success, 0 on failure.
+ */
+int pzp_compress_file_native16(
+        const unsigned short *pixels,
+        unsigned int width,
+        unsigned int height,
+        unsigned int channels,
+        unsigned int configuration,
+        const char   *output_filename)
+{
+    return pzp_compress_interleaved(pixels, 1, width, height, 16, channels, configuration & ~USE_NEAR_LOSSLESS, 0, output_filename);
+}
+
+/*
+ * pzp_compress_file_near — near-lossless (USE_NEAR_LOSSLESS) 16-bit encode.
+ * Every decoded sample is within ±max_error of the original; max_error 0 is
+ * lossless.  pixels are native-endian uint16 values when native16 is set,
+ * big-endian bytes as in pzp_compress_file otherwise.
+ *
+ * Returns 1 on success, 0 on failure.
+ */
+int pzp_compress_file_near(
+        const void   *pixels,
+        int           native16,
+        unsigned int  width,
+        unsigned int  height,
+        unsigned int  channels,
+        unsigned int  configuration,
+        unsigned int  max_error,
+        const char   *output_filename)
+{
+    if (max_error > PZP_NEAR_MAX_ERROR)
         return 0;
+    if (max_error > 0)
+        configuration |= USE_NEAR_LOSSLESS;
+    else
+        configuration &= ~USE_NEAR_LOSSLESS;
+    return pzp_compress_interleaved(pixels, native16, width, height, 16, channels, configuration, max_error, output_filename);
+}
 
-    // 16-bit images are split into two 8-bit internal channels per original channel.
-    unsigned int bpp_internal      = (bpp == 16) ? 8  : bpp;
-    unsigned int channels_internal = (bpp == 16) ? channels * 2 : channels;
+/*
+ * pzp_max_error_file — near-lossless bound stored in the header: decoded
+ * samples are within ±this value of the original, 0 for lossless files.
+ * Returns -1 if the header cannot be read.
+ */
+long pzp_max_error_file(const char *filename)
+{
+    return pzp_read_max_error(filename);
+}
 
-    unsigned char **buffers = malloc(channels_internal * sizeof(unsigned char *));
-    if (!buffers)
+/*
+ * Multi-layer frames: several images of one instant (e.g. RGB8 colour and
+ * 16-bit depth) in one file, each with its own bit depth, channel count and
+ * mode.  See struct pzp_layer in pzp.h.
+ *
+ * pzp_compress_file_layers   : encode `count` layers, in parallel, to one file.
+ *                              Returns 1 on success, 0 on failure.
+ * pzp_layers_file            : number of layers (1 for a plain file, 0 on error).
+ * pzp_decompress_file_layer  : decode one layer, reading only its bytes; free
+ *                              layer->pixels with pzp_free.  Returns 1 / 0.
+ * pzp_decompress_file_layers : decode every layer (up to max_layers) with one
+ *                              read.  Returns the layer count, 0 on failure.
+ */
+int pzp_compress_file_layers(const struct pzp_layer *layers, unsigned int count, const char *output_filename)
+{
+    if (!output_filename)
         return 0;
+    return pzp_compress_layers(layers, count, output_filename);
+}
+
+unsigned int pzp_layers_file(const char *filename)
+{
+    return pzp_layers(filename);
+}
+
+int pzp_decompress_file_layer(const char *filename, unsigned int layer, struct pzp_layer *output)
+{
+    return pzp_decompress_layer(filename, layer, output);
+}
+
+unsigned int pzp_decompress_file_layers(const char *filename, struct pzp_layer *outputs, unsigned int max_layers)
+{
+    return pzp_decompress_layers(filename, outputs, max_layers);
+}
+
+/*
+ * Bulk loading with read-ahead (see pzp_loader.h).
+ *
+ * pzp_bulk_open     : start reading `count` files, keeping `depth` reads in
+ *                     flight (0 = default).  filenames must stay valid until
+ *                     pzp_bulk_close.  Returns NULL on failure.
+ * pzp_bulk_next     : decode the next file whose read has finished.  Returns 1
+ *                     and sets *index / *pixels (NULL if that file failed to
+ *                     read or decode; free with pzp_free), or 0 when all files
+ *                     have been returned.  Files arrive in completion order.
+ * pzp_bulk_backend  : 1 = io_uring, 2 = pread thread pool.
+ * pzp_bulk_close    : cancel outstanding reads and release the loader.
+ */
+void *pzp_bulk_open(const char **filenames, unsigned int count, unsigned int depth)
+{
+    return pzp_loader_open(filenames, count, depth, PZP_LOADER_AUTO);
+}
 
-    for (unsigned int ch = 0; ch < channels_internal; ch++)
+int pzp_bulk_next(
+        void         *loader,
+        unsigned int *index,
+        unsigned char **pixels,
+        unsigned int *width,
+        unsigned int *height,
+        unsigned int *bpp_ext,
+        unsigned int *channels_ext,
+        unsigned int *bpp_int,
+        unsigned int *channels_int,
+        unsigned int *configuration)
+{
+    struct pzp_loaded_file file;
+    if (!pixels || !pzp_loader_next((struct pzp_loader *) loader, &file))
+        return 0;
+
+    if (index) *index = file.index;
+    *pixels = NULL;
+
+    if (file.data)
     {
-        buffers[ch] = malloc(width * height * sizeof(unsigned char));
-        if (!buffers[ch])
-        {
-            for (unsigned int j = 0; j < ch; j++) free(buffers[j]);
-            free(buffers);
-            return 0;
-        }
+        *pixels = pzp_decompress_combined_from_memory(file.data, file.size,
+                                                      width, height,
+                                                      bpp_ext, channels_ext,
+                                                      bpp_int, channels_int,
+                                                      configuration);
+        free(file.data);
     }
+    return 1;
+}
 
-    pzp_split_channels(pixels, buffers, channels_internal, width, height);
+int pzp_bulk_backend(void *loader)
+{
+    return loader ? ((struct pzp_loader *) loader)->backend : 0;
+}
 
-    // RLE filter and palette encoding are handled inside pzp_compress_combined.
-    pzp_compress_combined(buffers, width, height,
-                          bpp, channels,
-                          bpp_internal, channels_internal,
-                          configuration, output_filename);
+void pzp_bulk_close(void *loader)
+{
+    pzp_loader_close((struct pzp_loader *) loader);
+}
 
-    for (unsigned int ch = 0; ch < channels_internal; ch++) free(buffers[ch]);
-    free(buffers);
-    return 1;
+/*
+ * Decoded-frame cache in POSIX shared memory (see pzp_cache.h).
+ *
+ * pzp_shared_cache_open    : create or attach segment `name` ("/pzp-cache")
+ *                            with a `budget` byte data region and room for
+ *                            `entries` frames (0 = default).  NULL on failure.
+ * pzp_shared_cache_get     : view of the decoded frame of a file (HWC, 16-bit
+ *                            native-endian), decoded into the segment on a
+ *                            miss.  Returns 1, or 0 if it cannot be decoded.
+ * pzp_shared_cache_release : unpin a view; its pixels must not be used after.
+ * pzp_shared_cache_stats   : segment-wide counters.
+ * pzp_shared_cache_close   : detach this process.
+ * pzp_shared_cache_unlink  : remove the segment once every process detached.
+ */
+void *pzp_shared_cache_open(const char *name, size_t budget, unsigned int entries)
+{
+    return pzp_cache_open(name, budget, entries);
+}
+
+int pzp_shared_cache_get(void *cache, const char *filename, struct pzp_cache_view *view)
+{
+    return pzp_cache_get((struct pzp_cache *) cache, filename, view);
+}
+
+void pzp_shared_cache_release(void *cache, struct pzp_cache_view *view)
+{
+    pzp_cache_release((struct pzp_cache *) cache, view);
+}
+
+void pzp_shared_cache_stats(void *cache, struct pzp_cache_stats *stats)
+{
+    pzp_cache_get_stats((struct pzp_cache *) cache, stats);
+}
+
+void pzp_shared_cache_close(void *cache)
+{
+    pzp_cache_close((struct pzp_cache *) cache);
+}
+
+int pzp_shared_cache_unlink(const char *name)
+{
+    return pzp_cache_unlink(name);
 }
@@ -0,0 +1,578 @@
+/*
+PZP Portable Zipped PNM
+Copyright (C) 2025 Ammar Qammaz
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Asynchronous read-ahead for bulk loading many .pzp files.
+ *
+ * pzp_loader_open() takes a list of files and keeps up to `depth` reads in
+ * flight; pzp_loader_next() hands back whichever file finished first, so
+ * the caller can decode one file while the following ones are still being
+ * read.  Reads are submitted through io_uring (raw syscalls, no liburing)
+ * and fall back to a small pool of threads doing pread() when io_uring is
+ * not available (old kernel, seccomp, non-Linux).
+ *
+ * Files come back in completion order, not list order; pzp_loaded_file.index
+ * says which entry of the list each buffer belongs to.  Buffers are
+ * malloc'ed and owned by the caller.
+ */
+
+#ifndef PZP_LOADER_H_INCLUDED
+#define PZP_LOADER_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define PZP_LOADER_IO_URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifndef PZP_LOADER_IO_URING
+#define PZP_LOADER_IO_URING 0
+#endif
+
+#define PZP_LOADER_DEFAULT_DEPTH 16
+#define PZP_LOADER_MAX_DEPTH     256
+#define PZP_LOADER_MAX_THREADS   8
+#define PZP_LOADER_MAX_READ      (1u << 30) // single read request, keeps io_uring's 32-bit length happy
+
+typedef enum
+{
+    PZP_LOADER_AUTO = 0,     // io_uring when the kernel allows it, otherwise the thread pool
+    PZP_LOADER_IO_URING_ONLY,
+    PZP_LOADER_THREADPOOL
+} PZPLoaderBackend;
+
+struct pzp_loaded_file
+{
+    unsigned int   index;  // position in the file list given to pzp_loader_open
+    unsigned char *data;   // whole file, caller frees; NULL on error or empty file
+    size_t         size;
+    int            error;  // 0 or an errno value
+};
+
+struct pzp_loader_slot
+{
+    int            fd;
+    unsigned int   index;
+    unsigned char *data;
+    size_t         size;
+    size_t         done;
+};
+
+struct pzp_loader
+{
+    const char   **filenames;
+    unsigned int   count;
+    unsigned int   depth;
+    unsigned int   nextFile;   // next file to start reading
+    unsigned int   delivered;  // files handed to the caller
+    int            backend;    // PZP_LOADER_IO_URING_ONLY or PZP_LOADER_THREADPOOL once opened
+
+#if PZP_LOADER_IO_URING
+    // ── io_uring state ──
+    int            ring;
+    void          *sqRing, *cqRing;
+    size_t         sqRingSize, cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t         sqesSize;
+    unsigned int  *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned int  *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned int   pending;    // sqes queued but not yet passed to io_uring_enter
+    unsigned int   inFlight;
+    struct pzp_loader_slot *slots;
+    unsigned int  *freeSlots;
+    unsigned int   freeCount;
+#endif
+
+    // ── thread pool state ──
+    pthread_t      threads[PZP_LOADER_MAX_THREADS];
+    unsigned int   threadCount;
+    pthread_mutex_t lock;
+    pthread_cond_t canRead, hasResult;
+    unsigned int   ahead;      // files claimed by workers but not yet delivered
+    struct pzp_loaded_file *ready; // ring of `depth` finished files
+    unsigned int   readyHead, readyCount;
+    int            stop;
+};
+
+// ────────────────────────────────────────────────────────────────────────────
+
+// Open a file and allocate a buffer for its whole contents.
+// Returns 0 on success, or an errno value.
+static int pzp_loader_prepare(const char *filename, int *fd, unsigned char **data, size_t *size)
+{
+    *fd = -1; *data = NULL; *size = 0;
+
+    int f = open(filename, O_RDONLY);
+    if (f < 0) { return errno; }
+
+    struct stat st;
+    if (fstat(f, &st) != 0) { int e = errno; close(f); return e; }
+
+    if (st.st_size > 0)
+    {
+        *data = (unsigned char *) malloc((size_t) st.st_size);
+        if (*data == NULL) { close(f); return ENOMEM; }
+    }
+
+    *fd   = f;
+    *size = (size_t) st.st_size;
+    return 0;
+}
+
+// Blocking read of data[done..size) at the matching file offset.
+static int pzp_loader_pread_all(int fd, unsigned char *data, size_t done, size_t size)
+{
+    while (done < size)
+    {
+        size_t  want = size - done;
+        if (want > PZP_LOADER_MAX_READ) { want = PZP_LOADER_MAX_READ; }
+        ssize_t got = pread(fd, data + done, want, (off_t) done);
+        if (got < 0)
+        {
+            if (errno == EINTR) { continue; }
+            return errno;
+        }
+        if (got == 0) { return EIO; } // file shrank under us
+        done += (size_t) got;
+    }
+    return 0;
+}
+
+static void pzp_loader_read_whole(const char *filename, unsigned int index, struct pzp_loaded_file *out)
+{
+    int fd;
+    out->index = index;
+    out->error = pzp_loader_prepare(filename, &fd, &out->data, &out->size);
+    if (out->error) { return; }
+
+    out->error = pzp_loader_pread_all(fd, out->data, 0, out->size);
+    close(fd);
+    if (out->error) { free(out->data); out->data = NULL; out->size = 0; }
+}
+
+//----------------------------------------------------------------------------------------
+//                                 Thread pool backend
+//----------------------------------------------------------------------------------------
+
+static void * pzp_loader_worker(void *arg)
+{
+    struct pzp_loader *loader = (struct pzp_loader *) arg;
+
+    pthread_mutex_lock(&loader->lock);
+    for (;;)
+    {
+        while (!loader->stop && loader->nextFile < loader->count && loader->ahead >= loader->depth)
+            { pthread_cond_wait(&loader->canRead, &loader->lock); }
+
+        if (loader->stop || loader->nextFile >= loader->count) { break; }
+
+        unsigned int index = loader->nextFile++;
+        loader->ahead++;
+        pthread_mutex_unlock(&loader->lock);
+
+        struct pzp_loaded_file file;
+        pzp_loader_read_whole(loader->filenames[index], index, &file);
+
+        pthread_mutex_lock(&loader->lock);
+        // ahead <= depth, so the ready ring always has room
+        loader->ready[(loader->readyHead + loader->readyCount) % loader->depth] = file;
+        loader->readyCount++;
+        pthread_cond_signal(&loader->hasResult);
+    }
+    pthread_mutex_unlock(&loader->lock);
+    return NULL;
+}
+
+static int pzp_loader_pool_start(struct pzp_loader *loader)
+{
+    loader->ready = (struct pzp_loaded_file *) calloc(loader->depth, sizeof(struct pzp_loaded_file));
+    if (loader->ready == NULL) { return 0; }
+
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->canRead, NULL);
+    pthread_cond_init(&loader->hasResult, NULL);
+
+    unsigned int threads = loader->depth;
+    if (threads > PZP_LOADER_MAX_THREADS) { threads = PZP_LOADER_MAX_THREADS; }
+    if (threads > loader->count)          { threads = loader->count; }
+
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&loader->threads[i], NULL, pzp_loader_worker, loader) != 0) { break; }
+        loader->threadCount++;
+    }
+
+    if ( (loader->threadCount == 0) && (loader->count > 0) )
+    {
+        fprintf(stderr, "pzp_loader: could not start any reader thread\n");
+        pthread_cond_destroy(&loader->hasResult);
+        pthread_cond_destroy(&loader->canRead);
+        pthread_mutex_destroy(&loader->lock);
+        free(loader->ready);
+        loader->ready = NULL;
+        return 0;
+    }
+
+    loader->backend = PZP_LOADER_THREADPOOL;
+    return 1;
+}
+
+static void pzp_loader_pool_next(struct pzp_loader *loader, struct pzp_loaded_file *out)
+{
+    pthread_mutex_lock(&loader->lock);
+    while (loader->readyCount == 0)
+        { pthread_cond_wait(&loader->hasResult, &loader->lock); }
+
+    *out = loader->ready[loader->readyHead];
+    loader->readyHead = (loader->readyHead + 1) % loader->depth;
+    loader->readyCount--;
+    loader->ahead--;
+    pthread_cond_signal(&loader->canRead);
+    pthread_mutex_unlock(&loader->lock);
+}
+
+static void pzp_loader_pool_stop(struct pzp_loader *loader)
+{
+    pthread_mutex_lock(&loader->lock);
+    loader->stop = 1;
+    pthread_cond_broadcast(&loader->canRead);
+    pthread_mutex_unlock(&loader->lock);
+
+    for (unsigned int i = 0; i < loader->threadCount; i++)
+        { pthread_join(loader->threads[i], NULL); }
+
+    // Files read ahead that the caller never asked for
+    for (unsigned int i = 0; i < loader->readyCount; i++)
+        { free(loader->ready[(loader->readyHead + i) % loader->depth].data); }
+
+    pthread_cond_destroy(&loader->hasResult);
+    pthread_cond_destroy(&loader->canRead);
+    pthread_mutex_destroy(&loader->lock);
+    free(loader->ready);
+}
+
+//----------------------------------------------------------------------------------------
+//                                   io_uring backend
+//----------------------------------------------------------------------------------------
+#if PZP_LOADER_IO_URING
+
+static void pzp_loader_uring_release(struct pzp_loader *loader)
+{
+    if (loader->sqes)                                        { munmap(loader->sqes, loader->sqesSize); }
+    if (loader->cqRing && loader->cqRing != loader->sqRing)  { munmap(loader->cqRing, loader->cqRingSize); }
+    if (loader->sqRing)                                      { munmap(loader->sqRing, loader->sqRingSize); }
+    if (loader->ring >= 0)                                   { close(loader->ring); }
+    free(loader->slots);
+    free(loader->freeSlots);
+    loader->sqes = NULL; loader->sqRing = loader->cqRing = NULL;
+    loader->slots = NULL; loader->freeSlots = NULL;
+    loader->ring = -1;
+}
+
+static int pzp_loader_uring_start(struct pzp_loader *loader)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    loader->ring = (int) syscall(__NR_io_uring_setup, loader->depth, &params);
+    if (loader->ring < 0) { return 0; }
+
+    // ── Step 1: map the submission / completion rings and the sqe array ──
+    loader->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    loader->cqRingSize = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (loader->cqRingSize > loader->sqRingSize) { loader->sqRingSize = loader->cqRingSize; }
+        loader->cqRingSize = loader->sqRingSize;
+    }
+
+    loader->sqRing = mmap(NULL, loader->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, loader->ring, IORING_OFF_SQ_RING);
+    if (loader->sqRing == MAP_FAILED) { loader->sqRing = NULL; pzp_loader_uring_release(loader); return 0; }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        loader->cqRing = loader->sqRing;
+    } else
+    {
+        loader->cqRing = mmap(NULL, loader->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, loader->ring, IORING_OFF_CQ_RING);
+        if (loader->cqRing == MAP_FAILED) { loader->cqRing = NULL; pzp_loader_uring_release(loader); return 0; }
+    }
+
+    loader->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    loader->sqes = (struct io_uring_sqe *) mmap(NULL, loader->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, loader->ring, IORING_OFF_SQES);
+    if (loader->sqes == MAP_FAILED) { loader->sqes = NULL; pzp_loader_uring_release(loader); return 0; }
+
+    unsigned char *sq = (unsigned char *) loader->sqRing;
+    unsigned char *cq = (unsigned char *) loader->cqRing;
+    loader->sqHead  = (unsigned int *) (sq + params.sq_off.head);
+    loader->sqTail  = (unsigned int *) (sq + params.sq_off.tail);
+    loader->sqMask  = (unsigned int *) (sq + params.sq_off.ring_mask);
+    loader->sqArray = (unsigned int *) (sq + params.sq_off.array);
+    loader->cqHead  = (unsigned int *) (cq + params.cq_off.head);
+    loader->cqTail  = (unsigned int *) (cq + params.cq_off.tail);
+    loader->cqMask  = (unsigned int *) (cq + params.cq_off.ring_mask);
+    loader->cqes    = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    // ── Step 2: one slot per read kept in flight ──
+    loader->slots     = (struct pzp_loader_slot *) calloc(loader->depth, sizeof(struct pzp_loader_slot));
+    loader->freeSlots = (unsigned int *) malloc(loader->depth * sizeof(unsigned int));
+    if (!loader->slots || !loader->freeSlots) { pzp_loader_uring_release(loader); return 0; }
+
+    for (unsigned int i = 0; i < loader->depth; i++) { loader->freeSlots[i] = loader->depth - 1 - i; }
+    loader->freeCount = loader->depth;
+
+    loader->backend = PZP_LOADER_IO_URING_ONLY;
+    return 1;
+}
+
+// Queue a read for the part of the slot's file that has not arrived yet.
+static void pzp_loader_uring_queue(struct pzp_loader *loader, unsigned int slotID)
+{
+    struct pzp_loader_slot *slot = &loader->slots[slotID];
+
+    unsigned int tail  = *loader->sqTail;
+    unsigned int entry = tail & *loader->sqMask;
+    struct io_uring_sqe *sqe = &loader->sqes[entry];
+
+    size_t want = slot->size - slot->done;
+    if (want > PZP_LOADER_MAX_READ) { want = PZP_LOADER_MAX_READ; }
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = slot->fd;
+    sqe->addr      = (unsigned long long) (uintptr_t) (slot->data + slot->done);
+    sqe->len       = (unsigned int) want;
+    sqe->off       = (unsigned long long) slot->done;
+    sqe->user_data = slotID;
+
+    loader->sqArray[entry] = entry;
+    __atomic_store_n(loader->sqTail, tail + 1, __ATOMIC_RELEASE);
+    loader->pending++;
+}
+
+static void pzp_loader_uring_finish(struct pzp_loader *loader, unsigned int slotID, int error, struct pzp_loaded_file *out)
+{
+    struct pzp_loader_slot *slot = &loader->slots[slotID];
+    close(slot->fd);
+
+    out->index = slot->index;
+    out->data  = slot->data;
+    out->size  = slot->size;
+    out->error = error;
+    if (error) { free(out->data); out->data = NULL; out->size = 0; }
+
+    loader->freeSlots[loader->freeCount++] = slotID;
+}
+
+static void pzp_loader_uring_next(struct pzp_loader *loader, struct pzp_loaded_file *out)
+{
+    for (;;)
+    {
+        // ── Step 1: top up the queue to `depth` reads ──
+        while ( (loader->freeCount > 0) && (loader->nextFile < loader->count) )
+        {
+            unsigned int index = loader->nextFile++;
+            unsigned int slotID = loader->freeSlots[loader->freeCount - 1];
+            struct pzp_loader_slot *slot = &loader->slots[slotID];
+
+            int error = pzp_loader_prepare(loader->filenames[index], &slot->fd, &slot->data, &slot->size);
+            if ( (error) || (slot->size == 0) )
+            {
+                if (slot->fd >= 0) { close(slot->fd); }
+                out->index = index; out->data = NULL; out->size = 0; out->error = error;
+                return;
+            }
+
+            loader->freeCount--;
+            slot->index = index;
+            slot->done  = 0;
+            pzp_loader_uring_queue(loader, slotID);
+            loader->inFlight++;
+        }
+
+        // ── Step 2: reap a completion, or submit and wait for one ──
+        unsigned int head = *loader->cqHead;
+        if (head == __atomic_load_n(loader->cqTail, __ATOMIC_ACQUIRE))
+        {
+            int rc = (int) syscall(__NR_io_uring_enter, loader->ring, loader->pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (rc < 0)
+            {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) { continue; }
+                fprintf(stderr, "pzp_loader: io_uring_enter failed (%d)\n", errno);
+                rc = 0;
+            }
+            loader->pending -= ((unsigned int) rc < loader->pending) ? (unsigned int) rc : loader->pending;
+            continue;
+        }
+
+        struct io_uring_cqe *cqe = &loader->cqes[head & *loader->cqMask];
+        unsigned int slotID = (unsigned int) cqe->user_data;
+        int          res    = cqe->res;
+        __atomic_store_n(loader->cqHead, head + 1, __ATOMIC_RELEASE);
+
+        struct pzp_loader_slot *slot = &loader->slots[slotID];
+        if (res > 0)
+        {
+            slot->done += (size_t) res;
+            if (slot->done < slot->size) { pzp_loader_uring_queue(loader, slotID); continue; } // short read
+            loader->inFlight--;
+            pzp_loader_uring_finish(loader, slotID, 0, out);
+            return;
+        }
+
+        if ( (res == -EINTR) || (res == -EAGAIN) ) { pzp_loader_uring_queue(loader, slotID); continue; }
+
+        // EOF before the fstat size, or the kernel refused the read (e.g. IORING_OP_READ
+        // predates it): finish the file with plain pread() so the caller still gets it.
+        loader->inFlight--;
+        int error = (res == 0) ? EIO : pzp_loader_pread_all(slot->fd, slot->data, slot->done, slot->size);
+        pzp_loader_uring_finish(loader, slotID, error, out);
+        return;
+    }
+}
+
+static void pzp_loader_uring_stop(struct pzp_loader *loader)
+{
+    // Buffers are still referenced by the kernel until their reads complete
+    while (loader->inFlight > 0)
+    {
+        unsigned int head = *loader->cqHead;
+        if (head == __atomic_load_n(loader->cqTail, __ATOMIC_ACQUIRE))
+        {
+            int rc = (int) syscall(__NR_io_uring_enter, loader->ring, loader->pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) { break; }
+            if (rc > 0) { loader->pending -= ((unsigned int) rc < loader->pending) ? (unsigned int) rc : loader->pending; }
+            continue;
+        }
+
+        struct pzp_loader_slot *slot = &loader->slots[loader->cqes[head & *loader->cqMask].user_data];
+        __atomic_store_n(loader->cqHead, head + 1, __ATOMIC_RELEASE);
+        close(slot->fd);
+        free(slot->data);
+        loader->inFlight--;
+    }
+    pzp_loader_uring_release(loader);
+}
+
+#endif // PZP_LOADER_IO_URING
+
+//----------------------------------------------------------------------------------------
+//                                      Public API
+//----------------------------------------------------------------------------------------
+
+/*
+ * filenames must stay valid until pzp_loader_close().  depth is the number of
+ * reads kept in flight (0 = PZP_LOADER_DEFAULT_DEPTH).
+ */
+static struct pzp_loader * pzp_loader_open(const char **filenames, unsigned int count, unsigned int depth, PZPLoaderBackend backend)
+{
+    if ( (filenames == NULL) && (count > 0) ) { return NULL; }
+
+    struct pzp_loader *loader = (struct pzp_loader *) calloc(1, sizeof(struct pzp_loader));
+    if (loader == NULL) { return NULL; }
+
+    if (depth == 0)                    { depth = PZP_LOADER_DEFAULT_DEPTH; }
+    if (depth > PZP_LOADER_MAX_DEPTH)  { depth = PZP_LOADER_MAX_DEPTH; }
+
+    loader->filenames = filenames;
+    loader->count     = count;
+    loader->depth     = depth;
+
+#if PZP_LOADER_IO_URING
+    loader->ring = -1;
+    if (backend != PZP_LOADER_THREADPOOL)
+    {
+        if (pzp_loader_uring_start(loader)) { return loader; }
+        if (backend == PZP_LOADER_IO_URING_ONLY)
+        {
+            fprintf(stderr, "pzp_loader: io_uring is not available\n");
+            free(loader);
+            return NULL;
+        }
+    }
+#else
+    if (backend == PZP_LOADER_IO_URING_ONLY)
+    {
+        fprintf(stderr, "pzp_loader: built without io_uring support\n");
+        free(loader);
+        return NULL;
+    }
+#endif
+
+    if (pzp_loader_pool_start(loader)) { return loader; }
+
+    free(loader);
+    return NULL;
+}
+
+/*
+ * Waits for the next finished read.  Returns 1 and fills `out` (check
+ * out->error), or 0 once every file has been handed out.
+ */
+static int pzp_loader_next(struct pzp_loader *loader, struct pzp_loaded_file *out)
+{
+    if ( (loader == NULL) || (out == NULL) || (loader->delivered >= loader->count) ) { return 0; }
+
+#if PZP_LOADER_IO_URING
+    if (loader->backend == PZP_LOADER_IO_URING_ONLY) { pzp_loader_uring_next(loader, out); }
+      else
+#endif
+    pzp_loader_pool_next(loader, out);
+
+    loader->delivered++;
+    return 1;
+}
+
+// Cancels outstanding read-ahead and frees everything not handed out yet.
+static void pzp_loader_close(struct pzp_loader *loader)
+{
+    if (loader == NULL) { return; }
+
+#if PZP_LOADER_IO_URING
+    if (loader->backend == PZP_LOADER_IO_URING_ONLY) { pzp_loader_uring_stop(loader); }
+      else
+#endif
+    pzp_loader_pool_stop(loader);
+
+    free(loader);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
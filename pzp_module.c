@@ -0,0 +1,271 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "pzp.h"
+
+/*
+ * pzp._native — CPython extension module for the pzp package.
+ *
+ * The same codec calls as libpzp.so, without the ctypes marshalling: paths and
+ * pixel buffers are taken through the buffer protocol, the decode target (a
+ * numpy array, allocated by a callable the caller passes) is filled in place,
+ * and the GIL is released around all file I/O and coding, so Python threads
+ * decoding different files run on different cores.
+ *
+ * Built by setup.py (build_ext) next to libpzp.so; src/pzp/__init__.py falls
+ * back to ctypes when it is missing.  Needs no numpy at build time.
+ */
+
+/* scale / offset sequence (or None) → up to PZP_TENSOR_MAX_CHANNELS floats.
+   Returns the count, -1 with an exception set on error. */
+static int pzp_native_floats(PyObject *sequence, float values[PZP_TENSOR_MAX_CHANNELS], const char *what)
+{
+    if (sequence == Py_None)
+        return 0;
+
+    PyObject *fast = PySequence_Fast(sequence, "pzp: scale and offset must be sequences of floats");
+    if (!fast)
+        return -1;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(fast);
+    if (count > PZP_TENSOR_MAX_CHANNELS)
+    {
+        Py_DECREF(fast);
+        PyErr_Format(PyExc_ValueError, "pzp: at most %d %s values", PZP_TENSOR_MAX_CHANNELS, what);
+        return -1;
+    }
+
+    for (Py_ssize_t i = 0; i < count; i++)
+    {
+        double value = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(fast, i));
+        if ( (value == -1.0) && (PyErr_Occurred()) )
+        {
+            Py_DECREF(fast);
+            return -1;
+        }
+        values[i] = (float) value;
+    }
+
+    Py_DECREF(fast);
+    return (int) count;
+}
+
+PyDoc_STRVAR(pzp_native_decode_doc,
+"decode(filename, target, index=0, layout=0, type=-1, scale=None, offset=None)\n"
+"--\n\n"
+"Decode a .pzp file into slot `index` of a writable C-contiguous buffer.\n"
+"target is that buffer, or a callable(height, width, channels, bpp) returning\n"
+"one, called once the header is known.  layout 0 = HWC, 1 = CHW; type 0-3 as in\n"
+"pzp_decompress_file_to_tensor, -1 for the image's own uint8 / uint16.\n"
+"Returns (buffer, width, height, bpp, channels, configuration).");
+
+static PyObject *pzp_native_decode(PyObject *Py_UNUSED(self), PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"filename", "target", "index", "layout", "type", "scale", "offset", NULL};
+
+    PyObject    *path   = NULL;
+    PyObject    *target = NULL;
+    unsigned int index  = 0, layout = 0;
+    int          type   = -1;
+    PyObject    *scaleSequence = Py_None, *offsetSequence = Py_None;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&O|IIiOO", keywords,
+                                     PyUnicode_FSConverter, &path, &target,
+                                     &index, &layout, &type, &scaleSequence, &offsetSequence))
+        return NULL;
+
+    float scale[PZP_TENSOR_MAX_CHANNELS], offset[PZP_TENSOR_MAX_CHANNELS];
+    int   scaleCount  = pzp_native_floats(scaleSequence,  scale,  "scale");
+    int   offsetCount = (scaleCount < 0) ? -1 : pzp_native_floats(offsetSequence, offset, "offset");
+    if ( (offsetCount < 0) || (layout > PZP_LAYOUT_CHW) || (type > (int) PZP_TENSOR_FLOAT16) )
+    {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_ValueError, "pzp: unknown tensor layout or type");
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    const char  *filename = PyBytes_AS_STRING(path);
+    size_t       fileSize = 0;
+    void        *fileData = NULL;
+    unsigned int width = 0, height = 0, bpp = 0, channels = 0, bppInternal = 0, channelsInternal = 0, configuration = 0;
+    int          ok = 0;
+
+    Py_BEGIN_ALLOW_THREADS
+    fileData = pzp_read_file_to_memory(filename, &fileSize);
+    ok = (fileData != NULL) &&
+         pzp_read_header_from_memory(fileData, fileSize, &width, &height, &bpp, &channels,
+                                     &bppInternal, &channelsInternal, &configuration);
+    Py_END_ALLOW_THREADS
+
+    if (!ok)
+    {
+        PyErr_Format(PyExc_RuntimeError, "pzp: failed to decompress '%s'", filename);
+        pzp_dealloc(fileData);
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    if (type < 0)
+    {
+        if ( (bpp != 8) && (bpp != 16) )
+        {
+            PyErr_Format(PyExc_ValueError, "pzp: unsupported bit depth %u", bpp);
+            pzp_dealloc(fileData);
+            Py_DECREF(path);
+            return NULL;
+        }
+        type = (bpp == 16) ? PZP_TENSOR_UINT16 : PZP_TENSOR_UINT8;
+    }
+
+    PyObject *output = PyCallable_Check(target)
+                     ? PyObject_CallFunction(target, "IIII", height, width, channels, bpp)
+                     : (Py_INCREF(target), target);
+
+    Py_buffer buffer;
+    if ( (!output) || (PyObject_GetBuffer(output, &buffer, PyBUF_CONTIG) != 0) )
+    {
+        Py_XDECREF(output);
+        pzp_dealloc(fileData);
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    struct pzp_tensor tensor;
+    pzp_tensor_init(&tensor, buffer.buf, (size_t) buffer.len, (PZPTensorType) type, (PZPTensorLayout) layout);
+    tensor.batchIndex = index;
+
+    // A single value broadcasts to every channel, as in pzp_decompress_file_to_tensor.
+    for (int c = 0; c < PZP_TENSOR_MAX_CHANNELS; c++)
+    {
+        if ( (scaleCount  == 1) || (c < scaleCount) )  tensor.scale[c]  = scale [(scaleCount  == 1) ? 0 : c];
+        if ( (offsetCount == 1) || (c < offsetCount) ) tensor.offset[c] = offset[(offsetCount == 1) ? 0 : c];
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ok = pzp_decompress_to_tensor_from_memory(fileData, fileSize, &tensor,
+                                              &width, &height, &bpp, &channels, &configuration);
+    pzp_dealloc(fileData);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&buffer);
+    if (!ok)
+    {
+        PyErr_Format(PyExc_RuntimeError, "pzp: failed to decompress '%s'", filename);
+        Py_DECREF(output);
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    Py_DECREF(path);
+    return Py_BuildValue("(NIIIII)", output, width, height, bpp, channels, configuration);
+}
+
+PyDoc_STRVAR(pzp_native_info_doc,
+"info(filename)\n"
+"--\n\n"
+"Header of a .pzp file: (width, height, bpp, channels, bpp_internal,\n"
+"ch_internal, configuration).");
+
+static PyObject *pzp_native_info(PyObject *Py_UNUSED(self), PyObject *args)
+{
+    PyObject *path = NULL;
+    if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path))
+        return NULL;
+
+    unsigned int width = 0, height = 0, bpp = 0, channels = 0, bppInternal = 0, channelsInternal = 0, configuration = 0;
+    int ok = 0;
+
+    Py_BEGIN_ALLOW_THREADS
+    ok = pzp_read_header(PyBytes_AS_STRING(path), &width, &height, &bpp, &channels,
+                         &bppInternal, &channelsInternal, &configuration);
+    Py_END_ALLOW_THREADS
+
+    if (!ok)
+    {
+        PyErr_Format(PyExc_RuntimeError, "pzp: failed to read header of '%s'", PyBytes_AS_STRING(path));
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    Py_DECREF(path);
+    return Py_BuildValue("(IIIIIII)", width, height, bpp, channels, bppInternal, channelsInternal, configuration);
+}
+
+PyDoc_STRVAR(pzp_native_encode_doc,
+"encode(filename, pixels, width, height, bpp, channels, configuration, max_error=0, native16=0)\n"
+"--\n\n"
+"Compress interleaved pixels (any C-contiguous buffer) to a .pzp file.  16-bit\n"
+"samples are native-endian with native16, big-endian as in PNM otherwise.\n"
+"max_error > 0 selects USE_NEAR_LOSSLESS.");
+
+static PyObject *pzp_native_encode(PyObject *Py_UNUSED(self), PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"filename", "pixels", "width", "height", "bpp", "channels",
+                               "configuration", "max_error", "native16", NULL};
+
+    PyObject    *path = NULL;
+    Py_buffer    pixels;
+    unsigned int width = 0, height = 0, bpp = 0, channels = 0, configuration = 0, maxError = 0;
+    int          native16 = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&y*IIIII|Ip", keywords,
+                                     PyUnicode_FSConverter, &path, &pixels,
+                                     &width, &height, &bpp, &channels, &configuration, &maxError, &native16))
+        return NULL;
+
+    size_t expected = (size_t) width * height * channels * (bpp / 8);
+    if ( ( (bpp != 8) && (bpp != 16) ) || (maxError > PZP_NEAR_MAX_ERROR) || ( (maxError > 0) && (bpp != 16) ) ||
+         ((size_t) pixels.len != expected) )
+    {
+        PyErr_Format(PyExc_ValueError, "pzp: cannot encode %zd bytes as %ux%ux%u@%ubit (max_error %u)",
+                     pixels.len, width, height, channels, bpp, maxError);
+        PyBuffer_Release(&pixels);
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    if (maxError > 0)
+        configuration |= USE_NEAR_LOSSLESS;
+    else
+        configuration &= ~USE_NEAR_LOSSLESS;
+
+    int ok = 0;
+    Py_BEGIN_ALLOW_THREADS
+    ok = pzp_compress_interleaved(pixels.buf, native16, width, height, bpp, channels,
+                                  configuration, maxError, PyBytes_AS_STRING(path));
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&pixels);
+    if (!ok)
+    {
+        PyErr_Format(PyExc_RuntimeError, "pzp.write: compression failed for '%s'", PyBytes_AS_STRING(path));
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    Py_DECREF(path);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef pzp_native_methods[] =
+{
+    {"decode", (PyCFunction)(void(*)(void)) pzp_native_decode, METH_VARARGS | METH_KEYWORDS, pzp_native_decode_doc},
+    {"info",   pzp_native_info,                                METH_VARARGS,                 pzp_native_info_doc},
+    {"encode", (PyCFunction)(void(*)(void)) pzp_native_encode, METH_VARARGS | METH_KEYWORDS, pzp_native_encode_doc},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef pzp_native_module =
+{
+    PyModuleDef_HEAD_INIT,
+    "pzp._native",
+    "Native codec entry points of the pzp package (GIL released while coding).",
+    -1,
+    pzp_native_methods,
+    NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit__native(void)
+{
+    return PyModule_Create(&pzp_native_module);
+}
@@ -0,0 +1,74 @@
+/*
+PZP Portable Zipped PNM
+Copyright (C) 2025 Ammar Qammaz
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// pzpd: decodes .pzp files for the other processes of the node, see pzp_daemon.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <grp.h>
+
+#include "pzp_daemon.h"
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onStopSignal(int signal)
+{
+    (void) signal;
+    stopRequested = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    struct pzp_daemon_options options = { NULL, -1 };
+    int option;
+    while ( (option = getopt(argc, argv, "r:g:")) != -1 )
+    {
+        if (option == 'r') { options.root = optarg; continue; }
+        struct group *group = (option == 'g') ? getgrnam(optarg) : NULL;
+        if (group == NULL)
+        {
+            if (option == 'g') { fprintf(stderr, "Unknown group %s\n", optarg); }
+            optind = argc + 1; // print the usage
+            break;
+        }
+        options.group = (int) group->gr_gid;
+    }
+
+    if ( (argc - optind < 1) || (argc - optind > 2) )
+    {
+        fprintf(stderr, "Usage: %s [-r root] [-g group] <socket> [threads=nproc]\n", argv[0]);
+        fprintf(stderr, "       (only files below root are served; the socket is 0600, 0660 for the group)\n");
+        fprintf(stderr, "       (clients: pzp fetch <socket> <file.pzp> <output_file> [level] [x y width height])\n");
+        return EXIT_FAILURE;
+    }
+    const char *socketPath = argv[optind];
+
+    long         online  = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int threads = (argc - optind > 1) ? (unsigned int) atoi(argv[optind + 1]) : (online > 0) ? (unsigned int) online : 1;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStopSignal;
+    sigaction(SIGINT,  &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    return pzp_daemon_serve(socketPath, threads, &options, &stopRequested) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""
+checkAnalyze.py — Check what `analyze` reports: every image class gets a
+non-empty Pareto front, and every configuration it lists round-trips every
+image of the directory through the command line tool.
+
+Usage:
+    python3 scripts/checkAnalyze.py <pzp binary> <directory> <scratch dir>
+
+Runs `<pzp binary> analyze <directory> 4`, then compresses each .pnm / .ppm /
+.pgm file below <directory> with the listed mode and entropy stage (the zstd /
+LZ4 level only changes the search effort, so the default one is used),
+decompresses it and compares the samples with the original.  Uses only the
+standard library.
+
+Example:
+    python3 scripts/checkAnalyze.py ./spzp samples output
+"""
+
+import os
+import subprocess
+import sys
+
+from checkMaxError import read_pnm
+
+SUFFIXES = {"zstd": "", "lz4": "-lz4", "rans": "-rans", "store": "-store"}
+
+
+def fronts(report):
+    """Return {class title: [(mode, stage, level), ...]} from the analyze output."""
+    tables, title = {}, None
+    for line in report.splitlines():
+        if line.startswith("All images") or ("ch " in line and line.endswith(" MB")):
+            title = line
+            tables[title] = []
+        elif title is not None and line.startswith("  ") and not line.split()[0] == "mode":
+            mode, stage, level = line.split()[:3]
+            tables[title].append((mode, stage, level))
+    return tables
+
+
+def same(original, decoded):
+    """Same size, channel count and samples (maxval and header comments may differ)."""
+    w0, h0, c0, _m0, samples0 = read_pnm(original)
+    w1, h1, c1, _m1, samples1 = read_pnm(decoded)
+    return (w0, h0, c0) == (w1, h1, c1) and samples0 == samples1
+
+
+def main():
+    if len(sys.argv) != 4:
+        print(__doc__)
+        return 2
+
+    binary, directory, scratch = sys.argv[1:]
+    analyze = subprocess.run([binary, "analyze", directory, "4"], stdout=subprocess.PIPE, text=True)
+    print(analyze.stdout, end="")
+    if analyze.returncode != 0:
+        print("FAIL: analyze exited with %d" % analyze.returncode)
+        return 1
+
+    tables = fronts(analyze.stdout)
+    failures = 0
+    if not any(title.startswith("All images") for title in tables):
+        print("FAIL: no front over all images")
+        failures += 1
+    for title, rows in tables.items():
+        if not rows:
+            print("FAIL: empty front for %s" % title)
+            failures += 1
+
+    images = sorted(os.path.join(directory, name) for name in os.listdir(directory)
+                    if os.path.splitext(name)[1].lower() in (".pnm", ".ppm", ".pgm"))
+    encoded, decoded = os.path.join(scratch, "analyze.pzp"), os.path.join(scratch, "analyzeRecode.pnm")
+    commands = sorted({mode + SUFFIXES[stage] for rows in tables.values() for mode, stage, _level in rows})
+    for command in commands:
+        for image in images:
+            ok = (subprocess.run([binary, command, image, encoded]).returncode == 0 and
+                  subprocess.run([binary, "decompress", encoded, decoded]).returncode == 0 and
+                  same(image, decoded))
+            if not ok:
+                print("FAIL: %s %s does not round-trip" % (command, image))
+                failures += 1
+
+    print("%u fronts, %u listed configurations x %u images round-tripped, %u failures" %
+          (len(tables), len(commands), len(images), failures))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
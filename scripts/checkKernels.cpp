@@ -0,0 +1,83 @@
+/*
+ * checkKernels.cpp — round trips through the compile-time kernels of pzp.hpp.
+ * Noise of every Kernel<Channels, Bits, F> layout is encoded at odd sizes with
+ * pzp::Encoder and decoded back through pzp::decode and pzp::Decoder, so the
+ * unrolled / AVX2 scans are compared with the input.
+ *
+ * Built with and without INTEL_OPTIMIZATIONS by "make hpptest"; exits with
+ * status 1 if a frame differs or too few frames reached a kernel.
+ */
+
+#include "../pzp.hpp"
+
+#include <cstdio>
+#include <random>
+
+static std::minstd_rand noise(7);
+static unsigned int failures = 0, kernelFrames = 0, frames = 0;
+
+template<int Channels, int Bits, pzp::Flags F>
+static void roundTrip(unsigned int width, unsigned int height)
+{
+    using Sample = pzp::detail::Sample<Bits>;
+    std::vector<Sample> image((std::size_t) width * height * Channels);
+
+    // Full range noise on a gradient: no channel is narrow enough for range coding
+    for (std::size_t i = 0; i < image.size(); i++)
+        image[i] = (Sample) ( (i / Channels) * 7 + (noise() & ((Bits == 16) ? 0xFFFF : 0xFF)) );
+
+    pzp::Encoder encoder;
+    encoder.write<Channels, Bits, F>(image, width, height);
+    encoder.write<Channels, Bits, F>(image, width, height);
+    std::span<const std::uint8_t> file = encoder.data();
+
+    unsigned int header[10];
+    bool kernel = pzp_read_header_words_from_memory(file.data(), file.size(), header) &&
+                  pzp::Kernel<Channels, Bits, F>::matches(header);
+
+    std::vector<Sample> out(image.size());
+    pzp::FrameInfo info = pzp::decode<Channels, Bits, F>(file, out);
+    bool ok = (out == image) && (info.width == width) && (info.height == height);
+
+    // Both frames of the stream, through the same kernel state
+    pzp::Decoder decoder(file);
+    for (int frame = 0; frame < 2; frame++)
+    {
+        std::fill(out.begin(), out.end(), 0);
+        decoder.next<Channels, Bits, F>(out);
+        ok = ok && (out == image);
+    }
+    ok = ok && decoder.at_end();
+
+    frames++;
+    kernelFrames += kernel;
+    if (!ok)
+    {
+        failures++;
+        std::printf("Kernel<%d, %d, %u> %ux%u (%s): decoded pixels differ\n",
+                    Channels, Bits, F, width, height, (kernel) ? "kernel" : "generic");
+    }
+}
+
+template<int Channels, int Bits>
+static void layouts()
+{
+    static const unsigned int sizes[][2] = { { 1, 1 }, { 3, 5 }, { 17, 1 }, { 31, 33 }, { 65, 7 }, { 257, 3 }, { 300, 257 } };
+    for (const auto &size : sizes)
+    {
+        roundTrip<Channels, Bits, USE_COMPRESSION>(size[0], size[1]);
+        roundTrip<Channels, Bits, USE_COMPRESSION | USE_RLE>(size[0], size[1]);
+    }
+}
+
+int main()
+{
+    layouts<1, 8>();  layouts<2, 8>();  layouts<3, 8>();  layouts<4, 8>();
+    layouts<1, 16>(); layouts<2, 16>(); layouts<3, 16>(); layouts<4, 16>();
+
+    std::printf("%u of %u layouts decoded through a kernel, %u failed\n", kernelFrames, frames, failures);
+
+    // Every layout of a reasonably sized image must take the kernel, or it is not tested
+    if (kernelFrames < frames / 2) { std::printf("Too few frames reached the kernels\n"); return EXIT_FAILURE; }
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
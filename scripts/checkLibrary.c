@@ -0,0 +1,494 @@
+/*
+ * checkLibrary.c — round trips through the pzp.h entry points the command line
+ * tool does not reach.  Every frame is encoded from generated pixels into
+ * <scratch>/checkLibrary.pzp and decoded back, the decoded pixels are compared
+ * with the input or with the plain decode of the same file.
+ *
+ * Usage:
+ *     checkLibrary tensor    <scratch>   decode into uint8/uint16/float32/float16 HWC and CHW batch slots
+ *     checkLibrary native16  <scratch>   native-endian uint16 pixels, split and decoded back
+ *     checkLibrary allocator <scratch>   every block of a sink / context allocator and of the default returned
+ *     checkLibrary bands     <scratch>   per-band callbacks against the full decode, early stop
+ *
+ * Exits with status 1 if anything differs.  Built with and without
+ * INTEL_OPTIMIZATIONS by the tensortest, native16test, alloctest and bandtest
+ * targets of the Makefile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../pzp.h"
+
+static char         path[4096];
+static unsigned int failures = 0, checks = 0;
+static unsigned int seed = 2025;
+
+static void check(int ok, const char *name, const char *what)
+{
+    checks++;
+    if (ok) { return; }
+    failures++;
+    fprintf(stderr, "%s: %s\n", name, what);
+}
+
+static unsigned int noise(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 16;
+}
+
+/* Interleaved pixels, 16-bit samples big-endian as PNM holds them: a noisy
+   gradient with some zero depth samples, or a few flat colours for the palette
+   and run token modes. */
+static unsigned char * makeImage(unsigned int width, unsigned int height, unsigned int bits, unsigned int channels, int flat)
+{
+    size_t samples = (size_t) width * height * channels;
+    unsigned char *image = (unsigned char *) malloc(samples * (bits / 8));
+    for (size_t i = 0; (image) && (i < samples); i++)
+    {
+        unsigned int x = (unsigned int) ((i / channels) % width);
+        if (bits == 8)
+            image[i] = (unsigned char) ( (flat) ? (x / 9 % 5) * 40 + i % channels : x * 3 + (noise() & 15) );
+        else
+        {
+            unsigned int value = (noise() % 7 == 0) ? 0 : 4000 + x * 11 + (noise() & 63);
+            image[2 * i]     = (unsigned char) (value >> 8);
+            image[2 * i + 1] = (unsigned char) value;
+        }
+    }
+    return image;
+}
+
+/* Encode interleaved pixels into the scratch file and read it back, NULL on failure. */
+static unsigned char * encode(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int bits,
+                              unsigned int channels, unsigned int configuration, unsigned int maxError, size_t *size)
+{
+    unsigned int channelsInternal = (bits == 16) ? 2 * channels : channels;
+    unsigned char *buffers[8];
+    unsigned char *planes = (unsigned char *) malloc((size_t) width * height * channelsInternal);
+    if ( (!planes) || (channelsInternal > 8) ) { free(planes); return NULL; }
+    for (unsigned int ch = 0; ch < channelsInternal; ch++) { buffers[ch] = planes + (size_t) ch * width * height; }
+
+    remove(path);
+    pzp_split_channels(pixels, buffers, channelsInternal, width, height);
+    pzp_compress_combined_near(buffers, width, height, bits, channels, 8, channelsInternal,
+                               USE_COMPRESSION | configuration, maxError, path);
+    free(planes);
+    return (unsigned char *) pzp_read_file_to_memory(path, size);
+}
+
+/* The frames the tensor, allocator and band checks go through, one per storage mode */
+struct Frame
+{
+    const char  *name;
+    unsigned int bits, channels, configuration, maxError;
+    int          flat;
+};
+
+static const struct Frame frames[] =
+{
+    { "gray8",               8,  1, USE_RLE, 0, 0 },
+    { "rgb8",                8,  3, USE_RLE, 0, 0 },
+    { "rgba8",               8,  4, USE_RLE, 0, 0 },
+    { "rgb8 palette",        8,  3, USE_RLE | USE_PALETTE, 0, 1 },
+    { "gray-alpha8 palette", 8,  2, USE_PALETTE, 0, 1 },
+    { "rgb8 runs",           8,  3, USE_RUNS, 0, 1 },
+    { "depth16",             16, 1, USE_RLE, 0, 0 },
+    { "rgb16",               16, 3, USE_RLE, 0, 0 },
+    { "depth16 near",        16, 1, USE_NEAR_LOSSLESS, 2, 0 },
+    { "rgb8 rANS",           8,  3, USE_RLE | USE_RANS, 0, 0 },
+    { "depth16 LZ4",         16, 1, USE_RLE | USE_LZ4, 0, 0 },
+    { "rgb8 palette store",  8,  3, USE_RLE | USE_PALETTE | USE_STORE, 0, 1 },
+    { "rgb8 YCoCg",          8,  3, USE_RLE | USE_YCOCG, 0, 0 },
+    { "depth16 sparse",      16, 1, USE_RLE | USE_SPARSE, 0, 0 },
+};
+#define FRAME_COUNT (sizeof(frames) / sizeof(frames[0]))
+
+// ─── tensor ──────────────────────────────────────────────────────────────────
+
+static float halfToFloat(unsigned short h)
+{
+    int exponent = (h >> 10) & 0x1F, mantissa = h & 0x3FF;
+    float value = (exponent == 0) ? ldexpf((float) mantissa, -24) : ldexpf((float) (mantissa | 0x400), exponent - 25);
+    return (h & 0x8000) ? -value : value;
+}
+
+/* Decode into the middle slot of a three image batch, every type and layout, and
+   compare each element with the plain decode; the other slots stay untouched. */
+static void checkTensors(const char *name, const unsigned char *file, size_t size)
+{
+    unsigned int width = 0, height = 0, bits = 0, channels = 0, bitsInternal = 0, channelsInternal = 0, configuration = 0;
+    unsigned char *plain = pzp_decompress_combined_from_memory(file, size, &width, &height, &bits, &channels,
+                                                               &bitsInternal, &channelsInternal, &configuration);
+    check(plain != NULL, name, "the plain decode failed");
+    if (plain == NULL) { return; }
+
+    size_t pixels = (size_t) width * height, image = pixels * channels;
+    unsigned int types[3] = { (bits == 16) ? PZP_TENSOR_UINT16 : PZP_TENSOR_UINT8, PZP_TENSOR_FLOAT32, PZP_TENSOR_FLOAT16 };
+    for (unsigned int t = 0; t < 3; t++)
+        for (unsigned int layout = PZP_LAYOUT_HWC; layout <= PZP_LAYOUT_CHW; layout++)
+        {
+            size_t element = pzp_tensor_element_size(types[t]);
+            unsigned char *batch = (unsigned char *) malloc(3 * image * element);
+            if (batch == NULL) { check(0, name, "out of memory"); continue; }
+            memset(batch, 0xA5, 3 * image * element);
+
+            struct pzp_tensor tensor;
+            pzp_tensor_init(&tensor, batch, 3 * image * element, (PZPTensorType) types[t], (PZPTensorLayout) layout);
+            tensor.batchIndex = 1;
+            for (unsigned int c = 0; c < channels; c++)
+            {
+                tensor.scale[c]  = (float) (c + 1) / ((bits == 16) ? 65535.0f : 255.0f);
+                tensor.offset[c] = -0.25f * (float) c;
+            }
+
+            unsigned int w = 0, h = 0, b = 0, ch = 0, cfg = 0;
+            int ok = pzp_decompress_to_tensor_from_memory(file, size, &tensor, &w, &h, &b, &ch, &cfg) &&
+                     (w == width) && (h == height) && (ch == channels);
+
+            const unsigned char *slot = batch + image * element;
+            for (size_t i = 0; (ok) && (i < image); i++)
+            {
+                size_t c  = i % channels;
+                size_t at = (layout == PZP_LAYOUT_CHW) ? c * pixels + i / channels : i;
+                float want = (bits == 16) ? (float) ((plain[2 * i] << 8) | plain[2 * i + 1]) : (float) plain[i];
+                float got = 0.0f, tolerance = 0.0f;
+                unsigned short v;
+                switch (types[t])
+                {
+                    case PZP_TENSOR_UINT8:  got = slot[at]; break;
+                    case PZP_TENSOR_UINT16: memcpy(&v, slot + 2 * at, 2); got = v; break;
+                    case PZP_TENSOR_FLOAT32:
+                        memcpy(&got, slot + 4 * at, 4);
+                        want = want * tensor.scale[c] + tensor.offset[c];
+                        tolerance = 1e-6f;
+                        break;
+                    default:
+                        memcpy(&v, slot + 2 * at, 2);
+                        got  = halfToFloat(v);
+                        want = want * tensor.scale[c] + tensor.offset[c];
+                        tolerance = fabsf(want) / 1024.0f + 1e-7f; // half a unit in the last place of a half
+                        break;
+                }
+                ok = (fabsf(got - want) <= tolerance);
+            }
+            for (size_t i = 0; (ok) && (i < image * element); i++)
+                ok = (batch[i] == 0xA5) && (batch[2 * image * element + i] == 0xA5);
+
+            char what[64];
+            snprintf(what, sizeof(what), "tensor type %u layout %u differs from the plain decode", types[t], layout);
+            check(ok, name, what);
+            free(batch);
+        }
+    pzp_dealloc(plain);
+}
+
+static void tensorCheck(void)
+{
+    // Odd sizes leave tails to the vector loops, every frame spans several chunks
+    const unsigned int width = 1021, height = 1031;
+    for (unsigned int f = 0; f < FRAME_COUNT; f++)
+    {
+        size_t size = 0;
+        unsigned char *image = makeImage(width, height, frames[f].bits, frames[f].channels, frames[f].flat);
+        unsigned char *file  = (image) ? encode(image, width, height, frames[f].bits, frames[f].channels,
+                                                frames[f].configuration, frames[f].maxError, &size) : NULL;
+        check(file != NULL, frames[f].name, "could not be encoded");
+        if (file) { checkTensors(frames[f].name, file, size); }
+        pzp_dealloc(file);
+        free(image);
+    }
+}
+
+// ─── native16 ────────────────────────────────────────────────────────────────
+
+/* Native uint16 pixels split into the planes of their big-endian copy, and the
+   file of those planes decodes through the uint16 tensor store (HWC and CHW) to
+   the native values again. */
+static void native16Frame(unsigned int channels, unsigned int width, unsigned int height, unsigned int configuration)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%ux%ux%u mode %u", width, height, channels, configuration);
+
+    size_t pixels = (size_t) width * height, samples = pixels * channels;
+    unsigned short *native    = (unsigned short *) malloc(samples * sizeof(unsigned short));
+    unsigned char  *bigEndian = (unsigned char *)  malloc(2 * samples);
+    unsigned char  *planes    = (unsigned char *)  malloc(4 * samples);
+    unsigned short *out       = (unsigned short *) malloc(samples * sizeof(unsigned short));
+    if ( (!native) || (!bigEndian) || (!planes) || (!out) )
+    {
+        check(0, name, "out of memory");
+        free(native); free(bigEndian); free(planes); free(out);
+        return;
+    }
+    for (size_t i = 0; i < samples; i++)
+    {
+        native[i] = (noise() % 9 == 0) ? 0 : (unsigned short) (30000 + (i / channels) % width * 5 + (noise() & 0x3FF));
+        bigEndian[2 * i]     = (unsigned char) (native[i] >> 8);
+        bigEndian[2 * i + 1] = (unsigned char) native[i];
+    }
+
+    unsigned char *buffersNative[8], *buffersBig[8];
+    for (unsigned int c = 0; c < 2 * channels; c++)
+    {
+        buffersNative[c] = planes + c * pixels;
+        buffersBig[c]    = planes + (2 * channels + c) * pixels;
+    }
+    pzp_split_channels_native16(native, buffersNative, channels, width, height);
+    pzp_split_channels(bigEndian, buffersBig, 2 * channels, width, height);
+    check(memcmp(planes, planes + 2 * samples, 2 * samples) == 0, name, "native split differs from the big-endian split");
+
+    remove(path);
+    pzp_compress_combined(buffersNative, width, height, 16, channels, 8, 2 * channels, USE_COMPRESSION | configuration, path);
+    size_t size = 0;
+    unsigned char *file = (unsigned char *) pzp_read_file_to_memory(path, &size);
+    check(file != NULL, name, "could not be encoded");
+
+    for (unsigned int layout = PZP_LAYOUT_HWC; (file) && (layout <= PZP_LAYOUT_CHW); layout++)
+    {
+        memset(out, 0xA5, samples * sizeof(unsigned short));
+        struct pzp_tensor tensor;
+        pzp_tensor_init(&tensor, out, samples * sizeof(unsigned short), PZP_TENSOR_UINT16, (PZPTensorLayout) layout);
+
+        unsigned int w = 0, h = 0, bits = 0, ch = 0, cfg = 0;
+        int ok = pzp_decompress_to_tensor_from_memory(file, size, &tensor, &w, &h, &bits, &ch, &cfg) &&
+                 (w == width) && (h == height) && (bits == 16) && (ch == channels);
+        for (size_t i = 0; (ok) && (i < samples); i++)
+            ok = (out[(layout == PZP_LAYOUT_CHW) ? (i % channels) * pixels + i / channels : i] == native[i]);
+        check(ok, name, (layout == PZP_LAYOUT_HWC) ? "HWC uint16 decode differs from the input" :
+                                                    "CHW uint16 decode differs from the input");
+    }
+    pzp_dealloc(file);
+    free(native); free(bigEndian); free(planes); free(out);
+}
+
+static void native16Check(void)
+{
+    static const unsigned int sizes[][2] = { { 1, 1 }, { 15, 1 }, { 17, 3 }, { 33, 31 }, { 641, 257 } };
+    static const unsigned int modes[]    = { 0, USE_RLE, USE_RLE | USE_RANS, USE_RLE | USE_SPARSE };
+    for (unsigned int channels = 1; channels <= 4; channels++)
+        for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+            for (unsigned int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+                native16Frame(channels, sizes[s][0], sizes[s][1], modes[m]);
+}
+
+// ─── allocator ───────────────────────────────────────────────────────────────
+
+struct Counter { unsigned long allocs, frees; };
+
+static void * countingAlloc(void *user, size_t size)
+{
+    __atomic_add_fetch(&((struct Counter *) user)->allocs, 1, __ATOMIC_RELAXED);
+    return pzp_default_alloc(NULL, size);
+}
+
+static void countingFree(void *user, void *pointer)
+{
+    __atomic_add_fetch(&((struct Counter *) user)->frees, 1, __ATOMIC_RELAXED);
+    pzp_default_free(NULL, pointer);
+}
+
+/* Frames encoded into a sink and decoded through a pzp_dctx that carry their own
+   allocator, with a second one installed as the default: the own allocator must
+   get every block back and the default none.  Then pyramid levels and layers go
+   through the default, which must balance too. */
+static void allocatorCheck(void)
+{
+    struct Counter owned = { 0, 0 }, standard = { 0, 0 };
+    struct pzp_allocator ownedAllocator   = { countingAlloc, countingFree, &owned };
+    struct pzp_allocator defaultAllocator = { countingAlloc, countingFree, &standard };
+    pzp_set_allocator(&defaultAllocator);
+
+    const unsigned int width = 97, height = 61;
+    unsigned char *images[FRAME_COUNT];
+    struct pzp_sink encoded;
+    pzp_sink_memory(&encoded);
+    encoded.allocator = &ownedAllocator;
+    for (unsigned int f = 0; f < FRAME_COUNT; f++)
+    {
+        const struct Frame *frame = &frames[f];
+        unsigned int channelsInternal = (frame->bits == 16) ? 2 * frame->channels : frame->channels;
+        unsigned char *buffers[8];
+        unsigned char *planes = (unsigned char *) malloc((size_t) width * height * channelsInternal);
+        images[f] = makeImage(width, height, frame->bits, frame->channels, frame->flat);
+        if ( (!planes) || (!images[f]) ) { check(0, frame->name, "out of memory"); free(planes); continue; }
+        for (unsigned int ch = 0; ch < channelsInternal; ch++) { buffers[ch] = planes + (size_t) ch * width * height; }
+        pzp_split_channels(images[f], buffers, channelsInternal, width, height);
+        check(pzp_compress_to_sink(buffers, width, height, frame->bits, frame->channels, 8, channelsInternal,
+                                   USE_COMPRESSION | frame->configuration, frame->maxError, &encoded),
+              frame->name, "could not be encoded into the sink");
+        free(planes);
+    }
+
+    struct pzp_dctx dctx;
+    memset(&dctx, 0, sizeof(dctx));
+    dctx.allocator = &ownedAllocator;
+    struct pzp_source source;
+    pzp_source_memory(&source, encoded.data, encoded.size);
+    for (unsigned int f = 0; f < FRAME_COUNT; f++)
+    {
+        const struct Frame *frame = &frames[f];
+        unsigned int w = 0, h = 0, bits = 0, channels = 0, bitsInternal = 0, channelsInternal = 0, configuration = 0;
+        unsigned char *pixels = pzp_decompress_from_source_dctx(&dctx, &source, NULL, &w, &h, &bits, &channels,
+                                                                &bitsInternal, &channelsInternal, &configuration);
+        size_t bytes = (size_t) width * height * frame->channels * (frame->bits / 8);
+        check( (pixels != NULL) && (images[f] != NULL) && (w == width) && (h == height) &&
+               ( (frame->maxError != 0) || (memcmp(pixels, images[f], bytes) == 0) ),
+               frame->name, "decoded through the context differs from the input");
+        pzp_allocator_free(&ownedAllocator, pixels);
+    }
+    check(pzp_source_at_end(&source), "stream", "has more frames than were written");
+    pzp_source_close(&source);
+    pzp_dctx_free(&dctx);
+
+    // Layers are encoded on threads of their own, through the output's allocator
+    struct pzp_sink layered;
+    pzp_sink_memory(&layered);
+    layered.allocator = &ownedAllocator;
+    struct pzp_layer layers[2];
+    memset(layers, 0, sizeof(layers));
+    layers[0].pixels = images[1]; layers[0].configuration = USE_COMPRESSION | USE_RLE;
+    layers[1].pixels = images[3]; layers[1].configuration = USE_COMPRESSION | USE_PALETTE;
+    for (unsigned int l = 0; l < 2; l++)
+        { layers[l].width = width; layers[l].height = height; layers[l].bitsperpixel = 8; layers[l].channels = 3; }
+    check( (layers[0].pixels) && (layers[1].pixels) && (pzp_compress_layers_to_sink(layers, 2, &layered)),
+           "layers", "could not be encoded");
+
+    check(standard.allocs == 0, "default allocator", "used by a sink or context with its own");
+    check(owned.allocs > 0, "own allocator", "never used");
+
+    // ── The default takes what has no context ───────────────────────────────
+    struct pzp_sink pyramid;
+    pzp_sink_memory(&pyramid);
+    unsigned char *large = makeImage(2 * width, 2 * height, 8, 3, 0);
+    unsigned char *planes = (unsigned char *) malloc((size_t) 4 * width * height * 3);
+    if ( (large) && (planes) )
+    {
+        unsigned char *buffers[3] = { planes, planes + (size_t) 4 * width * height, planes + (size_t) 8 * width * height };
+        pzp_split_channels(large, buffers, 3, 2 * width, 2 * height);
+        pzp_compress_to_sink(buffers, 2 * width, 2 * height, 8, 3, 8, 3, USE_COMPRESSION | USE_RLE | USE_PYRAMID, 0, &pyramid);
+    }
+    unsigned int w = 0, h = 0, bits = 0, channels = 0, bitsInternal = 0, channelsInternal = 0, configuration = 0;
+    unsigned char *level = pzp_decompress_level_from_memory(pyramid.data, pyramid.size, 1, &w, &h,
+                                                            &bits, &channels, &bitsInternal, &channelsInternal, &configuration);
+    check( (level != NULL) && (w == width) && (h == height), "pyramid", "level 1 could not be decoded");
+    pzp_dealloc(level);
+    pzp_sink_release(&pyramid);
+    free(planes);
+    free(large);
+
+    struct pzp_layer decoded[2];
+    memset(decoded, 0, sizeof(decoded));
+    size_t layerBytes = (size_t) width * height * 3;
+    check( (pzp_decompress_layers_from_memory(layered.data, layered.size, decoded, 2) == 2) &&
+           (memcmp(decoded[0].pixels, images[1], layerBytes) == 0) && (memcmp(decoded[1].pixels, images[3], layerBytes) == 0),
+           "layers", "decoded through the default differ from the input");
+    for (unsigned int l = 0; l < 2; l++) { pzp_dealloc(decoded[l].pixels); }
+
+    pzp_sink_release(&layered);
+    pzp_sink_release(&encoded);
+    pzp_set_allocator(NULL);
+    for (unsigned int f = 0; f < FRAME_COUNT; f++) { free(images[f]); }
+
+    printf("own allocator: %lu allocs, %lu frees | default allocator: %lu allocs, %lu frees\n",
+           owned.allocs, owned.frees, standard.allocs, standard.frees);
+    check(owned.allocs == owned.frees, "own allocator", "did not get every block back");
+    check( (standard.allocs > 0) && (standard.allocs == standard.frees), "default allocator", "did not get every block back");
+}
+
+// ─── bands ───────────────────────────────────────────────────────────────────
+
+struct BandCollector
+{
+    unsigned char *image;     // the rows handed over so far, at their place
+    unsigned int   nextRow;   // where the next band has to start
+    unsigned int   rows;      // band height asked for
+    unsigned int   bands, stopAfter;
+    int            ordered;   // every band started at nextRow and was full but the last
+};
+
+static int collectBand(void *user, const struct pzp_band *band)
+{
+    struct BandCollector *collector = (struct BandCollector *) user;
+    unsigned int rows = (collector->rows != 0) ? collector->rows : PZP_BAND_ROWS;
+    if ( (band->firstRow != collector->nextRow) ||
+         ( (band->rowCount != rows) && (band->firstRow + band->rowCount != band->height) ) )
+        { collector->ordered = 0; }
+    memcpy(collector->image + (size_t) band->firstRow * band->rowBytes, band->rows, (size_t) band->rowCount * band->rowBytes);
+    collector->nextRow = band->firstRow + band->rowCount;
+    collector->bands++;
+    return (collector->bands != collector->stopAfter);
+}
+
+/* Bands of 0 (the default), 1, 7 and more rows than the image has must cover it in
+   order and match the full decode; a callback returning 0 ends the decode there. */
+static void bandsCheck(void)
+{
+    const unsigned int width = 1021, height = 1031;
+    static const unsigned int rows[] = { 0, 1, 7, 2000 };
+    for (unsigned int f = 0; f < FRAME_COUNT; f++)
+    {
+        const char *name = frames[f].name;
+        size_t size = 0;
+        unsigned char *image = makeImage(width, height, frames[f].bits, frames[f].channels, frames[f].flat);
+        unsigned char *file  = (image) ? encode(image, width, height, frames[f].bits, frames[f].channels,
+                                                frames[f].configuration, frames[f].maxError, &size) : NULL;
+        unsigned int w = 0, h = 0, bits = 0, channels = 0, bitsInternal = 0, channelsInternal = 0, configuration = 0;
+        unsigned char *full = (file) ? pzp_decompress_combined_from_memory(file, size, &w, &h, &bits, &channels,
+                                                                           &bitsInternal, &channelsInternal, &configuration) : NULL;
+        check(full != NULL, name, "could not be encoded and decoded");
+        size_t bytes = (size_t) width * height * frames[f].channels * (frames[f].bits / 8);
+
+        for (unsigned int r = 0; (full) && (r <= sizeof(rows) / sizeof(rows[0])); r++)
+        {
+            // the last pass stops after the second band
+            struct BandCollector collector = { (unsigned char *) calloc(1, bytes), 0, (r < 4) ? rows[r] : 7, 0, (r < 4) ? 0 : 2, 1 };
+            struct pzp_bands bands = { collectBand, &collector, collector.rows };
+            unsigned char *pixels = (collector.image) ?
+                pzp_decompress_bands_from_memory(file, size, &bands, &w, &h, &bits, &channels,
+                                                 &bitsInternal, &channelsInternal, &configuration) : NULL;
+            char what[64];
+            if (r < 4)
+            {
+                snprintf(what, sizeof(what), "bands of %u rows differ from the full decode", rows[r]);
+                check( (pixels != NULL) && (collector.ordered) && (collector.nextRow == height) &&
+                       (memcmp(collector.image, full, bytes) == 0) && (memcmp(pixels, full, bytes) == 0), name, what);
+            } else
+            {
+                size_t stopped = (size_t) 14 * width * frames[f].channels * (frames[f].bits / 8);
+                check( (pixels == NULL) && (collector.bands == 2) && (collector.nextRow == 14) &&
+                       (memcmp(collector.image, full, stopped) == 0), name, "decode went on after the callback returned 0");
+            }
+            pzp_dealloc(pixels);
+            free(collector.image);
+        }
+        pzp_dealloc(full);
+        pzp_dealloc(file);
+        free(image);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct { const char *name; void (*run)(void); } tests[] =
+        { { "tensor", tensorCheck }, { "native16", native16Check }, { "allocator", allocatorCheck }, { "bands", bandsCheck } };
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s tensor|native16|allocator|bands <scratch directory>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    snprintf(path, sizeof(path), "%s/checkLibrary.pzp", argv[2]);
+
+    for (unsigned int t = 0; t < sizeof(tests) / sizeof(tests[0]); t++)
+        if (strcmp(argv[1], tests[t].name) == 0)
+        {
+            tests[t].run();
+            printf("%s: %u checks, %u failed\n", argv[1], checks, failures);
+            return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    fprintf(stderr, "Unknown check %s\n", argv[1]);
+    return EXIT_FAILURE;
+}
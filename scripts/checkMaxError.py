@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""
+checkMaxError.py — Verify that a decoded image stays within a per-sample
+error bound of the original (near-lossless round-trip check).
+
+Usage:
+    python3 scripts/checkMaxError.py <original.pnm> <decoded.pnm> <max_error>
+
+Both files must be binary PNM (P5 grayscale / P6 colour) with the same size,
+channel count and maxval.  Exits with status 1 if any sample differs by more
+than max_error.  Uses only the standard library.
+
+Example:
+    ./pzp near 2 samples/depth16.pnm output/depth16Near.pzp
+    ./pzp decompress output/depth16Near.pzp output/depth16NearRecode.pnm
+    python3 scripts/checkMaxError.py samples/depth16.pnm output/depth16NearRecode.pnm 2
+"""
+
+import array
+import sys
+
+
+def read_pnm(path):
+    """Return (width, height, channels, maxval, samples) for a P5/P6 file."""
+    with open(path, "rb") as f:
+        data = f.read()
+
+    tokens = []
+    pos = 0
+    while len(tokens) < 4:
+        while data[pos:pos + 1].isspace():
+            pos += 1
+        if data[pos:pos + 1] == b"#":
+            pos = data.index(b"\n", pos) + 1
+            continue
+        start = pos
+        while not data[pos:pos + 1].isspace():
+            pos += 1
+        tokens.append(data[start:pos].decode("ascii"))
+    pos += 1  # single whitespace byte before the raster
+
+    magic, width, height, maxval = tokens[0], int(tokens[1]), int(tokens[2]), int(tokens[3])
+    if magic not in ("P5", "P6"):
+        raise ValueError(f"{path}: unsupported PNM type {magic}")
+    channels = 1 if magic == "P5" else 3
+
+    count = width * height * channels
+    if maxval > 255:
+        samples = array.array("H", data[pos:pos + 2 * count])
+        if sys.byteorder == "little":
+            samples.byteswap()  # PNM stores 16-bit samples big-endian
+    else:
+        samples = array.array("B", data[pos:pos + count])
+    if len(samples) != count:
+        raise ValueError(f"{path}: truncated raster")
+    return width, height, channels, maxval, samples
+
+
+def main():
+    if len(sys.argv) != 4:
+        print(__doc__)
+        return 2
+
+    max_error = int(sys.argv[3])
+    w0, h0, c0, m0, original = read_pnm(sys.argv[1])
+    w1, h1, c1, m1, decoded  = read_pnm(sys.argv[2])
+    if (w0, h0, c0) != (w1, h1, c1):
+        print(f"FAIL: {w0}x{h0}x{c0} vs {w1}x{h1}x{c1}")
+        return 1
+
+    worst = max(abs(a - b) for a, b in zip(original, decoded))
+    exact = sum(1 for a, b in zip(original, decoded) if a == b)
+    print(f"{w0}x{h0}x{c0} maxval {m0}: max |error| {worst} (bound {max_error}), "
+          f"{100.0 * exact / len(original):.1f}% samples exact")
+    if worst > max_error:
+        print("FAIL: error bound exceeded")
+        return 1
+    print("OK")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""
+checkNative.py — Check the extension module pzp._native against the command
+line decoder.
+
+Usage:
+    PYTHONPATH=src python3 scripts/checkNative.py <file.pzp> <decoded.pnm> <output prefix>
+
+<decoded.pnm> is <file.pzp> decoded by ./pzp.  The script checks info(),
+decode() into a callable target (HWC), into slot 1 of a CHW batch and into a
+float32 batch with per-channel scale / offset, then encode()s the raster to
+<prefix>.pzp (lossless) and, for 16-bit images, to <prefix>Near.pzp with
+max_error 2, and that a pixel buffer of the wrong length raises ValueError.
+The Makefile decodes both files with ./pzp and compares them to <decoded.pnm>.
+Needs the extension built in place (make pyext) but not numpy.
+
+Example:
+    ./pzp compress samples/rgb8.pnm output/rgb8.pzp
+    ./pzp decompress output/rgb8.pzp output/rgb8Recode.ppm
+    PYTHONPATH=src python3 scripts/checkNative.py output/rgb8.pzp output/rgb8Recode.ppm output/rgb8Native
+    ./pzp decompress output/rgb8Native.pzp output/rgb8NativeRecode.ppm
+    cmp output/rgb8NativeRecode.ppm output/rgb8Recode.ppm
+"""
+
+import array
+import sys
+
+from checkMaxError import read_pnm
+from pzp import _native
+
+USE_COMPRESSION, USE_RLE, USE_NEAR_LOSSLESS = 1, 2, 128
+LAYOUT_HWC, LAYOUT_CHW = 0, 1
+TENSOR_FLOAT32 = 2
+
+failures = 0
+
+
+def check(ok, what):
+    global failures
+    if not ok:
+        failures += 1
+        print("FAIL: %s" % what)
+
+
+def main():
+    if len(sys.argv) != 4:
+        print(__doc__)
+        return 2
+
+    filename, prefix = sys.argv[1], sys.argv[3]
+    width, height, channels, maxval, samples = read_pnm(sys.argv[2])
+    bpp = 16 if maxval > 255 else 8
+    count = width * height * channels
+
+    info = _native.info(filename)
+    check(info[:4] == (width, height, bpp, channels), "info %r vs %ux%u@%u x%u" % (info, width, height, bpp, channels))
+
+    # HWC in the image's own type, allocated by a callable once the header is known
+    shapes = []
+
+    def allocate(h, w, c, b):
+        shapes.append((h, w, c, b))
+        return array.array(samples.typecode, bytes(h * w * c * b // 8))
+
+    decoded, w, h, b, c, configuration = _native.decode(filename, allocate)
+    check(shapes == [(height, width, channels, bpp)], "callable target called with %r" % shapes)
+    check((w, h, b, c) == (width, height, bpp, channels), "decode returned %ux%u@%u x%u" % (w, h, b, c))
+    check(configuration == info[6], "configuration %u vs info %u" % (configuration, info[6]))
+    check(decoded == samples, "HWC decode differs from ./pzp")
+
+    # CHW into the second image of a batch of two, the first must stay untouched
+    batch = array.array(samples.typecode, [7]) * (2 * count)
+    _native.decode(filename, batch, 1, LAYOUT_CHW)
+    check(batch[:count] == array.array(samples.typecode, [7]) * count, "CHW decode wrote outside its slot")
+    planes = batch[count:]
+    for ch in range(channels):
+        check(planes[ch * width * height:(ch + 1) * width * height] == samples[ch::channels],
+              "CHW plane %u differs from ./pzp" % ch)
+
+    # float32 HWC with a per-channel scale and offset
+    scale  = [(ch + 1) / maxval for ch in range(channels)]
+    offset = [-0.25 * ch for ch in range(channels)]
+    floats = array.array("f", bytes(4 * count))
+    _native.decode(filename, floats, 0, LAYOUT_HWC, TENSOR_FLOAT32, scale, offset)
+    worst = max(abs(floats[i] - (samples[i] * scale[i % channels] + offset[i % channels])) for i in range(count))
+    check(worst < 1e-5, "float32 decode off by %g" % worst)
+
+    # encode: lossless, bounded error for 16-bit, and a buffer of the wrong length
+    _native.encode(prefix + ".pzp", samples, width, height, bpp, channels, USE_COMPRESSION | USE_RLE, native16=True)
+    check(_native.decode(prefix + ".pzp", allocate)[0] == samples, "encode / decode round trip differs")
+    if bpp == 16:
+        _native.encode(prefix + "Near.pzp", samples, width, height, bpp, channels, USE_COMPRESSION | USE_RLE,
+                       max_error=2, native16=True)
+        check(_native.info(prefix + "Near.pzp")[6] & USE_NEAR_LOSSLESS, "max_error did not select USE_NEAR_LOSSLESS")
+    try:
+        _native.encode(prefix + "Short.pzp", samples[:-1], width, height, bpp, channels, USE_COMPRESSION)
+        check(False, "a short pixel buffer did not raise ValueError")
+    except ValueError:
+        pass
+
+    print("%s: %ux%u@%u x%u, %u failures" % (filename, width, height, bpp, channels, failures))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -15,6 +15,8 @@ Options:
     --warmup N      Warm-up passes before timing (default: 1)
     --passes N      Timed measurement passes (default: 3)
     --no-verify     Skip pixel-identity check (faster, useful for large sets)
+    --depth N       Load PZP files with PZP.read_many, N reads in flight
+                    (default: 0, one blocking PZP.read per file)
 
 Example:
     python3 scripts/compare_load_speed.py \\
@@ -77,6 +79,14 @@ def _time_pass(pairs, load_fn, idx):
     return time.perf_counter() - t0
 
 
+def _time_bulk_pass(pairs, depth):
+    """Load all .pzp files through the read-ahead loader and return total seconds."""
+    t0 = time.perf_counter()
+    for _ in PZP.read_many([pair[1] for pair in pairs], depth=depth):
+        pass
+    return time.perf_counter() - t0
+
+
 # ---------------------------------------------------------------------------
 # main
 # ---------------------------------------------------------------------------
@@ -97,6 +107,8 @@ def main():
                     help="Timed passes (default 3)")
     ap.add_argument("--no-verify", action="store_true",
                     help="Skip per-pixel correctness check")
+    ap.add_argument("--depth",     type=int, default=0,
+                    help="Read-ahead depth for PZP.read_many (0 = PZP.read per file)")
     args = ap.parse_args()
 
     png_dir = Path(args.png_dir)
@@ -107,6 +119,12 @@ def main():
             sys.exit(f"ERROR: directory not found: {d}")
 
     pairs = _collect_pairs(png_dir, pzp_dir, args.max)
+
+    def _pzp_pass():
+        if args.depth:
+            return _time_bulk_pass(pairs, args.depth)
+        return _time_pass(pairs, _load_pzp, 1)
+
     if not pairs:
         sys.exit("ERROR: no matching png/pzp pairs found.")
 
@@ -143,7 +161,7 @@ def main():
               end=" ", flush=True)
         for _ in range(args.warmup):
             _time_pass(pairs, _load_png, 0)
-            _time_pass(pairs, _load_pzp, 1)
+            _pzp_pass()
         print("done")
         print()
 
@@ -159,7 +177,7 @@ def main():
 
     for p in range(1, args.passes + 1):
         t_png = _time_pass(pairs, _load_png, 0)
-        t_pzp = _time_pass(pairs, _load_pzp, 1)
+        t_pzp = _pzp_pass()
         png_times.append(t_png)
         pzp_times.append(t_pzp)
 
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""
+pyramidReference.py — Write what a USE_PYRAMID level of an image must decode
+to: the image halved `level` times the way the encoder does it.
+
+Usage:
+    python3 scripts/pyramidReference.py <original.pnm> <level> <mean|nearest> <reference.pnm>
+
+Every step halves both sizes (odd ones round up, the last row / column is
+repeated) and keeps the rounded mean of each 2x2 block, or its top-left sample
+for the palette and run token modes, whose label maps must not get new labels.
+Reads and writes binary PNM (P5 / P6, 8 or 16-bit).  Uses only the standard
+library.
+
+Example:
+    ./pzp compress-pyramid samples/rgb8.pnm output/rgb8Pyramid.pzp
+    ./pzp level 2 output/rgb8Pyramid.pzp output/rgb8Level2.ppm
+    python3 scripts/pyramidReference.py samples/rgb8.pnm 2 mean output/rgb8Level2Reference.ppm
+    cmp output/rgb8Level2.ppm output/rgb8Level2Reference.ppm
+"""
+
+import array
+import sys
+
+
+def read_pnm(path):
+    """Return (magic, width, height, maxval, samples) for a P5/P6 file."""
+    with open(path, "rb") as f:
+        data = f.read()
+
+    tokens = []
+    pos = 0
+    while len(tokens) < 4:
+        while data[pos:pos + 1].isspace():
+            pos += 1
+        if data[pos:pos + 1] == b"#":
+            pos = data.index(b"\n", pos) + 1
+            continue
+        start = pos
+        while not data[pos:pos + 1].isspace():
+            pos += 1
+        tokens.append(data[start:pos].decode("ascii"))
+    pos += 1  # single whitespace byte before the raster
+
+    magic, width, height, maxval = tokens[0], int(tokens[1]), int(tokens[2]), int(tokens[3])
+    if magic not in ("P5", "P6"):
+        sys.exit("%s: only binary P5/P6 files are supported" % path)
+
+    raster = data[pos:]
+    if maxval > 255:
+        samples = array.array("H", raster[:len(raster) // 2 * 2])
+        if sys.byteorder == "little":
+            samples.byteswap()  # PNM stores 16-bit samples big-endian
+    else:
+        samples = array.array("B", raster)
+    return magic, width, height, maxval, samples
+
+
+def halve(samples, width, height, channels, nearest):
+    """One pyramid step, see pzp_pyramid_downsample()."""
+    out_width, out_height = (width + 1) // 2, (height + 1) // 2
+    out = array.array(samples.typecode, bytes(out_width * out_height * channels * samples.itemsize))
+    for y in range(out_height):
+        row0 = 2 * y * width
+        row1 = row0 + width if 2 * y + 1 < height else row0
+        for x in range(out_width):
+            x0 = 2 * x
+            x1 = x0 + 1 if x0 + 1 < width else x0
+            o = (y * out_width + x) * channels
+            for c in range(channels):
+                a = samples[(row0 + x0) * channels + c]
+                if nearest:
+                    out[o + c] = a
+                else:
+                    out[o + c] = (a + samples[(row0 + x1) * channels + c] +
+                                  samples[(row1 + x0) * channels + c] +
+                                  samples[(row1 + x1) * channels + c] + 2) >> 2
+    return out, out_width, out_height
+
+
+def main():
+    if len(sys.argv) != 5 or sys.argv[3] not in ("mean", "nearest"):
+        print(__doc__)
+        sys.exit(1)
+
+    magic, width, height, maxval, samples = read_pnm(sys.argv[1])
+    channels = 3 if magic == "P6" else 1
+    for _ in range(int(sys.argv[2])):
+        samples, width, height = halve(samples, width, height, channels, sys.argv[3] == "nearest")
+
+    if maxval > 255 and sys.byteorder == "little":
+        samples.byteswap()
+    with open(sys.argv[4], "wb") as f:
+        f.write(b"%s\n%d %d\n%d\n" % (magic.encode("ascii"), width, height, maxval))
+        f.write(samples.tobytes())
+
+
+if __name__ == "__main__":
+    main()
@@ -7,6 +7,11 @@ and found at runtime next to pzp/__init__.py.
 
 For an editable install (pip install -e .) the library is left at the repo
 root, and pzp/_find_lib() falls back to searching there.
+
+Next to it the native extension module pzp._native (pzp_module.c) is built by
+build_ext; pzp/__init__.py uses it for read / read_tensor / info / write, so
+those release the GIL without ctypes call overhead, and falls back to ctypes
+through libpzp.so when it is missing.
 """
 
 import os
@@ -15,7 +20,7 @@ import subprocess
 import sys
 from pathlib import Path
 
-from setuptools import setup
+from setuptools import Extension, setup
 from setuptools.command.build_py import build_py
 from setuptools.command.develop import develop
 
@@ -31,6 +36,17 @@ _PKG_DIR  = _ROOT / "src" / "pzp"
 _LIB_SRC  = _ROOT / _LIB_NAME       # built by make
 _LIB_DST  = _PKG_DIR / _LIB_NAME    # inside the package (for wheels)
 
+# pzp._native — compiled against pzp.h directly, same flags as libpzp.so
+_NATIVE = Extension(
+    "pzp._native",
+    sources=["pzp_module.c"],
+    include_dirs=["."],
+    define_macros=[("_GNU_SOURCE", None)],
+    extra_compile_args=["-O3", "-march=native", "-mtune=native"],
+    libraries=["zstd", "lz4", "m", "pthread"],
+    depends=["pzp.h"],
+)
+
 
 def _build_c_library():
     """Run make to produce libpzp.so in the repo root."""
@@ -47,7 +63,7 @@ def _copy_lib_into_package():
     if not _LIB_SRC.exists():
         raise FileNotFoundError(
             f"{_LIB_SRC} not found after make. "
-            "Ensure gcc and libzstd-dev are installed."
+            "Ensure gcc, libzstd-dev and liblz4-dev are installed."
         )
     shutil.copy2(str(_LIB_SRC), str(_LIB_DST))
     print(f"[pzp] Copied {_LIB_NAME} → {_LIB_DST}")
@@ -74,6 +90,7 @@ class Develop(develop):
 
 
 setup(
+    ext_modules=[_NATIVE],
     cmdclass={
         "build_py": BuildPy,
         "develop":  Develop,